@@ -0,0 +1,8 @@
+include(../qxmpp.pri)
+
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$QXMPP_INCLUDEPATH
+LIBS += -L../../src $$QXMPP_LIBS
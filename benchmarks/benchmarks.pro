@@ -0,0 +1,6 @@
+include(../qxmpp.pri)
+
+TEMPLATE = subdirs
+
+SUBDIRS = load \
+          stanzas
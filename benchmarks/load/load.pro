@@ -0,0 +1,8 @@
+include(../benchmarks.pri)
+
+TARGET = qxmpp-bench-load
+
+RESOURCES += load.qrc
+SOURCES += loadGenerator.cpp \
+           main.cpp
+HEADERS += loadGenerator.h
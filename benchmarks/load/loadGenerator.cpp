@@ -0,0 +1,690 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <cstdio>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QHostAddress>
+#include <QProcess>
+#include <QTimer>
+
+#include "QXmppClient.h"
+#include "QXmppLogger.h"
+#include "QXmppMessage.h"
+#include "QXmppMetrics.h"
+#include "QXmppOfflineExtension.h"
+#include "QXmppPasswordChecker.h"
+#include "QXmppPingIq.h"
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+
+#include "loadGenerator.h"
+
+static const char *loadDomain = "localhost";
+static const char *loadPassword = "bench";
+static const char *loadResource = "bench";
+
+/// Returns the resident set size of the given process in bytes, or -1 if
+/// it cannot be determined on this platform.
+
+static qint64 residentMemory(qint64 pid)
+{
+#ifdef Q_OS_LINUX
+    QFile file(QString("/proc/%1/status").arg(pid));
+    if (file.open(QIODevice::ReadOnly)) {
+        foreach (const QByteArray &line, file.readAll().split('\n')) {
+            if (line.startsWith("VmRSS:"))
+                return line.mid(6).trimmed().split(' ').first().toLongLong() * 1024;
+        }
+    }
+#else
+    Q_UNUSED(pid);
+#endif
+    return -1;
+}
+
+static QString userJid(int index)
+{
+    return QString("user%1@%2").arg(QString::number(index), loadDomain);
+}
+
+/// Removes the offline message logs left in the given directory.
+
+static void removeLogs(const QString &path)
+{
+    QDir dir(path);
+    foreach (const QString &name, dir.entryList(QDir::Files))
+        dir.remove(name);
+    dir.rmdir(path);
+}
+
+static QString offlineJid(int index)
+{
+    return QString("offline%1@%2").arg(QString::number(index), loadDomain);
+}
+
+/// Accepts any user provided the password is loadPassword.
+
+class LoadPasswordChecker : public QXmppPasswordChecker
+{
+public:
+    QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password)
+    {
+        Q_UNUSED(request);
+        password = loadPassword;
+        return QXmppPasswordReply::NoError;
+    }
+
+    bool hasGetPassword() const
+    {
+        return true;
+    }
+};
+
+LoadOptions::LoadOptions()
+    : clients(100),
+    connectWindow(50),
+    contacts(10),
+    messages(100),
+    pings(100),
+    presences(10),
+    window(1),
+    timeout(60),
+    port(5333),
+    inProcess(false),
+    serve(false),
+    tls(false)
+{
+    workloads << "message" << "presence" << "ping";
+}
+
+/// Parses the command line arguments, returning false if they are invalid.
+///
+/// \param arguments
+
+bool LoadOptions::parse(const QStringList &arguments)
+{
+    for (int i = 1; i < arguments.size(); ++i) {
+        const QString arg = arguments.at(i);
+        if (arg == "--in-process") {
+            inProcess = true;
+        } else if (arg == "--serve") {
+            serve = true;
+        } else if (arg == "--tls") {
+            tls = true;
+        } else if (i + 1 < arguments.size()) {
+            const QString value = arguments.at(++i);
+            bool ok = true;
+            if (arg == "--clients")
+                clients = value.toInt(&ok);
+            else if (arg == "--connect-window")
+                connectWindow = value.toInt(&ok);
+            else if (arg == "--contacts")
+                contacts = value.toInt(&ok);
+            else if (arg == "--messages")
+                messages = value.toInt(&ok);
+            else if (arg == "--output")
+                output = value;
+            else if (arg == "--pings")
+                pings = value.toInt(&ok);
+            else if (arg == "--port")
+                port = value.toUShort(&ok);
+            else if (arg == "--presences")
+                presences = value.toInt(&ok);
+            else if (arg == "--timeout")
+                timeout = value.toInt(&ok);
+            else if (arg == "--window")
+                window = value.toInt(&ok);
+            else if (arg == "--workloads")
+                workloads = value.split(',', QString::SkipEmptyParts);
+            else
+                return false;
+            if (!ok)
+                return false;
+        } else {
+            return false;
+        }
+    }
+    return clients > 0 && connectWindow > 0 && window > 0 && timeout > 0;
+}
+
+LoadServer::LoadServer(const LoadOptions &options, QObject *parent)
+    : QObject(parent),
+    m_options(options),
+    m_checker(new LoadPasswordChecker),
+    m_server(new QXmppServer(this))
+{
+    m_server->setDomain(loadDomain);
+    m_server->setPasswordChecker(m_checker);
+    if (m_options.tls) {
+        m_server->setLocalCertificate(":/server.crt");
+        m_server->setPrivateKey(":/server.key");
+    }
+    if (m_options.workloads.contains("offline")) {
+        m_offlineDirectory = QDir::temp().filePath(
+            QString("qxmpp-bench-offline-%1").arg(m_options.port));
+        removeLogs(m_offlineDirectory);
+
+        QXmppOfflineExtension *extension = new QXmppOfflineExtension;
+        extension->setDirectory(m_offlineDirectory);
+        extension->setMaximumLogSize(Q_INT64_C(1) << 30);
+        m_server->addExtension(extension);
+    }
+}
+
+LoadServer::~LoadServer()
+{
+    delete m_server;
+    delete m_checker;
+
+    if (!m_offlineDirectory.isEmpty())
+        removeLogs(m_offlineDirectory);
+}
+
+/// Starts listening for clients on the loopback interface.
+
+bool LoadServer::listen()
+{
+    return m_server->listenForClients(QHostAddress::LocalHost, m_options.port);
+}
+
+/// Returns the underlying QXmppServer.
+
+QXmppServer *LoadServer::server() const
+{
+    return m_server;
+}
+
+class LoadGenerator::Client
+{
+public:
+    QXmppClient *client;
+    qint64 connectStart;
+    bool connected;
+    int sent;
+    int outstanding;
+};
+
+LoadGenerator::LoadGenerator(const LoadOptions &options, QObject *parent)
+    : QObject(parent),
+    m_options(options),
+    m_process(0),
+    m_server(0),
+    m_connecting(0),
+    m_connected(0),
+    m_connectFailures(0),
+    m_disconnects(0),
+    m_connectStart(0),
+    m_connectLatency(0),
+    m_baselineMemory(-1),
+    m_workload(-2),
+    m_expected(0),
+    m_perClient(0),
+    m_sent(0),
+    m_delivered(0),
+    m_workloadStart(0),
+    m_latency(0),
+    m_exitCode(0)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    check = connect(m_timer, SIGNAL(timeout()),
+                    this, SLOT(_q_timeout()));
+    Q_ASSERT(check);
+
+    m_clock.start();
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    foreach (Client *c, m_clients) {
+        delete c->client;
+        delete c;
+    }
+    delete m_connectLatency;
+    delete m_latency;
+}
+
+/// Returns 0 if the run completed, 1 if it was aborted.
+
+int LoadGenerator::exitCode() const
+{
+    return m_exitCode;
+}
+
+/// Starts the server, then connects the clients once it is listening.
+
+void LoadGenerator::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_timer->start(m_options.timeout * 1000);
+    if (m_options.inProcess) {
+        m_server = new LoadServer(m_options, this);
+        if (!m_server->listen()) {
+            finish(QString("Could not listen on port %1").arg(m_options.port));
+            return;
+        }
+        connectClients();
+        return;
+    }
+
+    QStringList arguments;
+    arguments << "--serve" << "--port" << QString::number(m_options.port);
+    arguments << "--workloads" << m_options.workloads.join(",");
+    if (m_options.tls)
+        arguments << "--tls";
+
+    m_process = new QProcess(this);
+    m_process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    check = connect(m_process, SIGNAL(readyReadStandardOutput()),
+                    this, SLOT(_q_serverOutput()));
+    Q_ASSERT(check);
+    m_process->start(QCoreApplication::applicationFilePath(), arguments);
+}
+
+void LoadGenerator::connectClients()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_baselineMemory = serverMemory();
+
+    for (int i = 0; i < m_options.clients; ++i) {
+        Client *c = new Client;
+        c->client = new QXmppClient;
+        c->client->setProperty("loadIndex", i);
+        c->connectStart = 0;
+        c->connected = false;
+        c->sent = 0;
+        c->outstanding = 0;
+
+        check = connect(c->client, SIGNAL(connected()),
+                        this, SLOT(_q_clientConnected()));
+        Q_ASSERT(check);
+
+        check = connect(c->client, SIGNAL(disconnected()),
+                        this, SLOT(_q_clientDisconnected()));
+        Q_ASSERT(check);
+
+        check = connect(c->client, SIGNAL(iqReceived(QXmppIq)),
+                        this, SLOT(_q_iqReceived(QXmppIq)));
+        Q_ASSERT(check);
+
+        check = connect(c->client, SIGNAL(messageReceived(QXmppMessage)),
+                        this, SLOT(_q_messageReceived(QXmppMessage)));
+        Q_ASSERT(check);
+
+        check = connect(c->client, SIGNAL(presenceReceived(QXmppPresence)),
+                        this, SLOT(_q_presenceReceived(QXmppPresence)));
+        Q_ASSERT(check);
+
+        m_clients << c;
+    }
+
+    m_workload = -1;
+    m_connectLatency = new QXmppHistogram;
+    m_connectStart = m_clock.nsecsElapsed() / 1000;
+    m_timer->start(m_options.timeout * 1000);
+    for (int i = 0; i < m_options.connectWindow && m_connecting < m_clients.size(); ++i)
+        connectNext();
+}
+
+/// Opens the next client connection.
+
+void LoadGenerator::connectNext()
+{
+    Client *c = m_clients.at(m_connecting);
+    const QString bareJid = userJid(m_connecting);
+    m_connecting++;
+
+    QXmppConfiguration config;
+    config.setDomain(loadDomain);
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(m_options.port);
+    config.setUser(bareJid.split('@').first());
+    config.setPassword(loadPassword);
+    config.setResource(loadResource);
+    config.setKeepAliveInterval(0);
+    config.setStreamSecurityMode(m_options.tls ?
+        QXmppConfiguration::TLSRequired : QXmppConfiguration::TLSDisabled);
+
+    c->connectStart = m_clock.nsecsElapsed() / 1000;
+    c->client->connectToServer(config);
+}
+
+void LoadGenerator::_q_clientConnected()
+{
+    QXmppClient *client = qobject_cast<QXmppClient*>(sender());
+    if (!client || m_workload != -1)
+        return;
+
+    Client *c = m_clients.at(client->property("loadIndex").toInt());
+    c->connected = true;
+    m_connectLatency->record(m_clock.nsecsElapsed() / 1000 - c->connectStart);
+    m_connected++;
+
+    if (m_connecting < m_clients.size())
+        connectNext();
+    else if (m_connected + m_connectFailures == m_clients.size())
+        _q_timeout();
+}
+
+void LoadGenerator::_q_clientDisconnected()
+{
+    QXmppClient *client = qobject_cast<QXmppClient*>(sender());
+    if (!client)
+        return;
+
+    Client *c = m_clients.at(client->property("loadIndex").toInt());
+    if (c->connected) {
+        c->connected = false;
+        m_disconnects++;
+    } else if (m_workload == -1) {
+        m_connectFailures++;
+        if (m_connecting < m_clients.size())
+            connectNext();
+        else if (m_connected + m_connectFailures == m_clients.size())
+            _q_timeout();
+    }
+}
+
+void LoadGenerator::_q_iqReceived(const QXmppIq &iq)
+{
+    if (iq.type() == QXmppIq::Result)
+        delivered(iq.id());
+}
+
+void LoadGenerator::_q_messageReceived(const QXmppMessage &message)
+{
+    delivered(message.id());
+}
+
+void LoadGenerator::_q_presenceReceived(const QXmppPresence &presence)
+{
+    delivered(presence.id());
+}
+
+void LoadGenerator::_q_serverOutput()
+{
+    while (m_process->canReadLine()) {
+        if (m_process->readLine().trimmed() == "ready" && m_workload == -2)
+            connectClients();
+    }
+}
+
+/// Ends the current phase, either because it completed or because it ran
+/// out of time.
+
+void LoadGenerator::_q_timeout()
+{
+    if (m_workload == -2) {
+        finish("Timed out waiting for the server to start");
+    } else if (m_workload == -1) {
+        m_timer->stop();
+
+        const qint64 memory = serverMemory();
+        const qint64 elapsed = m_clock.nsecsElapsed() / 1000 - m_connectStart;
+
+        QVariantMap connectResult;
+        connectResult["clients"] = m_connected;
+        connectResult["failures"] = m_clients.size() - m_connected;
+        connectResult["elapsed_ms"] = elapsed / 1000;
+        connectResult["rate"] = elapsed ? m_connected * 1000000.0 / elapsed : 0.0;
+        connectResult["latency_us"] = m_connectLatency->toVariantMap();
+        m_results["connect"] = connectResult;
+
+        QVariantMap memoryResult;
+        memoryResult["baseline"] = m_baselineMemory;
+        memoryResult["connected"] = memory;
+        if (m_connected && memory >= 0 && m_baselineMemory >= 0)
+            memoryResult["per_connection"] = (memory - m_baselineMemory) / m_connected;
+        m_results["rss"] = memoryResult;
+
+        if (!m_connected) {
+            finish("No client could connect");
+            return;
+        }
+        m_workload = 0;
+        startWorkload();
+    } else {
+        stopWorkload();
+    }
+}
+
+/// Returns the resident set size of the process running the server.
+
+qint64 LoadGenerator::serverMemory() const
+{
+    qint64 pid = QCoreApplication::applicationPid();
+    if (m_process) {
+#if QT_VERSION >= 0x050300
+        pid = m_process->processId();
+#elif defined(Q_OS_UNIX)
+        pid = m_process->pid();
+#endif
+    }
+    return residentMemory(pid);
+}
+
+/// Handles the arrival of a benchmark stanza.
+///
+/// \param id
+
+void LoadGenerator::delivered(const QString &id)
+{
+    // identifiers are of the form <workload>-<sender>-<timestamp>
+    const QStringList bits = id.split('-');
+    if (bits.size() != 3 || bits.at(0).toInt() != m_workload || !m_latency)
+        return;
+
+    const int index = bits.at(1).toInt();
+    m_latency->record(m_clock.nsecsElapsed() / 1000 - bits.at(2).toLongLong());
+    m_delivered++;
+
+    Client *c = m_clients.value(index);
+    if (!c)
+        return;
+    c->outstanding--;
+
+    if (m_delivered >= qint64(m_connected) * m_perClient * m_expected)
+        stopWorkload();
+    else
+        pump(index);
+}
+
+/// Sends stanzas from the given client until its window is full.
+///
+/// \param index
+
+void LoadGenerator::pump(int index)
+{
+    Client *c = m_clients.at(index);
+    while (c->connected && c->sent < m_perClient &&
+           c->outstanding < m_options.window * m_expected)
+        send(index);
+}
+
+/// Sends one stanza of the current workload from the given client.
+///
+/// \param index
+
+void LoadGenerator::send(int index)
+{
+    Client *c = m_clients.at(index);
+    const QString workload = m_options.workloads.at(m_workload);
+    const QString id = QString("%1-%2-%3").arg(
+        QString::number(m_workload),
+        QString::number(index),
+        QString::number(m_clock.nsecsElapsed() / 1000));
+    const int peer = (index + 1) % m_clients.size();
+
+    if (workload == "message") {
+        QXmppMessage message(QString(), userJid(peer) + "/" + loadResource, "benchmark");
+        message.setId(id);
+        c->client->sendPacket(message);
+    } else if (workload == "presence") {
+        for (int k = 1; k <= m_expected; ++k) {
+            QXmppPresence presence;
+            presence.setId(id);
+            presence.setTo(userJid((index + k) % m_clients.size()));
+            presence.setStatus(QXmppPresence::Status(QXmppPresence::Status::Online, "benchmark"));
+            c->client->sendPacket(presence);
+        }
+    } else if (workload == "ping") {
+        QXmppPingIq ping;
+        ping.setId(id);
+        ping.setTo(userJid(peer) + "/" + loadResource);
+        c->client->sendPacket(ping);
+    } else if (workload == "offline") {
+        // the ping is answered once the server has stored the message
+        QXmppMessage message(QString(), offlineJid(index), "benchmark");
+        c->client->sendPacket(message);
+        QXmppPingIq ping;
+        ping.setId(id);
+        ping.setTo(userJid(peer) + "/" + loadResource);
+        c->client->sendPacket(ping);
+    }
+    c->sent++;
+    c->outstanding += m_expected;
+    m_sent += m_expected;
+}
+
+/// Starts the next workload, or reports the results if there are none left.
+
+void LoadGenerator::startWorkload()
+{
+    if (m_workload >= m_options.workloads.size()) {
+        finish();
+        return;
+    }
+
+    const QString workload = m_options.workloads.at(m_workload);
+    m_expected = 1;
+    if (workload == "message") {
+        m_perClient = m_options.messages;
+    } else if (workload == "presence") {
+        m_perClient = m_options.presences;
+        m_expected = qBound(1, m_options.contacts, qMax(1, m_clients.size() - 1));
+    } else if (workload == "ping") {
+        m_perClient = m_options.pings;
+    } else if (workload == "offline") {
+        m_perClient = m_options.messages;
+    } else {
+        finish(QString("Unknown workload %1").arg(workload));
+        return;
+    }
+
+    m_sent = 0;
+    m_delivered = 0;
+    m_latency = new QXmppHistogram;
+    m_workloadStart = m_clock.nsecsElapsed() / 1000;
+    m_timer->start(m_options.timeout * 1000);
+
+    for (int i = 0; i < m_clients.size(); ++i) {
+        m_clients.at(i)->sent = 0;
+        m_clients.at(i)->outstanding = 0;
+    }
+    if (!m_perClient) {
+        stopWorkload();
+        return;
+    }
+    for (int i = 0; i < m_clients.size(); ++i)
+        pump(i);
+}
+
+/// Records the results of the current workload and moves on to the next.
+
+void LoadGenerator::stopWorkload()
+{
+    m_timer->stop();
+    const qint64 elapsed = m_clock.nsecsElapsed() / 1000 - m_workloadStart;
+
+    QVariantMap result;
+    result["stanzas"] = m_sent / m_expected;
+    result["deliveries"] = m_delivered;
+    result["lost"] = m_sent - m_delivered;
+    result["elapsed_ms"] = elapsed / 1000;
+    result["throughput"] = elapsed ? m_delivered * 1000000.0 / elapsed : 0.0;
+    result["latency_us"] = m_latency->toVariantMap();
+    delete m_latency;
+    m_latency = 0;
+
+    QVariantMap workloads = m_results.value("workloads").toMap();
+    workloads[m_options.workloads.at(m_workload)] = result;
+    m_results["workloads"] = workloads;
+
+    m_workload++;
+    startWorkload();
+}
+
+/// Writes the results as JSON, disconnects the clients and stops the server.
+///
+/// \param error
+
+void LoadGenerator::finish(const QString &error)
+{
+    m_timer->stop();
+
+    QVariantMap options;
+    options["clients"] = m_options.clients;
+    options["contacts"] = m_options.contacts;
+    options["server"] = m_options.inProcess ? "in-process" : "child";
+    options["tls"] = m_options.tls;
+    options["window"] = m_options.window;
+    m_results["options"] = options;
+    m_results["disconnects"] = m_disconnects;
+    if (m_server)
+        m_results["server"] = m_server->server()->statistics();
+    if (!error.isEmpty())
+        m_results["error"] = error;
+
+    const QByteArray json = QXmppMetrics::toJson(m_results) + "\n";
+    QFile file;
+    if (m_options.output.isEmpty() || m_options.output == "-") {
+        file.open(stdout, QIODevice::WriteOnly);
+    } else {
+        file.setFileName(m_options.output);
+        file.open(QIODevice::WriteOnly);
+    }
+    file.write(json);
+    file.close();
+
+    foreach (Client *c, m_clients) {
+        c->connected = false;
+        c->client->disconnectFromServer();
+    }
+    if (m_process) {
+        m_process->kill();
+        m_process->waitForFinished();
+    }
+
+    m_exitCode = error.isEmpty() ? 0 : 1;
+    emit finished();
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QStringList>
+#include <QVariantMap>
+
+class QProcess;
+class QTimer;
+class LoadPasswordChecker;
+class QXmppClient;
+class QXmppHistogram;
+class QXmppIq;
+class QXmppMessage;
+class QXmppPresence;
+class QXmppServer;
+
+/// Settings for a load generator run.
+
+class LoadOptions
+{
+public:
+    LoadOptions();
+    bool parse(const QStringList &arguments);
+
+    int clients;
+    int connectWindow;
+    int contacts;
+    int messages;
+    int pings;
+    int presences;
+    int window;
+    int timeout;
+    quint16 port;
+    bool inProcess;
+    bool serve;
+    bool tls;
+    QString output;
+    QStringList workloads;
+};
+
+/// Runs a QXmppServer for the load generator, either in the benchmark
+/// process or in a child process.
+
+class LoadServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadServer(const LoadOptions &options, QObject *parent = 0);
+    ~LoadServer();
+
+    bool listen();
+    QXmppServer *server() const;
+
+private:
+    const LoadOptions m_options;
+    LoadPasswordChecker *m_checker;
+    QXmppServer *m_server;
+    QString m_offlineDirectory;
+};
+
+/// Connects clients to a LoadServer over loopback, runs the requested
+/// workloads and reports the results as JSON.
+
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadGenerator(const LoadOptions &options, QObject *parent = 0);
+    ~LoadGenerator();
+
+    int exitCode() const;
+    void start();
+
+signals:
+    void finished();
+
+private slots:
+    void _q_clientConnected();
+    void _q_clientDisconnected();
+    void _q_iqReceived(const QXmppIq &iq);
+    void _q_messageReceived(const QXmppMessage &message);
+    void _q_presenceReceived(const QXmppPresence &presence);
+    void _q_serverOutput();
+    void _q_timeout();
+
+private:
+    class Client;
+
+    void connectClients();
+    void connectNext();
+    void delivered(const QString &id);
+    void finish(const QString &error = QString());
+    void pump(int index);
+    void send(int index);
+    qint64 serverMemory() const;
+    void startWorkload();
+    void stopWorkload();
+
+    const LoadOptions m_options;
+    QElapsedTimer m_clock;
+    QList<Client*> m_clients;
+    QProcess *m_process;
+    LoadServer *m_server;
+    QTimer *m_timer;
+
+    // connection phase
+    int m_connecting;
+    int m_connected;
+    int m_connectFailures;
+    int m_disconnects;
+    qint64 m_connectStart;
+    QXmppHistogram *m_connectLatency;
+    qint64 m_baselineMemory;
+
+    // current workload
+    int m_workload;
+    int m_expected;
+    int m_perClient;
+    qint64 m_sent;
+    qint64 m_delivered;
+    qint64 m_workloadStart;
+    QXmppHistogram *m_latency;
+
+    int m_exitCode;
+
+    QVariantMap m_results;
+};
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <QCoreApplication>
+#include <QStringList>
+
+#include "loadGenerator.h"
+
+static void usage()
+{
+    fprintf(stderr,
+        "Usage: qxmpp-bench-load [options]\n"
+        "\n"
+        "Starts a QXmppServer, connects clients to it over loopback, runs\n"
+        "the requested workloads and prints the results as JSON.\n"
+        "\n"
+        "Options:\n"
+        "  --clients <n>         number of clients (default: 100)\n"
+        "  --connect-window <n>  concurrent connection attempts (default: 50)\n"
+        "  --contacts <n>        recipients of each presence broadcast (default: 10)\n"
+        "  --in-process          run the server in the benchmark process\n"
+        "  --messages <n>        messages sent by each client in the message and\n"
+        "                        offline workloads (default: 100)\n"
+        "  --output <file>       write the results to a file instead of stdout\n"
+        "  --pings <n>           pings sent by each client (default: 100)\n"
+        "  --port <port>         server port (default: 5333)\n"
+        "  --presences <n>       presence broadcasts by each client (default: 10)\n"
+        "  --timeout <secs>      time allowed for each phase (default: 60)\n"
+        "  --tls                 require TLS on client connections\n"
+        "  --window <n>          stanzas in flight per client (default: 1)\n"
+        "  --workloads <list>    comma-separated list of workloads among\n"
+        "                        message, presence, ping and offline (default:\n"
+        "                        message,presence,ping)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    LoadOptions options;
+    if (!options.parse(app.arguments())) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    // child process mode: run the server and tell the parent when ready
+    if (options.serve) {
+        LoadServer server(options);
+        if (!server.listen()) {
+            fprintf(stderr, "Could not listen on port %i\n", options.port);
+            return EXIT_FAILURE;
+        }
+        fprintf(stdout, "ready\n");
+        fflush(stdout);
+        return app.exec();
+    }
+
+    LoadGenerator generator(options);
+    QObject::connect(&generator, SIGNAL(finished()),
+                     &app, SLOT(quit()));
+    generator.start();
+    if (generator.exitCode())
+        return generator.exitCode();
+    app.exec();
+    return generator.exitCode();
+}
@@ -0,0 +1,655 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <cstdlib>
+
+#include <QDomDocument>
+#include <QHostAddress>
+#include <QSslSocket>
+#include <QTcpServer>
+#include <QtTest>
+
+#include "QXmppArchiveIq.h"
+#include "QXmppElement.h"
+#include "QXmppJingleIq.h"
+#include "QXmppMessage.h"
+#include "QXmppPresence.h"
+#include "QXmppPubSubIq.h"
+#include "QXmppRosterIq.h"
+#include "QXmppRpcIq.h"
+#include "QXmppVCardIq.h"
+
+#include "stanzas.h"
+
+// Count heap allocations by interposing glibc's allocator, which catches
+// both operator new and the malloc() calls made by QString and friends.
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+static volatile long allocations = 0;
+
+void *malloc(size_t size)
+{
+    __sync_fetch_and_add(&allocations, 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    __sync_fetch_and_add(&allocations, 1);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    __sync_fetch_and_add(&allocations, 1);
+    return __libc_realloc(ptr, size);
+}
+}
+
+static qint64 allocationCount()
+{
+    return __sync_fetch_and_add(&allocations, 0);
+}
+#else
+static qint64 allocationCount()
+{
+    return -1;
+}
+#endif
+
+static void reportAllocations(qint64 start)
+{
+    if (start >= 0)
+        qDebug("%lli allocations per iteration", allocationCount() - start);
+}
+
+static QByteArray archiveChatXml()
+{
+    QList<QXmppArchiveMessage> messages;
+    const QDateTime start(QDate(2012, 4, 12), QTime(9, 30, 0), Qt::UTC);
+    for (int i = 0; i < 100; ++i) {
+        QXmppArchiveMessage message;
+        message.setBody(QString("Message number %1, which is about as long as a chat line gets.").arg(i));
+        message.setDate(start.addSecs(i * 7));
+        message.setReceived(i % 2);
+        messages << message;
+    }
+
+    QXmppArchiveChat chat;
+    chat.setWith("juliet@capulet.com");
+    chat.setStart(start);
+    chat.setSubject("She speaks!");
+    chat.setVersion(4);
+    chat.setMessages(messages);
+
+    QXmppArchiveChatIq iq;
+    iq.setType(QXmppIq::Result);
+    iq.setId("chat_1");
+    iq.setChat(chat);
+
+    QByteArray xml;
+    QXmlStreamWriter writer(&xml);
+    iq.toXml(&writer);
+    return xml;
+}
+
+static QByteArray jingleXml()
+{
+    QXmppJingleIq iq;
+    iq.setType(QXmppIq::Set);
+    iq.setId("zid615d9");
+    iq.setFrom("romeo@montague.lit/orchard");
+    iq.setTo("juliet@capulet.lit/balcony");
+    iq.setAction(QXmppJingleIq::SessionInitiate);
+    iq.setInitiator("romeo@montague.lit/orchard");
+    iq.setSid("a73sjjvkla37jfea");
+    iq.content().setCreator("initiator");
+    iq.content().setName("voice");
+    iq.content().setSenders("both");
+    iq.content().setDescriptionMedia("audio");
+    iq.content().setTransportUser("8hhy");
+    iq.content().setTransportPassword("asd88fgpdd777uzjYhagZg");
+
+    const char *codecs[] = { "speex", "PCMU", "PCMA", "G722" };
+    for (int i = 0; i < 4; ++i) {
+        QXmppJinglePayloadType payload;
+        payload.setId(96 + i);
+        payload.setName(codecs[i]);
+        payload.setClockrate(i ? 8000 : 16000);
+        payload.setChannels(1);
+        iq.content().addPayloadType(payload);
+    }
+    for (int i = 0; i < 6; ++i) {
+        QXmppJingleCandidate candidate;
+        candidate.setComponent(1 + i % 2);
+        candidate.setFoundation(i / 2);
+        candidate.setHost(QHostAddress(QString("192.0.2.%1").arg(i + 1)));
+        candidate.setId(QString("el0747fg11%1").arg(i));
+        candidate.setNetwork(0);
+        candidate.setPort(3478 + i);
+        candidate.setPriority(2130706431 - i);
+        candidate.setProtocol("udp");
+        candidate.setType(i < 2 ? QXmppJingleCandidate::HostType : QXmppJingleCandidate::ServerReflexiveType);
+        iq.content().addTransportCandidate(candidate);
+    }
+
+    QByteArray xml;
+    QXmlStreamWriter writer(&xml);
+    iq.toXml(&writer);
+    return xml;
+}
+
+static QByteArray messageXml()
+{
+    return QByteArray(
+        "<message xmlns=\"jabber:client\" id=\"ktx72v49\" to=\"juliet@capulet.lit/balcony\" from=\"romeo@montague.lit/orchard\" type=\"chat\">"
+        "<subject>Balcony</subject>"
+        "<body>But, soft! what light through yonder window breaks? It is the east, and Juliet is the sun.</body>"
+        "<thread>e0ffe42b28561960c6b12b944a092794b9683a38</thread>"
+        "<active xmlns=\"http://jabber.org/protocol/chatstates\"/>"
+        "<request xmlns=\"urn:xmpp:receipts\"/>"
+        "<delay xmlns=\"urn:xmpp:delay\" stamp=\"2012-04-12T09:30:00Z\"/>"
+        "<html xmlns=\"http://jabber.org/protocol/xhtml-im\">"
+        "<body xmlns=\"http://www.w3.org/1999/xhtml\"><p>But, <em>soft!</em> what light through yonder window breaks?</p></body>"
+        "</html>"
+        "</message>");
+}
+
+static QByteArray presenceXml()
+{
+    return QByteArray(
+        "<presence xmlns=\"jabber:client\" to=\"foo@example.com/QXmpp\" from=\"bar@example.com/QXmpp\">"
+        "<show>away</show>"
+        "<status>In a meeting</status>"
+        "<priority>5</priority>"
+        "<x xmlns=\"vcard-temp:x:update\">"
+        "<photo>73b908bc</photo>"
+        "</x>"
+        "<c xmlns=\"http://jabber.org/protocol/caps\" hash=\"sha-1\" node=\"http://code.google.com/p/qxmpp\" ver=\"QgayPKawpkPSDYmwT/WM94uAlu0=\"/>"
+        "<x xmlns=\"http://jabber.org/protocol/muc#user\">"
+        "<item affiliation=\"member\" role=\"participant\" jid=\"bar@example.com/QXmpp\"/>"
+        "</x>"
+        "</presence>");
+}
+
+static QByteArray pubSubXml()
+{
+    QList<QXmppPubSubItem> items;
+    for (int i = 0; i < 20; ++i) {
+        QXmppElement nick;
+        nick.setTagName("nick");
+        nick.setValue(QString("Player %1").arg(i));
+
+        QXmppElement conference;
+        conference.setTagName("conference");
+        conference.setAttribute("autojoin", "true");
+        conference.setAttribute("jid", QString("room%1@conference.shakespeare.lit").arg(i));
+        conference.setAttribute("name", QString("The Play's the Thing, act %1").arg(i));
+        conference.appendChild(nick);
+
+        QXmppElement storage;
+        storage.setTagName("storage");
+        storage.setAttribute("xmlns", "storage:bookmarks");
+        storage.appendChild(conference);
+
+        QXmppPubSubItem item;
+        item.setId(QString("item%1").arg(i));
+        item.setContents(storage);
+        items << item;
+    }
+
+    QXmppPubSubIq iq;
+    iq.setType(QXmppIq::Result);
+    iq.setId("items1");
+    iq.setFrom("pubsub.shakespeare.lit");
+    iq.setTo("francisco@denmark.lit/barracks");
+    iq.setQueryType(QXmppPubSubIq::ItemsQuery);
+    iq.setQueryNode("storage:bookmarks");
+    iq.setItems(items);
+
+    QByteArray xml;
+    QXmlStreamWriter writer(&xml);
+    iq.toXml(&writer);
+    return xml;
+}
+
+static QByteArray rosterXml()
+{
+    QXmppRosterIq iq;
+    iq.setType(QXmppIq::Result);
+    iq.setId("roster1");
+    iq.setTo("juliet@example.com/balcony");
+    for (int i = 0; i < 1000; ++i) {
+        QSet<QString> groups;
+        groups << "Friends";
+        if (i % 3 == 0)
+            groups << "Work";
+
+        QXmppRosterIq::Item item;
+        item.setBareJid(QString("contact%1@example.com").arg(i));
+        item.setName(QString("Contact %1").arg(i));
+        item.setSubscriptionType(QXmppRosterIq::Item::Both);
+        item.setGroups(groups);
+        iq.addItem(item);
+    }
+
+    QByteArray xml;
+    QXmlStreamWriter writer(&xml);
+    iq.toXml(&writer);
+    return xml;
+}
+
+static QByteArray rpcXml()
+{
+    QVariantList tracks;
+    for (int i = 0; i < 20; ++i) {
+        QVariantMap track;
+        track["title"] = QString("Track %1").arg(i);
+        track["duration"] = 180 + i;
+        track["rating"] = 3.5;
+        track["explicit"] = false;
+        tracks << track;
+    }
+
+    QVariantMap album;
+    album["artist"] = QString("The Montagues");
+    album["released"] = QDateTime(QDate(2012, 4, 12), QTime(0, 0, 0), Qt::UTC);
+    album["tracks"] = tracks;
+
+    QXmppRpcInvokeIq iq;
+    iq.setId("rpc1");
+    iq.setFrom("requester@company-b.com/jrpc-client");
+    iq.setTo("responder@company-a.com/jrpc-server");
+    iq.setMethod("library.addAlbum");
+    iq.setArguments(QVariantList() << album << QString("favourites"));
+
+    QByteArray xml;
+    QXmlStreamWriter writer(&xml);
+    iq.toXml(&writer);
+    return xml;
+}
+
+static QByteArray vCardXml()
+{
+    QByteArray photo(32768, 0);
+    for (int i = 0; i < photo.size(); ++i)
+        photo[i] = char((i * 7919) >> 3);
+
+    QXmppVCardIq iq;
+    iq.setType(QXmppIq::Result);
+    iq.setId("vcard1");
+    iq.setBirthday(QDate(1983, 9, 14));
+    iq.setEmail("foo.bar@example.com");
+    iq.setFirstName("Foo");
+    iq.setFullName("Foo Bar!");
+    iq.setLastName("Wiz");
+    iq.setMiddleName("Baz");
+    iq.setNickName("FooBar");
+    iq.setPhoto(photo);
+    iq.setPhotoType("image/png");
+    iq.setUrl("http://example.com/");
+
+    QByteArray xml;
+    QXmlStreamWriter writer(&xml);
+    iq.toXml(&writer);
+    return xml;
+}
+
+template <class T>
+static void benchParse(const QByteArray &xml)
+{
+    QDomDocument doc;
+    QVERIFY(doc.setContent(xml, true));
+    const QDomElement element = doc.documentElement();
+
+    QBENCHMARK {
+        T packet;
+        packet.parse(element);
+    }
+
+    const qint64 start = allocationCount();
+    {
+        T packet;
+        packet.parse(element);
+    }
+    reportAllocations(start);
+}
+
+template <class T>
+static void benchSerialize(const QByteArray &xml)
+{
+    QDomDocument doc;
+    QVERIFY(doc.setContent(xml, true));
+    T packet;
+    packet.parse(doc.documentElement());
+
+    QBENCHMARK {
+        QByteArray data;
+        QXmlStreamWriter writer(&data);
+        packet.toXml(&writer);
+    }
+
+    const qint64 start = allocationCount();
+    {
+        QByteArray data;
+        QXmlStreamWriter writer(&data);
+        packet.toXml(&writer);
+    }
+    reportAllocations(start);
+}
+
+template <class T>
+static void benchParseDocument(const QByteArray &xml)
+{
+    QBENCHMARK {
+        QDomDocument doc;
+        doc.setContent(xml, true);
+        T packet;
+        packet.parse(doc.documentElement());
+    }
+
+    const qint64 start = allocationCount();
+    {
+        QDomDocument doc;
+        doc.setContent(xml, true);
+        T packet;
+        packet.parse(doc.documentElement());
+    }
+    reportAllocations(start);
+}
+
+template <class T>
+static void benchParseReader(const QByteArray &xml)
+{
+    QBENCHMARK {
+        QXmlStreamReader reader(xml);
+        reader.readNextStartElement();
+        T packet;
+        packet.parse(&reader);
+    }
+
+    const qint64 start = allocationCount();
+    {
+        QXmlStreamReader reader(xml);
+        reader.readNextStartElement();
+        T packet;
+        packet.parse(&reader);
+    }
+    reportAllocations(start);
+}
+
+void BenchStanzas::parseArchiveChat()
+{
+    benchParse<QXmppArchiveChatIq>(archiveChatXml());
+}
+
+void BenchStanzas::parseJingle()
+{
+    benchParse<QXmppJingleIq>(jingleXml());
+}
+
+void BenchStanzas::parseMessage()
+{
+    benchParse<QXmppMessage>(messageXml());
+}
+
+void BenchStanzas::parsePresence()
+{
+    benchParse<QXmppPresence>(presenceXml());
+}
+
+void BenchStanzas::parsePubSub()
+{
+    benchParse<QXmppPubSubIq>(pubSubXml());
+}
+
+void BenchStanzas::parseRoster()
+{
+    benchParse<QXmppRosterIq>(rosterXml());
+}
+
+void BenchStanzas::parseRpc()
+{
+    benchParse<QXmppRpcInvokeIq>(rpcXml());
+}
+
+void BenchStanzas::parseVCard()
+{
+    benchParse<QXmppVCardIq>(vCardXml());
+}
+
+static void addParseRows()
+{
+    QTest::addColumn<QString>("type");
+    QTest::addColumn<QByteArray>("xml");
+
+    QTest::newRow("message") << "message" << messageXml();
+    QTest::newRow("presence") << "presence" << presenceXml();
+    QTest::newRow("roster") << "roster" << rosterXml();
+}
+
+void BenchStanzas::parseFromDocument_data()
+{
+    addParseRows();
+}
+
+void BenchStanzas::parseFromDocument()
+{
+    QFETCH(QString, type);
+    QFETCH(QByteArray, xml);
+
+    if (type == "message")
+        benchParseDocument<QXmppMessage>(xml);
+    else if (type == "presence")
+        benchParseDocument<QXmppPresence>(xml);
+    else if (type == "roster")
+        benchParseDocument<QXmppRosterIq>(xml);
+}
+
+void BenchStanzas::parseFromReader_data()
+{
+    addParseRows();
+}
+
+void BenchStanzas::parseFromReader()
+{
+    QFETCH(QString, type);
+    QFETCH(QByteArray, xml);
+
+    if (type == "message")
+        benchParseReader<QXmppMessage>(xml);
+    else if (type == "presence")
+        benchParseReader<QXmppPresence>(xml);
+    else if (type == "roster")
+        benchParseReader<QXmppRosterIq>(xml);
+}
+
+void BenchStanzas::elementFromReader()
+{
+    const QByteArray xml = pubSubXml();
+
+    QBENCHMARK {
+        QXmlStreamReader reader(xml);
+        reader.readNextStartElement();
+        QXmppElement element(&reader);
+    }
+
+    const qint64 start = allocationCount();
+    {
+        QXmlStreamReader reader(xml);
+        reader.readNextStartElement();
+        QXmppElement element(&reader);
+    }
+    reportAllocations(start);
+}
+
+static int countElements(const QXmppElement &element)
+{
+    int count = 1;
+    QXmppElement child = element.firstChildElement();
+    while (!child.isNull()) {
+        count += countElements(child);
+        child = child.nextSiblingElement();
+    }
+    return count;
+}
+
+void BenchStanzas::elementTraverse()
+{
+    QXmlStreamReader reader(pubSubXml());
+    reader.readNextStartElement();
+    const QXmppElement element(&reader);
+
+    int count = 0;
+    QBENCHMARK {
+        count = countElements(element);
+    }
+    QVERIFY(count > 20);
+}
+
+void BenchStanzas::serializeArchiveChat()
+{
+    benchSerialize<QXmppArchiveChatIq>(archiveChatXml());
+}
+
+void BenchStanzas::serializeJingle()
+{
+    benchSerialize<QXmppJingleIq>(jingleXml());
+}
+
+void BenchStanzas::serializeMessage()
+{
+    benchSerialize<QXmppMessage>(messageXml());
+}
+
+void BenchStanzas::serializePresence()
+{
+    benchSerialize<QXmppPresence>(presenceXml());
+}
+
+void BenchStanzas::serializePubSub()
+{
+    benchSerialize<QXmppPubSubIq>(pubSubXml());
+}
+
+void BenchStanzas::serializeRoster()
+{
+    benchSerialize<QXmppRosterIq>(rosterXml());
+}
+
+void BenchStanzas::serializeRpc()
+{
+    benchSerialize<QXmppRpcInvokeIq>(rpcXml());
+}
+
+void BenchStanzas::serializeVCard()
+{
+    benchSerialize<QXmppVCardIq>(vCardXml());
+}
+
+void BenchStanzas::streamIngest_data()
+{
+    QTest::addColumn<int>("fragmentSize");
+
+    QTest::newRow("unfragmented") << 0;
+    QTest::newRow("4096 bytes") << 4096;
+    QTest::newRow("512 bytes") << 512;
+    QTest::newRow("64 bytes") << 64;
+}
+
+static void feed(QTcpSocket *peer, QSslSocket *socket, BenchStream *stream, const QByteArray &data, int fragmentSize)
+{
+    const int step = fragmentSize ? fragmentSize : data.size();
+    for (int offset = 0; offset < data.size(); offset += step) {
+        const qint64 target = stream->bytesReceived() + qMin(step, data.size() - offset);
+        peer->write(data.mid(offset, step));
+        peer->waitForBytesWritten(1000);
+        while (stream->bytesReceived() < target && socket->waitForReadyRead(1000))
+            ;
+    }
+}
+
+void BenchStanzas::streamIngest()
+{
+    QFETCH(int, fragmentSize);
+
+    const int stanzas = 100;
+    QByteArray corpus;
+    for (int i = 0; i < stanzas; ++i)
+        corpus += (i % 2) ? presenceXml() : messageXml();
+
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QSslSocket *socket = new QSslSocket;
+    socket->connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(server.waitForNewConnection(1000));
+    QTcpSocket *peer = server.nextPendingConnection();
+    QVERIFY(socket->waitForConnected(1000));
+
+    BenchStream stream(socket);
+    feed(peer, socket, &stream, "<?xml version='1.0'?><stream:stream"
+        " xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'"
+        " version='1.0'>", 0);
+
+    QBENCHMARK {
+        stream.stanzaCount = 0;
+        feed(peer, socket, &stream, corpus, fragmentSize);
+        QCOMPARE(stream.stanzaCount, stanzas);
+    }
+
+    const qint64 start = allocationCount();
+    feed(peer, socket, &stream, corpus, fragmentSize);
+    reportAllocations(start);
+}
+
+BenchStream::BenchStream(QSslSocket *socket)
+    : QXmppStream(0),
+    stanzaCount(0)
+{
+    socket->setParent(this);
+    setSocket(socket);
+}
+
+void BenchStream::handleStanza(const QDomElement &element)
+{
+    if (!element.isNull())
+        stanzaCount++;
+}
+
+void BenchStream::handleStream(const QDomElement &element)
+{
+    Q_UNUSED(element);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    BenchStanzas benchStanzas;
+    return QTest::qExec(&benchStanzas, argc, argv) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QObject>
+
+#include "QXmppStream.h"
+
+class BenchStanzas : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void parseArchiveChat();
+    void parseJingle();
+    void parseMessage();
+    void parsePresence();
+    void parsePubSub();
+    void parseRoster();
+    void parseRpc();
+    void parseVCard();
+
+    void parseFromDocument_data();
+    void parseFromDocument();
+    void parseFromReader_data();
+    void parseFromReader();
+
+    void elementFromReader();
+    void elementTraverse();
+
+    void serializeArchiveChat();
+    void serializeJingle();
+    void serializeMessage();
+    void serializePresence();
+    void serializePubSub();
+    void serializeRoster();
+    void serializeRpc();
+    void serializeVCard();
+
+    void streamIngest_data();
+    void streamIngest();
+};
+
+class BenchStream : public QXmppStream
+{
+    Q_OBJECT
+
+public:
+    BenchStream(QSslSocket *socket);
+    int stanzaCount;
+
+protected:
+    void handleStanza(const QDomElement &element);
+    void handleStream(const QDomElement &element);
+};
@@ -0,0 +1,8 @@
+include(../benchmarks.pri)
+
+QT += testlib
+
+TARGET = qxmpp-bench-stanzas
+
+SOURCES += stanzas.cpp
+HEADERS += stanzas.h
@@ -4,6 +4,7 @@ TEMPLATE = subdirs
 
 SUBDIRS = src \
           tests \
+          benchmarks \
           examples \
           doc
 
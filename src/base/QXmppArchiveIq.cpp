@@ -24,9 +24,10 @@
 #include <QDomElement>
 
 #include "QXmppArchiveIq.h"
+#include "QXmppAtom.h"
+#include "QXmppConstants.h"
 #include "QXmppUtils.h"
 
-static const char *ns_archive = "urn:xmpp:archive";
 static const char *ns_rsm = "http://jabber.org/protocol/rsm";
 
 QXmppArchiveMessage::QXmppArchiveMessage()
@@ -336,8 +337,7 @@ void QXmppArchiveListIq::setEnd(const QDateTime &end)
 
 bool QXmppArchiveListIq::isArchiveListIq(const QDomElement &element)
 {
-    QDomElement listElement = element.firstChildElement("list");
-    return (listElement.namespaceURI() == ns_archive);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::List, QXmppAtom::NsArchive);
 }
 
 void QXmppArchiveListIq::parseElementFromChild(const QDomElement &element)
@@ -388,8 +388,7 @@ void QXmppArchiveListIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
 
 bool QXmppArchivePrefIq::isArchivePrefIq(const QDomElement &element)
 {
-    QDomElement prefElement = element.firstChildElement("pref");
-    return (prefElement.namespaceURI() == ns_archive);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Pref, QXmppAtom::NsArchive);
 }
 
 void QXmppArchivePrefIq::parseElementFromChild(const QDomElement &element)
@@ -458,8 +457,7 @@ void QXmppArchiveRemoveIq::setEnd(const QDateTime &end)
 
 bool QXmppArchiveRemoveIq::isArchiveRemoveIq(const QDomElement &element)
 {
-    QDomElement retrieveElement = element.firstChildElement("remove");
-    return (retrieveElement.namespaceURI() == ns_archive);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Remove, QXmppAtom::NsArchive);
 }
 
 void QXmppArchiveRemoveIq::parseElementFromChild(const QDomElement &element)
@@ -541,8 +539,7 @@ void QXmppArchiveRetrieveIq::setWith(const QString &with)
 
 bool QXmppArchiveRetrieveIq::isArchiveRetrieveIq(const QDomElement &element)
 {
-    QDomElement retrieveElement = element.firstChildElement("retrieve");
-    return (retrieveElement.namespaceURI() == ns_archive);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Retrieve, QXmppAtom::NsArchive);
 }
 
 void QXmppArchiveRetrieveIq::parseElementFromChild(const QDomElement &element)
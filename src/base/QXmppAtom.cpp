@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QAtomicInt>
+#include <QDomElement>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "QXmppAtom.h"
+#include "QXmppConstants.h"
+
+#include <cstring>
+
+/// The table of atoms.
+///
+/// Entries are only ever appended to fixed arrays. An insertion writes the
+/// name, publishes the new count with release semantics, then fills the
+/// bucket. Lookups read the count with acquire semantics and ignore the
+/// buckets holding a higher id, so they never take a lock.
+
+class QXmppAtomTable
+{
+public:
+    QXmppAtomTable();
+    int find(const QChar *data, int size) const;
+    int insert(const QString &name);
+    int published() const;
+
+    enum {
+        Capacity = 4096,
+        BucketCount = 2 * Capacity
+    };
+
+    // serialises insertions
+    QMutex mutex;
+
+    QString names[Capacity];
+    QAtomicInt buckets[BucketCount];
+    QAtomicInt count;
+};
+
+static uint hashName(const QChar *data, int size)
+{
+    uint h = 0;
+    for (int i = 0; i < size; ++i)
+        h = 31 * h + data[i].unicode();
+    return h ^ (h >> 16);
+}
+
+QXmppAtomTable::QXmppAtomTable()
+    : count(1)
+{
+    // entries must be listed in the order of QXmppAtom::Predefined
+    const char *predefined[] = {
+        // namespaces
+        ns_archive,
+        ns_attention,
+        ns_auth,
+        ns_authFeature,
+        ns_bind,
+        ns_bookmarks,
+        ns_bytestreams,
+        ns_capabilities,
+        ns_chat_states,
+        ns_client,
+        ns_compress,
+        ns_compressFeature,
+        ns_conference,
+        ns_data,
+        ns_delayed_delivery,
+        ns_disco_info,
+        ns_disco_items,
+        ns_entity_time,
+        ns_feature_negotiation,
+        ns_ibb,
+        ns_jingle,
+        ns_jingle_ice_udp,
+        ns_jingle_raw_udp,
+        ns_jingle_rtp,
+        ns_jingle_rtp_audio,
+        ns_jingle_rtp_video,
+        ns_legacy_delayed_delivery,
+        ns_message_receipts,
+        ns_muc,
+        ns_muc_admin,
+        ns_muc_owner,
+        ns_muc_user,
+        ns_ping,
+        ns_privacy,
+        ns_pubsub,
+        ns_roster,
+        ns_rpc,
+        ns_sasl,
+        ns_server,
+        ns_server_dialback,
+        ns_session,
+        ns_stanza,
+        ns_stream,
+        ns_stream_initiation,
+        ns_stream_initiation_file_transfer,
+        ns_tls,
+        ns_vcard,
+        ns_vcard_update,
+        ns_version,
+
+        // element names
+        "attention",
+        "auth",
+        "bind",
+        "body",
+        "c",
+        "challenge",
+        "chat",
+        "close",
+        "data",
+        "delay",
+        "error",
+        "failure",
+        "features",
+        "iq",
+        "item",
+        "jingle",
+        "list",
+        "message",
+        "open",
+        "photo",
+        "ping",
+        "pref",
+        "presence",
+        "priority",
+        "proceed",
+        "pubsub",
+        "query",
+        "received",
+        "remove",
+        "request",
+        "response",
+        "result",
+        "retrieve",
+        "session",
+        "show",
+        "si",
+        "starttls",
+        "status",
+        "storage",
+        "stream",
+        "subject",
+        "success",
+        "thread",
+        "time",
+        "vCard",
+        "verify",
+        "x",
+
+        // attribute names and values
+        "code",
+        "from",
+        "get",
+        "id",
+        "jid",
+        "lang",
+        "mechanism",
+        "name",
+        "node",
+        "set",
+        "stamp",
+        "to",
+        "type",
+        "var",
+        "xmlns",
+    };
+    Q_ASSERT(sizeof(predefined) / sizeof(predefined[0]) == QXmppAtom::PredefinedCount - 1);
+
+    for (unsigned int i = 0; i < sizeof(predefined) / sizeof(predefined[0]); ++i) {
+        const int id = insert(QString::fromLatin1(predefined[i]));
+        Q_UNUSED(id);
+        Q_ASSERT(id == int(i) + 1);
+    }
+}
+
+/// Returns the id of the given name, or 0 if it is not in the table.
+///
+/// This is safe to call from any thread without holding the mutex.
+
+int QXmppAtomTable::find(const QChar *data, int size) const
+{
+    if (!size)
+        return 0;
+
+    const int limit = published();
+    uint index = hashName(data, size) & (BucketCount - 1);
+    while (const int id = buckets[index]) {
+        if (id < limit) {
+            const QString &name = names[id];
+            if (name.size() == size && !memcmp(name.unicode(), data, size * sizeof(QChar)))
+                return id;
+        }
+        index = (index + 1) & (BucketCount - 1);
+    }
+    return 0;
+}
+
+/// Adds a name which is not yet in the table, returning 0 if the table is
+/// full.
+///
+/// The caller must hold the mutex.
+
+int QXmppAtomTable::insert(const QString &name)
+{
+    const int id = published();
+    if (id == Capacity)
+        return 0;
+
+    names[id] = name;
+    count.fetchAndStoreRelease(id + 1);
+
+    uint index = hashName(name.unicode(), name.size()) & (BucketCount - 1);
+    while (buckets[index])
+        index = (index + 1) & (BucketCount - 1);
+    buckets[index] = id;
+    return id;
+}
+
+/// Returns the number of entries whose names are visible to the calling
+/// thread.
+
+int QXmppAtomTable::published() const
+{
+#if QT_VERSION >= 0x050000
+    return count.loadAcquire();
+#else
+    return const_cast<QAtomicInt&>(count).fetchAndAddAcquire(0);
+#endif
+}
+
+Q_GLOBAL_STATIC(QXmppAtomTable, atomTable)
+
+/// Constructs a null atom.
+
+QXmppAtom::QXmppAtom()
+    : m_id(Null)
+{
+}
+
+/// Constructs one of the predefined atoms.
+///
+/// \param atom
+
+QXmppAtom::QXmppAtom(Predefined atom)
+    : m_id(atom)
+{
+}
+
+/// Looks up \a name in the atom table, returning a null atom if it was
+/// never registered.
+///
+/// \param name
+
+QXmppAtom QXmppAtom::find(const QString &name)
+{
+    QXmppAtom atom;
+    atom.m_id = atomTable()->find(name.unicode(), name.size());
+    return atom;
+}
+
+/// Looks up \a name in the atom table without copying it, returning a
+/// null atom if it was never registered.
+///
+/// This is intended for names read by a QXmlStreamReader.
+///
+/// \param name
+
+QXmppAtom QXmppAtom::find(const QStringRef &name)
+{
+    QXmppAtom atom;
+    atom.m_id = atomTable()->find(name.unicode(), name.size());
+    return atom;
+}
+
+/// Returns the atom for \a name, registering it if needed.
+///
+/// The table has a fixed capacity, once it is full a null atom is returned
+/// for unknown names.
+///
+/// \param name
+
+QXmppAtom QXmppAtom::intern(const QString &name)
+{
+    QXmppAtomTable *table = atomTable();
+    QXmppAtom atom;
+    atom.m_id = table->find(name.unicode(), name.size());
+    if (atom.m_id || name.isEmpty() || table->published() == QXmppAtomTable::Capacity)
+        return atom;
+
+    QMutexLocker locker(&table->mutex);
+    atom.m_id = table->find(name.unicode(), name.size());
+    if (!atom.m_id)
+        atom.m_id = table->insert(name);
+    return atom;
+}
+
+/// Returns the atom for the tag name of \a element.
+///
+/// \param element
+
+QXmppAtom QXmppAtom::tagName(const QDomElement &element)
+{
+    return find(element.tagName());
+}
+
+/// Returns the atom for the namespace of \a element.
+///
+/// \param element
+
+QXmppAtom QXmppAtom::namespaceUri(const QDomElement &element)
+{
+    return find(element.namespaceURI());
+}
+
+/// Returns the atom for the value of the attribute \a name of \a element.
+///
+/// \param element
+/// \param name
+
+QXmppAtom QXmppAtom::attribute(const QDomElement &element, Predefined name)
+{
+    return find(element.attribute(atomTable()->names[name]));
+}
+
+/// Returns the first child of \a element called \a name.
+///
+/// \param element
+/// \param name
+
+QDomElement QXmppAtom::firstChildElement(const QDomElement &element, Predefined name)
+{
+    return element.firstChildElement(atomTable()->names[name]);
+}
+
+/// Returns true if the first child of \a element called \a name has the
+/// namespace \a xmlns.
+///
+/// This is the check performed by most of the isXxxIq() methods.
+///
+/// \param element
+/// \param name
+/// \param xmlns
+
+bool QXmppAtom::hasChildElement(const QDomElement &element, Predefined name, Predefined xmlns)
+{
+    return namespaceUri(firstChildElement(element, name)) == QXmppAtom(xmlns);
+}
+
+/// Returns the atom's numeric id, which is 0 for a null atom.
+
+int QXmppAtom::id() const
+{
+    return m_id;
+}
+
+/// Returns true if the atom is null.
+
+bool QXmppAtom::isNull() const
+{
+    return m_id == Null;
+}
+
+/// Returns the name represented by the atom, sharing the table's copy of
+/// the string.
+
+QString QXmppAtom::toString() const
+{
+    // an entry never changes once its id has been published
+    return atomTable()->names[m_id];
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPATOM_H
+#define QXMPPATOM_H
+
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+class QDomElement;
+
+/// \brief The QXmppAtom class represents an interned XML name.
+///
+/// XMPP namespaces and common element and attribute names are registered
+/// in a global atom table, so that checking what a stanza is becomes an
+/// integer comparison and repeated names share a single string buffer.
+///
+/// Looking up a name with find() never allocates memory, modifies the
+/// table nor takes a lock, use it for names received from the network.
+///
+
+class QXMPP_EXPORT QXmppAtom
+{
+public:
+    /// This enum lists the atoms which are always present in the table.
+    enum Predefined
+    {
+        Null = 0,
+
+        // namespaces
+        NsArchive,
+        NsAttention,
+        NsAuth,
+        NsAuthFeature,
+        NsBind,
+        NsBookmarks,
+        NsBytestreams,
+        NsCapabilities,
+        NsChatStates,
+        NsClient,
+        NsCompress,
+        NsCompressFeature,
+        NsConference,
+        NsData,
+        NsDelayedDelivery,
+        NsDiscoInfo,
+        NsDiscoItems,
+        NsEntityTime,
+        NsFeatureNegotiation,
+        NsIbb,
+        NsJingle,
+        NsJingleIceUdp,
+        NsJingleRawUdp,
+        NsJingleRtp,
+        NsJingleRtpAudio,
+        NsJingleRtpVideo,
+        NsLegacyDelayedDelivery,
+        NsMessageReceipts,
+        NsMuc,
+        NsMucAdmin,
+        NsMucOwner,
+        NsMucUser,
+        NsPing,
+        NsPrivacy,
+        NsPubSub,
+        NsRoster,
+        NsRpc,
+        NsSasl,
+        NsServer,
+        NsServerDialback,
+        NsSession,
+        NsStanza,
+        NsStream,
+        NsStreamInitiation,
+        NsStreamInitiationFileTransfer,
+        NsTls,
+        NsVCard,
+        NsVCardUpdate,
+        NsVersion,
+
+        // element names
+        Attention,
+        Auth,
+        Bind,
+        Body,
+        C,
+        Challenge,
+        Chat,
+        Close,
+        Data,
+        Delay,
+        Error,
+        Failure,
+        Features,
+        Iq,
+        Item,
+        Jingle,
+        List,
+        Message,
+        Open,
+        Photo,
+        Ping,
+        Pref,
+        Presence,
+        Priority,
+        Proceed,
+        PubSub,
+        Query,
+        Received,
+        Remove,
+        Request,
+        Response,
+        Result,
+        Retrieve,
+        Session,
+        Show,
+        Si,
+        StartTls,
+        Status,
+        Storage,
+        Stream,
+        Subject,
+        Success,
+        Thread,
+        Time,
+        VCard,
+        Verify,
+        X,
+
+        // attribute names and values
+        Code,
+        From,
+        Get,
+        Id,
+        Jid,
+        Lang,
+        Mechanism,
+        Name,
+        Node,
+        Set,
+        Stamp,
+        To,
+        Type,
+        Var,
+        Xmlns,
+
+        PredefinedCount
+    };
+
+    QXmppAtom();
+    QXmppAtom(Predefined atom);
+
+    static QXmppAtom find(const QString &name);
+    static QXmppAtom find(const QStringRef &name);
+    static QXmppAtom intern(const QString &name);
+
+    static QXmppAtom tagName(const QDomElement &element);
+    static QXmppAtom namespaceUri(const QDomElement &element);
+    static QXmppAtom attribute(const QDomElement &element, Predefined name);
+    static QDomElement firstChildElement(const QDomElement &element, Predefined name);
+    static bool hasChildElement(const QDomElement &element, Predefined name, Predefined xmlns);
+
+    int id() const;
+    bool isNull() const;
+    QString toString() const;
+
+    /// Returns true if both atoms represent the same name.
+    bool operator==(const QXmppAtom &other) const { return m_id == other.m_id; }
+
+    /// Returns true if the atoms represent different names.
+    bool operator!=(const QXmppAtom &other) const { return m_id != other.m_id; }
+
+private:
+    int m_id;
+};
+
+/// Returns the hash value for \a atom.
+inline uint qHash(const QXmppAtom &atom)
+{
+    return atom.id();
+}
+
+#endif
@@ -26,6 +26,7 @@
 #include <QTextStream>
 #include <QXmlStreamWriter>
 
+#include "QXmppAtom.h"
 #include "QXmppBindIq.h"
 #include "QXmppUtils.h"
 #include "QXmppConstants.h"
@@ -66,8 +67,7 @@ void QXmppBindIq::setResource(const QString& resource)
 
 bool QXmppBindIq::isBindIq(const QDomElement &element)
 {
-    QDomElement bindElement = element.firstChildElement("bind");
-    return (bindElement.namespaceURI() == ns_bind);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Bind, QXmppAtom::NsBind);
 }
 
 void QXmppBindIq::parseElementFromChild(const QDomElement &element)
@@ -77,6 +77,26 @@ void QXmppBindIq::parseElementFromChild(const QDomElement &element)
     m_resource = bindElement.firstChildElement("resource").text();
 }
 
+void QXmppBindIq::parseElementFromChild(QXmlStreamReader *reader)
+{
+    while (reader->readNextStartElement()) {
+        if (parseError(reader))
+            continue;
+        if (reader->name() != "bind") {
+            reader->skipCurrentElement();
+            continue;
+        }
+        while (reader->readNextStartElement()) {
+            if (reader->name() == "jid")
+                m_jid = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+            else if (reader->name() == "resource")
+                m_resource = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+            else
+                reader->skipCurrentElement();
+        }
+    }
+}
+
 void QXmppBindIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement("bind");
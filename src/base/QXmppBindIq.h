@@ -49,6 +49,7 @@ public:
 protected:
     /// \cond
     void parseElementFromChild(const QDomElement &element);
+    void parseElementFromChild(QXmlStreamReader *reader);
     void toXmlElementFromChild(QXmlStreamWriter *writer) const;
     /// \endcond
 
@@ -23,11 +23,11 @@
 
 #include <QDomElement>
 
+#include "QXmppAtom.h"
 #include "QXmppBookmarkSet.h"
+#include "QXmppConstants.h"
 #include "QXmppUtils.h"
 
-static const char *ns_bookmarks = "storage:bookmarks";
-
 /// Constructs a new conference room bookmark.
 ///
 
@@ -176,8 +176,8 @@ void QXmppBookmarkSet::setUrls(const QList<QXmppBookmarkUrl> &urls)
 
 bool QXmppBookmarkSet::isBookmarkSet(const QDomElement &element)
 {
-    return element.tagName() == "storage" &&
-           element.namespaceURI() == ns_bookmarks;
+    return QXmppAtom::tagName(element) == QXmppAtom::Storage &&
+           QXmppAtom::namespaceUri(element) == QXmppAtom::NsBookmarks;
 }
 
 void QXmppBookmarkSet::parse(const QDomElement &element)
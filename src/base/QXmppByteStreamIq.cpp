@@ -23,6 +23,7 @@
 
 #include <QDomElement>
 
+#include "QXmppAtom.h"
 #include "QXmppByteStreamIq.h"
 #include "QXmppConstants.h"
 #include "QXmppUtils.h"
@@ -119,7 +120,7 @@ void QXmppByteStreamIq::setStreamHostUsed(const QString &jid)
 
 bool QXmppByteStreamIq::isByteStreamIq(const QDomElement &element)
 {
-    return element.firstChildElement("query").namespaceURI() == ns_bytestreams;
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsBytestreams);
 }
 
 void QXmppByteStreamIq::parseElementFromChild(const QDomElement &element)
@@ -74,3 +74,9 @@ const char *ns_jingle_rtp_video = "urn:xmpp:jingle:apps:rtp:video";
 const char *ns_entity_time = "urn:xmpp:time";
 // XEP-0224: Attention
 const char *ns_attention = "urn:xmpp:attention:0";
+// XEP-0048: Bookmarks
+const char *ns_bookmarks = "storage:bookmarks";
+// XEP-0060: Publish-Subscribe
+const char *ns_pubsub = "http://jabber.org/protocol/pubsub";
+// XEP-0136: Message Archiving
+const char *ns_archive = "urn:xmpp:archive";
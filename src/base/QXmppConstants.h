@@ -71,5 +71,8 @@ extern const char *ns_jingle_rtp_audio;
 extern const char *ns_jingle_rtp_video;
 extern const char *ns_entity_time;
 extern const char *ns_attention;
+extern const char *ns_bookmarks;
+extern const char *ns_pubsub;
+extern const char *ns_archive;
 
 #endif // QXMPPCONSTANTS_H
@@ -24,6 +24,7 @@
 #include <QCryptographicHash>
 #include <QDomElement>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppDiscoveryIq.h"
 #include "QXmppUtils.h"
@@ -213,9 +214,9 @@ QByteArray QXmppDiscoveryIq::verificationString() const
 
 bool QXmppDiscoveryIq::isDiscoveryIq(const QDomElement &element)
 {
-    QDomElement queryElement = element.firstChildElement("query");
-    return (queryElement.namespaceURI() == ns_disco_info ||
-            queryElement.namespaceURI() == ns_disco_items);
+    const QXmppAtom xmlns = QXmppAtom::namespaceUri(QXmppAtom::firstChildElement(element, QXmppAtom::Query));
+    return (xmlns == QXmppAtom::NsDiscoInfo ||
+            xmlns == QXmppAtom::NsDiscoItems);
 }
 
 void QXmppDiscoveryIq::parseElementFromChild(const QDomElement &element)
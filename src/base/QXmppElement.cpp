@@ -21,48 +21,293 @@
  *
  */
 
+#include "QXmppAtom.h"
 #include "QXmppElement.h"
 #include "QXmppUtils.h"
 
 #include <QDomElement>
+#include <QVarLengthArray>
+
+#include <new>
+
+class QXmppElementArena;
+
+typedef QPair<QString, QString> QXmppElementAttribute;
+
+/// Returns the atom table's copy of \a name, registering it if needed.
+///
+/// This must only be used for names chosen by the application, as the
+/// table is never purged.
+
+static QString internName(const QString &name)
+{
+    const QXmppAtom atom = QXmppAtom::intern(name);
+    return atom.isNull() ? name : atom.toString();
+}
+
+/// Returns the atom table's copy of \a name if it has one, so that the
+/// thousands of "item", "jid" or "xmlns" strings in a parsed tree share a
+/// single buffer. Unknown names received from the network are not
+/// registered.
+
+static QString sharedName(const QString &name)
+{
+    const QXmppAtom atom = QXmppAtom::find(name);
+    return atom.isNull() ? name : atom.toString();
+}
+
+static QString sharedName(const QStringRef &name)
+{
+    const QXmppAtom atom = QXmppAtom::find(name);
+    return atom.isNull() ? name.toString() : atom.toString();
+}
 
 class QXmppElementPrivate
 {
 public:
-    QXmppElementPrivate();
-    QXmppElementPrivate(const QDomElement &element);
+    QXmppElementPrivate(QXmppElementArena *arena);
     ~QXmppElementPrivate();
 
+    void appendChild(QXmppElementPrivate *child);
+    void removeChild(QXmppElementPrivate *child);
+    int attributeIndex(const QString &name, bool *found) const;
+    void setAttribute(const QString &name, const QString &value);
+
+    void ref();
+    void deref();
+
     QAtomicInt counter;
+    QXmppElementArena *arena;
 
     QXmppElementPrivate *parent;
-    QMap<QString, QString> attributes;
-    QList<QXmppElementPrivate*> children;
+    QXmppElementPrivate *firstChild;
+    QXmppElementPrivate *lastChild;
+    QXmppElementPrivate *previousSibling;
+    QXmppElementPrivate *nextSibling;
+
+    // sorted by name, which gives the same serialisation as the former QMap
+    QVarLengthArray<QXmppElementAttribute, 2> attributes;
     QString name;
     QString value;
 };
 
-QXmppElementPrivate::QXmppElementPrivate()
-    : counter(1), parent(NULL)
+/// A QXmppElementArena owns the storage for the nodes of one element tree.
+///
+/// Parsing a stanza allocates all of its nodes from a single arena instead
+/// of doing one heap allocation per node. Each node remains individually
+/// reference counted, the arena's memory is released once its last live
+/// node has been destroyed.
+
+class QXmppElementArena
 {
+public:
+    static QXmppElementArena *create(int capacity);
+    QXmppElementPrivate *allocate();
+    void release();
+
+private:
+    struct Block
+    {
+        Block *next;
+        QXmppElementPrivate *nodes;
+        int capacity;
+        int used;
+    };
+
+    QXmppElementArena();
+    static int alignedSize(int size);
+
+    QAtomicInt m_live;
+    Block m_block;
+    Block *m_current;
+};
+
+QXmppElementArena::QXmppElementArena()
+    : m_live(0),
+    m_current(&m_block)
+{
+}
+
+int QXmppElementArena::alignedSize(int size)
+{
+    const int alignment = 2 * sizeof(void*);
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/// Creates an arena with room for \a capacity nodes in a single allocation.
+/// Further nodes are allocated from overflow blocks of growing size.
+
+QXmppElementArena *QXmppElementArena::create(int capacity)
+{
+    capacity = qMax(capacity, 1);
+    const int headerSize = alignedSize(sizeof(QXmppElementArena));
+    char *memory = static_cast<char*>(::operator new(headerSize + capacity * sizeof(QXmppElementPrivate)));
+    QXmppElementArena *arena = new (memory) QXmppElementArena;
+    arena->m_block.next = 0;
+    arena->m_block.nodes = reinterpret_cast<QXmppElementPrivate*>(memory + headerSize);
+    arena->m_block.capacity = capacity;
+    arena->m_block.used = 0;
+    return arena;
+}
+
+/// Allocates a node. Nodes are only ever allocated while the tree is being
+/// built, before any handle to it has been handed out.
+
+QXmppElementPrivate *QXmppElementArena::allocate()
+{
+    if (m_current->used == m_current->capacity) {
+        const int capacity = m_current->capacity * 2;
+        const int headerSize = alignedSize(sizeof(Block));
+        char *memory = static_cast<char*>(::operator new(headerSize + capacity * sizeof(QXmppElementPrivate)));
+        Block *block = reinterpret_cast<Block*>(memory);
+        block->next = m_current;
+        block->nodes = reinterpret_cast<QXmppElementPrivate*>(memory + headerSize);
+        block->capacity = capacity;
+        block->used = 0;
+        m_current = block;
+    }
+    m_live.ref();
+    return new (m_current->nodes + m_current->used++) QXmppElementPrivate(this);
 }
 
-QXmppElementPrivate::QXmppElementPrivate(const QDomElement &element)
-    : counter(1), parent(NULL)
+/// Releases a node's slot, freeing the arena once no node is alive.
+
+void QXmppElementArena::release()
+{
+    if (m_live.deref())
+        return;
+
+    Block *block = m_current;
+    while (block != &m_block) {
+        Block *next = block->next;
+        ::operator delete(block);
+        block = next;
+    }
+    this->~QXmppElementArena();
+    ::operator delete(this);
+}
+
+QXmppElementPrivate::QXmppElementPrivate(QXmppElementArena *arena_)
+    : counter(1),
+    arena(arena_),
+    parent(0),
+    firstChild(0),
+    lastChild(0),
+    previousSibling(0),
+    nextSibling(0)
+{
+}
+
+QXmppElementPrivate::~QXmppElementPrivate()
+{
+    QXmppElementPrivate *child = firstChild;
+    while (child) {
+        QXmppElementPrivate *next = child->nextSibling;
+        child->parent = 0;
+        child->previousSibling = 0;
+        child->nextSibling = 0;
+        child->deref();
+        child = next;
+    }
+}
+
+void QXmppElementPrivate::ref()
+{
+    counter.ref();
+}
+
+void QXmppElementPrivate::deref()
+{
+    if (!counter.deref()) {
+        QXmppElementArena *nodeArena = arena;
+        this->~QXmppElementPrivate();
+        nodeArena->release();
+    }
+}
+
+/// Links \a child as the last child. The caller is responsible for the
+/// reference the parent holds on \a child.
+
+void QXmppElementPrivate::appendChild(QXmppElementPrivate *child)
+{
+    child->parent = this;
+    child->previousSibling = lastChild;
+    child->nextSibling = 0;
+    if (lastChild)
+        lastChild->nextSibling = child;
+    else
+        firstChild = child;
+    lastChild = child;
+}
+
+/// Unlinks \a child without touching its reference count.
+
+void QXmppElementPrivate::removeChild(QXmppElementPrivate *child)
+{
+    if (child->previousSibling)
+        child->previousSibling->nextSibling = child->nextSibling;
+    else
+        firstChild = child->nextSibling;
+    if (child->nextSibling)
+        child->nextSibling->previousSibling = child->previousSibling;
+    else
+        lastChild = child->previousSibling;
+    child->parent = 0;
+    child->previousSibling = 0;
+    child->nextSibling = 0;
+}
+
+int QXmppElementPrivate::attributeIndex(const QString &attrName, bool *found) const
+{
+    int lo = 0;
+    int hi = attributes.size();
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (attributes[mid].first < attrName)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = (lo < attributes.size() && attributes[lo].first == attrName);
+    return lo;
+}
+
+void QXmppElementPrivate::setAttribute(const QString &attrName, const QString &attrValue)
+{
+    bool found;
+    const int index = attributeIndex(attrName, &found);
+    if (found)
+        attributes[index].second = attrValue;
+    else
+        attributes.insert(index, qMakePair(attrName, attrValue));
+}
+
+static int countNodes(const QDomElement &element)
+{
+    int count = 1;
+    QDomElement child = element.firstChildElement();
+    while (!child.isNull()) {
+        count += countNodes(child);
+        child = child.nextSiblingElement();
+    }
+    return count;
+}
+
+static void buildFromDom(QXmppElementPrivate *node, const QDomElement &element)
 {
     if (element.isNull())
         return;
 
-    name = element.tagName();
+    node->name = sharedName(element.tagName());
     QString xmlns = element.namespaceURI();
     QString parentns = element.parentNode().namespaceURI();
     if (!xmlns.isEmpty() && xmlns != parentns)
-        attributes.insert("xmlns", xmlns);
+        node->setAttribute(sharedName(QString("xmlns")), xmlns);
     QDomNamedNodeMap attrs = element.attributes();
     for (int i = 0; i < attrs.size(); i++)
     {
         QDomAttr attr = attrs.item(i).toAttr();
-        attributes.insert(attr.name(), attr.value());
+        node->setAttribute(sharedName(attr.name()), attr.value());
     }
 
     QDomNode childNode = element.firstChild();
@@ -70,73 +315,113 @@ QXmppElementPrivate::QXmppElementPrivate(const QDomElement &element)
     {
         if (childNode.isElement())
         {
-            QXmppElementPrivate *child = new QXmppElementPrivate(childNode.toElement());
-            child->parent = this;
-            children.append(child);
+            QXmppElementPrivate *child = node->arena->allocate();
+            node->appendChild(child);
+            buildFromDom(child, childNode.toElement());
         } else if (childNode.isText()) {
-            value += childNode.toText().data();
+            node->value += childNode.toText().data();
         }
         childNode = childNode.nextSibling();
     }
 }
 
-QXmppElementPrivate::~QXmppElementPrivate()
+static void buildFromReader(QXmppElementPrivate *node, QXmlStreamReader *reader, const QString &parentNamespace)
 {
-    foreach (QXmppElementPrivate *child, children)
-        if (!child->counter.deref())
-            delete child;
+    if (!reader->isStartElement())
+        return;
+
+    node->name = sharedName(reader->qualifiedName());
+    const QString xmlns = reader->namespaceUri().toString();
+    if (!xmlns.isEmpty() && xmlns != parentNamespace)
+        node->setAttribute(sharedName(QString("xmlns")), xmlns);
+    foreach (const QXmlStreamAttribute &attr, reader->attributes())
+        node->setAttribute(sharedName(attr.qualifiedName()), attr.value().toString());
+
+    while (!reader->atEnd()) {
+        reader->readNext();
+        if (reader->isStartElement()) {
+            QXmppElementPrivate *child = node->arena->allocate();
+            node->appendChild(child);
+            buildFromReader(child, reader, xmlns);
+        } else if (reader->isCharacters() && !reader->isWhitespace()) {
+            node->value += reader->text();
+        } else if (reader->isEndElement()) {
+            break;
+        }
+    }
 }
 
 QXmppElement::QXmppElement()
 {
-    d = new QXmppElementPrivate();
+    d = QXmppElementArena::create(1)->allocate();
 }
 
 QXmppElement::QXmppElement(const QXmppElement &other)
 {
-    other.d->counter.ref();
+    other.d->ref();
     d = other.d;
 }
 
 QXmppElement::QXmppElement(QXmppElementPrivate *other)
 {
-    other->counter.ref();
+    other->ref();
     d = other;
 }
 
 QXmppElement::QXmppElement(const QDomElement &element)
 {
-    d = new QXmppElementPrivate(element);
+    const int capacity = element.isNull() ? 1 : countNodes(element);
+    d = QXmppElementArena::create(capacity)->allocate();
+    buildFromDom(d, element);
+}
+
+/// Constructs an element by reading it from a QXmlStreamReader positioned
+/// on its start element. On return the reader is positioned on the
+/// element's end element.
+///
+/// The "xmlns" attribute is only set if the element's namespace differs
+/// from \a parentNamespace.
+///
+/// \param reader
+/// \param parentNamespace
+
+QXmppElement::QXmppElement(QXmlStreamReader *reader, const QString &parentNamespace)
+{
+    d = QXmppElementArena::create(8)->allocate();
+    buildFromReader(d, reader, parentNamespace);
 }
 
 QXmppElement::~QXmppElement()
 {
-    if (!d->counter.deref())
-        delete d;
+    d->deref();
 }
 
 QXmppElement &QXmppElement::operator=(const QXmppElement &other)
 {
-    other.d->counter.ref();
-    if (!d->counter.deref())
-        delete d;
+    other.d->ref();
+    d->deref();
     d = other.d;
     return *this;
 }
 
 QStringList QXmppElement::attributeNames() const
 {
-    return d->attributes.keys();
+    QStringList names;
+    for (int i = 0; i < d->attributes.size(); ++i)
+        names << d->attributes[i].first;
+    return names;
 }
 
 QString QXmppElement::attribute(const QString &name) const
 {
-    return d->attributes.value(name);
+    bool found;
+    const int index = d->attributeIndex(name, &found);
+    return found ? d->attributes[index].second : QString();
 }
 
 void QXmppElement::setAttribute(const QString &name, const QString &value)
 {
-    d->attributes.insert(name, value);
+    d->setAttribute(internName(name), value);
 }
 
 void QXmppElement::appendChild(const QXmppElement &child)
@@ -145,16 +430,15 @@ void QXmppElement::appendChild(const QXmppElement &child)
         return;
 
     if (child.d->parent)
-        child.d->parent->children.removeAll(child.d);
+        child.d->parent->removeChild(child.d);
     else
-        child.d->counter.ref();
-    child.d->parent = d;
-    d->children.append(child.d);
+        child.d->ref();
+    d->appendChild(child.d);
 }
 
 QXmppElement QXmppElement::firstChildElement(const QString &name) const
 {
-    foreach (QXmppElementPrivate *child_d, d->children)
+    for (QXmppElementPrivate *child_d = d->firstChild; child_d; child_d = child_d->nextSibling)
         if (name.isEmpty() || child_d->name == name)
             return QXmppElement(child_d);
     return QXmppElement();
@@ -162,12 +446,9 @@ QXmppElement QXmppElement::firstChildElement(const QString &name) const
 
 QXmppElement QXmppElement::nextSiblingElement(const QString &name) const
 {
-    if (!d->parent)
-        return QXmppElement();
-    const QList<QXmppElementPrivate*> &siblings_d = d->parent->children;
-    for (int i = siblings_d.indexOf(d) + 1; i < siblings_d.size(); i++)
-        if (name.isEmpty() || siblings_d[i]->name == name)
-            return QXmppElement(siblings_d[i]);
+    for (QXmppElementPrivate *sibling_d = d->nextSibling; sibling_d; sibling_d = sibling_d->nextSibling)
+        if (name.isEmpty() || sibling_d->name == name)
+            return QXmppElement(sibling_d);
     return QXmppElement();
 }
 
@@ -181,9 +462,8 @@ void QXmppElement::removeChild(const QXmppElement &child)
     if (child.d->parent != d)
         return;
 
-    d->children.removeAll(child.d);
-    child.d->counter.deref();
-    child.d->parent = NULL;
+    d->removeChild(child.d);
+    child.d->deref();
 }
 
 QString QXmppElement::tagName() const
@@ -212,14 +492,16 @@ void QXmppElement::toXml(QXmlStreamWriter *writer) const
         return;
 
     writer->writeStartElement(d->name);
-    if (d->attributes.contains("xmlns"))
-        writer->writeAttribute("xmlns", d->attributes.value("xmlns"));
-    foreach (const QString &attr, d->attributes.keys())
-        if (attr != "xmlns")
-            helperToXmlAddAttribute(writer, attr, d->attributes.value(attr));
+    bool found;
+    const int xmlnsIndex = d->attributeIndex("xmlns", &found);
+    if (found)
+        writer->writeAttribute("xmlns", d->attributes[xmlnsIndex].second);
+    for (int i = 0; i < d->attributes.size(); ++i)
+        if (!found || i != xmlnsIndex)
+            helperToXmlAddAttribute(writer, d->attributes[i].first, d->attributes[i].second);
     if (!d->value.isEmpty())
         writer->writeCharacters(d->value);
-    foreach (const QXmppElement &child, d->children)
-        child.toXml(writer);
+    for (QXmppElementPrivate *child_d = d->firstChild; child_d; child_d = child_d->nextSibling)
+        QXmppElement(child_d).toXml(writer);
     writer->writeEndElement();
 }
@@ -41,6 +41,7 @@ public:
     QXmppElement();
     QXmppElement(const QXmppElement &other);
     QXmppElement(const QDomElement &element);
+    QXmppElement(QXmlStreamReader *reader, const QString &parentNamespace = QString());
     ~QXmppElement();
 
     QStringList attributeNames() const;
@@ -22,6 +22,7 @@
  */
 
 
+#include "QXmppAtom.h"
 #include "QXmppEntityTimeIq.h"
 
 #include <QDomElement>
@@ -65,8 +66,7 @@ void QXmppEntityTimeIq::setUtc(const QDateTime &utc)
 
 bool QXmppEntityTimeIq::isEntityTimeIq(const QDomElement &element)
 {
-    QDomElement timeElement = element.firstChildElement("time");
-    return timeElement.namespaceURI() == ns_entity_time;
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Time, QXmppAtom::NsEntityTime);
 }
 
 void QXmppEntityTimeIq::parseElementFromChild(const QDomElement &element)
@@ -76,6 +76,26 @@ void QXmppEntityTimeIq::parseElementFromChild(const QDomElement &element)
     m_utc = QXmppUtils::datetimeFromString(timeElement.firstChildElement("utc").text());
 }
 
+void QXmppEntityTimeIq::parseElementFromChild(QXmlStreamReader *reader)
+{
+    while (reader->readNextStartElement()) {
+        if (parseError(reader))
+            continue;
+        if (reader->name() != "time") {
+            reader->skipCurrentElement();
+            continue;
+        }
+        while (reader->readNextStartElement()) {
+            if (reader->name() == "tzo")
+                m_tzo = QXmppUtils::timezoneOffsetFromString(reader->readElementText(QXmlStreamReader::IncludeChildElements));
+            else if (reader->name() == "utc")
+                m_utc = QXmppUtils::datetimeFromString(reader->readElementText(QXmlStreamReader::IncludeChildElements));
+            else
+                reader->skipCurrentElement();
+        }
+    }
+}
+
 void QXmppEntityTimeIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement("time");
@@ -25,6 +25,7 @@
 #include <QDomElement>
 #include <QXmlStreamWriter>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppIbbIq.h"
 
@@ -55,8 +56,7 @@ void QXmppIbbOpenIq::setSid( const QString &sid )
 
 bool QXmppIbbOpenIq::isIbbOpenIq(const QDomElement &element)
 {
-    QDomElement openElement = element.firstChildElement("open");
-    return openElement.namespaceURI() == ns_ibb;
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Open, QXmppAtom::NsIbb);
 }
 
 void QXmppIbbOpenIq::parseElementFromChild(const QDomElement &element)
@@ -92,8 +92,7 @@ void QXmppIbbCloseIq::setSid( const QString &sid )
 
 bool QXmppIbbCloseIq::isIbbCloseIq(const QDomElement &element)
 {
-    QDomElement openElement = element.firstChildElement("close");
-    return openElement.namespaceURI() == ns_ibb;
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Close, QXmppAtom::NsIbb);
 }
 
 void QXmppIbbCloseIq::parseElementFromChild(const QDomElement &element)
@@ -146,8 +145,7 @@ void QXmppIbbDataIq::setPayload( const QByteArray &data )
 
 bool QXmppIbbDataIq::isIbbDataIq(const QDomElement &element)
 {
-    QDomElement dataElement = element.firstChildElement("data");
-    return dataElement.namespaceURI() == ns_ibb;
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Data, QXmppAtom::NsIbb);
 }
 
 void QXmppIbbDataIq::parseElementFromChild(const QDomElement &element)
@@ -74,6 +74,33 @@ void QXmppIq::parseElementFromChild(const QDomElement &element)
     setExtensions(extensions);
 }
 
+void QXmppIq::parse(QXmlStreamReader *reader)
+{
+    parseAttributes(reader);
+    setTypeFromStr(reader->attributes().value("type").toString());
+    parseElementFromChild(reader);
+}
+
+/// Parses the IQ's children from a QXmlStreamReader.
+///
+/// The default implementation builds a QDomElement for the IQ and hands it
+/// to the DOM version of parseElementFromChild(), so that subclasses which
+/// do not read the stream directly keep working.
+
+void QXmppIq::parseElementFromChild(QXmlStreamReader *reader)
+{
+    QDomDocument document;
+    const QDomElement element = helperReadDomElement(reader, document);
+
+    QDomElement errorElement = element.firstChildElement("error");
+    if (!errorElement.isNull()) {
+        QXmppStanza::Error error;
+        error.parse(errorElement);
+        setError(error);
+    }
+    parseElementFromChild(element);
+}
+
 void QXmppIq::toXml( QXmlStreamWriter *xmlWriter ) const
 {
     xmlWriter->writeStartElement("iq");
@@ -56,10 +56,12 @@ public:
 
     /// \cond
     void parse(const QDomElement &element);
+    void parse(QXmlStreamReader *reader);
     void toXml(QXmlStreamWriter *writer) const;
 
 protected:
     virtual void parseElementFromChild(const QDomElement &element);
+    virtual void parseElementFromChild(QXmlStreamReader *reader);
     virtual void toXmlElementFromChild(QXmlStreamWriter *writer) const;
     /// \endcond
 
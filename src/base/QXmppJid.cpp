@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QHash>
+
+#include "QXmppJid.h"
+
+/// Constructs a null JID.
+
+QXmppJid::QXmppJid()
+    : m_nodeEnd(-1),
+    m_domainEnd(0),
+    m_hash(0)
+{
+}
+
+/// Constructs a JID by parsing the string \a jid.
+///
+/// \param jid
+
+QXmppJid::QXmppJid(const QString &jid)
+    : m_jid(jid)
+{
+    parse();
+}
+
+/// Constructs a JID from its parts.
+///
+/// \param node
+/// \param domain
+/// \param resource
+
+QXmppJid::QXmppJid(const QString &node, const QString &domain, const QString &resource)
+{
+    m_jid.reserve(node.size() + domain.size() + resource.size() + 2);
+    if (!node.isEmpty()) {
+        m_jid += node;
+        m_jid += QLatin1Char('@');
+    }
+    m_jid += domain;
+    if (!resource.isEmpty()) {
+        m_jid += QLatin1Char('/');
+        m_jid += resource;
+    }
+    parse();
+}
+
+void QXmppJid::parse()
+{
+    const int slash = m_jid.indexOf(QLatin1Char('/'));
+    m_domainEnd = slash < 0 ? m_jid.size() : slash;
+    const int at = m_jid.indexOf(QLatin1Char('@'));
+    m_nodeEnd = (at >= 0 && at < m_domainEnd) ? at : -1;
+    m_hash = qHash(m_jid);
+}
+
+/// Returns true if the JID is empty.
+
+bool QXmppJid::isNull() const
+{
+    return m_jid.isEmpty();
+}
+
+/// Returns true if the JID has no resource.
+
+bool QXmppJid::isBare() const
+{
+    return m_domainEnd == m_jid.size();
+}
+
+/// Returns the node part of the JID, for instance "user" for
+/// "user@example.com/resource".
+
+QString QXmppJid::node() const
+{
+    return m_nodeEnd < 0 ? QString() : m_jid.left(m_nodeEnd);
+}
+
+/// Returns the node part of the JID, without copying it.
+///
+/// The reference is only valid for the lifetime of this object.
+
+QStringRef QXmppJid::nodeRef() const
+{
+    return QStringRef(&m_jid, 0, qMax(m_nodeEnd, 0));
+}
+
+/// Returns the domain part of the JID, for instance "example.com" for
+/// "user@example.com/resource".
+
+QString QXmppJid::domain() const
+{
+    return domainRef().toString();
+}
+
+/// Returns the domain part of the JID, without copying it.
+///
+/// The reference is only valid for the lifetime of this object.
+
+QStringRef QXmppJid::domainRef() const
+{
+    return QStringRef(&m_jid, m_nodeEnd + 1, m_domainEnd - m_nodeEnd - 1);
+}
+
+/// Returns the resource part of the JID, for instance "resource" for
+/// "user@example.com/resource".
+
+QString QXmppJid::resource() const
+{
+    return isBare() ? QString() : m_jid.mid(m_domainEnd + 1);
+}
+
+/// Returns the resource part of the JID, without copying it.
+///
+/// The reference is only valid for the lifetime of this object.
+
+QStringRef QXmppJid::resourceRef() const
+{
+    if (isBare())
+        return QStringRef(&m_jid, m_domainEnd, 0);
+    return QStringRef(&m_jid, m_domainEnd + 1, m_jid.size() - m_domainEnd - 1);
+}
+
+/// Returns the JID without its resource.
+
+QXmppJid QXmppJid::bareJid() const
+{
+    if (isBare())
+        return *this;
+
+    QXmppJid jid;
+    jid.m_jid = m_jid.left(m_domainEnd);
+    jid.m_nodeEnd = m_nodeEnd;
+    jid.m_domainEnd = m_domainEnd;
+    jid.m_hash = qHash(jid.m_jid);
+    return jid;
+}
+
+/// Returns the JID without its resource, without copying it.
+///
+/// The reference is only valid for the lifetime of this object.
+
+QStringRef QXmppJid::bareJidRef() const
+{
+    return QStringRef(&m_jid, 0, m_domainEnd);
+}
+
+/// Returns the JID as a string.
+
+QString QXmppJid::toString() const
+{
+    return m_jid;
+}
+
+/// Returns true if the two JIDs are identical.
+
+bool QXmppJid::operator==(const QXmppJid &other) const
+{
+    return m_hash == other.m_hash && m_jid == other.m_jid;
+}
+
+/// Returns true if the two JIDs differ.
+
+bool QXmppJid::operator!=(const QXmppJid &other) const
+{
+    return !(*this == other);
+}
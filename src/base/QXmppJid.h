@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPJID_H
+#define QXMPPJID_H
+
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+/// \brief The QXmppJid class represents a Jabber ID.
+///
+/// The JID is split into its node, domain and resource parts once, when it
+/// is constructed. The parts are views into a single shared string, and the
+/// hash value is computed up front, which makes QXmppJid a cheap key for
+/// routing tables.
+///
+/// QXmppJid converts implicitly from QString, so it can be passed wherever
+/// a JID string is accepted.
+///
+
+class QXMPP_EXPORT QXmppJid
+{
+public:
+    QXmppJid();
+    QXmppJid(const QString &jid);
+    QXmppJid(const QString &node, const QString &domain, const QString &resource = QString());
+
+    bool isNull() const;
+    bool isBare() const;
+
+    QString node() const;
+    QStringRef nodeRef() const;
+
+    QString domain() const;
+    QStringRef domainRef() const;
+
+    QString resource() const;
+    QStringRef resourceRef() const;
+
+    QXmppJid bareJid() const;
+    QStringRef bareJidRef() const;
+
+    QString toString() const;
+
+    bool operator==(const QXmppJid &other) const;
+    bool operator!=(const QXmppJid &other) const;
+
+    /// Returns the hash value for \a jid.
+    friend inline uint qHash(const QXmppJid &jid) { return jid.m_hash; }
+
+private:
+    void parse();
+
+    QString m_jid;
+    int m_nodeEnd;
+    int m_domainEnd;
+    uint m_hash;
+};
+
+#endif
@@ -23,6 +23,7 @@
 
 #include <QDomElement>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppJingleIq.h"
 #include "QXmppUtils.h"
@@ -354,8 +355,7 @@ void QXmppJingleIq::setSid(const QString &sid)
 
 bool QXmppJingleIq::isJingleIq(const QDomElement &element)
 {
-    QDomElement jingleElement = element.firstChildElement("jingle");
-    return (jingleElement.namespaceURI() == ns_jingle);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Jingle, QXmppAtom::NsJingle);
 }
 
 /// Returns true if the call is ringing.
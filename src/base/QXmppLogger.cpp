@@ -22,18 +22,32 @@
  *
  */
 
-#include <iostream>
+#include <cstdio>
 
+#include <QAtomicInt>
 #include <QChildEvent>
+#include <QCoreApplication>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QMetaMethod>
 #include <QMetaType>
-#include <QTextStream>
+#include <QMutex>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+#include <QWaitCondition>
 
 #include "QXmppLogger.h"
 
 QXmppLogger* QXmppLogger::m_logger = 0;
 
+// capacity of the asynchronous ring buffer, must be a power of two
+static const int logBufferSize = 8192;
+
+// maximum time in milliseconds for which written messages stay buffered
+static const int logFlushInterval = 1000;
+
 static const char *typeName(QXmppLogger::MessageType type)
 {
     switch (type)
@@ -53,25 +67,136 @@ static const char *typeName(QXmppLogger::MessageType type)
     }
 }
 
-static QString formatted(QXmppLogger::MessageType type, const QString& text)
+static QByteArray formatted(const QDateTime &stamp, QXmppLogger::MessageType type, const QString& text)
+{
+    QByteArray line = stamp.toString().toLocal8Bit();
+    line += ' ';
+    line += typeName(type);
+    line += ' ';
+    line += text.toLocal8Bit();
+    line += '\n';
+    return line;
+}
+
+/// A log record waiting in the ring buffer.
+
+struct QXmppLogRecord
+{
+    QAtomicInt sequence;
+    QXmppLogger::MessageType type;
+    QDateTime stamp;
+    QString text;
+};
+
+/// A bounded multiple-producer, single-consumer ring buffer of log records.
+///
+/// Each slot carries a sequence number which tells producers and the
+/// consumer whether it is free or filled, so no lock is needed.
+
+class QXmppLogBuffer
+{
+public:
+    QXmppLogBuffer();
+    bool enqueue(QXmppLogger::MessageType type, const QString &text);
+    bool dequeue(QXmppLogRecord &record);
+    int size() const;
+
+private:
+    QVector<QXmppLogRecord> m_records;
+    QAtomicInt m_enqueuePos;
+    int m_dequeuePos;
+};
+
+QXmppLogBuffer::QXmppLogBuffer()
+    : m_records(logBufferSize),
+    m_dequeuePos(0)
+{
+    for (int i = 0; i < logBufferSize; ++i)
+        m_records[i].sequence = i;
+}
+
+/// Adds a record, returns false if the buffer is full.
+
+bool QXmppLogBuffer::enqueue(QXmppLogger::MessageType type, const QString &text)
 {
-    return QDateTime::currentDateTime().toString() + " " +
-        QString::fromLatin1(typeName(type)) + " " +
-        text;
+    QXmppLogRecord *record;
+    int pos = m_enqueuePos;
+    forever {
+        record = &m_records[pos & (logBufferSize - 1)];
+        const int diff = int(record->sequence) - pos;
+        if (diff == 0) {
+            if (m_enqueuePos.testAndSetRelaxed(pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            return false;
+        }
+        pos = m_enqueuePos;
+    }
+
+    record->type = type;
+    record->stamp = QDateTime::currentDateTime();
+    record->text = text;
+    record->sequence.fetchAndStoreRelease(pos + 1);
+    return true;
 }
 
+/// Takes the oldest record, returns false if the buffer is empty.
+///
+/// This must only be called from the writer thread.
+
+bool QXmppLogBuffer::dequeue(QXmppLogRecord &output)
+{
+    QXmppLogRecord &record = m_records[m_dequeuePos & (logBufferSize - 1)];
+    if (record.sequence.fetchAndAddAcquire(0) != m_dequeuePos + 1)
+        return false;
+
+    output.type = record.type;
+    output.stamp = record.stamp;
+    output.text = record.text;
+    record.text = QString();
+    record.sequence.fetchAndStoreRelease(m_dequeuePos + logBufferSize);
+    m_dequeuePos++;
+    return true;
+}
+
+/// Returns an estimate of the number of records in the buffer.
+
+int QXmppLogBuffer::size() const
+{
+    return int(m_enqueuePos) - m_dequeuePos;
+}
+
+/// The thread which formats and writes buffered records in batches.
+
+class QXmppLogWriter : public QThread
+{
+public:
+    QXmppLogWriter(QXmppLoggerPrivate *logger);
+    void stop();
+    void wake();
+
+protected:
+    void run();
+
+private:
+    QXmppLoggerPrivate *m_logger;
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    bool m_stopping;
+};
+
 /// Constructs a new QXmppLoggable.
 ///
+/// If \a parent is a QXmppLoggable, its log sink is inherited.
+///
 /// \param parent
 
 QXmppLoggable::QXmppLoggable(QObject *parent)
     : QObject(parent)
 {
     QXmppLoggable *logParent = qobject_cast<QXmppLoggable*>(parent);
-    if (logParent) {
-        connect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
-                logParent, SIGNAL(logMessage(QXmppLogger::MessageType,QString)));
-    }
+    if (logParent)
+        m_logSink = logParent->m_logSink;
 }
 
 void QXmppLoggable::childEvent(QChildEvent *event)
@@ -80,13 +205,64 @@ void QXmppLoggable::childEvent(QChildEvent *event)
     if (!child)
         return;
 
-    if (event->added()) {
-        connect(child, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
-                this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)));
-    } else if (event->removed()) {
-        disconnect(child, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
-                this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)));
+    if (event->added())
+        child->setLogSink(m_logSink);
+    else if (event->removed())
+        child->setLogSink(0);
+}
+
+/// Returns true if a message of the given type would be used by anybody.
+///
+/// You can use this to avoid building expensive log messages which would
+/// be discarded anyway.
+///
+/// \param type
+
+bool QXmppLoggable::isLoggingEnabled(QXmppLogger::MessageType type) const
+{
+    QXmppLogger *logger = m_logSink;
+    if (logger && logger->enabledTypes().testFlag(type))
+        return true;
+#if QT_VERSION >= 0x050000
+    static const QMetaMethod logMessageSignal = QMetaMethod::fromSignal(&QXmppLoggable::logMessage);
+    return isSignalConnected(logMessageSignal);
+#else
+    return receivers(SIGNAL(logMessage(QXmppLogger::MessageType,QString))) > 0;
+#endif
+}
+
+/// Returns the QXmppLogger to which messages are sent.
+///
+
+QXmppLogger *QXmppLoggable::logSink() const
+{
+    return m_logSink;
+}
+
+/// Sets the QXmppLogger to which messages are sent by this object
+/// and its loggable children.
+///
+/// \param logger
+
+void QXmppLoggable::setLogSink(QXmppLogger *logger)
+{
+    m_logSink = logger;
+    foreach (QXmppLoggable *child, findChildren<QXmppLoggable*>())
+        child->m_logSink = logger;
+}
+
+void QXmppLoggable::_q_log(QXmppLogger::MessageType type, const QString &message)
+{
+    QXmppLogger *logger = m_logSink;
+    if (logger && logger->enabledTypes().testFlag(type)) {
+        if (logger->thread() == QThread::currentThread())
+            logger->log(type, message);
+        else
+            QMetaObject::invokeMethod(logger, "log", Qt::QueuedConnection,
+                                      Q_ARG(QXmppLogger::MessageType, type),
+                                      Q_ARG(QString, message));
     }
+    emit logMessage(type, message);
 }
 
 class QXmppLoggerPrivate
@@ -94,12 +270,29 @@ class QXmppLoggerPrivate
 public:
     QXmppLoggerPrivate(QXmppLogger *qq);
 
+    void close();
+    void flush();
+    void write(const QByteArray &data);
+    void startWriter();
+    void stopWriter();
+
     QXmppLogger::LoggingType loggingType;
     QFile *logFile;
     QString logFilePath;
     QXmppLogger::MessageTypes messageTypes;
+    QAtomicInt enabledTypes;
+
+    bool asynchronous;
+    qint64 maxLogFileSize;
+    int maxLogFiles;
+    QXmppLogBuffer *buffer;
+    QXmppLogWriter *writer;
+    QAtomicInt dropped;
+    QTimer *flushTimer;
 
 private:
+    void rotate();
+
     QXmppLogger *q;
 };
 
@@ -108,10 +301,191 @@ QXmppLoggerPrivate::QXmppLoggerPrivate(QXmppLogger *qq)
     logFile(0),
     logFilePath("QXmppClientLog.log"),
     messageTypes(QXmppLogger::AnyMessage),
+    enabledTypes(QXmppLogger::NoMessage),
+    asynchronous(false),
+    maxLogFileSize(0),
+    maxLogFiles(5),
+    buffer(0),
+    writer(0),
+    flushTimer(0),
     q(qq)
 {
 }
 
+/// Closes the log file, it will be re-opened on the next write.
+
+void QXmppLoggerPrivate::close()
+{
+    flush();
+    if (logFile) {
+        delete logFile;
+        logFile = 0;
+    }
+}
+
+/// Flushes the data which was written to the output.
+
+void QXmppLoggerPrivate::flush()
+{
+    switch (loggingType)
+    {
+    case QXmppLogger::FileLogging:
+        if (logFile)
+            logFile->flush();
+        break;
+    case QXmppLogger::StdoutLogging:
+        fflush(stdout);
+        break;
+    default:
+        break;
+    }
+}
+
+/// Moves the current log file out of the way, shifting older files.
+
+void QXmppLoggerPrivate::rotate()
+{
+    close();
+    if (maxLogFiles > 0) {
+        QFile::remove(QString("%1.%2").arg(logFilePath, QString::number(maxLogFiles)));
+        for (int i = maxLogFiles - 1; i > 0; --i)
+            QFile::rename(QString("%1.%2").arg(logFilePath, QString::number(i)),
+                          QString("%1.%2").arg(logFilePath, QString::number(i + 1)));
+        QFile::rename(logFilePath, logFilePath + ".1");
+    } else {
+        QFile::remove(logFilePath);
+    }
+}
+
+/// Writes already formatted data to the output.
+///
+/// This is called either from the logger's thread or from the writer
+/// thread, never from both at the same time. The output is not flushed,
+/// see flush().
+
+void QXmppLoggerPrivate::write(const QByteArray &data)
+{
+    switch (loggingType)
+    {
+    case QXmppLogger::FileLogging:
+        // pos() includes the data which was not flushed yet
+        if (logFile && maxLogFileSize > 0 && logFile->pos() > 0 &&
+            logFile->pos() + data.size() > maxLogFileSize)
+            rotate();
+        if (!logFile) {
+            logFile = new QFile(logFilePath);
+            logFile->open(QIODevice::WriteOnly | QIODevice::Append);
+            if (maxLogFileSize > 0 && logFile->size() > 0 &&
+                logFile->size() + data.size() > maxLogFileSize) {
+                rotate();
+                logFile = new QFile(logFilePath);
+                logFile->open(QIODevice::WriteOnly | QIODevice::Append);
+            }
+        }
+        logFile->write(data);
+        break;
+    case QXmppLogger::StdoutLogging:
+        fwrite(data.constData(), 1, data.size(), stdout);
+        break;
+    default:
+        break;
+    }
+}
+
+/// Starts the writer thread if asynchronous logging to an output is requested.
+
+void QXmppLoggerPrivate::startWriter()
+{
+    if (writer || !asynchronous ||
+        (loggingType != QXmppLogger::FileLogging && loggingType != QXmppLogger::StdoutLogging))
+        return;
+
+    if (!buffer)
+        buffer = new QXmppLogBuffer;
+    writer = new QXmppLogWriter(this);
+    writer->start(QThread::LowPriority);
+}
+
+/// Stops the writer thread once all buffered records have been written.
+
+void QXmppLoggerPrivate::stopWriter()
+{
+    if (writer) {
+        writer->stop();
+        delete writer;
+        writer = 0;
+    }
+}
+
+QXmppLogWriter::QXmppLogWriter(QXmppLoggerPrivate *logger)
+    : m_logger(logger),
+    m_stopping(false)
+{
+}
+
+void QXmppLogWriter::run()
+{
+    QXmppLogRecord record;
+    QByteArray batch;
+    bool unflushed = false;
+    QElapsedTimer flushTimer;
+    flushTimer.start();
+    forever {
+        // drain the buffer, writing in batches of up to 64kB
+        while (m_logger->buffer->dequeue(record)) {
+            batch += formatted(record.stamp, record.type, record.text);
+            if (batch.size() >= 65536) {
+                m_logger->write(batch);
+                batch.clear();
+            }
+        }
+        const int dropped = m_logger->dropped.fetchAndStoreRelaxed(0);
+        if (dropped)
+            batch += formatted(QDateTime::currentDateTime(), QXmppLogger::WarningMessage,
+                QString("Log buffer full, %1 messages dropped").arg(dropped));
+        if (!batch.isEmpty()) {
+            m_logger->write(batch);
+            batch.clear();
+            unflushed = true;
+        }
+
+        // flush at most once per interval
+        if (unflushed && flushTimer.hasExpired(logFlushInterval)) {
+            m_logger->flush();
+            flushTimer.restart();
+            unflushed = false;
+        }
+
+        // wait for more records
+        QMutexLocker locker(&m_mutex);
+        if (m_stopping && !m_logger->buffer->size()) {
+            m_logger->flush();
+            break;
+        }
+        if (!m_stopping)
+            m_condition.wait(&m_mutex, 50);
+    }
+}
+
+/// Asks the writer to exit once the buffer is empty and waits for it.
+
+void QXmppLogWriter::stop()
+{
+    m_mutex.lock();
+    m_stopping = true;
+    m_condition.wakeOne();
+    m_mutex.unlock();
+    wait();
+}
+
+/// Wakes the writer before its next scheduled flush.
+
+void QXmppLogWriter::wake()
+{
+    QMutexLocker locker(&m_mutex);
+    m_condition.wakeOne();
+}
+
 /// Constructs a new QXmppLogger.
 ///
 /// \param parent
@@ -121,12 +495,32 @@ QXmppLogger::QXmppLogger(QObject *parent)
 {
     d = new QXmppLoggerPrivate(this);
 
+    // flush synchronously written messages in batches
+    d->flushTimer = new QTimer(this);
+    d->flushTimer->setInterval(logFlushInterval);
+    d->flushTimer->setSingleShot(true);
+    bool check;
+    Q_UNUSED(check);
+    check = connect(d->flushTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_flush()));
+    Q_ASSERT(check);
+
+    // the default logger is never destroyed, write everything on exit
+    if (QCoreApplication::instance()) {
+        check = connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()),
+                        this, SLOT(reopen()));
+        Q_ASSERT(check);
+    }
+
     // make it possible to pass QXmppLogger::MessageType between threads
     qRegisterMetaType< QXmppLogger::MessageType >("QXmppLogger::MessageType");
 }
 
 QXmppLogger::~QXmppLogger()
 {
+    d->stopWriter();
+    d->close();
+    delete d->buffer;
     delete d;
 }
 
@@ -156,7 +550,10 @@ QXmppLogger::LoggingType QXmppLogger::loggingType()
 void QXmppLogger::setLoggingType(QXmppLogger::LoggingType type)
 {
     if (d->loggingType != type) {
+        d->stopWriter();
+        d->flush();
         d->loggingType = type;
+        d->enabledTypes = (type == QXmppLogger::NoLogging) ? 0 : int(d->messageTypes);
         reopen();
     }
 }
@@ -176,6 +573,96 @@ QXmppLogger::MessageTypes QXmppLogger::messageTypes()
 void QXmppLogger::setMessageTypes(QXmppLogger::MessageTypes types)
 {
     d->messageTypes = types;
+    d->enabledTypes = (d->loggingType == QXmppLogger::NoLogging) ? 0 : int(types);
+}
+
+/// Returns the types of messages which are currently written or emitted.
+///
+/// This is empty if the logger discards all messages, and is safe to call
+/// from any thread.
+
+QXmppLogger::MessageTypes QXmppLogger::enabledTypes() const
+{
+    return QXmppLogger::MessageTypes(QFlag(int(d->enabledTypes)));
+}
+
+/// Returns true if messages are written by a background thread.
+///
+
+bool QXmppLogger::isAsynchronous()
+{
+    return d->asynchronous;
+}
+
+/// Sets whether messages should be written by a background thread.
+///
+/// In asynchronous mode, log() only stores the message in a bounded
+/// buffer; formatting and output are done in batches by a writer thread.
+/// If the buffer is full, messages are dropped and a warning reporting
+/// the number of lost messages is written.
+///
+/// This has no effect on SignalLogging, which always emits message()
+/// synchronously.
+///
+/// \param asynchronous
+
+void QXmppLogger::setAsynchronous(bool asynchronous)
+{
+    if (d->asynchronous != asynchronous) {
+        d->stopWriter();
+        d->asynchronous = asynchronous;
+        d->startWriter();
+    }
+}
+
+/// Returns the size in bytes above which the log file is rotated.
+///
+/// A value of 0 means the log file grows without limit.
+
+qint64 QXmppLogger::maxLogFileSize()
+{
+    return d->maxLogFileSize;
+}
+
+/// Sets the size in bytes above which the log file is rotated.
+///
+/// When a write would make the log file exceed this size, the file is
+/// renamed with a ".1" suffix, older files are shifted and a new file
+/// is started.
+///
+/// \param size
+
+void QXmppLogger::setMaxLogFileSize(qint64 size)
+{
+    if (d->maxLogFileSize != size) {
+        d->stopWriter();
+        d->maxLogFileSize = size;
+        d->startWriter();
+    }
+}
+
+/// Returns the number of rotated log files which are kept.
+///
+
+int QXmppLogger::maxLogFiles()
+{
+    return d->maxLogFiles;
+}
+
+/// Sets the number of rotated log files which are kept.
+///
+/// If set to 0, the log file is truncated when it reaches
+/// maxLogFileSize().
+///
+/// \param count
+
+void QXmppLogger::setMaxLogFiles(int count)
+{
+    if (d->maxLogFiles != count) {
+        d->stopWriter();
+        d->maxLogFiles = count;
+        d->startWriter();
+    }
 }
 
 /// Add a logging message.
@@ -192,14 +679,17 @@ void QXmppLogger::log(QXmppLogger::MessageType type, const QString& text)
     switch(d->loggingType)
     {
     case QXmppLogger::FileLogging:
-        if (!d->logFile) {
-            d->logFile = new QFile(d->logFilePath);
-            d->logFile->open(QIODevice::WriteOnly | QIODevice::Append);
-        }
-        QTextStream(d->logFile) << formatted(type, text) << "\n";
-        break;
     case QXmppLogger::StdoutLogging:
-        std::cout << qPrintable(formatted(type, text)) << std::endl;
+        if (d->writer) {
+            if (!d->buffer->enqueue(type, text))
+                d->dropped.ref();
+            else if (d->buffer->size() >= logBufferSize / 2)
+                d->writer->wake();
+        } else {
+            d->write(formatted(QDateTime::currentDateTime(), type, text));
+            if (!d->flushTimer->isActive())
+                d->flushTimer->start();
+        }
         break;
     case QXmppLogger::SignalLogging:
         emit message(type, text);
@@ -209,6 +699,13 @@ void QXmppLogger::log(QXmppLogger::MessageType type, const QString& text)
     }
 }
 
+void QXmppLogger::_q_flush()
+{
+    // the writer thread flushes its own output
+    if (!d->writer)
+        d->flush();
+}
+
 /// Returns the path to which logging messages should be written.
 ///
 /// \sa loggingType()
@@ -227,6 +724,7 @@ QString QXmppLogger::logFilePath()
 void QXmppLogger::setLogFilePath(const QString &path)
 {
     if (d->logFilePath != path) {
+        d->stopWriter();
         d->logFilePath = path;
         reopen();
     }
@@ -234,12 +732,11 @@ void QXmppLogger::setLogFilePath(const QString &path)
 
 /// If logging to a file, causes the file to be re-opened.
 ///
+/// In asynchronous mode, pending messages are written first.
 
 void QXmppLogger::reopen()
 {
-    if (d->logFile) {
-        delete d->logFile;
-        d->logFile = 0;
-    }
+    d->stopWriter();
+    d->close();
+    d->startWriter();
 }
-
@@ -27,6 +27,7 @@
 #define QXMPPLOGGER_H
 
 #include <QObject>
+#include <QPointer>
 
 #include "QXmppGlobal.h"
 
@@ -50,6 +51,9 @@ class QXMPP_EXPORT QXmppLogger : public QObject
     Q_PROPERTY(QString logFilePath READ logFilePath WRITE setLogFilePath)
     Q_PROPERTY(LoggingType loggingType READ loggingType WRITE setLoggingType)
     Q_PROPERTY(MessageTypes messageTypes READ messageTypes WRITE setMessageTypes)
+    Q_PROPERTY(bool asynchronous READ isAsynchronous WRITE setAsynchronous)
+    Q_PROPERTY(qint64 maxLogFileSize READ maxLogFileSize WRITE setMaxLogFileSize)
+    Q_PROPERTY(int maxLogFiles READ maxLogFiles WRITE setMaxLogFiles)
 
 public:
     /// This enum describes how log message are handled.
@@ -88,6 +92,17 @@ public:
     QXmppLogger::MessageTypes messageTypes();
     void setMessageTypes(QXmppLogger::MessageTypes types);
 
+    QXmppLogger::MessageTypes enabledTypes() const;
+
+    bool isAsynchronous();
+    void setAsynchronous(bool asynchronous);
+
+    qint64 maxLogFileSize();
+    void setMaxLogFileSize(qint64 size);
+
+    int maxLogFiles();
+    void setMaxLogFiles(int count);
+
 public slots:
     void log(QXmppLogger::MessageType type, const QString& text);
     void reopen();
@@ -96,6 +111,9 @@ signals:
     /// This signal is emitted whenever a log message is received.
     void message(QXmppLogger::MessageType type, const QString &text);
 
+private slots:
+    void _q_flush();
+
 private:
     static QXmppLogger* m_logger;
     QXmppLoggerPrivate *d;
@@ -103,6 +121,9 @@ private:
 
 /// \brief The QXmppLoggable class represents a source of logging messages.
 ///
+/// Messages are handed directly to the loggable's sink, a QXmppLogger which
+/// is inherited from its parent loggable, and emitted as logMessage().
+///
 /// \ingroup Core
 
 class QXMPP_EXPORT QXmppLoggable : public QObject
@@ -112,18 +133,23 @@ class QXMPP_EXPORT QXmppLoggable : public QObject
 public:
     QXmppLoggable(QObject *parent = 0);
 
+    QXmppLogger *logSink() const;
+
 protected:
     /// \cond
     virtual void childEvent(QChildEvent *event);
     /// \endcond
 
+    bool isLoggingEnabled(QXmppLogger::MessageType type) const;
+    void setLogSink(QXmppLogger *logger);
+
     /// Logs a debugging message.
     ///
     /// \param message
 
     void debug(const QString &message)
     {
-        emit logMessage(QXmppLogger::DebugMessage, qxmpp_loggable_trace(message));
+        _q_log(QXmppLogger::DebugMessage, qxmpp_loggable_trace(message));
     }
 
     /// Logs an informational message.
@@ -132,7 +158,7 @@ protected:
 
     void info(const QString &message)
     {
-        emit logMessage(QXmppLogger::InformationMessage, qxmpp_loggable_trace(message));
+        _q_log(QXmppLogger::InformationMessage, qxmpp_loggable_trace(message));
     }
 
     /// Logs a warning message.
@@ -141,7 +167,7 @@ protected:
 
     void warning(const QString &message)
     {
-        emit logMessage(QXmppLogger::WarningMessage, qxmpp_loggable_trace(message));
+        _q_log(QXmppLogger::WarningMessage, qxmpp_loggable_trace(message));
     }
 
     /// Logs a received packet.
@@ -150,7 +176,7 @@ protected:
 
     void logReceived(const QString &message)
     {
-        emit logMessage(QXmppLogger::ReceivedMessage, qxmpp_loggable_trace(message));
+        _q_log(QXmppLogger::ReceivedMessage, qxmpp_loggable_trace(message));
     }
 
     /// Logs a sent packet.
@@ -159,12 +185,18 @@ protected:
 
     void logSent(const QString &message)
     {
-        emit logMessage(QXmppLogger::SentMessage, qxmpp_loggable_trace(message));
+        _q_log(QXmppLogger::SentMessage, qxmpp_loggable_trace(message));
     }
 
 signals:
     /// This signal is emitted to send logging messages.
     void logMessage(QXmppLogger::MessageType type, const QString &msg);
+
+private slots:
+    void _q_log(QXmppLogger::MessageType type, const QString &message);
+
+private:
+    QPointer<QXmppLogger> m_logSink;
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(QXmppLogger::MessageTypes)
@@ -25,10 +25,29 @@
 #include <QDomElement>
 #include <QXmlStreamWriter>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppMessage.h"
 #include "QXmppUtils.h"
 
+class QXmppMessagePrivate : public QSharedData
+{
+public:
+    QXmppMessage::Type type;
+    QDateTime stamp;
+    QXmppMessage::StampType stampType;
+    QXmppMessage::State state;
+
+    bool attentionRequested;
+    QString body;
+    QString subject;
+    QString thread;
+
+    // Request message receipt as per XEP-0184.
+    QString receiptId;
+    bool receiptRequested;
+};
+
 static const char* chat_states[] = {
     "",
     "active",
@@ -48,13 +67,24 @@ static const char* chat_states[] = {
 QXmppMessage::QXmppMessage(const QString& from, const QString& to, const
                          QString& body, const QString& thread)
     : QXmppStanza(from, to),
-      m_type(Chat),
-      m_stampType(QXmppMessage::DelayedDelivery),
-      m_state(None),
-      m_attentionRequested(false),
-      m_body(body),
-      m_thread(thread),
-      m_receiptRequested(false)
+      d(new QXmppMessagePrivate)
+{
+    d->type = Chat;
+    d->stampType = QXmppMessage::DelayedDelivery;
+    d->state = None;
+    d->attentionRequested = false;
+    d->body = body;
+    d->thread = thread;
+    d->receiptRequested = false;
+}
+
+/// Constructs a copy of \a other.
+///
+/// \param other
+
+QXmppMessage::QXmppMessage(const QXmppMessage &other)
+    : QXmppStanza(other),
+      d(other.d)
 {
 }
 
@@ -63,12 +93,23 @@ QXmppMessage::~QXmppMessage()
 
 }
 
+/// Assigns \a other to this message.
+///
+/// \param other
+
+QXmppMessage& QXmppMessage::operator=(const QXmppMessage &other)
+{
+    QXmppStanza::operator=(other);
+    d = other.d;
+    return *this;
+}
+
 /// Returns the message's body.
 ///
 
 QString QXmppMessage::body() const
 {
-    return m_body;
+    return d->body;
 }
 
 /// Sets the message's body.
@@ -77,7 +118,7 @@ QString QXmppMessage::body() const
 
 void QXmppMessage::setBody(const QString& body)
 {
-    m_body = body;
+    d->body = body;
 }
 
 /// Returns true if the user's attention is requested, as defined
@@ -85,7 +126,7 @@ void QXmppMessage::setBody(const QString& body)
 
 bool QXmppMessage::isAttentionRequested() const
 {
-    return m_attentionRequested;
+    return d->attentionRequested;
 }
 
 /// Sets whether the user's attention is requested, as defined
@@ -95,7 +136,7 @@ bool QXmppMessage::isAttentionRequested() const
 
 void QXmppMessage::setAttentionRequested(bool requested)
 {
-    m_attentionRequested = requested;
+    d->attentionRequested = requested;
 }
 
 /// Returns true if a delivery receipt is requested, as defined
@@ -103,7 +144,7 @@ void QXmppMessage::setAttentionRequested(bool requested)
 
 bool QXmppMessage::isReceiptRequested() const
 {
-    return m_receiptRequested;
+    return d->receiptRequested;
 }
 
 /// Sets whether a delivery receipt is requested, as defined
@@ -113,7 +154,7 @@ bool QXmppMessage::isReceiptRequested() const
 
 void QXmppMessage::setReceiptRequested(bool requested)
 {
-    m_receiptRequested = requested;
+    d->receiptRequested = requested;
     if (requested && id().isEmpty())
         generateAndSetNextId();
 }
@@ -123,7 +164,7 @@ void QXmppMessage::setReceiptRequested(bool requested)
 
 QString QXmppMessage::receiptId() const
 {
-    return m_receiptId;
+    return d->receiptId;
 }
 
 /// Make this message a delivery receipt for the message with
@@ -131,7 +172,7 @@ QString QXmppMessage::receiptId() const
 
 void QXmppMessage::setReceiptId(const QString &id)
 {
-    m_receiptId = id;
+    d->receiptId = id;
 }
 
 /// Returns the message's type.
@@ -139,12 +180,12 @@ void QXmppMessage::setReceiptId(const QString &id)
 
 QXmppMessage::Type QXmppMessage::type() const
 {
-    return m_type;
+    return d->type;
 }
 
 QString QXmppMessage::getTypeStr() const
 {
-    switch(m_type)
+    switch(d->type)
     {
     case QXmppMessage::Error:
         return "error";
@@ -157,7 +198,7 @@ QString QXmppMessage::getTypeStr() const
     case QXmppMessage::Headline:
         return "headline";
     default:
-        qWarning("QXmppMessage::getTypeStr() invalid type %d", (int)m_type);
+        qWarning("QXmppMessage::getTypeStr() invalid type %d", (int)d->type);
         return "";
     }
 }
@@ -168,7 +209,7 @@ QString QXmppMessage::getTypeStr() const
 
 void QXmppMessage::setType(QXmppMessage::Type type)
 {
-    m_type = type;
+    d->type = type;
 }
 
 void QXmppMessage::setTypeFromStr(const QString& str)
@@ -216,7 +257,7 @@ void QXmppMessage::setTypeFromStr(const QString& str)
 
 QDateTime QXmppMessage::stamp() const
 {
-    return m_stamp;
+    return d->stamp;
 }
 
 /// Sets the message's timestamp.
@@ -225,7 +266,7 @@ QDateTime QXmppMessage::stamp() const
 
 void QXmppMessage::setStamp(const QDateTime &stamp)
 {
-    m_stamp = stamp;
+    d->stamp = stamp;
 }
 
 /// Returns the message's chat state.
@@ -233,7 +274,7 @@ void QXmppMessage::setStamp(const QDateTime &stamp)
 
 QXmppMessage::State QXmppMessage::state() const
 {
-    return m_state;
+    return d->state;
 }
 
 /// Sets the message's chat state.
@@ -242,7 +283,7 @@ QXmppMessage::State QXmppMessage::state() const
 
 void QXmppMessage::setState(QXmppMessage::State state)
 {
-    m_state = state;
+    d->state = state;
 }
 
 void QXmppMessage::parse(const QDomElement &element)
@@ -250,9 +291,9 @@ void QXmppMessage::parse(const QDomElement &element)
     QXmppStanza::parse(element);
 
     setTypeFromStr(element.attribute("type"));
-    m_body = element.firstChildElement("body").text();
-    m_subject = element.firstChildElement("subject").text();
-    m_thread = element.firstChildElement("thread").text();
+    d->body = element.firstChildElement("body").text();
+    d->subject = element.firstChildElement("subject").text();
+    d->thread = element.firstChildElement("thread").text();
 
     // chat states
     for (int i = Active; i <= Paused; i++)
@@ -261,7 +302,7 @@ void QXmppMessage::parse(const QDomElement &element)
         if (!stateElement.isNull() &&
             stateElement.namespaceURI() == ns_chat_states)
         {
-            m_state = static_cast<QXmppMessage::State>(i);
+            d->state = static_cast<QXmppMessage::State>(i);
             break;
         }
     }
@@ -269,27 +310,27 @@ void QXmppMessage::parse(const QDomElement &element)
     // XEP-0184: Message Delivery Receipts
     QDomElement receivedElement = element.firstChildElement("received");
     if (!receivedElement.isNull() && receivedElement.namespaceURI() == ns_message_receipts) {
-        m_receiptId = receivedElement.attribute("id");
+        d->receiptId = receivedElement.attribute("id");
 
         // compatibility with old-style XEP
-        if (m_receiptId.isEmpty())
-            m_receiptId = id();
+        if (d->receiptId.isEmpty())
+            d->receiptId = id();
     } else {
-        m_receiptId = QString();
+        d->receiptId = QString();
     }
-    m_receiptRequested = element.firstChildElement("request").namespaceURI() == ns_message_receipts;
+    d->receiptRequested = element.firstChildElement("request").namespaceURI() == ns_message_receipts;
 
     // XEP-0203: Delayed Delivery
     QDomElement delayElement = element.firstChildElement("delay");
     if (!delayElement.isNull() && delayElement.namespaceURI() == ns_delayed_delivery)
     {
         const QString str = delayElement.attribute("stamp");
-        m_stamp = QXmppUtils::datetimeFromString(str);
-        m_stampType = QXmppMessage::DelayedDelivery;
+        d->stamp = QXmppUtils::datetimeFromString(str);
+        d->stampType = QXmppMessage::DelayedDelivery;
     }
 
     // XEP-0224: Attention
-    m_attentionRequested = element.firstChildElement("attention").namespaceURI() == ns_attention;
+    d->attentionRequested = element.firstChildElement("attention").namespaceURI() == ns_attention;
 
     QXmppElementList extensions;
     QDomElement xElement = element.firstChildElement("x");
@@ -299,9 +340,9 @@ void QXmppMessage::parse(const QDomElement &element)
         {
             // XEP-0091: Legacy Delayed Delivery
             const QString str = xElement.attribute("stamp");
-            m_stamp = QDateTime::fromString(str, "yyyyMMddThh:mm:ss");
-            m_stamp.setTimeSpec(Qt::UTC);
-            m_stampType = QXmppMessage::LegacyDelayedDelivery;
+            d->stamp = QDateTime::fromString(str, "yyyyMMddThh:mm:ss");
+            d->stamp.setTimeSpec(Qt::UTC);
+            d->stampType = QXmppMessage::LegacyDelayedDelivery;
         } else {
             // other extensions
             extensions << QXmppElement(xElement);
@@ -311,6 +352,85 @@ void QXmppMessage::parse(const QDomElement &element)
     setExtensions(extensions);
 }
 
+void QXmppMessage::parse(QXmlStreamReader *reader)
+{
+    parseAttributes(reader);
+    setTypeFromStr(reader->attributes().value("type").toString());
+
+    const QString xmlns = reader->namespaceUri().toString();
+    bool hasBody = false;
+    bool hasSubject = false;
+    bool hasThread = false;
+    QXmppElementList extensions;
+    d->body = QString();
+    d->subject = QString();
+    d->thread = QString();
+    d->receiptId = QString();
+    d->receiptRequested = false;
+    d->attentionRequested = false;
+
+    while (reader->readNextStartElement())
+    {
+        const QXmppAtom name = QXmppAtom::find(reader->name());
+        const QXmppAtom ns = QXmppAtom::find(reader->namespaceUri());
+
+        if (parseError(reader)) {
+            continue;
+        } else if (name == QXmppAtom::Body && !hasBody) {
+            d->body = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+            hasBody = true;
+            continue;
+        } else if (name == QXmppAtom::Subject && !hasSubject) {
+            d->subject = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+            hasSubject = true;
+            continue;
+        } else if (name == QXmppAtom::Thread && !hasThread) {
+            d->thread = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+            hasThread = true;
+            continue;
+        } else if (ns == QXmppAtom::NsChatStates) {
+            // chat states
+            for (int i = Active; i <= Paused; i++) {
+                if (reader->name() == chat_states[i]) {
+                    d->state = static_cast<QXmppMessage::State>(i);
+                    break;
+                }
+            }
+        } else if (name == QXmppAtom::Received && ns == QXmppAtom::NsMessageReceipts) {
+            // XEP-0184: Message Delivery Receipts
+            d->receiptId = reader->attributes().value("id").toString();
+
+            // compatibility with old-style XEP
+            if (d->receiptId.isEmpty())
+                d->receiptId = id();
+        } else if (name == QXmppAtom::Request) {
+            d->receiptRequested = (ns == QXmppAtom::NsMessageReceipts);
+        } else if (name == QXmppAtom::Delay && ns == QXmppAtom::NsDelayedDelivery) {
+            // XEP-0203: Delayed Delivery
+            const QString str = reader->attributes().value("stamp").toString();
+            d->stamp = QXmppUtils::datetimeFromString(str);
+            d->stampType = QXmppMessage::DelayedDelivery;
+        } else if (name == QXmppAtom::Attention) {
+            // XEP-0224: Attention
+            d->attentionRequested = (ns == QXmppAtom::NsAttention);
+        } else if (name == QXmppAtom::X) {
+            if (ns == QXmppAtom::NsLegacyDelayedDelivery) {
+                // XEP-0091: Legacy Delayed Delivery
+                const QString str = reader->attributes().value("stamp").toString();
+                d->stamp = QDateTime::fromString(str, "yyyyMMddThh:mm:ss");
+                d->stamp.setTimeSpec(Qt::UTC);
+                d->stampType = QXmppMessage::LegacyDelayedDelivery;
+            } else {
+                // other extensions
+                extensions << QXmppElement(reader, xmlns);
+                continue;
+            }
+        }
+        reader->skipCurrentElement();
+    }
+    setExtensions(extensions);
+}
+
 void QXmppMessage::toXml(QXmlStreamWriter *xmlWriter) const
 {
 
@@ -320,27 +440,27 @@ void QXmppMessage::toXml(QXmlStreamWriter *xmlWriter) const
     helperToXmlAddAttribute(xmlWriter, "to", to());
     helperToXmlAddAttribute(xmlWriter, "from", from());
     helperToXmlAddAttribute(xmlWriter, "type", getTypeStr());
-    if (!m_subject.isEmpty())
-        helperToXmlAddTextElement(xmlWriter, "subject", m_subject);
-    if (!m_body.isEmpty())
-        helperToXmlAddTextElement(xmlWriter, "body", m_body);
-    if (!m_thread.isEmpty())
-        helperToXmlAddTextElement(xmlWriter, "thread", m_thread);
+    if (!d->subject.isEmpty())
+        helperToXmlAddTextElement(xmlWriter, "subject", d->subject);
+    if (!d->body.isEmpty())
+        helperToXmlAddTextElement(xmlWriter, "body", d->body);
+    if (!d->thread.isEmpty())
+        helperToXmlAddTextElement(xmlWriter, "thread", d->thread);
     error().toXml(xmlWriter);
 
     // chat states
-    if (m_state > None && m_state <= Paused)
+    if (d->state > None && d->state <= Paused)
     {
-        xmlWriter->writeStartElement(chat_states[m_state]);
+        xmlWriter->writeStartElement(chat_states[d->state]);
         xmlWriter->writeAttribute("xmlns", ns_chat_states);
         xmlWriter->writeEndElement();
     }
 
     // time stamp
-    if (m_stamp.isValid())
+    if (d->stamp.isValid())
     {
-        QDateTime utcStamp = m_stamp.toUTC();
-        if (m_stampType == QXmppMessage::DelayedDelivery)
+        QDateTime utcStamp = d->stamp.toUTC();
+        if (d->stampType == QXmppMessage::DelayedDelivery)
         {
             // XEP-0203: Delayed Delivery
             xmlWriter->writeStartElement("delay");
@@ -357,20 +477,20 @@ void QXmppMessage::toXml(QXmlStreamWriter *xmlWriter) const
     }
 
     // XEP-0184: Message Delivery Receipts
-    if (!m_receiptId.isEmpty()) {
+    if (!d->receiptId.isEmpty()) {
         xmlWriter->writeStartElement("received");
         xmlWriter->writeAttribute("xmlns", ns_message_receipts);
-        xmlWriter->writeAttribute("id", m_receiptId);
+        xmlWriter->writeAttribute("id", d->receiptId);
         xmlWriter->writeEndElement();
     }
-    if (m_receiptRequested) {
+    if (d->receiptRequested) {
         xmlWriter->writeStartElement("request");
         xmlWriter->writeAttribute("xmlns", ns_message_receipts);
         xmlWriter->writeEndElement();
     }
 
     // XEP-0224: Attention
-    if (m_attentionRequested) {
+    if (d->attentionRequested) {
         xmlWriter->writeStartElement("attention");
         xmlWriter->writeAttribute("xmlns", ns_attention);
         xmlWriter->writeEndElement();
@@ -387,7 +507,7 @@ void QXmppMessage::toXml(QXmlStreamWriter *xmlWriter) const
 
 QString QXmppMessage::subject() const
 {
-    return m_subject;
+    return d->subject;
 }
 
 /// Sets the message's subject.
@@ -396,14 +516,14 @@ QString QXmppMessage::subject() const
 
 void QXmppMessage::setSubject(const QString& subject)
 {
-    m_subject = subject;
+    d->subject = subject;
 }
 
 /// Returns the message's thread.
 
 QString QXmppMessage::thread() const
 {
-    return m_thread;
+    return d->thread;
 }
 
 /// Sets the message's thread.
@@ -412,6 +532,6 @@ QString QXmppMessage::thread() const
 
 void QXmppMessage::setThread(const QString& thread)
 {
-    m_thread = thread;
+    d->thread = thread;
 }
 
@@ -28,6 +28,8 @@
 #include <QDateTime>
 #include "QXmppStanza.h"
 
+class QXmppMessagePrivate;
+
 /// \brief The QXmppMessage class represents an XMPP message.
 ///
 /// \ingroup Stanzas
@@ -60,8 +62,11 @@ public:
 
     QXmppMessage(const QString& from = "", const QString& to = "",
                  const QString& body = "", const QString& thread = "");
+    QXmppMessage(const QXmppMessage &other);
     ~QXmppMessage();
 
+    QXmppMessage& operator=(const QXmppMessage &other);
+
     QString body() const;
     void setBody(const QString&);
 
@@ -91,6 +96,7 @@ public:
 
     /// \cond
     void parse(const QDomElement &element);
+    void parse(QXmlStreamReader *reader);
     void toXml(QXmlStreamWriter *writer) const;
     /// \endcond
 
@@ -105,19 +111,8 @@ private:
     QString getTypeStr() const;
     void setTypeFromStr(const QString&);
 
-    Type m_type;
-    QDateTime m_stamp;
-    StampType m_stampType;
-    State m_state;
-
-    bool m_attentionRequested;
-    QString m_body;
-    QString m_subject;
-    QString m_thread;
-
-    // Request message receipt as per XEP-0184.
-    QString m_receiptId;
-    bool m_receiptRequested;
+    QSharedDataPointer<QXmppMessagePrivate> d;
+    friend class QXmppMessagePrivate;
 };
 
 #endif // QXMPPMESSAGE_H
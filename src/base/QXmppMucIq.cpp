@@ -23,6 +23,7 @@
 
 #include <QDomElement>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppMucIq.h"
 #include "QXmppUtils.h"
@@ -201,6 +202,28 @@ void QXmppMucItem::parse(const QDomElement &element)
     m_reason = element.firstChildElement("reason").text();
 }
 
+void QXmppMucItem::parse(QXmlStreamReader *reader)
+{
+    const QXmlStreamAttributes attributes = reader->attributes();
+    m_affiliation = QXmppMucItem::affiliationFromString(attributes.value("affiliation").toString().toLower());
+    m_jid = attributes.value("jid").toString();
+    m_nick = attributes.value("nick").toString();
+    m_role = QXmppMucItem::roleFromString(attributes.value("role").toString().toLower());
+    m_actor = QString();
+    m_reason = QString();
+
+    while (reader->readNextStartElement()) {
+        if (reader->name() == "actor") {
+            m_actor = reader->attributes().value("jid").toString();
+            reader->skipCurrentElement();
+        } else if (reader->name() == "reason") {
+            m_reason = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+        } else {
+            reader->skipCurrentElement();
+        }
+    }
+}
+
 void QXmppMucItem::toXml(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement("item");
@@ -236,8 +259,7 @@ void QXmppMucAdminIq::setItems(const QList<QXmppMucItem> &items)
 
 bool QXmppMucAdminIq::isMucAdminIq(const QDomElement &element)
 {
-    QDomElement queryElement = element.firstChildElement("query");
-    return (queryElement.namespaceURI() == ns_muc_admin);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsMucAdmin);
 }
 
 void QXmppMucAdminIq::parseElementFromChild(const QDomElement &element)
@@ -280,8 +302,7 @@ void QXmppMucOwnerIq::setForm(const QXmppDataForm &form)
 
 bool QXmppMucOwnerIq::isMucOwnerIq(const QDomElement &element)
 {
-    QDomElement queryElement = element.firstChildElement("query");
-    return (queryElement.namespaceURI() == ns_muc_owner);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsMucOwner);
 }
 
 void QXmppMucOwnerIq::parseElementFromChild(const QDomElement &element)
@@ -77,6 +77,7 @@ public:
     void setRole(Role role);
 
     void parse(const QDomElement &element);
+    void parse(QXmlStreamReader *reader);
     void toXml(QXmlStreamWriter *writer) const;
 
     /// \cond
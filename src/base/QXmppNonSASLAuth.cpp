@@ -25,6 +25,7 @@
 #include <QDomElement>
 #include <QXmlStreamWriter>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppNonSASLAuth.h"
 #include "QXmppUtils.h"
@@ -36,8 +37,7 @@ QXmppNonSASLAuthIq::QXmppNonSASLAuthIq()
 
 bool QXmppNonSASLAuthIq::isNonSASLAuthIq(const QDomElement &element)
 {
-    QDomElement queryElement = element.firstChildElement("query");
-    return queryElement.namespaceURI() == ns_auth;
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsAuth);
 }
 
 void QXmppNonSASLAuthIq::parseElementFromChild(const QDomElement &element)
@@ -21,6 +21,7 @@
  *
  */
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppPingIq.h"
 #include "QXmppUtils.h"
@@ -33,9 +34,16 @@ QXmppPingIq::QXmppPingIq() : QXmppIq(QXmppIq::Get)
 
 bool QXmppPingIq::isPingIq(const QDomElement &element)
 {
-    QDomElement pingElement = element.firstChildElement("ping");
-    return (element.attribute("type") == "get" &&
-            pingElement.namespaceURI() == ns_ping);
+    return (QXmppAtom::attribute(element, QXmppAtom::Type) == QXmppAtom::Get &&
+            QXmppAtom::hasChildElement(element, QXmppAtom::Ping, QXmppAtom::NsPing));
+}
+
+void QXmppPingIq::parseElementFromChild(QXmlStreamReader *reader)
+{
+    while (reader->readNextStartElement()) {
+        if (!parseError(reader))
+            reader->skipCurrentElement();
+    }
 }
 
 void QXmppPingIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -35,6 +35,11 @@ public:
     QXmppPingIq();
     void toXmlElementFromChild(QXmlStreamWriter *writer) const;
     static bool isPingIq(const QDomElement &element);
+
+protected:
+    /// \cond
+    void parseElementFromChild(QXmlStreamReader *reader);
+    /// \endcond
 };
 
 #endif
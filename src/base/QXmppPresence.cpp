@@ -22,6 +22,7 @@
  */
 
 
+#include "QXmppAtom.h"
 #include "QXmppPresence.h"
 #include "QXmppUtils.h"
 #include <QtDebug>
@@ -29,6 +30,28 @@
 #include <QXmlStreamWriter>
 #include "QXmppConstants.h"
 
+class QXmppPresencePrivate : public QSharedData
+{
+public:
+    QXmppPresence::Type type;
+    QXmppPresence::Status status;
+
+    // XEP-0153: vCard-Based Avatars
+    QByteArray photoHash;
+    QXmppPresence::VCardUpdateType vCardUpdateType;
+
+    // XEP-0115: Entity Capabilities
+    QString capabilityHash;
+    QString capabilityNode;
+    QByteArray capabilityVer;
+    // Legacy XEP-0115: Entity Capabilities
+    QStringList capabilityExt;
+
+    // XEP-0045: Multi-User Chat
+    QXmppMucItem mucItem;
+    QList<int> mucStatusCodes;
+};
+
 /// Constructs a QXmppPresence.
 ///
 /// \param type
@@ -37,11 +60,21 @@
 QXmppPresence::QXmppPresence(QXmppPresence::Type type,
                              const QXmppPresence::Status& status)
     : QXmppStanza(),
-    m_type(type),
-    m_status(status),
-    m_vCardUpdateType(VCardUpdateNone)
+    d(new QXmppPresencePrivate)
 {
+    d->type = type;
+    d->status = status;
+    d->vCardUpdateType = VCardUpdateNone;
+}
+
+/// Constructs a copy of \a other.
+///
+/// \param other
 
+QXmppPresence::QXmppPresence(const QXmppPresence &other)
+    : QXmppStanza(other),
+    d(other.d)
+{
 }
 
 /// Destroys a QXmppPresence.
@@ -51,6 +84,17 @@ QXmppPresence::~QXmppPresence()
 
 }
 
+/// Assigns \a other to this presence.
+///
+/// \param other
+
+QXmppPresence& QXmppPresence::operator=(const QXmppPresence &other)
+{
+    QXmppStanza::operator=(other);
+    d = other.d;
+    return *this;
+}
+
 /// Returns the presence type.
 ///
 /// You can use this method to determine the action which needs to be
@@ -60,7 +104,7 @@ QXmppPresence::~QXmppPresence()
 
 QXmppPresence::Type QXmppPresence::type() const
 {
-    return m_type;
+    return d->type;
 }
 
 /// Sets the presence type.
@@ -69,21 +113,21 @@ QXmppPresence::Type QXmppPresence::type() const
 
 void QXmppPresence::setType(QXmppPresence::Type type)
 {
-    m_type = type;
+    d->type = type;
 }
 
 /// Returns the presence status.
 
 const QXmppPresence::Status& QXmppPresence::status() const
 {
-    return m_status;
+    return d->status;
 }
 
 /// Returns a reference to the presence status, allowing you to change it.
 
 QXmppPresence::Status& QXmppPresence::status()
 {
-    return m_status;
+    return d->status;
 }
 
 /// Sets the presence status.
@@ -92,7 +136,7 @@ QXmppPresence::Status& QXmppPresence::status()
 
 void QXmppPresence::setStatus(const QXmppPresence::Status& status)
 {
-    m_status = status;
+    d->status = status;
 }
 
 void QXmppPresence::parse(const QDomElement &element)
@@ -100,22 +144,22 @@ void QXmppPresence::parse(const QDomElement &element)
     QXmppStanza::parse(element);
 
     setTypeFromStr(element.attribute("type"));
-    m_status.parse(element);
+    d->status.parse(element);
 
     QXmppElementList extensions;
     QDomElement xElement = element.firstChildElement();
-    m_vCardUpdateType = VCardUpdateNone;
+    d->vCardUpdateType = VCardUpdateNone;
     while(!xElement.isNull())
     {
         // XEP-0045: Multi-User Chat
         if(xElement.namespaceURI() == ns_muc_user)
         {
             QDomElement itemElement = xElement.firstChildElement("item");
-            m_mucItem.parse(itemElement);
+            d->mucItem.parse(itemElement);
             QDomElement statusElement = xElement.firstChildElement("status");
-            m_mucStatusCodes.clear();
+            d->mucStatusCodes.clear();
             while (!statusElement.isNull()) {
-                m_mucStatusCodes << statusElement.attribute("code").toInt();
+                d->mucStatusCodes << statusElement.attribute("code").toInt();
                 statusElement = statusElement.nextSiblingElement("status");
             }
         }
@@ -125,25 +169,25 @@ void QXmppPresence::parse(const QDomElement &element)
             QDomElement photoElement = xElement.firstChildElement("photo");
             if(!photoElement.isNull())
             {
-                m_photoHash = QByteArray::fromHex(photoElement.text().toAscii());
-                if(m_photoHash.isEmpty())
-                    m_vCardUpdateType = VCardUpdateNoPhoto;
+                d->photoHash = QByteArray::fromHex(photoElement.text().toAscii());
+                if(d->photoHash.isEmpty())
+                    d->vCardUpdateType = VCardUpdateNoPhoto;
                 else
-                    m_vCardUpdateType = VCardUpdateValidPhoto;
+                    d->vCardUpdateType = VCardUpdateValidPhoto;
             }
             else
             {
-                m_photoHash = QByteArray();
-                m_vCardUpdateType = VCardUpdateNotReady;
+                d->photoHash = QByteArray();
+                d->vCardUpdateType = VCardUpdateNotReady;
             }
         }
         // XEP-0115: Entity Capabilities
         else if(xElement.tagName() == "c" && xElement.namespaceURI() == ns_capabilities)
         {
-            m_capabilityNode = xElement.attribute("node");
-            m_capabilityVer = QByteArray::fromBase64(xElement.attribute("ver").toAscii());
-            m_capabilityHash = xElement.attribute("hash");
-            m_capabilityExt = xElement.attribute("ext").split(" ", QString::SkipEmptyParts);
+            d->capabilityNode = xElement.attribute("node");
+            d->capabilityVer = QByteArray::fromBase64(xElement.attribute("ver").toAscii());
+            d->capabilityHash = xElement.attribute("hash");
+            d->capabilityExt = xElement.attribute("ext").split(" ", QString::SkipEmptyParts);
         }
         else if (xElement.tagName() == "error")
         {
@@ -167,6 +211,69 @@ void QXmppPresence::parse(const QDomElement &element)
     setExtensions(extensions);
 }
 
+void QXmppPresence::parse(QXmlStreamReader *reader)
+{
+    parseAttributes(reader);
+    setTypeFromStr(reader->attributes().value("type").toString());
+
+    const QString xmlns = reader->namespaceUri().toString();
+    QXmppElementList extensions;
+    d->status = QXmppPresence::Status();
+    d->vCardUpdateType = VCardUpdateNone;
+
+    while (reader->readNextStartElement())
+    {
+        const QXmppAtom ns = QXmppAtom::find(reader->namespaceUri());
+
+        if (parseError(reader) || d->status.parseChild(reader)) {
+            continue;
+        } else if (ns == QXmppAtom::NsMucUser) {
+            // XEP-0045: Multi-User Chat
+            d->mucStatusCodes.clear();
+            while (reader->readNextStartElement()) {
+                const QXmppAtom name = QXmppAtom::find(reader->name());
+                if (name == QXmppAtom::Item) {
+                    d->mucItem.parse(reader);
+                    continue;
+                } else if (name == QXmppAtom::Status) {
+                    d->mucStatusCodes << reader->attributes().value("code").toString().toInt();
+                }
+                reader->skipCurrentElement();
+            }
+            continue;
+        } else if (ns == QXmppAtom::NsVCardUpdate) {
+            // XEP-0153: vCard-Based Avatars
+            d->photoHash = QByteArray();
+            d->vCardUpdateType = VCardUpdateNotReady;
+            while (reader->readNextStartElement()) {
+                if (QXmppAtom::find(reader->name()) == QXmppAtom::Photo) {
+                    d->photoHash = QByteArray::fromHex(reader->readElementText(QXmlStreamReader::IncludeChildElements).toAscii());
+                    if (d->photoHash.isEmpty())
+                        d->vCardUpdateType = VCardUpdateNoPhoto;
+                    else
+                        d->vCardUpdateType = VCardUpdateValidPhoto;
+                } else {
+                    reader->skipCurrentElement();
+                }
+            }
+            continue;
+        } else if (ns == QXmppAtom::NsCapabilities && QXmppAtom::find(reader->name()) == QXmppAtom::C) {
+            // XEP-0115: Entity Capabilities
+            const QXmlStreamAttributes attributes = reader->attributes();
+            d->capabilityNode = attributes.value("node").toString();
+            d->capabilityVer = QByteArray::fromBase64(attributes.value("ver").toString().toAscii());
+            d->capabilityHash = attributes.value("hash").toString();
+            d->capabilityExt = attributes.value("ext").toString().split(" ", QString::SkipEmptyParts);
+        } else {
+            // other extensions
+            extensions << QXmppElement(reader, xmlns);
+            continue;
+        }
+        reader->skipCurrentElement();
+    }
+    setExtensions(extensions);
+}
+
 void QXmppPresence::toXml(QXmlStreamWriter *xmlWriter) const
 {
     xmlWriter->writeStartElement("presence");
@@ -175,18 +282,18 @@ void QXmppPresence::toXml(QXmlStreamWriter *xmlWriter) const
     helperToXmlAddAttribute(xmlWriter,"to", to());
     helperToXmlAddAttribute(xmlWriter,"from", from());
     helperToXmlAddAttribute(xmlWriter,"type", getTypeStr());
-    m_status.toXml(xmlWriter);
+    d->status.toXml(xmlWriter);
 
     error().toXml(xmlWriter);
 
     // XEP-0045: Multi-User Chat
-    if(!m_mucItem.isNull() || !m_mucStatusCodes.isEmpty())
+    if(!d->mucItem.isNull() || !d->mucStatusCodes.isEmpty())
     {
         xmlWriter->writeStartElement("x");
         xmlWriter->writeAttribute("xmlns", ns_muc_user);
-        if (!m_mucItem.isNull())
-            m_mucItem.toXml(xmlWriter);
-        foreach (int code, m_mucStatusCodes) {
+        if (!d->mucItem.isNull())
+            d->mucItem.toXml(xmlWriter);
+        foreach (int code, d->mucStatusCodes) {
             xmlWriter->writeStartElement("status");
             xmlWriter->writeAttribute("code", QString::number(code));
             xmlWriter->writeEndElement();
@@ -195,17 +302,17 @@ void QXmppPresence::toXml(QXmlStreamWriter *xmlWriter) const
     }
 
     // XEP-0153: vCard-Based Avatars
-    if(m_vCardUpdateType != VCardUpdateNone)
+    if(d->vCardUpdateType != VCardUpdateNone)
     {
         xmlWriter->writeStartElement("x");
         xmlWriter->writeAttribute("xmlns", ns_vcard_update);
-        switch(m_vCardUpdateType)
+        switch(d->vCardUpdateType)
         {
         case VCardUpdateNoPhoto:
             helperToXmlAddTextElement(xmlWriter, "photo", "");
             break;
         case VCardUpdateValidPhoto:
-            helperToXmlAddTextElement(xmlWriter, "photo", m_photoHash.toHex());
+            helperToXmlAddTextElement(xmlWriter, "photo", d->photoHash.toHex());
             break;
         case VCardUpdateNotReady:
             break;
@@ -215,14 +322,14 @@ void QXmppPresence::toXml(QXmlStreamWriter *xmlWriter) const
         xmlWriter->writeEndElement();
     }
 
-    if(!m_capabilityNode.isEmpty() && !m_capabilityVer.isEmpty()
-        && !m_capabilityHash.isEmpty())
+    if(!d->capabilityNode.isEmpty() && !d->capabilityVer.isEmpty()
+        && !d->capabilityHash.isEmpty())
     {
         xmlWriter->writeStartElement("c");
         xmlWriter->writeAttribute("xmlns", ns_capabilities);
-        helperToXmlAddAttribute(xmlWriter, "hash", m_capabilityHash);
-        helperToXmlAddAttribute(xmlWriter, "node", m_capabilityNode);
-        helperToXmlAddAttribute(xmlWriter, "ver", m_capabilityVer.toBase64());
+        helperToXmlAddAttribute(xmlWriter, "hash", d->capabilityHash);
+        helperToXmlAddAttribute(xmlWriter, "node", d->capabilityNode);
+        helperToXmlAddAttribute(xmlWriter, "ver", d->capabilityVer.toBase64());
         xmlWriter->writeEndElement();
     }
 
@@ -234,7 +341,7 @@ void QXmppPresence::toXml(QXmlStreamWriter *xmlWriter) const
 
 QString QXmppPresence::getTypeStr() const
 {
-    switch(m_type) {
+    switch(d->type) {
     case QXmppPresence::Error:
         return "error";
     case QXmppPresence::Available:
@@ -252,7 +359,7 @@ QString QXmppPresence::getTypeStr() const
     case QXmppPresence::Probe:
         return "probe";
     default:
-        qWarning("QXmppPresence::getTypeStr() invalid type %d", (int)m_type);
+        qWarning("QXmppPresence::getTypeStr() invalid type %d", (int)d->type);
         return "";
     }
 }
@@ -260,25 +367,25 @@ QString QXmppPresence::getTypeStr() const
 void QXmppPresence::setTypeFromStr(const QString& str)
 {
     if(str == "error")
-        m_type = QXmppPresence::Error;
+        d->type = QXmppPresence::Error;
     else if(str == "")
-        m_type = QXmppPresence::Available;
+        d->type = QXmppPresence::Available;
     else if(str == "unavailable")
-        m_type = QXmppPresence::Unavailable;
+        d->type = QXmppPresence::Unavailable;
     else if(str == "subscribe")
-        m_type = QXmppPresence::Subscribe;
+        d->type = QXmppPresence::Subscribe;
     else if(str == "subscribed")
-        m_type = QXmppPresence::Subscribed;
+        d->type = QXmppPresence::Subscribed;
     else if(str == "unsubscribe")
-        m_type = QXmppPresence::Unsubscribe;
+        d->type = QXmppPresence::Unsubscribe;
     else if(str == "unsubscribed")
-        m_type = QXmppPresence::Unsubscribed;
+        d->type = QXmppPresence::Unsubscribed;
     else if(str == "probe")
-        m_type = QXmppPresence::Probe;
+        d->type = QXmppPresence::Probe;
     else {
         qWarning("QXmppPresence::setTypeFromStr() invalid input string type: %s",
                  qPrintable(str));
-        m_type = QXmppPresence::Error;
+        d->type = QXmppPresence::Error;
     }
 }
 
@@ -387,6 +494,25 @@ void QXmppPresence::Status::parse(const QDomElement &element)
     m_priority = element.firstChildElement("priority").text().toInt();
 }
 
+/// Parses a "show", "status" or "priority" element, returning false if
+/// the reader is positioned on another element.
+///
+/// \param reader
+
+bool QXmppPresence::Status::parseChild(QXmlStreamReader *reader)
+{
+    const QXmppAtom name = QXmppAtom::find(reader->name());
+    if (name == QXmppAtom::Show)
+        setTypeFromStr(reader->readElementText(QXmlStreamReader::IncludeChildElements));
+    else if (name == QXmppAtom::Status)
+        m_statusText = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+    else if (name == QXmppAtom::Priority)
+        m_priority = reader->readElementText(QXmlStreamReader::IncludeChildElements).toInt();
+    else
+        return false;
+    return true;
+}
+
 void QXmppPresence::Status::toXml(QXmlStreamWriter *xmlWriter) const
 {
     const QString show = getTypeStr();
@@ -404,7 +530,7 @@ void QXmppPresence::Status::toXml(QXmlStreamWriter *xmlWriter) const
 
 QByteArray QXmppPresence::photoHash() const
 {
-    return m_photoHash;
+    return d->photoHash;
 }
 
 /// Sets the photo-hash of the VCardUpdate.
@@ -413,7 +539,7 @@ QByteArray QXmppPresence::photoHash() const
 
 void QXmppPresence::setPhotoHash(const QByteArray& photoHash)
 {
-    m_photoHash = photoHash;
+    d->photoHash = photoHash;
 }
 
 /// Returns the type of VCardUpdate
@@ -422,7 +548,7 @@ void QXmppPresence::setPhotoHash(const QByteArray& photoHash)
 
 QXmppPresence::VCardUpdateType QXmppPresence::vCardUpdateType() const
 {
-    return m_vCardUpdateType;
+    return d->vCardUpdateType;
 }
 
 /// Sets the type of VCardUpdate
@@ -431,56 +557,56 @@ QXmppPresence::VCardUpdateType QXmppPresence::vCardUpdateType() const
 
 void QXmppPresence::setVCardUpdateType(VCardUpdateType type)
 {
-    m_vCardUpdateType = type;
+    d->vCardUpdateType = type;
 }
 
 /// XEP-0115: Entity Capabilities
 QString QXmppPresence::capabilityHash() const
 {
-    return m_capabilityHash;
+    return d->capabilityHash;
 }
 
 /// XEP-0115: Entity Capabilities
 void QXmppPresence::setCapabilityHash(const QString& hash)
 {
-    m_capabilityHash = hash;
+    d->capabilityHash = hash;
 }
 
 /// XEP-0115: Entity Capabilities
 QString QXmppPresence::capabilityNode() const
 {
-    return m_capabilityNode;
+    return d->capabilityNode;
 }
 
 /// XEP-0115: Entity Capabilities
 void QXmppPresence::setCapabilityNode(const QString& node)
 {
-    m_capabilityNode = node;
+    d->capabilityNode = node;
 }
 
 /// XEP-0115: Entity Capabilities
 QByteArray QXmppPresence::capabilityVer() const
 {
-    return m_capabilityVer;
+    return d->capabilityVer;
 }
 
 /// XEP-0115: Entity Capabilities
 void QXmppPresence::setCapabilityVer(const QByteArray& ver)
 {
-    m_capabilityVer = ver;
+    d->capabilityVer = ver;
 }
 
 /// Legacy XEP-0115: Entity Capabilities
 QStringList QXmppPresence::capabilityExt() const
 {
-    return m_capabilityExt;
+    return d->capabilityExt;
 }
 
 /// Returns the MUC item.
 
 QXmppMucItem QXmppPresence::mucItem() const
 {
-    return m_mucItem;
+    return d->mucItem;
 }
 
 /// Sets the MUC item.
@@ -489,14 +615,14 @@ QXmppMucItem QXmppPresence::mucItem() const
 
 void QXmppPresence::setMucItem(const QXmppMucItem &item)
 {
-    m_mucItem = item;
+    d->mucItem = item;
 }
 
 /// Returns the MUC status codes.
 
 QList<int> QXmppPresence::mucStatusCodes() const
 {
-    return m_mucStatusCodes;
+    return d->mucStatusCodes;
 }
 
 /// Sets the MUC status codes.
@@ -505,6 +631,6 @@ QList<int> QXmppPresence::mucStatusCodes() const
 
 void QXmppPresence::setMucStatusCodes(const QList<int> &codes)
 {
-    m_mucStatusCodes = codes;
+    d->mucStatusCodes = codes;
 }
 
@@ -28,6 +28,8 @@
 #include "QXmppStanza.h"
 #include "QXmppMucIq.h"
 
+class QXmppPresencePrivate;
+
 /// \brief The QXmppPresence class represents an XMPP presence stanza.
 ///
 /// \ingroup Stanzas
@@ -92,6 +94,7 @@ public:
 
         /// \cond
         void parse(const QDomElement &element);
+        bool parseChild(QXmlStreamReader *reader);
         void toXml(QXmlStreamWriter *writer) const;
         /// \endcond
 
@@ -106,8 +109,11 @@ public:
 
     QXmppPresence(QXmppPresence::Type type = QXmppPresence::Available,
         const QXmppPresence::Status& status = QXmppPresence::Status());
+    QXmppPresence(const QXmppPresence &other);
     ~QXmppPresence();
 
+    QXmppPresence& operator=(const QXmppPresence &other);
+
     QXmppPresence::Type type() const;
     void setType(QXmppPresence::Type);
 
@@ -117,6 +123,7 @@ public:
 
     /// \cond
     void parse(const QDomElement &element);
+    void parse(QXmlStreamReader *reader);
     void toXml(QXmlStreamWriter *writer) const;
     /// \endcond
 
@@ -150,27 +157,7 @@ private:
     QString getTypeStr() const;
     void setTypeFromStr(const QString&);
 
-    Type m_type;
-    QXmppPresence::Status m_status;
-
-
-    /// XEP-0153: vCard-Based Avatars
-
-    /// m_photoHash: the SHA1 hash of the avatar image data itself (not the base64-encoded version)
-    /// in accordance with RFC 3174
-    QByteArray m_photoHash;
-    VCardUpdateType m_vCardUpdateType;
-
-    // XEP-0115: Entity Capabilities
-    QString m_capabilityHash;
-    QString m_capabilityNode;
-    QByteArray m_capabilityVer;
-    // Legacy XEP-0115: Entity Capabilities
-    QStringList m_capabilityExt;
-
-    // XEP-0045: Multi-User Chat
-    QXmppMucItem m_mucItem;
-    QList<int> m_mucStatusCodes;
+    QSharedDataPointer<QXmppPresencePrivate> d;
 };
 
 #endif // QXMPPPRESENCE_H
@@ -24,6 +24,7 @@
 #include <QDomElement>
 #include <QXmlStreamWriter>
 
+#include "QXmppAtom.h"
 #include "QXmppPrivacyIq.h"
 #include "QXmppConstants.h"
 #include "QXmppUtils.h"
@@ -45,7 +46,7 @@ QList<QXmppPrivacyIq::List> QXmppPrivacyIq::lists() const
 
 bool QXmppPrivacyIq::isPrivacyIq(const QDomElement &element)
 {
-    return (element.firstChildElement("query").namespaceURI() == ns_privacy);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsPrivacy);
 }
 
 void QXmppPrivacyIq::parseElementFromChild(const QDomElement &element)
@@ -23,12 +23,11 @@
 
 #include <QDomElement>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppPubSubIq.h"
 #include "QXmppUtils.h"
 
-static const char *ns_pubsub = "http://jabber.org/protocol/pubsub";
-
 static const char *pubsub_queries[] = {
     "affiliations",
     "default",
@@ -176,8 +175,7 @@ void QXmppPubSubIq::setItems(const QList<QXmppPubSubItem> &items)
 
 bool QXmppPubSubIq::isPubSubIq(const QDomElement &element)
 {
-    const QDomElement pubSubElement = element.firstChildElement("pubsub");
-    return pubSubElement.namespaceURI() == ns_pubsub;
+    return QXmppAtom::hasChildElement(element, QXmppAtom::PubSub, QXmppAtom::NsPubSub);
 }
 
 void QXmppPubSubIq::parseElementFromChild(const QDomElement &element)
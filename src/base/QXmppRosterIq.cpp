@@ -25,6 +25,7 @@
 #include <QDomElement>
 #include <QXmlStreamWriter>
 
+#include "QXmppAtom.h"
 #include "QXmppRosterIq.h"
 #include "QXmppConstants.h"
 #include "QXmppUtils.h"
@@ -47,7 +48,7 @@ QList<QXmppRosterIq::Item> QXmppRosterIq::items() const
 
 bool QXmppRosterIq::isRosterIq(const QDomElement &element)
 {
-    return (element.firstChildElement("query").namespaceURI() == ns_roster);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsRoster);
 }
 
 void QXmppRosterIq::parseElementFromChild(const QDomElement &element)
@@ -64,6 +65,27 @@ void QXmppRosterIq::parseElementFromChild(const QDomElement &element)
     }
 }
 
+void QXmppRosterIq::parseElementFromChild(QXmlStreamReader *reader)
+{
+    while (reader->readNextStartElement()) {
+        if (parseError(reader))
+            continue;
+        if (reader->name() != "query") {
+            reader->skipCurrentElement();
+            continue;
+        }
+        while (reader->readNextStartElement()) {
+            if (reader->name() == "item") {
+                QXmppRosterIq::Item item;
+                item.parse(reader);
+                m_items.append(item);
+            } else {
+                reader->skipCurrentElement();
+            }
+        }
+    }
+}
+
 void QXmppRosterIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement("query");
@@ -242,6 +264,22 @@ void QXmppRosterIq::Item::parse(const QDomElement &element)
     }
 }
 
+void QXmppRosterIq::Item::parse(QXmlStreamReader *reader)
+{
+    const QXmlStreamAttributes attributes = reader->attributes();
+    m_name = attributes.value("name").toString();
+    m_bareJid = attributes.value("jid").toString();
+    setSubscriptionTypeFromStr(attributes.value("subscription").toString());
+    setSubscriptionStatus(attributes.value("ask").toString());
+
+    while (reader->readNextStartElement()) {
+        if (reader->name() == "group")
+            m_groups << reader->readElementText(QXmlStreamReader::IncludeChildElements);
+        else
+            reader->skipCurrentElement();
+    }
+}
+
 void QXmppRosterIq::Item::toXml(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement("item");
@@ -73,6 +73,7 @@ public:
 
         /// \cond
         void parse(const QDomElement &element);
+        void parse(QXmlStreamReader *reader);
         void toXml(QXmlStreamWriter *writer) const;
         /// \endcond
 
@@ -98,6 +99,7 @@ public:
 protected:
     /// \cond
     void parseElementFromChild(const QDomElement &element);
+    void parseElementFromChild(QXmlStreamReader *reader);
     void toXmlElementFromChild(QXmlStreamWriter *writer) const;
     /// \endcond
 
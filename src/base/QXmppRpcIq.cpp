@@ -28,6 +28,7 @@
 #include <QDateTime>
 #include <QStringList>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppRpcIq.h"
 #include "QXmppUtils.h"
@@ -202,12 +203,9 @@ void QXmppRpcErrorIq::setQuery(const QXmppRpcInvokeIq &query)
 
 bool QXmppRpcErrorIq::isRpcErrorIq(const QDomElement &element)
 {
-    QString type = element.attribute("type");
-    QDomElement errorElement = element.firstChildElement("error");
-    QDomElement queryElement = element.firstChildElement("query");
-    return (type == "error") &&
-            !errorElement.isNull() &&
-            queryElement.namespaceURI() == ns_rpc;
+    return QXmppAtom::attribute(element, QXmppAtom::Type) == QXmppAtom::Error &&
+           !QXmppAtom::firstChildElement(element, QXmppAtom::Error).isNull() &&
+           QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsRpc);
 }
 
 void QXmppRpcErrorIq::parseElementFromChild(const QDomElement &element)
@@ -279,10 +277,8 @@ void QXmppRpcResponseIq::setValues(const QVariantList &values)
 
 bool QXmppRpcResponseIq::isRpcResponseIq(const QDomElement &element)
 {
-    QString type = element.attribute("type");
-    QDomElement dataElement = element.firstChildElement("query");
-    return dataElement.namespaceURI() == ns_rpc &&
-           type == "result";
+    return QXmppAtom::attribute(element, QXmppAtom::Type) == QXmppAtom::Result &&
+           QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsRpc);
 }
 
 void QXmppRpcResponseIq::parseElementFromChild(const QDomElement &element)
@@ -388,10 +384,8 @@ void QXmppRpcInvokeIq::setMethod(const QString &method)
 
 bool QXmppRpcInvokeIq::isRpcInvokeIq(const QDomElement &element)
 {
-    QString type = element.attribute("type");
-    QDomElement dataElement = element.firstChildElement("query");
-    return dataElement.namespaceURI() == ns_rpc &&
-           type == "set";
+    return QXmppAtom::attribute(element, QXmppAtom::Type) == QXmppAtom::Set &&
+           QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsRpc);
 }
 
 void QXmppRpcInvokeIq::parseElementFromChild(const QDomElement &element)
@@ -318,7 +318,7 @@ QXmppRtpAudioChannel::QXmppRtpAudioChannel(QObject *parent)
     QXmppLoggable *logParent = qobject_cast<QXmppLoggable*>(parent);
     if (logParent) {
         connect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
-                logParent, SIGNAL(logMessage(QXmppLogger::MessageType,QString)));
+                logParent, SLOT(_q_log(QXmppLogger::MessageType,QString)));
     }
     d->outgoingTimer = new QTimer(this);
     connect(d->outgoingTimer, SIGNAL(timeout()), this, SLOT(writeDatagram()));
@@ -54,6 +54,10 @@ QXmppConfiguration::SASLAuthMechanism QXmppSaslMechanism::fromString(const QStri
         return QXmppConfiguration::SASLAnonymous;
     if (mech == "X-FACEBOOK-PLATFORM")
         return QXmppConfiguration::SASLXFacebookPlatform;
+    if (mech == "SCRAM-SHA-1")
+        return QXmppConfiguration::SASLScramSha1;
+    if (mech == "SCRAM-SHA-256")
+        return QXmppConfiguration::SASLScramSha256;
 
     return static_cast<QXmppConfiguration::SASLAuthMechanism>(-1);
 }
@@ -69,6 +73,10 @@ QString QXmppSaslMechanism::toString(QXmppConfiguration::SASLAuthMechanism mech)
         return QLatin1String("ANONYMOUS");
     case QXmppConfiguration::SASLXFacebookPlatform:
         return QLatin1String("X-FACEBOOK-PLATFORM");
+    case QXmppConfiguration::SASLScramSha1:
+        return QLatin1String("SCRAM-SHA-1");
+    case QXmppConfiguration::SASLScramSha256:
+        return QLatin1String("SCRAM-SHA-256");
     }
 
     return QString();
@@ -84,6 +92,17 @@ QByteArray QXmppSaslMechanism::authText() const
     return QByteArray();
 }
 
+/// Returns true if the exchange may be considered successful once the
+/// server reports success.
+///
+/// Mechanisms which authenticate the server reimplement this to require
+/// that the server's proof was verified.
+
+bool QXmppSaslMechanism::isComplete() const
+{
+    return true;
+}
+
 bool QXmppSaslMechanism::challengeResponse(const QByteArray &challenge,
                                            QByteArray &response,
                                            unsigned int step)
@@ -384,6 +403,276 @@ bool QXmppSaslDigestMd5::challengeResponse(const QByteArray &challenge,
 
 
 
+static const int scramMinimumIterations = 4096;
+
+static QByteArray xorBytes(const QByteArray &a, const QByteArray &b)
+{
+    QByteArray result(a);
+    for (int i = 0; i < result.size() && i < b.size(); ++i)
+        result[i] = result[i] ^ b[i];
+    return result;
+}
+
+/// Constructs a SCRAM mechanism using the given hash algorithm.
+///
+/// SCRAM-SHA-256 requires Qt 5.
+///
+/// \param algorithm
+/// \param parent
+
+QXmppSaslScram::QXmppSaslScram(QCryptographicHash::Algorithm algorithm, QObject *parent) :
+    QXmppSaslMechanism(parent,
+#if QT_VERSION >= 0x050000
+        algorithm == QCryptographicHash::Sha256 ? QLatin1String("SCRAM-SHA-256") :
+#endif
+        QLatin1String("SCRAM-SHA-1")),
+    m_algorithm(algorithm),
+    m_serverVerified(false),
+    m_cachedIterations(0)
+{
+}
+
+/// Returns the hash algorithm used by this mechanism.
+
+QCryptographicHash::Algorithm QXmppSaslScram::algorithm() const
+{
+    return m_algorithm;
+}
+
+/// Returns the client-first message, which starts a new exchange.
+
+QByteArray QXmppSaslScram::authText() const
+{
+    m_cnonce = generateNonce();
+    m_serverVerified = false;
+    m_clientFirstBare = "n=" + escapeName(m_configuration->user()) + ",r=" + m_cnonce;
+    return "n,," + m_clientFirstBare;
+}
+
+bool QXmppSaslScram::challengeResponse(const QByteArray &challenge,
+                                       QByteArray &response,
+                                       unsigned int step)
+{
+    const QMap<char, QByteArray> map = parseMessage(challenge);
+
+    if (step == 1) {
+        const QByteArray nonce = map.value('r');
+        const QByteArray salt = QByteArray::fromBase64(map.value('s'));
+        const int iterations = map.value('i').toInt();
+        if (!nonce.startsWith(m_cnonce) || nonce.size() == m_cnonce.size() ||
+            salt.isEmpty() || iterations <= 0) {
+            warning("QXmppSaslScram: Invalid input");
+            return false;
+        }
+        if (iterations < scramMinimumIterations)
+            warning(QString("QXmppSaslScram: Low iteration count %1").arg(iterations));
+
+        // derive keys, unless we already did so for these parameters
+        if (m_clientKey.isEmpty() ||
+            m_cachedUser != m_configuration->user() ||
+            m_cachedPassword != m_configuration->password() ||
+            m_cachedSalt != salt ||
+            m_cachedIterations != iterations) {
+            const QByteArray salted = saltedPassword(m_algorithm, m_configuration->password().toUtf8(), salt, iterations);
+            m_clientKey = clientKey(m_algorithm, salted);
+            m_serverKey = serverKey(m_algorithm, salted);
+            m_cachedUser = m_configuration->user();
+            m_cachedPassword = m_configuration->password();
+            m_cachedSalt = salt;
+            m_cachedIterations = iterations;
+        } else {
+            debug("QXmppSaslScram: Using cached keys");
+        }
+
+        // build response
+        const QByteArray clientFinal = "c=" + QByteArray("n,,").toBase64() + ",r=" + nonce;
+        const QByteArray authMessage = m_clientFirstBare + "," + challenge + "," + clientFinal;
+        const QByteArray clientSignature = hmac(m_algorithm, hash(m_algorithm, m_clientKey), authMessage);
+        m_serverSignature = hmac(m_algorithm, m_serverKey, authMessage);
+
+        response = clientFinal + ",p=" + xorBytes(m_clientKey, clientSignature).toBase64();
+        return true;
+    } else if (step == 2) {
+        if (map.contains('e')) {
+            warning(QString("QXmppSaslScram: Server error %1").arg(QString::fromUtf8(map.value('e'))));
+            return false;
+        }
+
+        if (!map.contains('v') || m_serverSignature.isEmpty() ||
+            !signatureEquals(QByteArray::fromBase64(map.value('v')), m_serverSignature)) {
+            warning("QXmppSaslScram: Bad server signature");
+            return false;
+        }
+
+        m_serverVerified = true;
+        response = QByteArray();
+        return true;
+    }
+
+    warning("QXmppSaslScram: Too many authentication steps");
+    return false;
+}
+
+/// Returns true once the server proved it knows the password, which
+/// SCRAM requires before the client considers itself authenticated.
+
+bool QXmppSaslScram::isComplete() const
+{
+    return m_serverVerified;
+}
+
+/// Hashes the given data.
+///
+/// \param algorithm
+/// \param data
+
+QByteArray QXmppSaslScram::hash(QCryptographicHash::Algorithm algorithm, const QByteArray &data)
+{
+    return QCryptographicHash::hash(data, algorithm);
+}
+
+/// Calculates the HMAC of the given text.
+///
+/// \param algorithm
+/// \param key
+/// \param text
+
+QByteArray QXmppSaslScram::hmac(QCryptographicHash::Algorithm algorithm, const QByteArray &key, const QByteArray &text)
+{
+#if QT_VERSION >= 0x050000
+    if (algorithm == QCryptographicHash::Sha256)
+        return QXmppUtils::generateHmacSha256(key, text);
+#endif
+    Q_UNUSED(algorithm);
+    return QXmppUtils::generateHmacSha1(key, text);
+}
+
+/// Derives the SaltedPassword using PBKDF2, the Hi() function of RFC 5802.
+///
+/// This is the expensive part of a SCRAM exchange, which is why its
+/// results should be kept rather than recomputed.
+///
+/// \param algorithm
+/// \param password
+/// \param salt
+/// \param iterations
+
+QByteArray QXmppSaslScram::saltedPassword(QCryptographicHash::Algorithm algorithm, const QByteArray &password, const QByteArray &salt, int iterations)
+{
+    // prepare the HMAC pads once, rather than on every iteration
+    const int B = 64;
+    QByteArray key = (password.size() > B) ? hash(algorithm, password) : password;
+    key += QByteArray(B - key.size(), 0);
+    QByteArray ipad(B, 0), opad(B, 0);
+    for (int i = 0; i < B; ++i) {
+        ipad[i] = key[i] ^ 0x36;
+        opad[i] = key[i] ^ 0x5c;
+    }
+
+    QCryptographicHash inner(algorithm);
+    QCryptographicHash outer(algorithm);
+
+    // U1 = HMAC(password, salt + INT(1))
+    QByteArray u = salt + QByteArray("\x00\x00\x00\x01", 4);
+    QByteArray result;
+    for (int i = 0; i < iterations; ++i) {
+        inner.reset();
+        inner.addData(ipad);
+        inner.addData(u);
+        outer.reset();
+        outer.addData(opad);
+        outer.addData(inner.result());
+        u = outer.result();
+        result = result.isEmpty() ? u : xorBytes(result, u);
+    }
+    return result;
+}
+
+/// Returns the ClientKey for the given SaltedPassword.
+///
+/// \param algorithm
+/// \param saltedPassword
+
+QByteArray QXmppSaslScram::clientKey(QCryptographicHash::Algorithm algorithm, const QByteArray &saltedPassword)
+{
+    return hmac(algorithm, saltedPassword, "Client Key");
+}
+
+/// Returns the ServerKey for the given SaltedPassword.
+///
+/// \param algorithm
+/// \param saltedPassword
+
+QByteArray QXmppSaslScram::serverKey(QCryptographicHash::Algorithm algorithm, const QByteArray &saltedPassword)
+{
+    return hmac(algorithm, saltedPassword, "Server Key");
+}
+
+/// Compares two signatures in a time which does not depend on the
+/// position of the first difference.
+///
+/// \param a
+/// \param b
+
+bool QXmppSaslScram::signatureEquals(const QByteArray &a, const QByteArray &b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    char diff = 0;
+    for (int i = 0; i < a.size(); ++i)
+        diff |= a.at(i) ^ b.at(i);
+    return diff == 0;
+}
+
+/// Generates a printable nonce.
+
+QByteArray QXmppSaslScram::generateNonce()
+{
+    // base64 never contains ',' which is the attribute delimiter
+    return QXmppUtils::generateRandomBytes(24).toBase64();
+}
+
+/// Parses a SCRAM message into its attributes.
+///
+/// \param ba
+
+QMap<char, QByteArray> QXmppSaslScram::parseMessage(const QByteArray &ba)
+{
+    QMap<char, QByteArray> map;
+    foreach (const QByteArray &attribute, ba.split(',')) {
+        if (attribute.size() >= 2 && attribute.at(1) == '=')
+            map.insert(attribute.at(0), attribute.mid(2));
+    }
+    return map;
+}
+
+/// Escapes a user name for use in a SCRAM message.
+///
+/// \param name
+
+QByteArray QXmppSaslScram::escapeName(const QString &name)
+{
+    QByteArray ba = name.toUtf8();
+    ba.replace('=', "=3D");
+    ba.replace(',', "=2C");
+    return ba;
+}
+
+/// Unescapes a user name from a SCRAM message.
+///
+/// \param name
+
+QString QXmppSaslScram::unescapeName(const QByteArray &name)
+{
+    QByteArray ba = name;
+    ba.replace("=2C", ",");
+    ba.replace("=3D", "=");
+    return QString::fromUtf8(ba);
+}
+
+
+
 QXmppSaslFacebook::QXmppSaslFacebook(QObject *parent) :
     QXmppSaslMechanism(parent, QLatin1String("X-FACEBOOK-PLATFORM"))
 {
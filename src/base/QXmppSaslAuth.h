@@ -26,6 +26,7 @@
 #define QXMPPSASLAUTH_H
 
 #include <QByteArray>
+#include <QCryptographicHash>
 #include <QMap>
 #include <QString>
 
@@ -49,6 +50,7 @@ public:
     virtual bool challengeResponse(const QByteArray &challenge,
                                    QByteArray &response,
                                    unsigned int step);
+    virtual bool isComplete() const;
 
     static QXmppConfiguration::SASLAuthMechanism Q_DECL_DEPRECATED fromString(const QString &);
     static QString Q_DECL_DEPRECATED toString(QXmppConfiguration::SASLAuthMechanism);
@@ -131,6 +133,64 @@ private:
     QByteArray m_secret;
 };
 
+/// \brief The QXmppSaslScram class implements the SCRAM family of SASL
+/// mechanisms (RFC 5802), without channel binding.
+///
+/// The ClientKey and ServerKey derived from the password are kept, so
+/// that authenticating again with the same password, salt and iteration
+/// count does not repeat the expensive key derivation.
+///
+/// The static helpers are also used on the server side to verify proofs
+/// against stored keys.
+
+class QXMPP_EXPORT QXmppSaslScram : public QXmppSaslMechanism
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(QXmppSaslScram)
+
+public:
+    QXmppSaslScram(QCryptographicHash::Algorithm algorithm = QCryptographicHash::Sha1, QObject *parent = 0);
+
+    QCryptographicHash::Algorithm algorithm() const;
+
+    QByteArray authText() const;
+    bool challengeResponse(const QByteArray &challenge,
+                           QByteArray &response,
+                           unsigned int step);
+    bool isComplete() const;
+
+    // key derivation
+    static QByteArray hash(QCryptographicHash::Algorithm algorithm, const QByteArray &data);
+    static QByteArray hmac(QCryptographicHash::Algorithm algorithm, const QByteArray &key, const QByteArray &text);
+    static QByteArray saltedPassword(QCryptographicHash::Algorithm algorithm, const QByteArray &password, const QByteArray &salt, int iterations);
+    static QByteArray clientKey(QCryptographicHash::Algorithm algorithm, const QByteArray &saltedPassword);
+    static QByteArray serverKey(QCryptographicHash::Algorithm algorithm, const QByteArray &saltedPassword);
+    static bool signatureEquals(const QByteArray &a, const QByteArray &b);
+
+    // message parsing and serialization
+    static QByteArray generateNonce();
+    static QMap<char, QByteArray> parseMessage(const QByteArray &ba);
+    static QByteArray escapeName(const QString &name);
+    static QString unescapeName(const QByteArray &name);
+
+private:
+    QCryptographicHash::Algorithm m_algorithm;
+
+    // exchange state, the client-first message is built by authText()
+    mutable QByteArray m_cnonce;
+    mutable QByteArray m_clientFirstBare;
+    QByteArray m_serverSignature;
+    mutable bool m_serverVerified;
+
+    // cached keys
+    QString m_cachedUser;
+    QString m_cachedPassword;
+    QByteArray m_cachedSalt;
+    int m_cachedIterations;
+    QByteArray m_clientKey;
+    QByteArray m_serverKey;
+};
+
 class QXMPP_EXPORT QXmppSaslFacebook : public QXmppSaslMechanism
 {
     Q_OBJECT
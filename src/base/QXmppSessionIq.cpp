@@ -25,14 +25,22 @@
 #include <QDomElement>
 #include <QXmlStreamWriter>
 
+#include "QXmppAtom.h"
 #include "QXmppSessionIq.h"
 #include "QXmppConstants.h"
 #include "QXmppUtils.h"
 
 bool QXmppSessionIq::isSessionIq(const QDomElement &element)
 {
-    QDomElement sessionElement = element.firstChildElement("session");
-    return (sessionElement.namespaceURI() == ns_session);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Session, QXmppAtom::NsSession);
+}
+
+void QXmppSessionIq::parseElementFromChild(QXmlStreamReader *reader)
+{
+    while (reader->readNextStartElement()) {
+        if (!parseError(reader))
+            reader->skipCurrentElement();
+    }
 }
 
 void QXmppSessionIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -42,6 +42,7 @@ public:
 
 private:
     /// \cond
+    void parseElementFromChild(QXmlStreamReader *reader);
     void toXmlElementFromChild(QXmlStreamWriter *writer) const;
     /// \endcond
 };
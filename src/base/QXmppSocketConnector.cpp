@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QNetworkProxy>
+#include <QtAlgorithms>
+#include <QSslSocket>
+#include <QTimer>
+
+#include "QXmppSocketConnector.h"
+#include "qdnslookup.h"
+
+class QXmppSocketTarget
+{
+public:
+    QXmppSocketTarget();
+
+    QString host;
+    quint16 port;
+    int priority;
+    QList<QHostAddress> addresses;
+    int lookupId;
+    int nextAddress;
+    bool resolved;
+};
+
+QXmppSocketTarget::QXmppSocketTarget()
+    : port(0),
+    priority(0),
+    lookupId(-1),
+    nextAddress(0),
+    resolved(false)
+{
+}
+
+class QXmppSocketConnectorPrivate
+{
+public:
+    QXmppSocketConnectorPrivate();
+
+    QList<QXmppSocketTarget> targets;
+    QList<QSslSocket*> attempts;
+    int attemptPriority;
+    QTimer *attemptTimer;
+    QAbstractSocket::SocketError lastError;
+    QNetworkProxy proxy;
+};
+
+QXmppSocketConnectorPrivate::QXmppSocketConnectorPrivate()
+    : attemptPriority(0),
+    attemptTimer(0),
+    lastError(QAbstractSocket::UnknownSocketError)
+{
+}
+
+/// Interleaves IPv6 and IPv4 addresses, starting with IPv6,
+/// as described in RFC 8305 section 4.
+
+static QList<QHostAddress> sortAddresses(const QList<QHostAddress> &addresses)
+{
+    QList<QHostAddress> ipv4, ipv6;
+    foreach (const QHostAddress &address, addresses) {
+        if (address.protocol() == QAbstractSocket::IPv6Protocol)
+            ipv6 << address;
+        else
+            ipv4 << address;
+    }
+
+    QList<QHostAddress> sorted;
+    while (!ipv6.isEmpty() || !ipv4.isEmpty()) {
+        if (!ipv6.isEmpty())
+            sorted << ipv6.takeFirst();
+        if (!ipv4.isEmpty())
+            sorted << ipv4.takeFirst();
+    }
+    return sorted;
+}
+
+/// Returns true if the proxy requires connecting by host name.
+
+static bool isHostNameProxy(const QNetworkProxy &proxy)
+{
+    return proxy.type() == QNetworkProxy::Socks5Proxy ||
+           proxy.type() == QNetworkProxy::HttpProxy;
+}
+
+/// Returns the number of endpoints to try for the given target.
+
+static int endpointCount(const QXmppSocketTarget &target, const QNetworkProxy &proxy)
+{
+    return isHostNameProxy(proxy) ? 1 : target.addresses.size();
+}
+
+static bool servicePriorityLessThan(const QDnsServiceRecord &r1, const QDnsServiceRecord &r2)
+{
+    return r1.priority() < r2.priority();
+}
+
+/// Constructs a new socket connector.
+///
+/// \param parent
+
+QXmppSocketConnector::QXmppSocketConnector(QObject *parent)
+    : QXmppLoggable(parent),
+    d(new QXmppSocketConnectorPrivate)
+{
+    d->attemptTimer = new QTimer(this);
+    d->attemptTimer->setInterval(250);
+    d->attemptTimer->setSingleShot(true);
+
+    bool check = connect(d->attemptTimer, SIGNAL(timeout()),
+                         this, SLOT(_q_attemptTimeout()));
+    Q_ASSERT(check);
+    Q_UNUSED(check);
+}
+
+/// Destroys the socket connector, aborting any pending attempts.
+
+QXmppSocketConnector::~QXmppSocketConnector()
+{
+    abort();
+    delete d;
+}
+
+/// Returns the delay in milliseconds between two connection attempts.
+
+int QXmppSocketConnector::attemptDelay() const
+{
+    return d->attemptTimer->interval();
+}
+
+/// Sets the delay in milliseconds between two connection attempts.
+///
+/// The default value is 250ms, as recommended by RFC 8305.
+///
+/// \param msecs
+
+void QXmppSocketConnector::setAttemptDelay(int msecs)
+{
+    d->attemptTimer->setInterval(msecs);
+}
+
+/// Returns the network proxy used for connection attempts.
+
+QNetworkProxy QXmppSocketConnector::proxy() const
+{
+    return d->proxy;
+}
+
+/// Sets the network proxy used for connection attempts.
+///
+/// If the proxy is a SOCKS5 or HTTP proxy, host names are not resolved
+/// locally and a single attempt is made for each host.
+///
+/// \param proxy
+
+void QXmppSocketConnector::setProxy(const QNetworkProxy &proxy)
+{
+    d->proxy = proxy;
+}
+
+/// Returns true if host lookups or connection attempts are in progress.
+
+bool QXmppSocketConnector::isConnecting() const
+{
+    if (!d->attempts.isEmpty())
+        return true;
+    foreach (const QXmppSocketTarget &target, d->targets)
+        if (!target.resolved)
+            return true;
+    return false;
+}
+
+/// Aborts all pending host lookups and connection attempts.
+
+void QXmppSocketConnector::abort()
+{
+    d->attemptTimer->stop();
+
+    foreach (const QXmppSocketTarget &target, d->targets)
+        if (!target.resolved && target.lookupId >= 0)
+            QHostInfo::abortHostLookup(target.lookupId);
+    d->targets.clear();
+
+    foreach (QSslSocket *socket, d->attempts) {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+    }
+    d->attempts.clear();
+    d->lastError = QAbstractSocket::UnknownSocketError;
+}
+
+/// Attempts to connect to the given \a host and \a port.
+///
+/// \param host
+/// \param port
+
+void QXmppSocketConnector::connectToHost(const QString &host, quint16 port)
+{
+    connectToHosts(QList<QPair<QString, quint16> >() << qMakePair(host, port));
+}
+
+/// Attempts to connect to the given \a hosts, in order of preference.
+///
+/// All the hosts are raced against each other.
+///
+/// \param hosts
+
+void QXmppSocketConnector::connectToHosts(const QList<QPair<QString, quint16> > &hosts)
+{
+    QList<QXmppSocketTarget> targets;
+    for (int i = 0; i < hosts.size(); ++i) {
+        QXmppSocketTarget target;
+        target.host = hosts[i].first;
+        target.port = hosts[i].second;
+        targets << target;
+    }
+    connectToTargets(targets);
+}
+
+/// Attempts to connect to the targets of the given SRV \a records.
+///
+/// The records are expected in the order defined by RFC 2782, as returned
+/// by QDnsLookup. Only the targets sharing the lowest priority are raced
+/// against each other, the next priority is tried once they all failed.
+///
+/// \param records
+
+void QXmppSocketConnector::connectToServices(const QList<QDnsServiceRecord> &records)
+{
+    QList<QDnsServiceRecord> sorted = records;
+    qStableSort(sorted.begin(), sorted.end(), servicePriorityLessThan);
+
+    QList<QXmppSocketTarget> targets;
+    foreach (const QDnsServiceRecord &record, sorted) {
+        QXmppSocketTarget target;
+        target.host = record.target();
+        target.port = record.port();
+        target.priority = record.priority();
+        targets << target;
+    }
+    connectToTargets(targets);
+}
+
+void QXmppSocketConnector::connectToTargets(const QList<QXmppSocketTarget> &targets)
+{
+    abort();
+
+    foreach (QXmppSocketTarget target, targets) {
+        QHostAddress address;
+        if (isHostNameProxy(d->proxy)) {
+            // the proxy resolves the host name
+            target.resolved = true;
+        } else if (address.setAddress(target.host)) {
+            target.addresses << address;
+            target.resolved = true;
+        }
+        d->targets << target;
+    }
+
+    // start lookups once all targets are known, as results
+    // for cached host names can be delivered immediately
+    for (int i = 0; i < d->targets.size(); ++i) {
+        if (d->targets[i].resolved)
+            continue;
+        const int lookupId = QHostInfo::lookupHost(d->targets[i].host,
+            this, SLOT(_q_hostFound(QHostInfo)));
+        if (i < d->targets.size() && !d->targets[i].resolved)
+            d->targets[i].lookupId = lookupId;
+    }
+
+    if (!d->attemptTimer->isActive() && !startNextAttempt())
+        checkFinished();
+}
+
+/// Starts the next connection attempt, if an endpoint is available.
+///
+/// Attempts are only raced within the lowest priority which still has
+/// endpoints to try or lookups in progress. The next priority is only
+/// tried once every attempt of the previous one failed.
+///
+/// Returns true if an attempt was started.
+
+bool QXmppSocketConnector::startNextAttempt()
+{
+    // find the preferred priority with endpoints left
+    int priority = 0;
+    bool found = false;
+    foreach (const QXmppSocketTarget &target, d->targets) {
+        if ((!target.resolved || target.nextAddress < endpointCount(target, d->proxy)) &&
+            (!found || target.priority < priority)) {
+            priority = target.priority;
+            found = true;
+        }
+    }
+    if (!found || (!d->attempts.isEmpty() && priority != d->attemptPriority))
+        return false;
+
+    const bool byName = isHostNameProxy(d->proxy);
+    for (int i = 0; i < d->targets.size(); ++i) {
+        QXmppSocketTarget &target = d->targets[i];
+        if (!target.resolved || target.priority != priority ||
+            target.nextAddress >= endpointCount(target, d->proxy))
+            continue;
+
+        QSslSocket *socket = new QSslSocket(this);
+        socket->setProxy(d->proxy);
+
+        bool check;
+        Q_UNUSED(check);
+
+        check = connect(socket, SIGNAL(connected()),
+                        this, SLOT(_q_socketConnected()));
+        Q_ASSERT(check);
+
+        check = connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+                        this, SLOT(_q_socketError(QAbstractSocket::SocketError)));
+        Q_ASSERT(check);
+
+        d->attempts << socket;
+        if (byName) {
+            info(QString("Connecting to %1:%2").arg(target.host, QString::number(target.port)));
+            socket->connectToHost(target.host, target.port);
+        } else {
+            const QHostAddress address = target.addresses.at(target.nextAddress);
+            info(QString("Connecting to %1:%2 (%3)").arg(
+                target.host, QString::number(target.port), address.toString()));
+#if QT_VERSION >= 0x040800
+            socket->setPeerVerifyName(target.host);
+#endif
+            socket->connectToHost(address, target.port);
+        }
+        target.nextAddress++;
+        d->attemptPriority = priority;
+
+        d->attemptTimer->start();
+        return true;
+    }
+    return false;
+}
+
+/// Emits error() if there is nothing left to try.
+
+void QXmppSocketConnector::checkFinished()
+{
+    if (d->targets.isEmpty() || isConnecting())
+        return;
+
+    // check whether any endpoints remain
+    foreach (const QXmppSocketTarget &target, d->targets)
+        if (target.nextAddress < endpointCount(target, d->proxy))
+            return;
+
+    const QAbstractSocket::SocketError error = d->lastError;
+    warning("Could not connect to any host");
+    abort();
+    emit this->error(error);
+}
+
+void QXmppSocketConnector::_q_attemptTimeout()
+{
+    startNextAttempt();
+}
+
+void QXmppSocketConnector::_q_hostFound(const QHostInfo &hostInfo)
+{
+    for (int i = 0; i < d->targets.size(); ++i) {
+        // cached results are delivered before lookupHost() returns,
+        // so we may not know the lookup identifier yet
+        QXmppSocketTarget &target = d->targets[i];
+        if (target.resolved || (target.lookupId != hostInfo.lookupId() &&
+            (target.lookupId >= 0 || target.host != hostInfo.hostName())))
+            continue;
+
+        if (hostInfo.error() != QHostInfo::NoError) {
+            warning(QString("Lookup for host %1 failed: %2").arg(
+                target.host, hostInfo.errorString()));
+            d->lastError = QAbstractSocket::HostNotFoundError;
+        }
+        target.addresses = sortAddresses(hostInfo.addresses());
+        target.resolved = true;
+        break;
+    }
+
+    // if no attempt is scheduled, start one right away
+    if (!d->attemptTimer->isActive() && !startNextAttempt())
+        checkFinished();
+}
+
+void QXmppSocketConnector::_q_socketConnected()
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    if (!socket || !d->attempts.removeAll(socket))
+        return;
+
+    // hand the winning socket over, drop the other attempts
+    socket->disconnect(this);
+    socket->setParent(0);
+    abort();
+
+    emit connected(socket);
+}
+
+void QXmppSocketConnector::_q_socketError(QAbstractSocket::SocketError error)
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    if (!socket || !d->attempts.removeAll(socket))
+        return;
+
+    debug(QString("Connection attempt failed: %1").arg(socket->errorString()));
+    d->lastError = error;
+    socket->disconnect(this);
+    socket->deleteLater();
+
+    // do not wait for the attempt delay to try the next endpoint
+    if (!startNextAttempt())
+        checkFinished();
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSOCKETCONNECTOR_H
+#define QXMPPSOCKETCONNECTOR_H
+
+#include <QAbstractSocket>
+#include <QList>
+#include <QPair>
+
+#include "QXmppLogger.h"
+
+class QDnsServiceRecord;
+class QHostInfo;
+class QNetworkProxy;
+class QSslSocket;
+class QXmppSocketConnectorPrivate;
+class QXmppSocketTarget;
+
+/// \brief The QXmppSocketConnector class establishes a TCP connection to
+/// the first reachable host out of a list of candidates.
+///
+/// Candidate hosts are typically the targets of a DNS SRV lookup, which are
+/// tried in the priority and weight order of RFC 2782: only the targets
+/// sharing the lowest priority are raced, the next priority being tried
+/// once they all failed. Each host name is resolved to both its IPv6
+/// and IPv4 addresses, which are interleaved as recommended by RFC 8305
+/// ("Happy Eyeballs"). Connection attempts are then started one after the
+/// other, each one attemptDelay() milliseconds after the previous one, or
+/// as soon as the previous one fails. The first socket which connects wins
+/// and all other attempts are aborted.
+///
+
+class QXMPP_EXPORT QXmppSocketConnector : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppSocketConnector(QObject *parent = 0);
+    ~QXmppSocketConnector();
+
+    int attemptDelay() const;
+    void setAttemptDelay(int msecs);
+
+    QNetworkProxy proxy() const;
+    void setProxy(const QNetworkProxy &proxy);
+
+    bool isConnecting() const;
+
+    void connectToServices(const QList<QDnsServiceRecord> &records);
+
+signals:
+    /// This signal is emitted when a connection attempt succeeded.
+    ///
+    /// The receiver takes ownership of the \a socket.
+    void connected(QSslSocket *socket);
+
+    /// This signal is emitted when all connection attempts failed.
+    void error(QAbstractSocket::SocketError error);
+
+public slots:
+    void abort();
+    void connectToHost(const QString &host, quint16 port);
+    void connectToHosts(const QList<QPair<QString, quint16> > &hosts);
+
+private slots:
+    void _q_attemptTimeout();
+    void _q_hostFound(const QHostInfo &info);
+    void _q_socketConnected();
+    void _q_socketError(QAbstractSocket::SocketError error);
+
+private:
+    void connectToTargets(const QList<QXmppSocketTarget> &targets);
+    bool startNextAttempt();
+    void checkFinished();
+
+    QXmppSocketConnectorPrivate * const d;
+};
+
+#endif
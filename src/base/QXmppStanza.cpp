@@ -22,14 +22,28 @@
  */
 
 
+#include "QXmppAtom.h"
 #include "QXmppStanza.h"
 #include "QXmppUtils.h"
 #include "QXmppConstants.h"
 
+#include <QAtomicInt>
 #include <QDomElement>
 #include <QXmlStreamWriter>
 
-uint QXmppStanza::s_uniqeIdNo = 0;
+class QXmppStanzaPrivate : public QSharedData
+{
+public:
+    QString to;
+    QString from;
+    QString id;
+    QString lang;
+    QXmppStanza::Error error;
+    QXmppElementList extensions;
+};
+
+// counter for stanza IDs, shared by all threads
+static QAtomicInt stanzaIdCounter;
 
 QXmppStanza::Error::Error():
     m_code(0),
@@ -261,6 +275,29 @@ void QXmppStanza::Error::parse(const QDomElement &errorElement)
     setText(text);
 }
 
+void QXmppStanza::Error::parse(QXmlStreamReader *reader)
+{
+    const QXmlStreamAttributes attributes = reader->attributes();
+    setCode(attributes.value("code").toString().toInt());
+    setTypeFromStr(attributes.value("type").toString());
+
+    QString text;
+    QString cond;
+    while (reader->readNextStartElement())
+    {
+        if (reader->name() == "text") {
+            text = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+        } else {
+            if (reader->namespaceUri() == ns_stanza)
+                cond = reader->name().toString();
+            reader->skipCurrentElement();
+        }
+    }
+
+    setConditionFromStr(cond);
+    setText(text);
+}
+
 void QXmppStanza::Error::toXml( QXmlStreamWriter *writer ) const
 {
     QString cond = getConditionStr();
@@ -299,8 +336,21 @@ void QXmppStanza::Error::toXml( QXmlStreamWriter *writer ) const
 /// \param to
 
 QXmppStanza::QXmppStanza(const QString& from, const QString& to)
-    : m_to(to)
-    , m_from(from)
+    : d(new QXmppStanzaPrivate)
+{
+    d->to = to;
+    d->from = from;
+}
+
+/// Constructs a copy of \a other.
+///
+/// The stanza's data is implicitly shared, so copying a stanza is cheap
+/// until one of the copies is modified.
+///
+/// \param other
+
+QXmppStanza::QXmppStanza(const QXmppStanza &other)
+    : d(other.d)
 {
 }
 
@@ -310,12 +360,22 @@ QXmppStanza::~QXmppStanza()
 {
 }
 
+/// Assigns \a other to this stanza.
+///
+/// \param other
+
+QXmppStanza& QXmppStanza::operator=(const QXmppStanza &other)
+{
+    d = other.d;
+    return *this;
+}
+
 /// Returns the stanza's recipient JID.
 ///
 
 QString QXmppStanza::to() const
 {
-    return m_to;
+    return d->to;
 }
 
 /// Sets the stanza's recipient JID.
@@ -324,14 +384,14 @@ QString QXmppStanza::to() const
 
 void QXmppStanza::setTo(const QString& to)
 {
-    m_to = to;
+    d->to = to;
 }
 
 /// Returns the stanza's sender JID.
 
 QString QXmppStanza::from() const
 {
-    return m_from;
+    return d->from;
 }
 
 /// Sets the stanza's sender JID.
@@ -340,14 +400,14 @@ QString QXmppStanza::from() const
 
 void QXmppStanza::setFrom(const QString& from)
 {
-    m_from = from;
+    d->from = from;
 }
 
 /// Returns the stanza's identifier.
 
 QString QXmppStanza::id() const
 {
-    return m_id;
+    return d->id;
 }
 
 /// Sets the stanza's identifier.
@@ -356,14 +416,14 @@ QString QXmppStanza::id() const
 
 void QXmppStanza::setId(const QString& id)
 {
-    m_id = id;
+    d->id = id;
 }
 
 /// Returns the stanza's language.
 
 QString QXmppStanza::lang() const
 {
-    return m_lang;
+    return d->lang;
 }
 
 /// Sets the stanza's language.
@@ -372,14 +432,14 @@ QString QXmppStanza::lang() const
 
 void QXmppStanza::setLang(const QString& lang)
 {
-    m_lang = lang;
+    d->lang = lang;
 }
 
 /// Returns the stanza's error.
 
 QXmppStanza::Error QXmppStanza::error() const
 {
-    return m_error;
+    return d->error;
 }
 
 /// Sets the stanza's error.
@@ -388,7 +448,7 @@ QXmppStanza::Error QXmppStanza::error() const
 
 void QXmppStanza::setError(const QXmppStanza::Error& error)
 {
-    m_error = error;
+    d->error = error;
 }
 
 /// Returns the stanza's "extensions".
@@ -397,7 +457,7 @@ void QXmppStanza::setError(const QXmppStanza::Error& error)
 
 QXmppElementList QXmppStanza::extensions() const
 {
-    return m_extensions;
+    return d->extensions;
 }
 
 /// Sets the stanza's "extensions".
@@ -406,30 +466,74 @@ QXmppElementList QXmppStanza::extensions() const
 
 void QXmppStanza::setExtensions(const QXmppElementList &extensions)
 {
-    m_extensions = extensions;
+    d->extensions = extensions;
 }
 
 void QXmppStanza::generateAndSetNextId()
 {
-    // get back
-    ++s_uniqeIdNo;
-    m_id = "qxmpp" + QString::number(s_uniqeIdNo);
+    d->id = QLatin1String("qxmpp") + QString::number(stanzaIdCounter.fetchAndAddRelaxed(1) + 1);
 }
 
 bool QXmppStanza::isErrorStanza() const
 {
-    return m_error.isValid();
+    return d->error.isValid();
 }
 
 void QXmppStanza::parse(const QDomElement &element)
 {
-    m_from = element.attribute("from");
-    m_to = element.attribute("to");
-    m_id = element.attribute("id");
-    m_lang = element.attribute("lang");
+    d->from = element.attribute("from");
+    d->to = element.attribute("to");
+    d->id = element.attribute("id");
+    d->lang = element.attribute("lang");
 
     QDomElement errorElement = element.firstChildElement("error");
     if(!errorElement.isNull())
-        m_error.parse(errorElement);
+        d->error.parse(errorElement);
+}
+
+/// Parses the stanza from a QXmlStreamReader positioned on its start
+/// element, without building a DOM tree. On return the reader is
+/// positioned on the stanza's end element.
+///
+/// The default implementation builds a QDomElement and calls the DOM
+/// parse(), subclasses read the stream directly.
+///
+/// \param reader
+
+void QXmppStanza::parse(QXmlStreamReader *reader)
+{
+    QDomDocument document;
+    parse(helperReadDomElement(reader, document));
+}
+
+/// Reads the attributes common to all stanzas.
+///
+/// \param reader
+
+void QXmppStanza::parseAttributes(QXmlStreamReader *reader)
+{
+    const QXmlStreamAttributes attributes = reader->attributes();
+    d->from = attributes.value("from").toString();
+    d->to = attributes.value("to").toString();
+    d->id = attributes.value("id").toString();
+    d->lang = attributes.value("lang").toString();
+}
+
+/// Parses the stanza's error if the reader is positioned on an "error"
+/// child element, in which case true is returned.
+///
+/// \param reader
+
+bool QXmppStanza::parseError(QXmlStreamReader *reader)
+{
+    if (QXmppAtom::find(reader->name()) != QXmppAtom::Error)
+        return false;
+
+    // only the first error is considered, as for DOM parsing
+    if (d->error.isValid())
+        reader->skipCurrentElement();
+    else
+        d->error.parse(reader);
+    return true;
 }
 
@@ -26,6 +26,7 @@
 #define QXMPPSTANZA_H
 
 #include <QByteArray>
+#include <QSharedDataPointer>
 #include <QString>
 
 // forward declarations of QXmlStream* classes will not work on Mac, we need to
@@ -36,6 +37,8 @@
 
 #include "QXmppElement.h"
 
+class QXmppStanzaPrivate;
+
 /// \defgroup Stanzas
 
 /// \brief The QXmppStanza class is the base class for all XMPP stanzas.
@@ -104,6 +107,7 @@ public:
 
         /// \cond
         void parse(const QDomElement &element);
+        void parse(QXmlStreamReader *reader);
         void toXml(QXmlStreamWriter *writer) const;
         /// \endcond
 
@@ -121,8 +125,11 @@ public:
     };
 
     QXmppStanza(const QString& from = QString(), const QString& to = QString());
+    QXmppStanza(const QXmppStanza &other);
     ~QXmppStanza();
 
+    QXmppStanza& operator=(const QXmppStanza &other);
+
     QString to() const;
     void setTo(const QString&);
 
@@ -145,20 +152,17 @@ public:
     // FIXME : why is this needed?
     bool isErrorStanza() const;
     virtual void parse(const QDomElement &element);
+    virtual void parse(QXmlStreamReader *reader);
     virtual void toXml(QXmlStreamWriter *writer) const = 0;
 
 protected:
     void generateAndSetNextId();
+    void parseAttributes(QXmlStreamReader *reader);
+    bool parseError(QXmlStreamReader *reader);
     /// \endcond
 
 private:
-    static uint s_uniqeIdNo;
-    QString m_to;
-    QString m_from;
-    QString m_id;
-    QString m_lang;
-    QXmppStanza::Error m_error;
-    QXmppElementList m_extensions;
+    QSharedDataPointer<QXmppStanzaPrivate> d;
 };
 
 #endif // QXMPPSTANZA_H
@@ -27,20 +27,37 @@
 #include "QXmppLogger.h"
 #include "QXmppStanza.h"
 #include "QXmppStream.h"
+#include "QXmppStream_p.h"
 #include "QXmppUtils.h"
 
 #include <QBuffer>
 #include <QDomDocument>
+#include <QHash>
 #include <QHostAddress>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QRegExp>
+#include <QSslConfiguration>
 #include <QSslSocket>
+#include <QSet>
 #include <QStringList>
 #include <QTime>
+#include <QTimer>
 #include <QXmlStreamWriter>
 
 static bool randomSeeded = false;
 static const QByteArray streamRootElementEnd = "</stream:stream>";
 
+// amount of data we let the socket buffer before queueing by priority
+static const qint64 socketWindow = 65536;
+
+#if QT_VERSION >= 0x050400
+// TLS session tickets, indexed by peer name, shared by all streams
+typedef QHash<QString, QByteArray> QXmppSslSessionHash;
+Q_GLOBAL_STATIC(QXmppSslSessionHash, sslSessions)
+Q_GLOBAL_STATIC(QMutex, sslSessionsMutex)
+#endif
+
 class QXmppStreamPrivate
 {
 public:
@@ -51,13 +68,199 @@ public:
 
     // stream state
     QByteArray streamStart;
+
+    // name of the peer whose TLS session we resume
+    QString sslPeerName;
+
+    // traffic
+    qint64 bytesReceived;
+    qint64 bytesSent;
+
+    // output queue
+    qint64 backlog() const;
+    bool write(const QByteArray &data);
+
+    QXmppOutputQueue outputQueue;
+    qint64 coalescedSize;
+    qint64 lowWaterMark;
+    qint64 highWaterMark;
+    QTimer *slowConsumerTimer;
 };
 
 QXmppStreamPrivate::QXmppStreamPrivate()
-    : socket(0)
+    : socket(0),
+    bytesReceived(0),
+    bytesSent(0),
+    coalescedSize(0),
+    lowWaterMark(0),
+    highWaterMark(0),
+    slowConsumerTimer(0)
+{
+}
+
+/// Returns the amount of data buffered by the socket.
+
+qint64 QXmppStreamPrivate::backlog() const
+{
+    return socket->bytesToWrite() + socket->encryptedBytesToWrite();
+}
+
+/// Writes data to the socket.
+
+bool QXmppStreamPrivate::write(const QByteArray &data)
+{
+    const qint64 written = socket->write(data);
+    if (written > 0)
+        bytesSent += written;
+    return written == data.size();
+}
+
+static QByteArray attributeValue(const QByteArray &tag, const char *name)
+{
+    const QByteArray needle = QByteArray(" ") + name + "=";
+    int pos = tag.indexOf(needle);
+    if (pos < 0)
+        return QByteArray();
+    pos += needle.size();
+    if (pos >= tag.size() || (tag.at(pos) != '\'' && tag.at(pos) != '"'))
+        return QByteArray();
+    const int end = tag.indexOf(tag.at(pos), pos + 1);
+    if (end < 0)
+        return QByteArray();
+    return tag.mid(pos + 1, end - pos - 1);
+}
+
+QXmppOutputQueue::QXmppOutputQueue()
+    : m_size(0)
 {
 }
 
+/// Returns the priority of the given serialised element.
+///
+/// \param data
+/// \param key If not null, receives the key identifying presence
+/// broadcasts which supersede each other, or an empty key if the data
+/// must never be dropped.
+
+QXmppOutputQueue::Priority QXmppOutputQueue::priority(const QByteArray &data, QByteArray *key)
+{
+    if (key)
+        key->clear();
+
+    // only look at the start tag
+    int end = data.indexOf('>');
+    if (end < 0)
+        end = data.size();
+    const QByteArray tag = data.left(end);
+
+    if (tag.startsWith("<iq ") || tag.startsWith("<iq>")) {
+        const QByteArray type = attributeValue(tag, "type");
+        if (type == "result" || type == "error")
+            return HighPriority;
+        return NormalPriority;
+    } else if (tag.startsWith("<message")) {
+        return NormalPriority;
+    } else if (tag.startsWith("<presence")) {
+        // subscription requests, probes and errors must be delivered
+        const QByteArray type = attributeValue(tag, "type");
+        if (!type.isEmpty() && type != "unavailable")
+            return NormalPriority;
+        if (key)
+            *key = attributeValue(tag, "from") + ' ' + attributeValue(tag, "to");
+        return LowPriority;
+    }
+    return HighPriority;
+}
+
+/// Adds data to the queue.
+///
+/// \param data
+
+void QXmppOutputQueue::enqueue(const QByteArray &data)
+{
+    Entry entry;
+    entry.data = data;
+    const Priority p = priority(data, &entry.key);
+    m_entries[p].append(entry);
+    m_size += data.size();
+}
+
+/// Removes and returns the oldest data with the highest priority.
+
+QByteArray QXmppOutputQueue::dequeue()
+{
+    for (int p = 0; p < PriorityCount; ++p) {
+        if (!m_entries[p].isEmpty()) {
+            const QByteArray data = m_entries[p].takeFirst().data;
+            m_size -= data.size();
+            return data;
+        }
+    }
+    return QByteArray();
+}
+
+/// Removes all the queued data.
+
+void QXmppOutputQueue::clear()
+{
+    for (int p = 0; p < PriorityCount; ++p)
+        m_entries[p].clear();
+    m_size = 0;
+}
+
+/// Drops presence broadcasts which are superseded by a more recent one
+/// with the same sender and recipient.
+///
+/// Returns the number of dropped elements.
+
+int QXmppOutputQueue::coalesce()
+{
+    QList<Entry> &entries = m_entries[LowPriority];
+    QSet<QByteArray> seen;
+    int removed = 0;
+    for (int i = entries.size() - 1; i >= 0; --i) {
+        const QByteArray &key = entries.at(i).key;
+        if (key.isEmpty())
+            continue;
+        if (seen.contains(key)) {
+            m_size -= entries.at(i).data.size();
+            entries.removeAt(i);
+            removed++;
+        } else {
+            seen.insert(key);
+        }
+    }
+    return removed;
+}
+
+/// Returns the number of queued elements.
+
+int QXmppOutputQueue::count() const
+{
+    int total = 0;
+    for (int p = 0; p < PriorityCount; ++p)
+        total += m_entries[p].size();
+    return total;
+}
+
+/// Returns true if the queue is empty.
+
+bool QXmppOutputQueue::isEmpty() const
+{
+    for (int p = 0; p < PriorityCount; ++p) {
+        if (!m_entries[p].isEmpty())
+            return false;
+    }
+    return true;
+}
+
+/// Returns the number of queued bytes.
+
+qint64 QXmppOutputQueue::size() const
+{
+    return m_size;
+}
+
 /// Constructs a base XMPP stream.
 ///
 /// \param parent
@@ -72,6 +275,14 @@ QXmppStream::QXmppStream(QObject *parent)
         qsrand(QTime(0,0,0).secsTo(QTime::currentTime()));
         randomSeeded = true;
     }
+
+    d->slowConsumerTimer = new QTimer(this);
+    d->slowConsumerTimer->setInterval(30000);
+    d->slowConsumerTimer->setSingleShot(true);
+    bool check = connect(d->slowConsumerTimer, SIGNAL(timeout()),
+                         this, SLOT(_q_slowConsumerTimeout()));
+    Q_ASSERT(check);
+    Q_UNUSED(check);
 }
 
 /// Destroys a base XMPP stream.
@@ -86,14 +297,37 @@ QXmppStream::~QXmppStream()
 
 void QXmppStream::disconnectFromHost()
 {
-    sendData(streamRootElementEnd);
+    if (isLoggingEnabled(QXmppLogger::SentMessage))
+        logSent(QString::fromUtf8(streamRootElementEnd));
     if (d->socket)
     {
+        // queued data must go out before the end of the stream
+        if (d->socket->state() == QAbstractSocket::ConnectedState) {
+            while (!d->outputQueue.isEmpty())
+                d->write(d->outputQueue.dequeue());
+            d->write(streamRootElementEnd);
+        }
+        d->outputQueue.clear();
+        d->slowConsumerTimer->stop();
         d->socket->flush();
         d->socket->disconnectFromHost();
     }
 }
 
+/// Hands all the queued data to the socket, regardless of the socket's
+/// backlog, for instance before the socket is detached from the stream.
+
+void QXmppStream::flushOutputQueue()
+{
+    if (!d->socket)
+        return;
+
+    while (!d->outputQueue.isEmpty())
+        d->write(d->outputQueue.dequeue());
+    d->slowConsumerTimer->stop();
+    d->socket->flush();
+}
+
 /// Handles a stream start event, which occurs when the underlying transport
 /// becomes ready (socket connected, encryption started).
 ///
@@ -120,10 +354,129 @@ bool QXmppStream::isConnected() const
 
 bool QXmppStream::sendData(const QByteArray &data)
 {
-    logSent(QString::fromUtf8(data));
+    if (isLoggingEnabled(QXmppLogger::SentMessage))
+        logSent(QString::fromUtf8(data));
     if (!d->socket || d->socket->state() != QAbstractSocket::ConnectedState)
         return false;
-    return d->socket->write(data) == data.size();
+
+    // only hand data to the socket while its buffer is short, so that
+    // urgent data can overtake the rest
+    if (d->outputQueue.isEmpty() && d->backlog() < socketWindow)
+        return d->write(data);
+
+    d->outputQueue.enqueue(data);
+    checkOutputQueue();
+    return true;
+}
+
+/// Checks the size of the output queue against the watermarks.
+
+void QXmppStream::checkOutputQueue()
+{
+    if (d->highWaterMark <= 0)
+        return;
+
+    qint64 size = d->outputQueue.size();
+    if (size > d->highWaterMark) {
+        // drop superseded presences, but avoid rescanning on every stanza
+        if (size > d->coalescedSize + d->highWaterMark / 4) {
+            const int removed = d->outputQueue.coalesce();
+            if (removed)
+                debug(QString("Dropped %1 superseded presences from output queue").arg(removed));
+            size = d->outputQueue.size();
+            d->coalescedSize = size;
+        }
+
+        if (size > 4 * d->highWaterMark) {
+            // give up on the peer immediately
+            d->slowConsumerTimer->start(0);
+        } else if (size > d->highWaterMark && !d->slowConsumerTimer->isActive()) {
+            d->slowConsumerTimer->start();
+        }
+    } else if (size <= d->lowWaterMark) {
+        d->coalescedSize = 0;
+        d->slowConsumerTimer->stop();
+    }
+}
+
+/// Returns the number of bytes waiting in the stream's output queue.
+///
+/// Data is only queued by the stream once the socket's own buffer holds
+/// more than 64kB.
+
+qint64 QXmppStream::outputQueueSize() const
+{
+    return d->outputQueue.size();
+}
+
+/// Returns the output queue size below which the stream is no longer
+/// considered congested.
+///
+
+qint64 QXmppStream::lowWaterMark() const
+{
+    return d->lowWaterMark;
+}
+
+/// Returns the output queue size above which superseded presences are
+/// dropped and the stream is considered congested.
+///
+/// A value of 0, which is the default, means the queue is not limited.
+
+qint64 QXmppStream::highWaterMark() const
+{
+    return d->highWaterMark;
+}
+
+/// Sets the output queue watermarks, in bytes.
+///
+/// When more than \a high bytes are queued, presence broadcasts which are
+/// superseded by a more recent one are dropped. If the queue then stays
+/// above \a low bytes for longer than slowConsumerTimeout(), or grows
+/// beyond four times \a high, the connection is aborted.
+///
+/// \param low
+/// \param high
+
+void QXmppStream::setWaterMarks(qint64 low, qint64 high)
+{
+    d->lowWaterMark = qMin(low, high);
+    d->highWaterMark = high;
+}
+
+/// Returns the number of seconds a congested stream is given to catch up
+/// before it is disconnected.
+///
+
+int QXmppStream::slowConsumerTimeout() const
+{
+    return d->slowConsumerTimer->interval() / 1000;
+}
+
+/// Sets the number of seconds a congested stream is given to catch up
+/// before it is disconnected, the default is 30.
+///
+/// \param secs
+
+void QXmppStream::setSlowConsumerTimeout(int secs)
+{
+    d->slowConsumerTimer->setInterval(secs * 1000);
+}
+
+/// Returns the number of bytes received on the stream.
+///
+
+qint64 QXmppStream::bytesReceived() const
+{
+    return d->bytesReceived;
+}
+
+/// Returns the number of bytes sent on the stream.
+///
+
+qint64 QXmppStream::bytesSent() const
+{
+    return d->bytesSent;
 }
 
 /// Sends an XMPP packet to the peer.
@@ -141,6 +494,44 @@ bool QXmppStream::sendPacket(const QXmppStanza &packet)
     return sendData(data);
 }
 
+/// Starts client-side encryption on the stream's socket.
+///
+/// If a TLS session was previously established with the same peer, it is
+/// offered to the server so that the connection can be resumed using an
+/// abbreviated handshake instead of a full one.
+///
+/// \param peerName The name the peer's certificate is verified against,
+/// which is also used to look up the TLS session.
+
+void QXmppStream::startClientEncryption(const QString &peerName)
+{
+    if (!d->socket)
+        return;
+
+    d->sslPeerName = peerName;
+#if QT_VERSION >= 0x040800
+    if (!peerName.isEmpty())
+        d->socket->setPeerVerifyName(peerName);
+#endif
+
+#if QT_VERSION >= 0x050400
+    QSslConfiguration config = d->socket->sslConfiguration();
+    config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    if (!peerName.isEmpty()) {
+        QMutexLocker locker(sslSessionsMutex());
+        const QByteArray ticket = sslSessions()->value(peerName);
+        if (!ticket.isEmpty()) {
+            debug(QString("Resuming TLS session with %1").arg(peerName));
+            config.setSessionTicket(ticket);
+        }
+    }
+    d->socket->setSslConfiguration(config);
+#endif
+
+    debug("Starting encryption");
+    d->socket->startClientEncryption();
+}
+
 /// Returns the QSslSocket used for this stream.
 ///
 
@@ -151,12 +542,19 @@ QSslSocket *QXmppStream::socket() const
 
 /// Sets the QSslSocket used for this stream.
 ///
+/// If the stream already had a socket, it stops listening to it,
+/// but the previous socket is not deleted.
+///
 
 void QXmppStream::setSocket(QSslSocket *socket)
 {
     bool check;
     Q_UNUSED(check);
 
+    // stop listening to the previous socket
+    if (d->socket)
+        d->socket->disconnect(this);
+
     d->socket = socket;
     if (!d->socket)
         return;
@@ -181,10 +579,23 @@ void QXmppStream::setSocket(QSslSocket *socket)
                     this, SLOT(_q_socketReadyRead()));
     Q_ASSERT(check);
 
+    check = connect(socket, SIGNAL(bytesWritten(qint64)),
+                    this, SLOT(_q_socketBytesWritten()));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(encryptedBytesWritten(qint64)),
+                    this, SLOT(_q_socketBytesWritten()));
+    Q_ASSERT(check);
+
     // relay signals
     check = connect(socket, SIGNAL(disconnected()),
                     this, SIGNAL(disconnected()));
     Q_ASSERT(check);
+
+    // the socket may already hold data, for instance if its TLS handshake
+    // was performed in another thread
+    if (socket->bytesAvailable())
+        QMetaObject::invokeMethod(this, "_q_socketReadyRead", Qt::QueuedConnection);
 }
 
 void QXmppStream::_q_socketConnected()
@@ -195,14 +606,49 @@ void QXmppStream::_q_socketConnected()
     handleStart();
 }
 
+void QXmppStream::_q_socketBytesWritten()
+{
+    if (d->outputQueue.isEmpty() || d->socket->state() != QAbstractSocket::ConnectedState)
+        return;
+
+    while (!d->outputQueue.isEmpty() && d->backlog() < socketWindow)
+        d->write(d->outputQueue.dequeue());
+    checkOutputQueue();
+}
+
 void QXmppStream::_q_socketDisconnected()
 {
     info("Socket disconnected");
+    d->outputQueue.clear();
+    d->slowConsumerTimer->stop();
+}
+
+void QXmppStream::_q_slowConsumerTimeout()
+{
+    if (!d->socket || d->outputQueue.size() <= d->lowWaterMark)
+        return;
+
+    warning(QString("Disconnecting slow peer with %1 bytes in output queue").arg(
+        QString::number(d->outputQueue.size())));
+    d->outputQueue.clear();
+    d->socket->abort();
 }
 
 void QXmppStream::_q_socketEncrypted()
 {
     debug("Socket encrypted");
+
+#if QT_VERSION >= 0x050400
+    // remember the TLS session so that the next connection can resume it
+    if (!d->sslPeerName.isEmpty() && d->socket->mode() == QSslSocket::SslClientMode) {
+        const QByteArray ticket = d->socket->sslConfiguration().sessionTicket();
+        if (!ticket.isEmpty()) {
+            QMutexLocker locker(sslSessionsMutex());
+            sslSessions()->insert(d->sslPeerName, ticket);
+        }
+    }
+#endif
+
     handleStart();
 }
 
@@ -214,7 +660,9 @@ void QXmppStream::_q_socketError(QAbstractSocket::SocketError socketError)
 
 void QXmppStream::_q_socketReadyRead()
 {
-    d->dataBuffer.append(d->socket->readAll());
+    const QByteArray data = d->socket->readAll();
+    d->bytesReceived += data.size();
+    d->dataBuffer.append(data);
 
     // handle whitespace pings
     if (!d->dataBuffer.isEmpty() && d->dataBuffer.trimmed().isEmpty()) {
@@ -245,7 +693,8 @@ void QXmppStream::_q_socketReadyRead()
         return;
 
     // remove data from buffer
-    logReceived(strData);
+    if (isLoggingEnabled(QXmppLogger::ReceivedMessage))
+        logReceived(strData);
     d->dataBuffer.clear();
     if (streamStart)
         d->streamStart = startStreamRegex.cap(0).toUtf8();
@@ -49,6 +49,16 @@ public:
     virtual bool isConnected() const;
     bool sendPacket(const QXmppStanza&);
 
+    qint64 bytesReceived() const;
+    qint64 bytesSent() const;
+
+    qint64 outputQueueSize() const;
+    qint64 lowWaterMark() const;
+    qint64 highWaterMark() const;
+    void setWaterMarks(qint64 low, qint64 high);
+    int slowConsumerTimeout() const;
+    void setSlowConsumerTimeout(int secs);
+
 signals:
     /// This signal is emitted when the stream is connected.
     void connected();
@@ -60,6 +70,8 @@ protected:
     // Access to underlying socket
     QSslSocket *socket() const;
     void setSocket(QSslSocket *socket);
+    void flushOutputQueue();
+    void startClientEncryption(const QString &peerName);
 
     // Overridable methods
     virtual void handleStart();
@@ -79,6 +91,8 @@ public slots:
     virtual bool sendData(const QByteArray&);
 
 private slots:
+    void _q_slowConsumerTimeout();
+    void _q_socketBytesWritten();
     void _q_socketConnected();
     void _q_socketDisconnected();
     void _q_socketEncrypted();
@@ -86,6 +100,8 @@ private slots:
     void _q_socketReadyRead();
 
 private:
+    void checkOutputQueue();
+
     QXmppStreamPrivate * const d;
 };
 
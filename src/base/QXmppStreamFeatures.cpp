@@ -23,6 +23,7 @@
 
 #include <QDomElement>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppSaslAuth.h"
 #include "QXmppStreamFeatures.h"
@@ -123,8 +124,8 @@ void QXmppStreamFeatures::setTlsMode(QXmppStreamFeatures::Mode mode)
 
 bool QXmppStreamFeatures::isStreamFeatures(const QDomElement &element)
 {
-    return element.namespaceURI() == ns_stream &&
-           element.tagName() == "features";
+    return QXmppAtom::namespaceUri(element) == QXmppAtom::NsStream &&
+           QXmppAtom::tagName(element) == QXmppAtom::Features;
 }
 
 static QXmppStreamFeatures::Mode readFeature(const QDomElement &element, const char *tagName, const char *tagNs)
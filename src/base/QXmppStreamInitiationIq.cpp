@@ -23,6 +23,7 @@
 
 #include <QDomElement>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppStreamInitiationIq.h"
 #include "QXmppUtils.h"
@@ -69,8 +70,7 @@ void QXmppStreamInitiationIq::setSiItems(const QXmppElementList &items)
 
 bool QXmppStreamInitiationIq::isStreamInitiationIq(const QDomElement &element)
 {
-    QDomElement siElement = element.firstChildElement("si");
-    return (siElement.namespaceURI() == ns_stream_initiation);
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Si, QXmppAtom::NsStreamInitiation);
 }
 
 void QXmppStreamInitiationIq::parseElementFromChild(const QDomElement &element)
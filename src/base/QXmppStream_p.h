@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSTREAM_P_H
+#define QXMPPSTREAM_P_H
+
+#include <QByteArray>
+#include <QList>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+/// \brief The QXmppOutputQueue class holds serialised stanzas waiting to
+/// be written to a stream, ordered by priority.
+///
+/// IQ results and errors, as well as stream-level elements, are sent
+/// first, then messages and requests, then presences. Presence broadcasts
+/// are tagged with their sender and recipient, so that when a stream falls
+/// behind, an older broadcast can be replaced by a newer one.
+///
+
+class QXMPP_EXPORT QXmppOutputQueue
+{
+public:
+    /// This enum describes the priority of queued data.
+    enum Priority
+    {
+        HighPriority = 0,   ///< IQ results and errors, stream elements
+        NormalPriority,     ///< Messages, IQ requests, subscriptions
+        LowPriority,        ///< Presence broadcasts
+        PriorityCount
+    };
+
+    QXmppOutputQueue();
+
+    static Priority priority(const QByteArray &data, QByteArray *key = 0);
+
+    void enqueue(const QByteArray &data);
+    QByteArray dequeue();
+    void clear();
+    int coalesce();
+
+    int count() const;
+    bool isEmpty() const;
+    qint64 size() const;
+
+private:
+    struct Entry
+    {
+        QByteArray data;
+        QByteArray key;
+    };
+    QList<Entry> m_entries[PriorityCount];
+    qint64 m_size;
+};
+
+#endif
@@ -22,6 +22,7 @@
  *
  */
 
+#include <cstring>
 
 #include <QBuffer>
 #include <QByteArray>
@@ -29,14 +30,124 @@
 #include <QDateTime>
 #include <QDebug>
 #include <QDomElement>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QRegExp>
 #include <QString>
 #include <QStringList>
 #include <QXmlStreamWriter>
 
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <wincrypt.h>
+#elif defined(Q_OS_UNIX)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "QXmppUtils.h"
 #include "QXmppLogger.h"
 
+/// A pool of random bytes read in bulk from the operating system's
+/// cryptographically secure generator.
+
+class QXmppRandomPool
+{
+public:
+    QXmppRandomPool();
+    ~QXmppRandomPool();
+    void fill(char *data, int length);
+
+private:
+    bool readSystem(char *data, int length);
+
+    QMutex mutex;
+    char buffer[4096];
+    int available;
+#if defined(Q_OS_WIN)
+    HCRYPTPROV provider;
+#elif defined(Q_OS_UNIX)
+    int fd;
+#endif
+};
+
+QXmppRandomPool::QXmppRandomPool()
+    : available(0)
+{
+#if defined(Q_OS_WIN)
+    if (!CryptAcquireContext(&provider, 0, 0, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT | CRYPT_SILENT))
+        provider = 0;
+#elif defined(Q_OS_UNIX)
+    fd = ::open("/dev/urandom", O_RDONLY);
+#endif
+}
+
+QXmppRandomPool::~QXmppRandomPool()
+{
+#if defined(Q_OS_WIN)
+    if (provider)
+        CryptReleaseContext(provider, 0);
+#elif defined(Q_OS_UNIX)
+    if (fd >= 0)
+        ::close(fd);
+#endif
+}
+
+/// Fills the given buffer with random bytes.
+
+void QXmppRandomPool::fill(char *data, int length)
+{
+    QMutexLocker locker(&mutex);
+
+    // large requests bypass the pool
+    if (length > int(sizeof(buffer)) && readSystem(data, length))
+        return;
+
+    while (length > 0) {
+        if (!available) {
+            if (!readSystem(buffer, sizeof(buffer))) {
+                // no system generator, fall back to qrand()
+                for (unsigned int i = 0; i < sizeof(buffer); ++i)
+                    buffer[i] = char(qrand() >> 4);
+            }
+            available = sizeof(buffer);
+        }
+
+        // consume bytes from the end of the pool, and never reuse them
+        const int chunk = qMin(length, available);
+        available -= chunk;
+        memcpy(data, buffer + available, chunk);
+        memset(buffer + available, 0, chunk);
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+bool QXmppRandomPool::readSystem(char *data, int length)
+{
+#if defined(Q_OS_WIN)
+    return provider && CryptGenRandom(provider, length, reinterpret_cast<BYTE*>(data));
+#elif defined(Q_OS_UNIX)
+    while (fd >= 0 && length > 0) {
+        const ssize_t n = ::read(fd, data, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return fd >= 0;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(length);
+    return false;
+#endif
+}
+
+Q_GLOBAL_STATIC(QXmppRandomPool, randomPool)
+
 // adapted from public domain source by Ross Williams and Eric Durbin
 // FIXME : is this valid for big-endian machines?
 static quint32 crctable[256] =
@@ -185,7 +296,12 @@ QString QXmppUtils::timezoneOffsetToString(int secs)
 
 QString QXmppUtils::jidToDomain(const QString &jid)
 {
-    return jidToBareJid(jid).split("@").last();
+    const int slash = jid.indexOf(QChar('/'));
+    const int end = slash < 0 ? jid.size() : slash;
+    if (!end)
+        return QString();
+    const int at = jid.lastIndexOf(QChar('@'), end - 1);
+    return jid.mid(at + 1, end - at - 1);
 }
 
 QString QXmppUtils::jidToResource(const QString& jid)
@@ -224,8 +340,10 @@ static QByteArray generateHmac(QCryptographicHash::Algorithm algorithm, const QB
 {
     QCryptographicHash hasher(algorithm);
 
+    // keys longer than the block size are hashed first (RFC 2104)
     const int B = 64;
-    QByteArray kpad = key + QByteArray(B - key.size(), 0);
+    QByteArray kpad = (key.size() > B) ? QCryptographicHash::hash(key, algorithm) : key;
+    kpad += QByteArray(B - kpad.size(), 0);
 
     QByteArray ba;
     for (int i = 0; i < B; ++i)
@@ -253,27 +371,41 @@ QByteArray QXmppUtils::generateHmacSha1(const QByteArray &key, const QByteArray
     return generateHmac(QCryptographicHash::Sha1, key, text);
 }
 
+#if QT_VERSION >= 0x050000
+QByteArray QXmppUtils::generateHmacSha256(const QByteArray &key, const QByteArray &text)
+{
+    return generateHmac(QCryptographicHash::Sha256, key, text);
+}
+#endif
+
 /// Generates a random integer x between 0 and N-1.
 ///
 /// \param N
 
 int QXmppUtils::generateRandomInteger(int N)
 {
-    Q_ASSERT(N > 0 && N <= RAND_MAX);
-    int val;
-    while (N <= (val = qrand() / (RAND_MAX/N))) {};
-    return val;
+    Q_ASSERT(N > 0);
+
+    // reject values which would bias the result
+    const quint32 limit = 0xffffffffu - (0xffffffffu % quint32(N));
+    quint32 val;
+    do {
+        randomPool()->fill(reinterpret_cast<char*>(&val), sizeof(val));
+    } while (val >= limit);
+    return val % quint32(N);
 }
 
 /// Returns a random byte array of the specified size.
 ///
+/// The bytes come from the operating system's cryptographically secure
+/// generator, which is read in bulk.
+///
 /// \param length
 
 QByteArray QXmppUtils::generateRandomBytes(int length)
 {
-    QByteArray bytes(length, 'm');
-    for (int i = 0; i < length; ++i)
-        bytes[i] = (char)generateRandomInteger(256);
+    QByteArray bytes(length, '\0');
+    randomPool()->fill(bytes.data(), length);
     return bytes;
 }
 
@@ -283,12 +415,22 @@ QByteArray QXmppUtils::generateRandomBytes(int length)
 
 QString QXmppUtils::generateStanzaHash(int length)
 {
-    const QString somechars = "1234567890abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    const int N = somechars.size();
-    QString hashResult;
-    for ( int idx = 0; idx < length; ++idx )
-        hashResult += somechars[generateRandomInteger(N)];
-    return hashResult;
+    static const char somechars[] = "1234567890abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    const int N = sizeof(somechars) - 1;
+
+    // each random byte below 4 * N maps to one character without bias,
+    // so draw a few more bytes than needed and only retry if we ran out
+    QByteArray hashResult;
+    hashResult.reserve(length);
+    while (hashResult.size() < length) {
+        const QByteArray random = generateRandomBytes(length - hashResult.size() + 8);
+        for (int i = 0; i < random.size() && hashResult.size() < length; ++i) {
+            const quint8 val = random.at(i);
+            if (val < 4 * N)
+                hashResult += somechars[val % N];
+        }
+    }
+    return QString::fromLatin1(hashResult.constData(), hashResult.size());
 }
 
 void helperToXmlAddAttribute(QXmlStreamWriter* stream, const QString& name,
@@ -307,3 +449,62 @@ void helperToXmlAddTextElement(QXmlStreamWriter* stream, const QString& name,
         stream->writeEmptyElement(name);
 }
 
+/// Builds a QDomElement from a QXmlStreamReader positioned on its start
+/// element, for code which only knows how to parse DOM elements. On return
+/// the reader is positioned on the element's end element.
+
+QDomElement helperReadDomElement(QXmlStreamReader *reader, QDomDocument &document)
+{
+    QDomElement element = document.createElementNS(
+        reader->namespaceUri().toString(), reader->qualifiedName().toString());
+    foreach (const QXmlStreamAttribute &attr, reader->attributes()) {
+        if (attr.namespaceUri().isEmpty())
+            element.setAttribute(attr.qualifiedName().toString(), attr.value().toString());
+        else
+            element.setAttributeNS(attr.namespaceUri().toString(), attr.qualifiedName().toString(), attr.value().toString());
+    }
+
+    while (!reader->atEnd()) {
+        reader->readNext();
+        if (reader->isStartElement())
+            element.appendChild(helperReadDomElement(reader, document));
+        else if (reader->isCharacters() && !reader->isWhitespace())
+            element.appendChild(document.createTextNode(reader->text().toString()));
+        else if (reader->isEndElement())
+            break;
+    }
+    return element;
+}
+
+/// Writes a QDomElement to a QXmlStreamWriter, omitting the xmlns
+/// attribute of the given namespaces.
+
+void helperToXmlAddDomElement(QXmlStreamWriter* stream, const QDomElement& element, const QStringList &omitNamespaces)
+{
+    stream->writeStartElement(element.tagName());
+
+    /* attributes */
+    QString xmlns = element.namespaceURI();
+    if (!xmlns.isEmpty() && !omitNamespaces.contains(xmlns))
+        stream->writeAttribute("xmlns", xmlns);
+    QDomNamedNodeMap attrs = element.attributes();
+    for (int i = 0; i < attrs.size(); i++)
+    {
+        QDomAttr attr = attrs.item(i).toAttr();
+        stream->writeAttribute(attr.name(), attr.value());
+    }
+
+    /* children */
+    QDomNode childNode = element.firstChild();
+    while (!childNode.isNull())
+    {
+        if (childNode.isElement())
+        {
+            helperToXmlAddDomElement(stream, childNode.toElement(), QStringList() << xmlns);
+        } else if (childNode.isText()) {
+            stream->writeCharacters(childNode.toText().data());
+        }
+        childNode = childNode.nextSibling();
+    }
+    stream->writeEndElement();
+}
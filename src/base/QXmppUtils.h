@@ -36,6 +36,7 @@
 
 class QByteArray;
 class QDateTime;
+class QDomDocument;
 class QDomElement;
 class QString;
 class QStringList;
@@ -59,6 +60,9 @@ public:
     static quint32 generateCrc32(const QByteArray &input);
     static QByteArray generateHmacMd5(const QByteArray &key, const QByteArray &text);
     static QByteArray generateHmacSha1(const QByteArray &key, const QByteArray &text);
+#if QT_VERSION >= 0x050000
+    static QByteArray generateHmacSha256(const QByteArray &key, const QByteArray &text);
+#endif
     static int generateRandomInteger(int N);
     static QByteArray generateRandomBytes(int length);
     static QString generateStanzaHash(int length=32);
@@ -68,5 +72,8 @@ void helperToXmlAddAttribute(QXmlStreamWriter* stream, const QString& name,
                              const QString& value);
 void helperToXmlAddTextElement(QXmlStreamWriter* stream, const QString& name,
                            const QString& value);
+QDomElement helperReadDomElement(QXmlStreamReader *reader, QDomDocument &document);
+void helperToXmlAddDomElement(QXmlStreamWriter* stream, const QDomElement& element,
+                              const QStringList &omitNamespaces);
 
 #endif // QXMPPUTILS_H
@@ -25,6 +25,7 @@
 #include <QBuffer>
 #include <QXmlStreamWriter>
 
+#include "QXmppAtom.h"
 #include "QXmppVCardIq.h"
 #include "QXmppUtils.h"
 #include "QXmppConstants.h"
@@ -237,7 +238,7 @@ void QXmppVCardIq::setPhotoType(const QString& photoType)
 
 bool QXmppVCardIq::isVCard(const QDomElement &nodeRecv)
 {
-    return nodeRecv.firstChildElement("vCard").namespaceURI() == ns_vcard;
+    return QXmppAtom::hasChildElement(nodeRecv, QXmppAtom::VCard, QXmppAtom::NsVCard);
 }
 
 void QXmppVCardIq::parseElementFromChild(const QDomElement& nodeRecv)
@@ -23,6 +23,7 @@
 
 #include <QDomElement>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppUtils.h"
 #include "QXmppVersionIq.h"
@@ -80,8 +81,7 @@ void QXmppVersionIq::setVersion(const QString &version)
 
 bool QXmppVersionIq::isVersionIq(const QDomElement &element)
 {
-    QDomElement queryElement = element.firstChildElement("query");
-    return queryElement.namespaceURI() == ns_version;
+    return QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsVersion);
 }
 
 void QXmppVersionIq::parseElementFromChild(const QDomElement &element)
@@ -92,6 +92,28 @@ void QXmppVersionIq::parseElementFromChild(const QDomElement &element)
     m_version = queryElement.firstChildElement("version").text();
 }
 
+void QXmppVersionIq::parseElementFromChild(QXmlStreamReader *reader)
+{
+    while (reader->readNextStartElement()) {
+        if (parseError(reader))
+            continue;
+        if (reader->name() != "query") {
+            reader->skipCurrentElement();
+            continue;
+        }
+        while (reader->readNextStartElement()) {
+            if (reader->name() == "name")
+                m_name = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+            else if (reader->name() == "os")
+                m_os = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+            else if (reader->name() == "version")
+                m_version = reader->readElementText(QXmlStreamReader::IncludeChildElements);
+            else
+                reader->skipCurrentElement();
+        }
+    }
+}
+
 void QXmppVersionIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement("query");
@@ -50,6 +50,7 @@ public:
 protected:
     /// \cond
     void parseElementFromChild(const QDomElement &element);
+    void parseElementFromChild(QXmlStreamReader *reader);
     void toXmlElementFromChild(QXmlStreamWriter *writer) const;
     /// \endcond
 
@@ -3,6 +3,7 @@ INSTALL_HEADERS += \
     base/qdnslookup.h \
     base/qdnslookup_p.h \
     base/QXmppArchiveIq.h \
+    base/QXmppAtom.h \
     base/QXmppBindIq.h \
     base/QXmppBookmarkSet.h \
     base/QXmppByteStreamIq.h \
@@ -15,6 +16,7 @@ INSTALL_HEADERS += \
     base/QXmppGlobal.h \
     base/QXmppIbbIq.h \
     base/QXmppIq.h \
+    base/QXmppJid.h \
     base/QXmppJingleIq.h \
     base/QXmppLogger.h \
     base/QXmppMessage.h \
@@ -29,9 +31,11 @@ INSTALL_HEADERS += \
     base/QXmppRtpChannel.h \
     base/QXmppSaslAuth.h \
     base/QXmppSessionIq.h \
+    base/QXmppSocketConnector.h \
     base/QXmppSocks.h \
     base/QXmppStanza.h \
     base/QXmppStream.h \
+    base/QXmppStream_p.h \
     base/QXmppStreamFeatures.h \
     base/QXmppStreamInitiationIq.h \
     base/QXmppStun.h \
@@ -42,6 +46,7 @@ INSTALL_HEADERS += \
 # Source files
 SOURCES += \
     base/QXmppArchiveIq.cpp \
+    base/QXmppAtom.cpp \
     base/QXmppBindIq.cpp \
     base/QXmppBookmarkSet.cpp \
     base/QXmppByteStreamIq.cpp \
@@ -54,6 +59,7 @@ SOURCES += \
     base/QXmppGlobal.cpp \
     base/QXmppIbbIq.cpp \
     base/QXmppIq.cpp \
+    base/QXmppJid.cpp \
     base/QXmppJingleIq.cpp \
     base/QXmppLogger.cpp \
     base/QXmppMessage.cpp \
@@ -68,6 +74,7 @@ SOURCES += \
     base/QXmppRtpChannel.cpp \
     base/QXmppSaslAuth.cpp \
     base/QXmppSessionIq.cpp \
+    base/QXmppSocketConnector.cpp \
     base/QXmppSocks.cpp \
     base/QXmppStanza.cpp \
     base/QXmppStream.cpp \
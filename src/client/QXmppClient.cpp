@@ -154,7 +154,7 @@ QXmppClient::QXmppClient(QObject *parent)
                     this, SIGNAL(iqReceived(QXmppIq)));
     Q_ASSERT(check);
 
-    check = connect(d->stream->socket(), SIGNAL(stateChanged(QAbstractSocket::SocketState)),
+    check = connect(d->stream, SIGNAL(socketStateChanged(QAbstractSocket::SocketState)),
                     this, SLOT(_q_socketStateChanged(QAbstractSocket::SocketState)));
     Q_ASSERT(check);
 
@@ -205,6 +205,10 @@ QXmppClient::QXmppClient(QObject *parent)
     addSaslMechanism(new QXmppSaslDigestMd5);
     addSaslMechanism(new QXmppSaslPlain);
     addSaslMechanism(new QXmppSaslFacebook);
+    addSaslMechanism(new QXmppSaslScram(QCryptographicHash::Sha1));
+#if QT_VERSION >= 0x050000
+    addSaslMechanism(new QXmppSaslScram(QCryptographicHash::Sha256));
+#endif
 }
 
 /// Destructor, destroys the QXmppClient object.
@@ -421,8 +425,9 @@ QXmppClient::State QXmppClient::state() const
 {
     if (d->stream->isConnected())
         return QXmppClient::ConnectedState;
-    else if (d->stream->socket()->state() != QAbstractSocket::UnconnectedState &&
-             d->stream->socket()->state() != QAbstractSocket::ClosingState)
+    else if (d->stream->isConnecting() ||
+             (d->stream->socket()->state() != QAbstractSocket::UnconnectedState &&
+              d->stream->socket()->state() != QAbstractSocket::ClosingState))
         return QXmppClient::ConnectingState;
     else
         return QXmppClient::DisconnectedState;
@@ -518,7 +523,7 @@ bool QXmppClient::setReconnectionManager(QXmppReconnectionManager*
 
 QAbstractSocket::SocketError QXmppClient::socketError()
 {
-    return d->stream->socket()->error();
+    return d->stream->socketError();
 }
 
 /// Returns the XMPP stream error if QXmppClient::Error is QXmppClient::XmppStreamError.
@@ -601,17 +606,8 @@ QXmppLogger *QXmppClient::logger() const
 void QXmppClient::setLogger(QXmppLogger *logger)
 {
     if (logger != d->logger) {
-        if (d->logger) {
-            disconnect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
-                       d->logger, SLOT(log(QXmppLogger::MessageType,QString)));
-        }
-
         d->logger = logger;
-        if (d->logger) {
-            connect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
-                    d->logger, SLOT(log(QXmppLogger::MessageType,QString)));
-        }
-
+        setLogSink(d->logger);
         emit loggerChanged(d->logger);
     }
 }
@@ -41,7 +41,7 @@ QXmppConfiguration::QXmppConfiguration() : m_port(5222),
                 m_ignoreSslErrors(true),
                 m_streamSecurityMode(QXmppConfiguration::TLSEnabled),
                 m_nonSASLAuthMechanism(QXmppConfiguration::NonSASLDigest),
-                m_SASLAuthMechanism("DIGEST-MD5")
+                m_SASLAuthMechanism("SCRAM-SHA-1")
 {
 
 }
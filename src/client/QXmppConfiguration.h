@@ -52,8 +52,11 @@ public:
     {
         TLSEnabled = 0, ///< Encryption is used if available (default)
         TLSDisabled,    ///< No encryption is server allows
-        TLSRequired     ///< Encryption is a must otherwise connection would not
+        TLSRequired,    ///< Encryption is a must otherwise connection would not
                         ///< be established
+        TLSDirect       ///< Encryption starts as soon as the connection is
+                        ///< established, as defined by XEP-0368: SRV records
+                        ///< for XMPP over TLS
     };
 
     /// An enumeration for various Non-SASL authentication mechanisms available.
@@ -72,9 +75,11 @@ public:
     enum SASLAuthMechanism
     {
         SASLPlain = 0,         ///< Plain
-        SASLDigestMD5,         ///< Digest MD5 (default)
+        SASLDigestMD5,         ///< Digest MD5
         SASLAnonymous,         ///< Anonymous
         SASLXFacebookPlatform, ///< Facebook Platform
+        SASLScramSha1,         ///< SCRAM-SHA-1 (default)
+        SASLScramSha256,       ///< SCRAM-SHA-256, preferred if offered (Qt >= 5)
     };
 
     /// An enumeration for stream compression methods.
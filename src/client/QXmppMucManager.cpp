@@ -26,6 +26,7 @@
 
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
+#include "QXmppJid.h"
 #include "QXmppMessage.h"
 #include "QXmppMucIq.h"
 #include "QXmppMucManager.h"
@@ -549,7 +550,7 @@ void QXmppMucRoom::_q_disconnected()
 
 void QXmppMucRoom::_q_messageReceived(const QXmppMessage &message)
 {
-    if (QXmppUtils::jidToBareJid(message.from())!= d->jid)
+    if (QXmppJid(message.from()).bareJidRef() != d->jid)
         return;
 
     // handle message subject
@@ -564,16 +565,18 @@ void QXmppMucRoom::_q_messageReceived(const QXmppMessage &message)
 
 void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
 {
-    const QString jid = presence.from();
+    const QXmppJid fromJid(presence.from());
+    const QString jid = fromJid.toString();
+    const QString ownJid = d->ownJid();
 
     // if our own presence changes, reflect it in the chat room
-    if (isJoined() && jid == d->client->configuration().jid()) {
+    if (d->participants.contains(ownJid) && jid == d->client->configuration().jid()) {
         QXmppPresence packet = d->client->clientPresence();
-        packet.setTo(d->ownJid());
+        packet.setTo(ownJid);
         d->client->sendPacket(packet);
     }
 
-    if (QXmppUtils::jidToBareJid(jid) != d->jid)
+    if (fromJid.bareJidRef() != d->jid)
         return;
 
     if (presence.type() == QXmppPresence::Available) {
@@ -581,7 +584,7 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
         d->participants.insert(jid, presence);
 
         // refresh allowed actions
-        if (jid == d->ownJid()) {
+        if (jid == ownJid) {
 
             QXmppMucItem mucItem = presence.mucItem();
             Actions newActions = NoAction;
@@ -605,7 +608,7 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
         if (added) {
             emit participantAdded(jid);
             emit participantsChanged();
-            if (jid == d->ownJid())
+            if (jid == ownJid)
                 emit joined();
         } else {
             emit participantChanged(jid);
@@ -620,7 +623,7 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
             emit participantsChanged();
 
             // check whether this was our own presence
-            if (jid == d->ownJid()) {
+            if (jid == ownJid) {
 
                 // check whether we were kicked
                 if (presence.mucStatusCodes().contains(307)) {
@@ -27,6 +27,7 @@
 #include <QUrl>
 #include "qdnslookup.h"
 
+#include "QXmppAtom.h"
 #include "QXmppConfiguration.h"
 #include "QXmppConstants.h"
 #include "QXmppIq.h"
@@ -37,6 +38,7 @@
 #include "QXmppStreamFeatures.h"
 #include "QXmppNonSASLAuth.h"
 #include "QXmppSaslAuth.h"
+#include "QXmppSocketConnector.h"
 #include "QXmppUtils.h"
 
 // IQ types
@@ -65,6 +67,10 @@ public:
 
     // DNS
     QDnsLookup dns;
+    bool dnsPending;
+    bool directTls;
+    QXmppSocketConnector *connector;
+    QAbstractSocket::SocketError socketError;
 
     // Stream
     QString streamId;
@@ -89,7 +95,11 @@ public:
 };
 
 QXmppOutgoingClientPrivate::QXmppOutgoingClientPrivate()
-    : sessionAvailable(false),
+    : dnsPending(false),
+    directTls(false),
+    connector(0),
+    socketError(QAbstractSocket::UnknownSocketError),
+    sessionAvailable(false),
     saslStep(0),
     saslMechanism(0)
 {
@@ -107,15 +117,16 @@ QXmppOutgoingClient::QXmppOutgoingClient(QObject *parent)
     Q_UNUSED(check);
 
     // initialise socket
-    QSslSocket *socket = new QSslSocket(this);
-    setSocket(socket);
+    attachSocket(new QSslSocket(this));
 
-    check = connect(socket, SIGNAL(sslErrors(QList<QSslError>)),
-                    this, SLOT(socketSslErrors(QList<QSslError>)));
+    // connection attempts
+    d->connector = new QXmppSocketConnector(this);
+    check = connect(d->connector, SIGNAL(connected(QSslSocket*)),
+                    this, SLOT(_q_connectorConnected(QSslSocket*)));
     Q_ASSERT(check);
 
-    check = connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
-                    this, SLOT(socketError(QAbstractSocket::SocketError)));
+    check = connect(d->connector, SIGNAL(error(QAbstractSocket::SocketError)),
+                    this, SLOT(_q_connectorError(QAbstractSocket::SocketError)));
     Q_ASSERT(check);
 
     // DNS lookups
@@ -165,49 +176,109 @@ void QXmppOutgoingClient::connectToHost()
     const QString host = configuration().host();
     const quint16 port = configuration().port();
 
-    // override CA certificates if requested
-    if (!configuration().caCertificates().isEmpty()) {
-        socket()->setCaCertificates(configuration().caCertificates());
-    }
+    d->connector->abort();
+    d->socketError = QAbstractSocket::UnknownSocketError;
+    d->connector->setProxy(configuration().networkProxy());
+    d->directTls = (configuration().streamSecurityMode() == QXmppConfiguration::TLSDirect);
+    emit socketStateChanged(QAbstractSocket::HostLookupState);
 
     // if an explicit host was provided, connect to it
     if (!host.isEmpty() && port) {
-        info(QString("Connecting to %1:%2").arg(host, QString::number(port)));
-        socket()->setProxy(configuration().networkProxy());
-        socket()->connectToHost(host, port);
+        d->connector->connectToHost(host, port);
         return;
     }
 
     // otherwise, lookup server
     const QString domain = configuration().domain();
     debug(QString("Looking up server for domain %1").arg(domain));
-    d->dns.setName("_xmpp-client._tcp." + domain);
+    if (d->directTls)
+        d->dns.setName("_xmpps-client._tcp." + domain);
+    else
+        d->dns.setName("_xmpp-client._tcp." + domain);
     d->dns.setType(QDnsLookup::SRV);
+    d->dnsPending = true;
     d->dns.lookup();
 }
 
 void QXmppOutgoingClient::_q_dnsLookupFinished()
 {
-    QString host;
-    quint16 port;
+    QList<QPair<QString, quint16> > hosts;
+
+    // the lookup was aborted by disconnectFromHost()
+    if (!d->dnsPending)
+        return;
+    d->dnsPending = false;
 
     if (d->dns.error() == QDnsLookup::NoError &&
         !d->dns.serviceRecords().isEmpty()) {
-        // take the first returned record
-        host = d->dns.serviceRecords().first().target();
-        port = d->dns.serviceRecords().first().port();
+        // the records are sorted by priority and weight
+        d->connector->connectToServices(d->dns.serviceRecords());
+        return;
+    } else if (d->directTls) {
+        // no direct TLS service, fall back to STARTTLS
+        debug(QString("No direct TLS service for domain %1, falling back to STARTTLS")
+              .arg(configuration().domain()));
+        d->directTls = false;
+        d->dns.setName("_xmpp-client._tcp." + configuration().domain());
+        d->dnsPending = true;
+        d->dns.lookup();
+        return;
     } else {
         // as a fallback, use domain as the host name
         warning(QString("Lookup for domain %1 failed: %2")
                 .arg(d->dns.name(), d->dns.errorString()));
-        host = configuration().domain();
-        port = configuration().port();
+        hosts << qMakePair(configuration().domain(), quint16(configuration().port()));
     }
 
     // connect to server
-    info(QString("Connecting to %1:%2").arg(host, QString::number(port)));
-    socket()->setProxy(configuration().networkProxy());
-    socket()->connectToHost(host, port);
+    d->connector->connectToHosts(hosts);
+}
+
+void QXmppOutgoingClient::_q_connectorConnected(QSslSocket *newSocket)
+{
+    QSslSocket *oldSocket = socket();
+    attachSocket(newSocket);
+    oldSocket->disconnect(this);
+    oldSocket->deleteLater();
+
+    // override CA certificates if requested
+    if (!configuration().caCertificates().isEmpty())
+        newSocket->setCaCertificates(configuration().caCertificates());
+
+    info(QString("Socket connected to %1 %2").arg(
+        newSocket->peerAddress().toString(),
+        QString::number(newSocket->peerPort())));
+    emit socketStateChanged(newSocket->state());
+
+    // XEP-0368: the stream starts once the socket is encrypted
+    if (d->directTls) {
+        startClientEncryption(configuration().domain());
+        return;
+    }
+    handleStart();
+}
+
+void QXmppOutgoingClient::_q_connectorError(QAbstractSocket::SocketError socketError)
+{
+    d->socketError = socketError;
+    emit socketStateChanged(QAbstractSocket::UnconnectedState);
+    emit error(QXmppClient::SocketError);
+}
+
+/// Disconnects from the server, aborting any pending DNS lookup or
+/// connection attempts.
+
+void QXmppOutgoingClient::disconnectFromHost()
+{
+    const bool wasConnecting = isConnecting();
+
+    d->dnsPending = false;
+    d->dns.abort();
+    d->connector->abort();
+    if (wasConnecting)
+        emit socketStateChanged(QAbstractSocket::UnconnectedState);
+
+    QXmppStream::disconnectFromHost();
 }
 
 /// Returns true if the socket is connected and a session has been started.
@@ -218,6 +289,43 @@ bool QXmppOutgoingClient::isConnected() const
     return QXmppStream::isConnected() && d->sessionStarted;
 }
 
+/// Returns true if the stream is still looking for a host to connect to.
+///
+
+bool QXmppOutgoingClient::isConnecting() const
+{
+    return d->dnsPending || d->connector->isConnecting();
+}
+
+/// Returns the last socket error, including errors which occured while
+/// still trying to reach the server.
+
+QAbstractSocket::SocketError QXmppOutgoingClient::socketError() const
+{
+    return d->socketError;
+}
+
+void QXmppOutgoingClient::attachSocket(QSslSocket *socket)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    socket->setParent(this);
+    setSocket(socket);
+
+    check = connect(socket, SIGNAL(sslErrors(QList<QSslError>)),
+                    this, SLOT(socketSslErrors(QList<QSslError>)));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+                    this, SLOT(socketError(QAbstractSocket::SocketError)));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
+                    this, SIGNAL(socketStateChanged(QAbstractSocket::SocketState)));
+    Q_ASSERT(check);
+}
+
 void QXmppOutgoingClient::socketSslErrors(const QList<QSslError> & error)
 {
     warning("SSL errors");
@@ -230,7 +338,7 @@ void QXmppOutgoingClient::socketSslErrors(const QList<QSslError> & error)
 
 void QXmppOutgoingClient::socketError(QAbstractSocket::SocketError socketError)
 {
-    Q_UNUSED(socketError);
+    d->socketError = socketError;
     emit error(QXmppClient::SocketError);
 }
 
@@ -282,7 +390,8 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
     // if we receive any kind of data, stop the timeout timer
     d->timeoutTimer->stop();
 
-    const QString ns = nodeRecv.namespaceURI();
+    const QXmppAtom ns = QXmppAtom::namespaceUri(nodeRecv);
+    const QXmppAtom tagName = QXmppAtom::tagName(nodeRecv);
 
     // give client opportunity to handle stanza
     bool handled = false;
@@ -300,15 +409,17 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             // determine TLS mode to use
             const QXmppConfiguration::StreamSecurityMode localSecurity = configuration().streamSecurityMode();
             const QXmppStreamFeatures::Mode remoteSecurity = features.tlsMode();
+            const bool localRequired = (localSecurity == QXmppConfiguration::TLSRequired ||
+                                        localSecurity == QXmppConfiguration::TLSDirect);
             if (!socket()->supportsSsl() &&
-                (localSecurity == QXmppConfiguration::TLSRequired ||
+                (localRequired ||
                  remoteSecurity == QXmppStreamFeatures::Required))
             {
                 warning("Disconnecting as TLS is required, but SSL support is not available");
                 disconnectFromHost();
                 return;
             }
-            if (localSecurity == QXmppConfiguration::TLSRequired &&
+            if (localRequired &&
                 remoteSecurity == QXmppStreamFeatures::Disabled)
             {
                 warning("Disconnecting as TLS is required, but not supported by the server");
@@ -346,15 +457,30 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
                 return;
             }
 
+            const QString scramSha1 = QLatin1String("SCRAM-SHA-1");
+            const QString scramSha256 = QLatin1String("SCRAM-SHA-256");
+            const bool scramSha256Available = mechanisms.contains(scramSha256) &&
+                                              d->saslMechanisms.contains(scramSha256);
+
             QString mech;
             if (!mechanisms.contains(configuration().sASLAuthMechanismString()))
             {
-                info("Desired SASL Auth mechanism is not available, selecting first available one");
+                info("Desired SASL Auth mechanism is not available, selecting first supported one");
                 mech = mechanisms.first();
+                foreach (const QString &candidate, mechanisms) {
+                    if (d->saslMechanisms.contains(candidate)) {
+                        mech = candidate;
+                        break;
+                    }
+                }
             } else {
                 mech = configuration().sASLAuthMechanismString();
             }
 
+            // prefer the stronger SCRAM variant when both are offered
+            if (mech == scramSha1 && scramSha256Available)
+                mech = scramSha256;
+
             if (!d->saslMechanisms.contains(mech)) {
                 warning("No supported SASL Authentication mechanism available");
                 disconnectFromHost();
@@ -397,7 +523,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
         if (features.sessionMode() != QXmppStreamFeatures::Disabled)
             d->sessionAvailable = true;
     }
-    else if(ns == ns_stream && nodeRecv.tagName() == "error")
+    else if(ns == QXmppAtom::NsStream && tagName == QXmppAtom::Error)
     {
         if (!nodeRecv.firstChildElement("conflict").isNull())
             d->xmppStreamError = QXmppStanza::Error::Conflict;
@@ -405,23 +531,44 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             d->xmppStreamError = QXmppStanza::Error::UndefinedCondition;
         emit error(QXmppClient::XmppStreamError);
     }
-    else if(ns == ns_tls)
+    else if(ns == QXmppAtom::NsTls)
     {
-        if(nodeRecv.tagName() == "proceed")
+        if(tagName == QXmppAtom::Proceed)
         {
-            debug("Starting encryption");
-            socket()->startClientEncryption();
+            startClientEncryption(configuration().domain());
             return;
         }
     }
-    else if(ns == ns_sasl)
+    else if(ns == QXmppAtom::NsSasl)
     {
-        if(nodeRecv.tagName() == "success")
+        if(tagName == QXmppAtom::Success)
         {
+            // some mechanisms (SCRAM) send additional data with the outcome
+            const QByteArray data = QByteArray::fromBase64(nodeRecv.text().toAscii());
+            if (!data.isEmpty()) {
+                QByteArray response;
+                d->saslStep++;
+                if (!d->saslMechanism || !d->saslMechanism->challengeResponse(data, response, d->saslStep)) {
+                    warning("Could not verify SASL success data");
+                    d->xmppStreamError = QXmppStanza::Error::NotAuthorized;
+                    emit error(QXmppClient::XmppStreamError);
+                    disconnectFromHost();
+                    return;
+                }
+            }
+
+            // the server must have proven its identity, if the mechanism allows it
+            if (d->saslMechanism && !d->saslMechanism->isComplete()) {
+                warning("The server did not prove its identity");
+                d->xmppStreamError = QXmppStanza::Error::NotAuthorized;
+                emit error(QXmppClient::XmppStreamError);
+                disconnectFromHost();
+                return;
+            }
             debug("Authenticated");
             handleStart();
         }
-        else if(nodeRecv.tagName() == "challenge")
+        else if(tagName == QXmppAtom::Challenge)
         {
             QByteArray challenge = QByteArray::fromBase64(nodeRecv.text().toAscii());
             QByteArray response;
@@ -440,7 +587,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
                 sendData(data);
             }
         }
-        else if(nodeRecv.tagName() == "failure")
+        else if(tagName == QXmppAtom::Failure)
         {
             if (!nodeRecv.firstChildElement("not-authorized").isNull())
                 d->xmppStreamError = QXmppStanza::Error::NotAuthorized;
@@ -452,10 +599,10 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             disconnectFromHost();
         }
     }
-    else if(ns == ns_client)
+    else if(ns == QXmppAtom::NsClient)
     {
 
-        if(nodeRecv.tagName() == "iq")
+        if(tagName == QXmppAtom::Iq)
         {
             QDomElement element = nodeRecv.firstChildElement();
             QString id = nodeRecv.attribute("id");
@@ -579,7 +726,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
                 }
             }
         }
-        else if(nodeRecv.tagName() == "presence")
+        else if(tagName == QXmppAtom::Presence)
         {
             QXmppPresence presence;
             presence.parse(nodeRecv);
@@ -587,7 +734,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             // emit presence
             emit presenceReceived(presence);
         }
-        else if(nodeRecv.tagName() == "message")
+        else if(tagName == QXmppAtom::Message)
         {
             QXmppMessage message;
             message.parse(nodeRecv);
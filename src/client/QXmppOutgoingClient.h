@@ -54,8 +54,10 @@ public:
 
     void connectToHost();
     bool isConnected() const;
+    bool isConnecting() const;
 
     QSslSocket *socket() const { return QXmppStream::socket(); };
+    QAbstractSocket::SocketError socketError() const;
     QXmppStanza::Error::Condition xmppStreamError();
 
     QXmppConfiguration& configuration();
@@ -64,6 +66,9 @@ public:
     bool removeSaslMechanism(QXmppSaslMechanism *mechanism);
     QHash<QString, QXmppSaslMechanism *> saslMechanisms();
 
+public slots:
+    void disconnectFromHost();
+
 signals:
     /// This signal is emitted when an error is encountered.
     void error(QXmppClient::Error);
@@ -80,6 +85,9 @@ signals:
     /// This signal is emitted when an IQ is received.
     void iqReceived(const QXmppIq&);
 
+    /// This signal is emitted when the state of the underlying socket changes.
+    void socketStateChanged(QAbstractSocket::SocketState state);
+
 protected:
     /// \cond
     // Overridable methods
@@ -89,6 +97,8 @@ protected:
     /// \endcond
 
 private slots:
+    void _q_connectorConnected(QSslSocket *socket);
+    void _q_connectorError(QAbstractSocket::SocketError error);
     void _q_dnsLookupFinished();
     void socketError(QAbstractSocket::SocketError);
     void socketSslErrors(const QList<QSslError>&);
@@ -99,6 +109,7 @@ private slots:
     void pingTimeout();
 
 private:
+    void attachSocket(QSslSocket *socket);
     void sendNonSASLAuth(bool plaintext);
     void sendNonSASLAuthQuery();
 
@@ -25,6 +25,7 @@
 #include <QDomElement>
 
 #include "QXmppClient.h"
+#include "QXmppJid.h"
 #include "QXmppPresence.h"
 #include "QXmppRosterIq.h"
 #include "QXmppRosterManager.h"
@@ -39,7 +40,7 @@ public:
     QMap<QString, QXmppRosterIq::Item> entries;
 
     // map of resources of the jid and map of resources and presences
-    QMap<QString, QMap<QString, QXmppPresence> > presences;
+    QHash<QXmppJid, QMap<QString, QXmppPresence> > presences;
 
     // flag to store that the roster has been populated
     bool isRosterReceived;
@@ -122,7 +123,7 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
     // Security check: only server should send this iq
     // from() should be either empty or bareJid of the user
     const QString fromJid = element.attribute("from");
-    if (!fromJid.isEmpty() && QXmppUtils::jidToBareJid(fromJid) != client()->configuration().jidBare())
+    if (!fromJid.isEmpty() && QXmppJid(fromJid).bareJidRef() != client()->configuration().jidBare())
         return false;
 
     QXmppRosterIq rosterIq;
@@ -189,33 +190,33 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
 
 void QXmppRosterManager::_q_presenceReceived(const QXmppPresence& presence)
 {
-    const QString jid = presence.from();
-    const QString bareJid = QXmppUtils::jidToBareJid(jid);
-    const QString resource = QXmppUtils::jidToResource(jid);
+    const QXmppJid jid(presence.from());
+    const QXmppJid bareJid = jid.bareJid();
+    const QString resource = jid.resource();
 
-    if (bareJid.isEmpty())
+    if (bareJid.isNull())
         return;
 
     switch(presence.type())
     {
     case QXmppPresence::Available:
         d->presences[bareJid][resource] = presence;
-        emit presenceChanged(bareJid, resource);
+        emit presenceChanged(bareJid.toString(), resource);
         break;
     case QXmppPresence::Unavailable:
         d->presences[bareJid].remove(resource);
-        emit presenceChanged(bareJid, resource);
+        emit presenceChanged(bareJid.toString(), resource);
         break;
     case QXmppPresence::Subscribe:
         if (client()->configuration().autoAcceptSubscriptions())
         {
             // accept subscription request
-            acceptSubscription(bareJid);
+            acceptSubscription(bareJid.toString());
 
             // ask for reciprocal subscription
-            subscribe(bareJid);
+            subscribe(bareJid.toString());
         } else {
-            emit subscriptionReceived(bareJid);
+            emit subscriptionReceived(bareJid.toString());
         }
         break;
     default:
@@ -359,10 +360,7 @@ QXmppRosterIq::Item QXmppRosterManager::getRosterEntry(
 
 QStringList QXmppRosterManager::getResources(const QString& bareJid) const
 {
-    if(d->presences.contains(bareJid))
-        return d->presences[bareJid].keys();
-    else
-        return QStringList();
+    return d->presences.value(bareJid).keys();
 }
 
 /// Get all the presences of all the resources of the given bareJid. A bareJid
@@ -376,10 +374,7 @@ QStringList QXmppRosterManager::getResources(const QString& bareJid) const
 QMap<QString, QXmppPresence> QXmppRosterManager::getAllPresencesForBareJid(
         const QString& bareJid) const
 {
-    if(d->presences.contains(bareJid))
-        return d->presences[bareJid];
-    else
-        return QMap<QString, QXmppPresence>();
+    return d->presences.value(bareJid);
 }
 
 /// Get the presence of the given resource of the given bareJid.
@@ -392,8 +387,9 @@ QMap<QString, QXmppPresence> QXmppRosterManager::getAllPresencesForBareJid(
 QXmppPresence QXmppRosterManager::getPresence(const QString& bareJid,
                                        const QString& resource) const
 {
-    if(d->presences.contains(bareJid) && d->presences[bareJid].contains(resource))
-        return d->presences[bareJid][resource];
+    const QMap<QString, QXmppPresence> resources = d->presences.value(bareJid);
+    if (resources.contains(resource))
+        return resources.value(resource);
     else
     {
         QXmppPresence presence;
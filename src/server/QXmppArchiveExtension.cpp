@@ -0,0 +1,983 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDataStream>
+#include <QDomElement>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QStringList>
+#include <QTimer>
+
+#include "QXmppArchiveExtension.h"
+#include "QXmppArchiveIq.h"
+#include "QXmppAtom.h"
+#include "QXmppConstants.h"
+#include "QXmppJid.h"
+#include "QXmppMessage.h"
+#include "QXmppMetrics.h"
+#include "QXmppRecordLog_p.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+
+// number of collections listed when the request does not set a maximum
+static const int defaultListSize = 100;
+
+// number of records from which a log whose records are mostly removed
+// messages and removals is compacted
+static const int compactionMinimumRecords = 256;
+
+// number of seconds after which the index of an owner who did not query
+// the archive is dropped
+static const int ownerTimeout = 600;
+
+/// A record of an owner's archive log.
+
+class QXmppArchiveRecord
+{
+public:
+    enum Type {
+        MessageRecord = 0,
+        RemoveRecord
+    };
+
+    QXmppArchiveRecord();
+    QByteArray encode() const;
+    bool decode(const QByteArray &payload);
+
+    quint8 type;
+    QString with;
+    QDateTime start;
+    // message date, or end of the removed range
+    QDateTime date;
+    bool received;
+    QString body;
+    QString subject;
+    QString thread;
+};
+
+QXmppArchiveRecord::QXmppArchiveRecord()
+    : type(MessageRecord),
+    received(false)
+{
+}
+
+QByteArray QXmppArchiveRecord::encode() const
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << type << with << start << date;
+    if (type == MessageRecord)
+        stream << received << body << subject << thread;
+    return payload;
+}
+
+bool QXmppArchiveRecord::decode(const QByteArray &payload)
+{
+    QDataStream stream(payload);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream >> type >> with >> start >> date;
+    if (type == MessageRecord)
+        stream >> received >> body >> subject >> thread;
+    return stream.status() == QDataStream::Ok;
+}
+
+/// A collection of messages, the offsets of its messages in the log.
+
+class QXmppArchiveCollection
+{
+public:
+    QXmppArchiveChat toChat(const QString &with, const QDateTime &start) const;
+
+    QString subject;
+    QString thread;
+    QList<qint64> offsets;
+};
+
+QXmppArchiveChat QXmppArchiveCollection::toChat(const QString &with, const QDateTime &start) const
+{
+    QXmppArchiveChat chat;
+    chat.setWith(with);
+    chat.setStart(start);
+    chat.setSubject(subject);
+    chat.setThread(thread);
+    return chat;
+}
+
+/// The index of an owner's archive.
+
+class QXmppArchiveOwner
+{
+public:
+    QXmppArchiveOwner();
+    void addMessage(const QXmppArchiveRecord &record, qint64 offset);
+    const QXmppArchiveCollection *collection(const QString &with, const QDateTime &start) const;
+    QList<QXmppArchiveChat> list(const QString &with, const QDateTime &start, const QDateTime &end, int max) const;
+    QList<qint64> offsets() const;
+    int remove(const QString &with, const QDateTime &start, const QDateTime &end);
+    void remap(const QHash<qint64, qint64> &offsets);
+
+    // collections by peer, then by start
+    QHash<QString, QMap<QDateTime, QXmppArchiveCollection> > byWith;
+
+    // peers by collection start
+    QMultiMap<QDateTime, QString> byStart;
+
+    // number of indexed messages, and of records in the log
+    int messageCount;
+    int recordCount;
+
+    // time of the owner's last query
+    qint64 lastUsed;
+};
+
+QXmppArchiveOwner::QXmppArchiveOwner()
+    : messageCount(0),
+    recordCount(0),
+    lastUsed(0)
+{
+}
+
+/// Indexes a message stored at the given offset of the log.
+///
+/// \param record
+/// \param offset
+
+void QXmppArchiveOwner::addMessage(const QXmppArchiveRecord &record, qint64 offset)
+{
+    QMap<QDateTime, QXmppArchiveCollection> &collections = byWith[record.with];
+    QMap<QDateTime, QXmppArchiveCollection>::iterator it = collections.find(record.start);
+    if (it == collections.end()) {
+        it = collections.insert(record.start, QXmppArchiveCollection());
+        byStart.insert(record.start, record.with);
+    }
+    if (!record.subject.isEmpty())
+        it->subject = record.subject;
+    if (it->thread.isEmpty())
+        it->thread = record.thread;
+    it->offsets << offset;
+    messageCount++;
+}
+
+/// Returns the collection with the given peer and start, or 0 if there is
+/// no such collection.
+///
+/// \param with
+/// \param start
+
+const QXmppArchiveCollection *QXmppArchiveOwner::collection(const QString &with, const QDateTime &start) const
+{
+    QHash<QString, QMap<QDateTime, QXmppArchiveCollection> >::const_iterator wit = byWith.constFind(with);
+    if (wit == byWith.constEnd())
+        return 0;
+    QMap<QDateTime, QXmppArchiveCollection>::const_iterator it = wit->constFind(start);
+    return it != wit->constEnd() ? &it.value() : 0;
+}
+
+/// Lists the collections started in the [start, end) range, optionally
+/// restricted to a peer.
+///
+/// \param with
+/// \param start
+/// \param end
+/// \param max
+
+QList<QXmppArchiveChat> QXmppArchiveOwner::list(const QString &with, const QDateTime &start, const QDateTime &end, int max) const
+{
+    QList<QXmppArchiveChat> chats;
+    if (!with.isEmpty()) {
+        QHash<QString, QMap<QDateTime, QXmppArchiveCollection> >::const_iterator wit = byWith.constFind(with);
+        if (wit == byWith.constEnd())
+            return chats;
+        QMap<QDateTime, QXmppArchiveCollection>::const_iterator it = start.isValid() ? wit->lowerBound(start) : wit->constBegin();
+        for (; it != wit->constEnd() && chats.size() < max; ++it) {
+            if (end.isValid() && it.key() >= end)
+                break;
+            chats << it->toChat(with, it.key());
+        }
+    } else {
+        QMultiMap<QDateTime, QString>::const_iterator it = start.isValid() ? byStart.lowerBound(start) : byStart.constBegin();
+        for (; it != byStart.constEnd() && chats.size() < max; ++it) {
+            if (end.isValid() && it.key() >= end)
+                break;
+            const QXmppArchiveCollection *c = collection(it.value(), it.key());
+            if (c)
+                chats << c->toChat(it.value(), it.key());
+        }
+    }
+    return chats;
+}
+
+/// Returns the offsets of all the indexed messages, in ascending order.
+
+QList<qint64> QXmppArchiveOwner::offsets() const
+{
+    QList<qint64> offsets;
+    QHash<QString, QMap<QDateTime, QXmppArchiveCollection> >::const_iterator wit;
+    for (wit = byWith.constBegin(); wit != byWith.constEnd(); ++wit)
+        foreach (const QXmppArchiveCollection &collection, *wit)
+            offsets += collection.offsets;
+    qSort(offsets);
+    return offsets;
+}
+
+/// Removes the collections started in the [start, end) range, optionally
+/// restricted to a peer, and returns the number of removed collections.
+///
+/// \param with
+/// \param start
+/// \param end
+
+int QXmppArchiveOwner::remove(const QString &with, const QDateTime &start, const QDateTime &end)
+{
+    int removed = 0;
+    if (!with.isEmpty()) {
+        QHash<QString, QMap<QDateTime, QXmppArchiveCollection> >::iterator wit = byWith.find(with);
+        if (wit == byWith.end())
+            return 0;
+        QMap<QDateTime, QXmppArchiveCollection>::iterator it = start.isValid() ? wit->lowerBound(start) : wit->begin();
+        while (it != wit->end() && (!end.isValid() || it.key() < end)) {
+            byStart.remove(it.key(), with);
+            messageCount -= it->offsets.size();
+            it = wit->erase(it);
+            removed++;
+        }
+        if (wit->isEmpty())
+            byWith.erase(wit);
+    } else {
+        QMultiMap<QDateTime, QString>::iterator it = start.isValid() ? byStart.lowerBound(start) : byStart.begin();
+        while (it != byStart.end() && (!end.isValid() || it.key() < end)) {
+            QHash<QString, QMap<QDateTime, QXmppArchiveCollection> >::iterator wit = byWith.find(it.value());
+            if (wit != byWith.end()) {
+                messageCount -= wit->value(it.key()).offsets.size();
+                wit->remove(it.key());
+                if (wit->isEmpty())
+                    byWith.erase(wit);
+            }
+            it = byStart.erase(it);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+/// Moves the indexed messages to new offsets after the log was compacted.
+///
+/// \param offsets The new offset of each message, by old offset.
+
+void QXmppArchiveOwner::remap(const QHash<qint64, qint64> &offsets)
+{
+    QHash<QString, QMap<QDateTime, QXmppArchiveCollection> >::iterator wit;
+    for (wit = byWith.begin(); wit != byWith.end(); ++wit) {
+        QMap<QDateTime, QXmppArchiveCollection>::iterator it;
+        for (it = wit->begin(); it != wit->end(); ++it)
+            for (int i = 0; i < it->offsets.size(); ++i)
+                it->offsets[i] = offsets.value(it->offsets.at(i));
+    }
+    recordCount = messageCount;
+}
+
+/// A message archived or a query received while an owner's index is
+/// being loaded.
+
+class QXmppArchiveEvent
+{
+public:
+    QDomElement query;
+    QXmppArchiveRecord record;
+    qint64 offset;
+};
+
+/// Builds the index of an owner's archive in the writer thread.
+
+class QXmppArchiveLoader : public QXmppRecordLogScanner
+{
+public:
+    QXmppArchiveLoader(const QString &ownerJid);
+    ~QXmppArchiveLoader();
+    void scanRecord(const QByteArray &payload, qint64 offset);
+
+    QString ownerJid;
+    QXmppArchiveOwner *owner;
+
+    // replayed in order once the index is loaded
+    QList<QXmppArchiveEvent> events;
+};
+
+QXmppArchiveLoader::QXmppArchiveLoader(const QString &ownerJid)
+    : ownerJid(ownerJid),
+    owner(new QXmppArchiveOwner)
+{
+}
+
+QXmppArchiveLoader::~QXmppArchiveLoader()
+{
+    delete owner;
+}
+
+void QXmppArchiveLoader::scanRecord(const QByteArray &payload, qint64 offset)
+{
+    owner->recordCount++;
+    QXmppArchiveRecord record;
+    if (!record.decode(payload))
+        return;
+    if (record.type == QXmppArchiveRecord::MessageRecord)
+        owner->addMessage(record, offset);
+    else
+        owner->remove(record.with, record.start, record.date);
+}
+
+/// Reads the messages of a collection in the writer thread, to answer a
+/// retrieve request.
+
+class QXmppArchiveReader : public QXmppRecordLogScanner
+{
+public:
+    QXmppArchiveReader(QObject *parent);
+    void scanRecord(const QByteArray &payload, qint64 offset);
+
+    QXmppArchiveChatIq response;
+    QList<QXmppArchiveMessage> messages;
+    QElapsedTimer timer;
+};
+
+QXmppArchiveReader::QXmppArchiveReader(QObject *parent)
+    : QXmppRecordLogScanner(parent)
+{
+}
+
+void QXmppArchiveReader::scanRecord(const QByteArray &payload, qint64 offset)
+{
+    Q_UNUSED(offset);
+
+    QXmppArchiveRecord record;
+    if (!record.decode(payload))
+        return;
+    QXmppArchiveMessage message;
+    message.setBody(record.body);
+    message.setDate(record.date);
+    message.setReceived(record.received);
+    messages << message;
+}
+
+/// Reads the indexed messages of an owner in the writer thread, so that
+/// the log can be rewritten without the removed messages.
+
+class QXmppArchiveCompactor : public QXmppRecordLogScanner
+{
+public:
+    QXmppArchiveCompactor(const QString &ownerJid);
+    void scanRecord(const QByteArray &payload, qint64 offset);
+
+    QString ownerJid;
+
+    // payloads of the messages read by the writer thread, and of those
+    // archived meanwhile, by offset
+    QHash<qint64, QByteArray> payloads;
+    QHash<qint64, QByteArray> appended;
+};
+
+QXmppArchiveCompactor::QXmppArchiveCompactor(const QString &ownerJid)
+    : ownerJid(ownerJid)
+{
+}
+
+void QXmppArchiveCompactor::scanRecord(const QByteArray &payload, qint64 offset)
+{
+    payloads.insert(offset, payload);
+}
+
+class QXmppArchiveExtensionPrivate
+{
+public:
+    QXmppArchiveExtensionPrivate(QXmppArchiveExtension *qq);
+    void archive(const QString &ownerJid, QXmppArchiveRecord &record);
+    void archiveMessage(const QDomElement &element, const QString &domain);
+    void clearOwners();
+    void compact(const QString &ownerJid);
+    void handleQuery(const QDomElement &element);
+
+    int collectionTimeout;
+    QTimer *expireTimer;
+    QXmppRecordLog *log;
+    QXmppServer *server;
+
+    // indexes of the owners who queried their archive
+    QHash<QString, QXmppArchiveOwner*> owners;
+
+    // indexes being loaded by the writer thread
+    QHash<QString, QXmppArchiveLoader*> loaders;
+
+    // logs being compacted
+    QHash<QString, QXmppArchiveCompactor*> compactors;
+    QElapsedTimer clock;
+
+    // start and last message of the current collections,
+    // by owner and peer separated by a space
+    QHash<QString, QPair<QDateTime, QDateTime> > currentCollections;
+
+    QXmppCounter *archived;
+    QXmppHistogram *queryTime;
+
+private:
+    QXmppArchiveExtension *q;
+};
+
+QXmppArchiveExtensionPrivate::QXmppArchiveExtensionPrivate(QXmppArchiveExtension *qq)
+    : collectionTimeout(1800),
+    expireTimer(0),
+    log(0),
+    server(0),
+    archived(0),
+    queryTime(0),
+    q(qq)
+{
+    clock.start();
+}
+
+/// Appends a message to an owner's archive.
+///
+/// \param ownerJid
+/// \param record
+
+void QXmppArchiveExtensionPrivate::archive(const QString &ownerJid, QXmppArchiveRecord &record)
+{
+    // continue the current collection with this peer or start a new one
+    QPair<QDateTime, QDateTime> &current = currentCollections[ownerJid + QLatin1Char(' ') + record.with];
+    if (!current.first.isValid() || current.second.secsTo(record.date) > collectionTimeout)
+        current.first = record.date;
+    current.second = record.date;
+    record.start = current.first;
+
+    // keep the index up to date if it is loaded or being loaded
+    QXmppArchiveOwner *owner = owners.value(ownerJid);
+    QXmppArchiveLoader *loader = loaders.value(ownerJid);
+    const qint64 offset = (owner || loader) ? log->size(ownerJid) : 0;
+    const QByteArray payload = record.encode();
+    log->append(ownerJid, payload);
+    if (owner) {
+        owner->addMessage(record, offset);
+        owner->recordCount++;
+
+        // a compaction in progress must keep the message
+        QXmppArchiveCompactor *compactor = compactors.value(ownerJid);
+        if (compactor)
+            compactor->appended.insert(offset, payload);
+    } else if (loader) {
+        QXmppArchiveEvent event;
+        event.record = record;
+        event.offset = offset;
+        loader->events << event;
+    }
+    archived->add();
+}
+
+/// Archives a routed message for its local sender and recipient.
+///
+/// \param element
+/// \param domain
+
+void QXmppArchiveExtensionPrivate::archiveMessage(const QDomElement &element, const QString &domain)
+{
+    QXmppMessage message;
+    message.parse(element);
+    if ((message.type() != QXmppMessage::Normal && message.type() != QXmppMessage::Chat) ||
+        message.body().isEmpty())
+        return;
+
+    const QXmppJid from(message.from());
+    const QXmppJid to(message.to());
+    if (from.isNull() || to.isNull())
+        return;
+    const QString fromBare = from.bareJidRef().toString();
+    const QString toBare = to.bareJidRef().toString();
+
+    QXmppArchiveRecord record;
+    record.date = QDateTime::fromTime_t(QDateTime::currentDateTime().toTime_t()).toUTC();
+    record.body = message.body();
+    record.subject = message.subject();
+    record.thread = message.thread();
+
+    if (from.domainRef() == domain && !from.nodeRef().isEmpty()) {
+        record.with = toBare;
+        record.received = false;
+        archive(fromBare, record);
+    }
+    if (to.domainRef() == domain && !to.nodeRef().isEmpty() && toBare != fromBare) {
+        record.with = fromBare;
+        record.received = true;
+        archive(toBare, record);
+    }
+}
+
+/// Drops the indexes of all owners.
+
+void QXmppArchiveExtensionPrivate::clearOwners()
+{
+    qDeleteAll(owners);
+    owners.clear();
+    qDeleteAll(loaders);
+    loaders.clear();
+    qDeleteAll(compactors);
+    compactors.clear();
+}
+
+/// Starts compacting an owner's log if most of its records are removed
+/// messages and removals.
+///
+/// The writer thread reads the indexed messages, then the log is rewritten
+/// with only these messages.
+///
+/// \param ownerJid
+
+void QXmppArchiveExtensionPrivate::compact(const QString &ownerJid)
+{
+    QXmppArchiveOwner *owner = owners.value(ownerJid);
+    if (!owner || compactors.contains(ownerJid) ||
+        owner->recordCount < compactionMinimumRecords ||
+        owner->recordCount < 2 * owner->messageCount)
+        return;
+
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppArchiveCompactor *compactor = new QXmppArchiveCompactor(ownerJid);
+    check = QObject::connect(compactor, SIGNAL(finished()),
+                             q, SLOT(_q_ownerCompacted()));
+    Q_ASSERT(check);
+
+    compactors.insert(ownerJid, compactor);
+    log->read(ownerJid, owner->offsets(), compactor);
+}
+
+/// Answers a list, retrieve or remove request, the owner's index must be
+/// loaded.
+///
+/// \param element
+
+void QXmppArchiveExtensionPrivate::handleQuery(const QDomElement &element)
+{
+    const QString domain = server->domain();
+    const QString ownerJid = QXmppUtils::jidToBareJid(element.attribute("from"));
+    const QString type = element.attribute("type");
+    QXmppArchiveOwner *owner = owners.value(ownerJid);
+    Q_ASSERT(owner);
+    owner->lastUsed = clock.elapsed();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (type == QLatin1String("get") && QXmppArchiveListIq::isArchiveListIq(element)) {
+        QXmppArchiveListIq request;
+        request.parse(element);
+
+        const int max = request.max() > 0 ? request.max() : defaultListSize;
+        QXmppArchiveListIq response;
+        response.setType(QXmppIq::Result);
+        response.setId(request.id());
+        response.setFrom(domain);
+        response.setTo(request.from());
+        response.setChats(owner->list(
+            QXmppUtils::jidToBareJid(request.with()), request.start(), request.end(), max));
+        server->sendPacket(response);
+
+    } else if (type == QLatin1String("get") && QXmppArchiveRetrieveIq::isArchiveRetrieveIq(element)) {
+        QXmppArchiveRetrieveIq request;
+        request.parse(element);
+
+        const QString with = QXmppUtils::jidToBareJid(request.with());
+        const QXmppArchiveCollection *collection = owner->collection(with, request.start());
+        if (!collection) {
+            QXmppIq response(QXmppIq::Error);
+            response.setId(request.id());
+            response.setFrom(domain);
+            response.setTo(request.from());
+            response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel,
+                QXmppStanza::Error::ItemNotFound));
+            server->sendPacket(response);
+            queryTime->record(timer.nsecsElapsed() / 1000);
+            return;
+        }
+
+        QList<qint64> offsets = collection->offsets;
+        if (request.max() > 0 && offsets.size() > request.max())
+            offsets = offsets.mid(0, request.max());
+
+        // answer once the writer thread has read the messages
+        bool check;
+        Q_UNUSED(check);
+
+        QXmppArchiveReader *reader = new QXmppArchiveReader(q);
+        reader->timer = timer;
+        reader->response.setType(QXmppIq::Result);
+        reader->response.setId(request.id());
+        reader->response.setFrom(domain);
+        reader->response.setTo(request.from());
+        reader->response.setChat(collection->toChat(with, request.start()));
+        check = QObject::connect(reader, SIGNAL(finished()),
+                                 q, SLOT(_q_recordsRead()));
+        Q_ASSERT(check);
+
+        log->read(ownerJid, offsets, reader);
+        return;
+
+    } else if (type == QLatin1String("set") && QXmppArchiveRemoveIq::isArchiveRemoveIq(element)) {
+        QXmppArchiveRemoveIq request;
+        request.parse(element);
+
+        // a start without an end designates a single collection
+        QXmppArchiveRecord record;
+        record.type = QXmppArchiveRecord::RemoveRecord;
+        record.with = QXmppUtils::jidToBareJid(request.with());
+        record.start = request.start();
+        record.date = request.end();
+        if (record.start.isValid() && !record.date.isValid())
+            record.date = record.start.addSecs(1);
+
+        const int removed = owner->remove(record.with, record.start, record.date);
+        if (removed) {
+            log->append(ownerJid, record.encode());
+            owner->recordCount++;
+
+            // do not append messages to removed collections
+            const QString prefix = ownerJid + QLatin1Char(' ') + record.with;
+            QHash<QString, QPair<QDateTime, QDateTime> >::iterator it = currentCollections.begin();
+            while (it != currentCollections.end()) {
+                if (it.key().startsWith(prefix) && !owner->collection(it.key().mid(ownerJid.size() + 1), it->first))
+                    it = currentCollections.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        QXmppIq response(removed ? QXmppIq::Result : QXmppIq::Error);
+        response.setId(request.id());
+        response.setFrom(domain);
+        response.setTo(request.from());
+        if (!removed)
+            response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel,
+                QXmppStanza::Error::ItemNotFound));
+        server->sendPacket(response);
+
+        if (removed)
+            compact(ownerJid);
+    }
+
+    queryTime->record(timer.nsecsElapsed() / 1000);
+}
+
+/// Constructs a new message archiving extension.
+
+QXmppArchiveExtension::QXmppArchiveExtension()
+    : d(new QXmppArchiveExtensionPrivate(this))
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->log = new QXmppRecordLog(".archive", this);
+
+    d->expireTimer = new QTimer(this);
+    check = connect(d->expireTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_expireCollections()));
+    Q_ASSERT(check);
+}
+
+QXmppArchiveExtension::~QXmppArchiveExtension()
+{
+    stop();
+    delete d;
+}
+
+QString QXmppArchiveExtension::extensionName() const
+{
+    return QLatin1String("archive");
+}
+
+/// Returns 1, so that messages are archived before other extensions
+/// handle them.
+
+int QXmppArchiveExtension::extensionPriority() const
+{
+    return 1;
+}
+
+/// Returns the number of seconds without any message after which the
+/// next message with a peer starts a new collection.
+///
+
+int QXmppArchiveExtension::collectionTimeout() const
+{
+    return d->collectionTimeout;
+}
+
+/// Sets the number of seconds without any message after which the
+/// next message with a peer starts a new collection, the default is 1800.
+///
+/// \param secs
+
+void QXmppArchiveExtension::setCollectionTimeout(int secs)
+{
+    d->collectionTimeout = secs;
+}
+
+/// Returns the directory in which the archives are stored.
+///
+
+QString QXmppArchiveExtension::directory() const
+{
+    return d->log->directory();
+}
+
+/// Sets the directory in which the archives are stored.
+///
+/// The change takes effect the next time the extension is started.
+///
+/// \param directory
+
+void QXmppArchiveExtension::setDirectory(const QString &directory)
+{
+    d->log->setDirectory(directory);
+}
+
+/// Returns the interval in milliseconds after which archived messages are
+/// written to disk.
+///
+
+int QXmppArchiveExtension::flushInterval() const
+{
+    return d->log->flushInterval();
+}
+
+/// Sets the interval in milliseconds after which archived messages are
+/// written to disk, the default is 100.
+///
+/// \param msecs
+
+void QXmppArchiveExtension::setFlushInterval(int msecs)
+{
+    d->log->setFlushInterval(msecs);
+}
+
+QStringList QXmppArchiveExtension::discoveryFeatures() const
+{
+    return QStringList() << ns_archive;
+}
+
+/// Archives chat and normal messages, and answers the list, retrieve and
+/// remove requests of local users.
+///
+/// \param element
+
+bool QXmppArchiveExtension::handleStanza(const QDomElement &element)
+{
+    if (!d->log->isOpen())
+        return false;
+
+    QXmppServer *server = this->server();
+    const QString domain = server->domain();
+    const QXmppAtom tagName = QXmppAtom::tagName(element);
+
+    // archive messages, then let them be routed
+    if (tagName == QXmppAtom::Message) {
+        d->archiveMessage(element, domain);
+        return false;
+    }
+
+    if (tagName != QXmppAtom::Iq || element.attribute("to") != domain)
+        return false;
+
+    const QXmppJid from(element.attribute("from"));
+    if (from.domainRef() != domain || from.nodeRef().isEmpty())
+        return false;
+    const QString ownerJid = from.bareJidRef().toString();
+    const QString type = element.attribute("type");
+    const bool isQuery = (type == QLatin1String("get") &&
+        (QXmppArchiveListIq::isArchiveListIq(element) || QXmppArchiveRetrieveIq::isArchiveRetrieveIq(element))) ||
+        (type == QLatin1String("set") && QXmppArchiveRemoveIq::isArchiveRemoveIq(element));
+    if (!isQuery)
+        return false;
+
+    if (d->owners.contains(ownerJid)) {
+        d->handleQuery(element);
+        return true;
+    }
+
+    // answer once the writer thread has loaded the owner's index
+    QXmppArchiveLoader *loader = d->loaders.value(ownerJid);
+    if (!loader) {
+        bool check;
+        Q_UNUSED(check);
+
+        loader = new QXmppArchiveLoader(ownerJid);
+        check = connect(loader, SIGNAL(finished()),
+                        this, SLOT(_q_ownerLoaded()));
+        Q_ASSERT(check);
+
+        d->loaders.insert(ownerJid, loader);
+        d->log->scan(ownerJid, loader);
+    }
+    QXmppArchiveEvent event;
+    event.query = element;
+    event.offset = 0;
+    loader->events << event;
+    return true;
+}
+
+/// Starts the writer thread.
+
+bool QXmppArchiveExtension::start()
+{
+    if (d->log->isOpen())
+        return true;
+
+    QXmppServer *server = this->server();
+    if (!server)
+        return false;
+
+    QXmppMetrics *metrics = server->metrics();
+    d->archived = metrics->counter("archive-messages");
+    d->queryTime = metrics->histogram("archive-query-time");
+    d->log->setMetrics(metrics->counter("archive-write-failures"),
+                       metrics->histogram("archive-flush-time"));
+
+    if (!d->log->open()) {
+        warning(QString("Could not use archive directory %1").arg(d->log->directory()));
+        return false;
+    }
+
+    d->server = server;
+    d->expireTimer->start(qMax(d->collectionTimeout, 60) * 1000);
+    info(QString("Archiving messages in %1").arg(d->log->directory()));
+    return true;
+}
+
+/// Writes the pending messages to disk and stops the writer thread.
+
+void QXmppArchiveExtension::stop()
+{
+    d->expireTimer->stop();
+    d->log->close();
+    d->clearOwners();
+    d->currentCollections.clear();
+}
+
+/// Installs the index built by the writer thread, then replays the
+/// messages archived and answers the queries received meanwhile.
+
+void QXmppArchiveExtension::_q_ownerLoaded()
+{
+    QXmppArchiveLoader *loader = static_cast<QXmppArchiveLoader*>(sender());
+    if (!loader || d->loaders.value(loader->ownerJid) != loader)
+        return;
+    d->loaders.remove(loader->ownerJid);
+
+    QXmppArchiveOwner *owner = loader->owner;
+    loader->owner = 0;
+    d->owners.insert(loader->ownerJid, owner);
+
+    foreach (const QXmppArchiveEvent &event, loader->events) {
+        if (event.query.isNull()) {
+            owner->addMessage(event.record, event.offset);
+            owner->recordCount++;
+        } else {
+            d->handleQuery(event.query);
+        }
+    }
+    loader->deleteLater();
+}
+
+/// Rewrites an owner's log with the messages read by the writer thread and
+/// those archived meanwhile, then moves the index to the new offsets.
+
+void QXmppArchiveExtension::_q_ownerCompacted()
+{
+    QXmppArchiveCompactor *compactor = static_cast<QXmppArchiveCompactor*>(sender());
+    if (!compactor || d->compactors.value(compactor->ownerJid) != compactor)
+        return;
+    d->compactors.remove(compactor->ownerJid);
+    compactor->deleteLater();
+
+    QXmppArchiveOwner *owner = d->owners.value(compactor->ownerJid);
+    if (!owner)
+        return;
+
+    QByteArray records;
+    QHash<qint64, qint64> moved;
+    foreach (qint64 offset, owner->offsets()) {
+        QByteArray payload = compactor->payloads.value(offset);
+        if (payload.isNull())
+            payload = compactor->appended.value(offset);
+        if (payload.isNull()) {
+            warning(QString("Could not compact the archive of %1").arg(compactor->ownerJid));
+            return;
+        }
+        moved.insert(offset, records.size());
+        records += QXmppRecordLog::record(payload);
+    }
+
+    d->log->rewrite(compactor->ownerJid, records);
+    owner->remap(moved);
+}
+
+/// Answers a retrieve request with the messages read by the writer thread.
+
+void QXmppArchiveExtension::_q_recordsRead()
+{
+    QXmppArchiveReader *reader = static_cast<QXmppArchiveReader*>(sender());
+    if (!reader)
+        return;
+
+    QXmppArchiveChat chat = reader->response.chat();
+    chat.setMessages(reader->messages);
+    reader->response.setChat(chat);
+    server()->sendPacket(reader->response);
+    d->queryTime->record(reader->timer.nsecsElapsed() / 1000);
+    reader->deleteLater();
+}
+
+/// Forgets the current collections which timed out, and the indexes of
+/// the owners who did not query their archive recently.
+
+void QXmppArchiveExtension::_q_expireCollections()
+{
+    const qint64 elapsed = d->clock.elapsed();
+    QHash<QString, QXmppArchiveOwner*>::iterator oit = d->owners.begin();
+    while (oit != d->owners.end()) {
+        if (elapsed - (*oit)->lastUsed > ownerTimeout * 1000 && !d->compactors.contains(oit.key())) {
+            delete *oit;
+            oit = d->owners.erase(oit);
+        } else {
+            ++oit;
+        }
+    }
+
+    const QDateTime now = QDateTime::currentDateTime().toUTC();
+    QHash<QString, QPair<QDateTime, QDateTime> >::iterator it = d->currentCollections.begin();
+    while (it != d->currentCollections.end()) {
+        if (it->second.secsTo(now) > d->collectionTimeout)
+            it = d->currentCollections.erase(it);
+        else
+            ++it;
+    }
+}
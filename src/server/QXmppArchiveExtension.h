@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPARCHIVEEXTENSION_H
+#define QXMPPARCHIVEEXTENSION_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppArchiveExtensionPrivate;
+
+/// \brief The QXmppArchiveExtension class archives the messages of local
+/// users and answers their XEP-0136: Message Archiving queries.
+///
+/// Messages are grouped in collections identified by their owner, the
+/// bare JID of the peer and their start time. Each owner has an
+/// append-only log in directory(), written in batches by a dedicated
+/// thread, so archiving a message never waits for the disk.
+///
+/// The collections of an owner are indexed in memory by peer and start
+/// time the first time the owner queries the archive, so that list,
+/// retrieve and remove requests are answered with range scans whatever
+/// the size of the archive. The index is built by the writer thread, the
+/// owner's first queries are answered once it is ready, and it is dropped
+/// once the owner has not queried the archive for ten minutes. Retrieved
+/// messages are also read by the writer thread.
+///
+/// Removing collections appends a removal to the log. Once most of the
+/// records of a log are removed messages and removals, the log is
+/// rewritten with only the remaining messages.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppArchiveExtension : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_PROPERTY(int collectionTimeout READ collectionTimeout WRITE setCollectionTimeout)
+    Q_PROPERTY(QString directory READ directory WRITE setDirectory)
+    Q_PROPERTY(int flushInterval READ flushInterval WRITE setFlushInterval)
+
+public:
+    QXmppArchiveExtension();
+    ~QXmppArchiveExtension();
+
+    QString extensionName() const;
+    int extensionPriority() const;
+
+    int collectionTimeout() const;
+    void setCollectionTimeout(int secs);
+
+    QString directory() const;
+    void setDirectory(const QString &directory);
+
+    int flushInterval() const;
+    void setFlushInterval(int msecs);
+
+    QStringList discoveryFeatures() const;
+    bool handleStanza(const QDomElement &element);
+
+    bool start();
+    void stop();
+
+private slots:
+    void _q_expireCollections();
+    void _q_ownerCompacted();
+    void _q_ownerLoaded();
+    void _q_recordsRead();
+
+private:
+    QXmppArchiveExtensionPrivate * const d;
+};
+
+#endif
@@ -0,0 +1,1132 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomDocument>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QTimer>
+#include <QXmlStreamReader>
+
+#include "QXmppAtom.h"
+#include "QXmppBoshExtension.h"
+#include "QXmppBoshExtension_p.h"
+#include "QXmppConstants.h"
+#include "QXmppJid.h"
+#include "QXmppMetrics.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+
+static const char *ns_bosh = "http://jabber.org/protocol/httpbind";
+static const char *ns_xbosh = "urn:xmpp:xbosh";
+
+// start of every response body
+static const QByteArray bodyStart = QByteArray("<body xmlns=\"") + ns_bosh +
+    "\" xmlns:xmpp=\"" + ns_xbosh + "\" xmlns:stream=\"" + ns_stream + "\"";
+
+// largest HTTP request header and body we accept
+static const int maxHeaderSize = 8192;
+static const int maxBodySize = 65536;
+
+// interval in milliseconds at which held requests and sessions expire
+static const int timeoutInterval = 500;
+
+// socket property set when the client does not keep the connection alive
+static const char *closeProperty = "_q_bosh_close";
+
+/// Returns data sent to a session, with the jabber:client namespace
+/// declared on the stanzas which do not declare one, as they would
+/// otherwise inherit the namespace of the response body.
+///
+/// The data is parsed as the children of a stream root, as the stream
+/// parser does, so that only the start tags of top-level elements are
+/// modified.
+///
+/// \param data
+
+static QByteArray declareClientNamespace(const QByteArray &data)
+{
+    const QString root = QString("<stream:stream xmlns:stream=\"%1\">").arg(ns_stream);
+    const QString xml = QString::fromUtf8(data);
+    QXmlStreamReader reader(root + xml + QLatin1String("</stream:stream>"));
+
+    QString result;
+    int copied = 0;
+    int depth = 0;
+    while (!reader.atEnd()) {
+        const QXmlStreamReader::TokenType token = reader.readNext();
+        if (token == QXmlStreamReader::EndElement) {
+            depth--;
+            continue;
+        } else if (token != QXmlStreamReader::StartElement || ++depth != 2) {
+            continue;
+        }
+
+        const QStringRef name = reader.qualifiedName();
+        if (name != QLatin1String("message") &&
+            name != QLatin1String("presence") &&
+            name != QLatin1String("iq"))
+            continue;
+
+        bool declared = false;
+        foreach (const QXmlStreamNamespaceDeclaration &ns, reader.namespaceDeclarations())
+            if (ns.prefix().isEmpty())
+                declared = true;
+        if (declared)
+            continue;
+
+        // the reader stands at the end of the start tag, which cannot
+        // contain another '<'
+        const int tagStart = xml.lastIndexOf(QLatin1Char('<'), int(reader.characterOffset()) - root.size() - 1);
+        const int nameEnd = tagStart + 1 + name.size();
+        result += xml.mid(copied, nameEnd - copied);
+        result += QLatin1String(" xmlns=\"jabber:client\"");
+        copied = nameEnd;
+    }
+    if (reader.hasError())
+        return data;
+
+    result += xml.mid(copied);
+    return result.toUtf8();
+}
+
+/// Returns a terminate body with the given condition.
+///
+/// \param condition
+/// \param payload
+
+static QByteArray terminateBody(const QString &condition, const QByteArray &payload = QByteArray())
+{
+    QByteArray body = bodyStart + " type=\"terminate\"";
+    if (!condition.isEmpty())
+        body += " condition=\"" + condition.toAscii() + "\"";
+    if (payload.isEmpty())
+        body += "/>";
+    else
+        body += ">" + payload + "</body>";
+    return body;
+}
+
+class QXmppBoshExtensionPrivate
+{
+public:
+    QXmppBoshExtensionPrivate(QXmppBoshExtension *qq);
+    int connections() const;
+    void createSession(QTcpSocket *socket, const QDomElement &body);
+    void readRequest(QTcpSocket *socket);
+    void writeResponse(QTcpSocket *socket, const QByteArray &status, const QByteArray &body);
+
+    QHostAddress address;
+    quint16 port;
+    QString path;
+    bool secure;
+    int inactivity;
+    int maximumConnections;
+    int maximumHold;
+    int maximumWait;
+
+    QTcpServer *httpServer;
+    QTimer *timeoutTimer;
+    QElapsedTimer clock;
+
+    // sessions by sid
+    QHash<QString, QXmppBoshSession*> sessions;
+
+    // the connections waiting for a response, and the session handling it
+    QHash<QTcpSocket*, QXmppBoshSession*> waiting;
+
+    // the other connections, and the time since which they are idle
+    QHash<QTcpSocket*, qint64> idle;
+
+    // connections holding a request which was received while they were waiting
+    QSet<QTcpSocket*> rereads;
+    bool rereadScheduled;
+
+    // the last response of terminated sessions, and its expiry
+    QHash<QString, QPair<QByteArray, qint64> > farewells;
+
+    // metrics
+    QXmppCounter *connectionsRefused;
+    QXmppCounter *emptyResponses;
+    QXmppCounter *requests;
+    QXmppCounter *sessionsCreated;
+    QXmppHistogram *responseSize;
+
+private:
+    QXmppBoshExtension *q;
+};
+
+QXmppBoshExtensionPrivate::QXmppBoshExtensionPrivate(QXmppBoshExtension *qq)
+    : address(QHostAddress::LocalHost),
+    port(5280),
+    path("/http-bind"),
+    secure(false),
+    inactivity(60),
+    maximumConnections(8192),
+    maximumHold(1),
+    maximumWait(60),
+    httpServer(0),
+    timeoutTimer(0),
+    rereadScheduled(false),
+    connectionsRefused(0),
+    emptyResponses(0),
+    requests(0),
+    sessionsCreated(0),
+    responseSize(0),
+    q(qq)
+{
+}
+
+/// Returns the number of open HTTP connections.
+
+int QXmppBoshExtensionPrivate::connections() const
+{
+    return waiting.size() + idle.size();
+}
+
+/// Creates a session for a session creation request.
+///
+/// \param socket
+/// \param body
+
+void QXmppBoshExtensionPrivate::createSession(QTcpSocket *socket, const QDomElement &body)
+{
+    QXmppServer *server = q->server();
+
+    bool ok = false;
+    const qint64 rid = body.attribute("rid").toLongLong(&ok);
+    if (!ok) {
+        writeResponse(socket, "200 OK", terminateBody("bad-request"));
+        return;
+    }
+    if (body.attribute("to") != server->domain()) {
+        writeResponse(socket, "200 OK", terminateBody("host-unknown"));
+        return;
+    }
+
+    QString sid;
+    do {
+        sid = QXmppUtils::generateStanzaHash();
+    } while (sessions.contains(sid) || farewells.contains(sid));
+
+    QXmppBoshSession *session = new QXmppBoshSession(sid, server->domain(), this, q);
+    server->addIncomingClient(session);
+    sessions.insert(sid, session);
+    sessionsCreated->add();
+    session->start(socket, body, rid);
+}
+
+/// Reads the next HTTP request from a connection, if it is complete.
+///
+/// \param socket
+
+void QXmppBoshExtensionPrivate::readRequest(QTcpSocket *socket)
+{
+    // a connection carries one request at a time
+    if (waiting.contains(socket))
+        return;
+
+    // wait for the complete request header
+    const QByteArray header = socket->peek(maxHeaderSize);
+    const int headerEnd = header.indexOf("\r\n\r\n");
+    if (headerEnd < 0) {
+        if (header.size() >= maxHeaderSize)
+            socket->abort();
+        return;
+    }
+
+    // parse the request line and headers
+    const QList<QByteArray> lines = header.left(headerEnd).split('\n');
+    const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+    qint64 contentLength = 0;
+    bool keepAlive = requestLine.size() == 3 && requestLine[2] == "HTTP/1.1";
+    for (int i = 1; i < lines.size(); ++i) {
+        const int colon = lines[i].indexOf(':');
+        if (colon < 0)
+            continue;
+        const QByteArray name = lines[i].left(colon).trimmed().toLower();
+        const QByteArray value = lines[i].mid(colon + 1).trimmed().toLower();
+        if (name == "content-length")
+            contentLength = value.toLongLong();
+        else if (name == "connection")
+            keepAlive = (value == "keep-alive");
+    }
+    socket->setProperty(closeProperty, !keepAlive);
+
+    if (contentLength < 0 || contentLength > maxBodySize) {
+        socket->setProperty(closeProperty, true);
+        writeResponse(socket, "413 Request Entity Too Large", QByteArray());
+        return;
+    }
+
+    // wait for the complete request body
+    const qint64 requestSize = headerEnd + 4 + contentLength;
+    if (socket->bytesAvailable() < requestSize)
+        return;
+    const QByteArray data = socket->read(requestSize).mid(headerEnd + 4);
+
+    // from now on, the connection waits for a response
+    idle.remove(socket);
+    waiting.insert(socket, 0);
+
+    QByteArray target = requestLine.value(1);
+    const int query = target.indexOf('?');
+    if (query >= 0)
+        target.truncate(query);
+
+    if (requestLine.size() != 3) {
+        socket->setProperty(closeProperty, true);
+        writeResponse(socket, "400 Bad Request", QByteArray());
+        return;
+    } else if (requestLine[0] == "OPTIONS") {
+        // CORS preflight
+        writeResponse(socket, "200 OK", QByteArray());
+        return;
+    } else if (requestLine[0] != "POST") {
+        writeResponse(socket, "405 Method Not Allowed", QByteArray());
+        return;
+    } else if (QString::fromUtf8(target) != path) {
+        writeResponse(socket, "404 Not Found", QByteArray());
+        return;
+    }
+
+    QDomDocument doc;
+    if (!doc.setContent(data, true)) {
+        writeResponse(socket, "400 Bad Request", QByteArray());
+        return;
+    }
+    const QDomElement body = doc.documentElement();
+    if (body.localName() != QLatin1String("body") || body.namespaceURI() != QLatin1String(ns_bosh)) {
+        writeResponse(socket, "400 Bad Request", QByteArray());
+        return;
+    }
+    requests->add();
+
+    const QString sid = body.attribute("sid");
+    if (sid.isEmpty()) {
+        createSession(socket, body);
+    } else if (QXmppBoshSession *session = sessions.value(sid)) {
+        waiting.insert(socket, session);
+        session->handleRequest(socket, body);
+    } else if (farewells.contains(sid)) {
+        writeResponse(socket, "200 OK", farewells.take(sid).first);
+    } else {
+        writeResponse(socket, "200 OK", terminateBody("item-not-found"));
+    }
+}
+
+/// Writes an HTTP response on a connection which was waiting for one.
+///
+/// \param socket
+/// \param status
+/// \param body
+
+void QXmppBoshExtensionPrivate::writeResponse(QTcpSocket *socket, const QByteArray &status, const QByteArray &body)
+{
+    const bool close = socket->property(closeProperty).toBool();
+
+    QByteArray response = "HTTP/1.1 " + status + "\r\n";
+    response += "Access-Control-Allow-Origin: *\r\n";
+    response += "Access-Control-Allow-Methods: POST, OPTIONS\r\n";
+    response += "Access-Control-Allow-Headers: Content-Type\r\n";
+    if (!body.isEmpty())
+        response += "Content-Type: text/xml; charset=utf-8\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    if (close)
+        response += "Connection: close\r\n";
+    response += "\r\n";
+    response += body;
+
+    waiting.remove(socket);
+    socket->write(response);
+    if (responseSize)
+        responseSize->record(body.size());
+
+    if (close) {
+        socket->disconnectFromHost();
+        return;
+    }
+
+    // the connection is idle until its next request
+    idle.insert(socket, clock.elapsed());
+    if (socket->bytesAvailable()) {
+        rereads.insert(socket);
+        if (!rereadScheduled) {
+            rereadScheduled = true;
+            QMetaObject::invokeMethod(q, "_q_reread", Qt::QueuedConnection);
+        }
+    }
+}
+
+/// Constructs a new BOSH session.
+///
+/// \param sid
+/// \param domain
+/// \param extension
+/// \param parent
+
+QXmppBoshSession::QXmppBoshSession(const QString &sid, const QString &domain, QXmppBoshExtensionPrivate *extension, QObject *parent)
+    : QXmppIncomingClient(0, domain, parent),
+    m_extension(extension),
+    m_sid(sid),
+    m_domain(domain),
+    m_wait(0),
+    m_hold(0),
+    m_requests(1),
+    m_nextRid(0),
+    m_idleSince(0),
+    m_congestedSince(-1),
+    m_coalescedSize(0),
+    m_flushScheduled(false),
+    m_terminated(false)
+{
+    setPlainAllowed(extension->secure);
+}
+
+/// Returns true if the session is alive and a resource is bound.
+///
+
+bool QXmppBoshSession::isConnected() const
+{
+    return !m_terminated && !QXmppJid(jid()).resourceRef().isEmpty();
+}
+
+/// Returns the number of requests the session holds.
+///
+
+int QXmppBoshSession::heldRequests() const
+{
+    return m_held.size();
+}
+
+/// Starts the session from its creation request.
+///
+/// \param socket
+/// \param body
+/// \param rid
+
+void QXmppBoshSession::start(QTcpSocket *socket, const QDomElement &body, qint64 rid)
+{
+    const int requestedWait = body.attribute("wait").toInt();
+    const int requestedHold = body.attribute("hold", "1").toInt();
+    m_wait = requestedWait > 0 ? qMin(requestedWait, m_extension->maximumWait) : m_extension->maximumWait;
+    m_hold = qBound(0, requestedHold, m_extension->maximumHold);
+    m_requests = m_hold + 1;
+    m_nextRid = rid + 1;
+
+    // start the XMPP stream, which queues the stream features
+    handleStream(body);
+    if (m_terminated) {
+        m_extension->writeResponse(socket, "200 OK", m_extension->farewells.take(m_sid).first);
+        return;
+    }
+
+    m_attributes = QString(" sid=\"%1\" wait=\"%2\" inactivity=\"%3\" polling=\"%4\""
+        " requests=\"%5\" hold=\"%6\" ver=\"1.11\" from=\"%7\" authid=\"%8\""
+        " xmpp:version=\"1.0\" xmpp:restartlogic=\"true\"").arg(
+        m_sid,
+        QString::number(m_wait),
+        QString::number(m_extension->inactivity),
+        QString::number(1),
+        QString::number(m_requests),
+        QString::number(m_hold),
+        m_domain,
+        QString::fromAscii(m_authId)).toUtf8();
+
+    m_idleSince = m_extension->clock.elapsed();
+    hold(socket, rid);
+    trim();
+    scheduleFlush();
+}
+
+/// Handles a request of the session.
+///
+/// \param socket
+/// \param body
+
+void QXmppBoshSession::handleRequest(QTcpSocket *socket, const QDomElement &body)
+{
+    bool ok = false;
+    const qint64 rid = body.attribute("rid").toLongLong(&ok);
+    if (!ok) {
+        m_extension->writeResponse(socket, "200 OK", terminateBody("bad-request"));
+        terminate("bad-request");
+        return;
+    }
+
+    if (rid == m_nextRid) {
+        process(socket, rid, body);
+
+        // process the requests which were waiting for this one
+        while (!m_terminated && m_early.contains(m_nextRid)) {
+            const QXmppBoshRequest request = m_early.take(m_nextRid);
+            process(request.socket, request.rid, request.body);
+        }
+    } else if (rid > m_nextRid && rid < m_nextRid + m_requests && !m_early.contains(rid)) {
+        // a request which overtook its predecessors
+        QXmppBoshRequest request;
+        request.socket = socket;
+        request.rid = rid;
+        request.deadline = m_extension->clock.elapsed() + m_wait * 1000;
+        request.body = body;
+        m_early.insert(rid, request);
+    } else if (m_responses.contains(rid)) {
+        // a retransmission, resend the response
+        m_extension->writeResponse(socket, "200 OK", m_responses.value(rid));
+    } else if (rid < m_nextRid && rid >= m_nextRid - m_requests) {
+        // the connection which carried the request was lost before the
+        // response was sent, its payload was already processed
+        hold(socket, rid);
+        trim();
+    } else {
+        m_extension->writeResponse(socket, "200 OK", terminateBody("item-not-found"));
+        terminate("item-not-found");
+    }
+}
+
+/// Forgets the requests carried by a connection which was closed.
+///
+/// \param socket
+
+void QXmppBoshSession::releaseSocket(QTcpSocket *socket)
+{
+    for (int i = m_held.size() - 1; i >= 0; --i)
+        if (m_held.at(i).socket == socket)
+            m_held.removeAt(i);
+
+    QMap<qint64, QXmppBoshRequest>::iterator it = m_early.begin();
+    while (it != m_early.end()) {
+        if (it->socket == socket)
+            it = m_early.erase(it);
+        else
+            ++it;
+    }
+
+    if (m_held.isEmpty())
+        m_idleSince = m_extension->clock.elapsed();
+}
+
+/// Answers the held requests whose wait expired, and terminates the session
+/// if it was inactive for too long.
+///
+/// \param now
+
+void QXmppBoshSession::checkTimeouts(qint64 now)
+{
+    if (m_congestedSince >= 0 && now - m_congestedSince > slowConsumerTimeout() * 1000) {
+        _q_slowConsumerTimeout();
+        return;
+    }
+
+    while (!m_held.isEmpty() && m_held.first().deadline <= now)
+        respond(m_held.takeFirst());
+
+    if (!m_early.isEmpty() && m_early.begin()->deadline <= now) {
+        // the request the early ones are waiting for never arrived
+        terminate("item-not-found");
+    } else if (m_held.isEmpty() && m_early.isEmpty() &&
+               now - m_idleSince > m_extension->inactivity * 1000) {
+        info(QString("BOSH session %1 is inactive").arg(m_sid));
+        terminate(QString());
+    }
+}
+
+/// Terminates the session, sending the pending data with the terminate
+/// body.
+///
+/// \param condition
+
+void QXmppBoshSession::terminate(const QString &condition)
+{
+    if (m_terminated)
+        return;
+    m_terminated = true;
+
+    const QByteArray farewell = terminateBody(condition, takePending());
+
+    // the oldest held request carries the pending data
+    QList<QXmppBoshRequest> requests = m_held;
+    requests += m_early.values();
+    m_held.clear();
+    m_early.clear();
+    if (requests.isEmpty()) {
+        m_extension->farewells.insert(m_sid, qMakePair(farewell,
+            m_extension->clock.elapsed() + m_wait * 1000));
+    } else {
+        m_extension->writeResponse(requests.first().socket, "200 OK", farewell);
+        for (int i = 1; i < requests.size(); ++i)
+            m_extension->writeResponse(requests.at(i).socket, "200 OK", terminateBody(condition));
+    }
+
+    m_extension->sessions.remove(m_sid);
+    emit disconnected();
+}
+
+/// Terminates the session.
+
+void QXmppBoshSession::disconnectFromHost()
+{
+    terminate(QString());
+}
+
+/// Queues data for the next response.
+///
+/// \param data
+
+bool QXmppBoshSession::sendData(const QByteArray &data)
+{
+    if (isLoggingEnabled(QXmppLogger::SentMessage))
+        logSent(QString::fromUtf8(data));
+    if (m_terminated)
+        return false;
+
+    // the stream header has no equivalent in BOSH, except for its id
+    if (data.startsWith("<?xml")) {
+        const int pos = data.indexOf(" id=\"");
+        if (pos >= 0) {
+            const int end = data.indexOf('"', pos + 5);
+            m_authId = data.mid(pos + 5, end - pos - 5);
+        }
+        return true;
+    }
+
+    m_pending.enqueue(declareClientNamespace(data));
+    checkPending();
+    scheduleFlush();
+    return true;
+}
+
+/// Applies the stream's watermarks to the data waiting for a held request:
+/// superseded presences are dropped once the high watermark is exceeded,
+/// and the session is terminated if the data stays above the low
+/// watermark for longer than slowConsumerTimeout(), or grows beyond four
+/// times the high watermark.
+
+void QXmppBoshSession::checkPending()
+{
+    const qint64 high = highWaterMark();
+    if (high <= 0)
+        return;
+
+    qint64 size = m_pending.size();
+    if (size > high) {
+        // avoid rescanning on every stanza
+        if (size > m_coalescedSize + high / 4) {
+            const int removed = m_pending.coalesce();
+            if (removed)
+                debug(QString("Dropped %1 superseded presences from BOSH session %2").arg(
+                    QString::number(removed), m_sid));
+            size = m_pending.size();
+            m_coalescedSize = size;
+        }
+
+        if (size > 4 * high)
+            QMetaObject::invokeMethod(this, "_q_slowConsumerTimeout", Qt::QueuedConnection);
+        else if (size > high && m_congestedSince < 0)
+            m_congestedSince = m_extension->clock.elapsed();
+    } else if (size <= lowWaterMark()) {
+        m_coalescedSize = 0;
+        m_congestedSince = -1;
+    }
+}
+
+/// Sends the pending data in response to the oldest held request.
+
+void QXmppBoshSession::_q_flush()
+{
+    m_flushScheduled = false;
+    if (!m_held.isEmpty() && !m_pending.isEmpty())
+        respond(m_held.takeFirst());
+}
+
+void QXmppBoshSession::_q_slowConsumerTimeout()
+{
+    if (m_terminated || m_pending.size() <= lowWaterMark())
+        return;
+
+    warning(QString("Terminating slow BOSH session %1 with %2 bytes pending").arg(
+        m_sid, QString::number(m_pending.size())));
+    m_pending.clear();
+    terminate("policy-violation");
+}
+
+/// Holds a request until there is data to send or its wait expires.
+///
+/// \param socket
+/// \param rid
+
+void QXmppBoshSession::hold(QTcpSocket *socket, qint64 rid)
+{
+    QXmppBoshRequest request;
+    request.socket = socket;
+    request.rid = rid;
+    request.deadline = m_extension->clock.elapsed() + m_wait * 1000;
+    m_held << request;
+    m_extension->waiting.insert(socket, this);
+}
+
+/// Processes the payload of the next request in sequence, then holds it.
+///
+/// \param socket
+/// \param rid
+/// \param body
+
+void QXmppBoshSession::process(QTcpSocket *socket, qint64 rid, const QDomElement &body)
+{
+    m_nextRid = rid + 1;
+    hold(socket, rid);
+
+    if (body.attributeNS(ns_xbosh, "restart") == QLatin1String("true")) {
+        // restart the XMPP stream after authentication
+        QDomDocument doc;
+        QDomElement stream = doc.createElement("stream");
+        stream.setAttribute("to", m_domain);
+        handleStream(stream);
+    } else {
+        QDomElement child = body.firstChildElement();
+        while (!child.isNull() && !m_terminated) {
+            // there is no TLS layer to negotiate
+            if (QXmppAtom::namespaceUri(child) != QXmppAtom::NsTls) {
+                if (isLoggingEnabled(QXmppLogger::ReceivedMessage)) {
+                    QString xml;
+                    QTextStream stream(&xml);
+                    child.save(stream, 0);
+                    logReceived(xml);
+                }
+                handleStanza(child);
+            }
+            child = child.nextSiblingElement();
+        }
+    }
+
+    if (m_terminated)
+        return;
+    if (body.attribute("type") == QLatin1String("terminate")) {
+        terminate(QString());
+        return;
+    }
+
+    trim();
+    scheduleFlush();
+}
+
+/// Answers a request with the pending data.
+///
+/// \param request
+
+void QXmppBoshSession::respond(const QXmppBoshRequest &request)
+{
+    const QByteArray pending = takePending();
+    QByteArray body = bodyStart + m_attributes;
+    if (pending.isEmpty()) {
+        body += "/>";
+        m_extension->emptyResponses->add();
+    } else {
+        body += ">" + pending + "</body>";
+    }
+    m_attributes.clear();
+
+    // keep the latest responses for retransmissions
+    m_responses.insert(request.rid, body);
+    while (m_responses.size() > m_requests)
+        m_responses.erase(m_responses.begin());
+
+    if (m_held.isEmpty())
+        m_idleSince = m_extension->clock.elapsed();
+    m_extension->writeResponse(request.socket, "200 OK", body);
+}
+
+/// Schedules the pending data to be sent once the current pass of the event
+/// loop is over, so that the data sent meanwhile is batched in the same
+/// response.
+
+void QXmppBoshSession::scheduleFlush()
+{
+    if (!m_flushScheduled && !m_held.isEmpty() && !m_pending.isEmpty()) {
+        m_flushScheduled = true;
+        QMetaObject::invokeMethod(this, "_q_flush", Qt::QueuedConnection);
+    }
+}
+
+/// Removes and returns the data waiting for a held request.
+
+QByteArray QXmppBoshSession::takePending()
+{
+    QByteArray data;
+    while (!m_pending.isEmpty())
+        data += m_pending.dequeue();
+    m_coalescedSize = 0;
+    m_congestedSince = -1;
+    return data;
+}
+
+/// Answers the oldest requests so that the session holds at most 'hold'
+/// requests.
+
+void QXmppBoshSession::trim()
+{
+    while (m_held.size() > m_hold)
+        respond(m_held.takeFirst());
+}
+
+/// Constructs a new BOSH extension.
+
+QXmppBoshExtension::QXmppBoshExtension()
+    : d(new QXmppBoshExtensionPrivate(this))
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->httpServer = new QTcpServer(this);
+    check = connect(d->httpServer, SIGNAL(newConnection()),
+                    this, SLOT(_q_newConnection()));
+    Q_ASSERT(check);
+
+    d->timeoutTimer = new QTimer(this);
+    d->timeoutTimer->setInterval(timeoutInterval);
+    check = connect(d->timeoutTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_checkTimeouts()));
+    Q_ASSERT(check);
+}
+
+QXmppBoshExtension::~QXmppBoshExtension()
+{
+    stop();
+    delete d;
+}
+
+QString QXmppBoshExtension::extensionName() const
+{
+    return QLatin1String("bosh");
+}
+
+/// Returns the address on which the HTTP listener is bound.
+///
+
+QHostAddress QXmppBoshExtension::address() const
+{
+    return d->address;
+}
+
+/// Sets the address on which the HTTP listener is bound.
+///
+/// The default is QHostAddress::LocalHost, as requests are served over
+/// plain HTTP. The change takes effect the next time the extension is
+/// started.
+///
+/// \param address
+
+void QXmppBoshExtension::setAddress(const QHostAddress &address)
+{
+    d->address = address;
+}
+
+/// Returns the port on which the HTTP listener is bound.
+///
+
+quint16 QXmppBoshExtension::port() const
+{
+    return d->port;
+}
+
+/// Sets the port on which the HTTP listener is bound, the default is 5280.
+///
+/// The change takes effect the next time the extension is started.
+///
+/// \param port
+
+void QXmppBoshExtension::setPort(quint16 port)
+{
+    d->port = port;
+}
+
+/// Returns the path of the BOSH endpoint.
+///
+
+QString QXmppBoshExtension::path() const
+{
+    return d->path;
+}
+
+/// Sets the path of the BOSH endpoint, the default is "/http-bind".
+///
+/// \param path
+
+void QXmppBoshExtension::setPath(const QString &path)
+{
+    d->path = path;
+}
+
+/// Returns true if the clients reach the listener over TLS.
+///
+
+bool QXmppBoshExtension::isSecure() const
+{
+    return d->secure;
+}
+
+/// Sets whether the clients reach the listener over TLS, typically through
+/// a reverse proxy which terminates TLS, the default is false.
+///
+/// SASL PLAIN is only offered to the sessions of a secure listener.
+///
+/// \param secure
+
+void QXmppBoshExtension::setSecure(bool secure)
+{
+    d->secure = secure;
+}
+
+/// Returns the number of seconds after which a session which holds no
+/// request is terminated.
+///
+
+int QXmppBoshExtension::inactivity() const
+{
+    return d->inactivity;
+}
+
+/// Sets the number of seconds after which a session which holds no
+/// request is terminated, the default is 60.
+///
+/// Idle HTTP connections are closed after the same delay.
+///
+/// \param secs
+
+void QXmppBoshExtension::setInactivity(int secs)
+{
+    d->inactivity = secs;
+}
+
+/// Returns the maximum number of open HTTP connections.
+///
+
+int QXmppBoshExtension::maximumConnections() const
+{
+    return d->maximumConnections;
+}
+
+/// Sets the maximum number of open HTTP connections, the default is 8192.
+///
+/// Connections beyond this number are closed as soon as they are accepted.
+///
+/// \param connections
+
+void QXmppBoshExtension::setMaximumConnections(int connections)
+{
+    d->maximumConnections = connections;
+}
+
+/// Returns the maximum number of requests a session may hold.
+///
+
+int QXmppBoshExtension::maximumHold() const
+{
+    return d->maximumHold;
+}
+
+/// Sets the maximum number of requests a session may hold, the default
+/// is 1.
+///
+/// Clients asking for more are granted this number.
+///
+/// \param requests
+
+void QXmppBoshExtension::setMaximumHold(int requests)
+{
+    d->maximumHold = requests;
+}
+
+/// Returns the maximum number of seconds a request is held.
+///
+
+int QXmppBoshExtension::maximumWait() const
+{
+    return d->maximumWait;
+}
+
+/// Sets the maximum number of seconds a request is held, the default
+/// is 60.
+///
+/// Clients asking for longer are granted this number.
+///
+/// \param secs
+
+void QXmppBoshExtension::setMaximumWait(int secs)
+{
+    d->maximumWait = secs;
+}
+
+QVariantMap QXmppBoshExtension::statistics() const
+{
+    int held = 0;
+    foreach (QXmppBoshSession *session, d->sessions)
+        held += session->heldRequests();
+
+    QVariantMap stats;
+    stats["connections"] = d->connections();
+    stats["held-requests"] = held;
+    stats["sessions"] = d->sessions.size();
+    return stats;
+}
+
+/// Starts the HTTP listener.
+
+bool QXmppBoshExtension::start()
+{
+    if (d->httpServer->isListening())
+        return true;
+
+    QXmppServer *server = this->server();
+    if (!server)
+        return false;
+
+    QXmppMetrics *metrics = server->metrics();
+    d->connectionsRefused = metrics->counter("bosh-connections-refused");
+    d->emptyResponses = metrics->counter("bosh-empty-responses");
+    d->requests = metrics->counter("bosh-requests");
+    d->sessionsCreated = metrics->counter("bosh-sessions-created");
+    d->responseSize = metrics->histogram("bosh-response-size");
+
+    if (!d->httpServer->listen(d->address, d->port)) {
+        warning(QString("Could not start listening for BOSH requests on %1 %2").arg(
+            d->address.toString(), QString::number(d->port)));
+        return false;
+    }
+
+    info(QString("Serving BOSH requests on %1 %2").arg(
+        d->address.toString(), QString::number(d->httpServer->serverPort())));
+    d->clock.start();
+    d->timeoutTimer->start();
+    return true;
+}
+
+/// Terminates the sessions and stops the HTTP listener.
+
+void QXmppBoshExtension::stop()
+{
+    if (!d->httpServer->isListening())
+        return;
+
+    d->httpServer->close();
+    d->timeoutTimer->stop();
+
+    foreach (QXmppBoshSession *session, d->sessions.values())
+        session->terminate("system-shutdown");
+
+    QList<QTcpSocket*> sockets = d->waiting.keys();
+    sockets += d->idle.keys();
+    d->waiting.clear();
+    d->idle.clear();
+    d->rereads.clear();
+    d->farewells.clear();
+    foreach (QTcpSocket *socket, sockets) {
+        socket->disconnect(this);
+        socket->flush();
+        socket->abort();
+        socket->deleteLater();
+    }
+}
+
+void QXmppBoshExtension::_q_checkTimeouts()
+{
+    const qint64 now = d->clock.elapsed();
+
+    foreach (QXmppBoshSession *session, d->sessions.values())
+        session->checkTimeouts(now);
+
+    // close idle connections
+    QList<QTcpSocket*> expired;
+    for (QHash<QTcpSocket*, qint64>::const_iterator it = d->idle.constBegin(); it != d->idle.constEnd(); ++it)
+        if (now - it.value() > d->inactivity * 1000)
+            expired << it.key();
+    foreach (QTcpSocket *socket, expired)
+        socket->disconnectFromHost();
+
+    // forget terminated sessions
+    QHash<QString, QPair<QByteArray, qint64> >::iterator it = d->farewells.begin();
+    while (it != d->farewells.end()) {
+        if (it->second <= now)
+            it = d->farewells.erase(it);
+        else
+            ++it;
+    }
+}
+
+void QXmppBoshExtension::_q_newConnection()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    while (QTcpSocket *socket = d->httpServer->nextPendingConnection()) {
+        if (d->connections() >= d->maximumConnections) {
+            d->connectionsRefused->add();
+            socket->abort();
+            socket->deleteLater();
+            continue;
+        }
+
+        check = connect(socket, SIGNAL(readyRead()),
+                        this, SLOT(_q_readyRead()));
+        Q_ASSERT(check);
+
+        check = connect(socket, SIGNAL(disconnected()),
+                        this, SLOT(_q_socketDisconnected()));
+        Q_ASSERT(check);
+
+        d->idle.insert(socket, d->clock.elapsed());
+    }
+}
+
+void QXmppBoshExtension::_q_readyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (socket)
+        d->readRequest(socket);
+}
+
+void QXmppBoshExtension::_q_reread()
+{
+    d->rereadScheduled = false;
+    const QSet<QTcpSocket*> sockets = d->rereads;
+    d->rereads.clear();
+    foreach (QTcpSocket *socket, sockets)
+        d->readRequest(socket);
+}
+
+void QXmppBoshExtension::_q_socketDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket)
+        return;
+
+    QXmppBoshSession *session = d->waiting.take(socket);
+    if (session)
+        session->releaseSocket(socket);
+    d->idle.remove(socket);
+    d->rereads.remove(socket);
+    socket->deleteLater();
+}
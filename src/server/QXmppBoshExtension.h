@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPBOSHEXTENSION_H
+#define QXMPPBOSHEXTENSION_H
+
+#include <QHostAddress>
+
+#include "QXmppServerExtension.h"
+
+class QXmppBoshExtensionPrivate;
+
+/// \brief The QXmppBoshExtension class lets clients connect to the server
+/// over HTTP, using XEP-0124: Bidirectional-streams Over Synchronous HTTP
+/// (BOSH) and XEP-0206: XMPP Over BOSH.
+///
+/// Each BOSH session is handled as a QXmppIncomingClient stream by the
+/// server. Requests are held open for up to wait() seconds, and the stanzas
+/// which arrive meanwhile are batched into the response to the oldest held
+/// request. A session holds at most maximumHold() requests, HTTP
+/// connections are kept alive and reused between requests, and the total
+/// number of connections is capped by maximumConnections(), so that the
+/// number of sockets stays bounded whatever the number of sessions.
+///
+/// The listener speaks plain HTTP, and by default only accepts connections
+/// from the local host. To serve remote clients, put it behind a reverse
+/// proxy which terminates TLS and call setSecure(), which is also what
+/// allows clients to authenticate with SASL PLAIN.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppBoshExtension : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_PROPERTY(QHostAddress address READ address WRITE setAddress)
+    Q_PROPERTY(quint16 port READ port WRITE setPort)
+    Q_PROPERTY(QString path READ path WRITE setPath)
+    Q_PROPERTY(bool secure READ isSecure WRITE setSecure)
+    Q_PROPERTY(int inactivity READ inactivity WRITE setInactivity)
+    Q_PROPERTY(int maximumConnections READ maximumConnections WRITE setMaximumConnections)
+    Q_PROPERTY(int maximumHold READ maximumHold WRITE setMaximumHold)
+    Q_PROPERTY(int maximumWait READ maximumWait WRITE setMaximumWait)
+
+public:
+    QXmppBoshExtension();
+    ~QXmppBoshExtension();
+
+    QString extensionName() const;
+
+    QHostAddress address() const;
+    void setAddress(const QHostAddress &address);
+
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    QString path() const;
+    void setPath(const QString &path);
+
+    bool isSecure() const;
+    void setSecure(bool secure);
+
+    int inactivity() const;
+    void setInactivity(int secs);
+
+    int maximumConnections() const;
+    void setMaximumConnections(int connections);
+
+    int maximumHold() const;
+    void setMaximumHold(int requests);
+
+    int maximumWait() const;
+    void setMaximumWait(int secs);
+
+    QVariantMap statistics() const;
+
+    bool start();
+    void stop();
+
+private slots:
+    void _q_checkTimeouts();
+    void _q_newConnection();
+    void _q_readyRead();
+    void _q_reread();
+    void _q_socketDisconnected();
+
+private:
+    QXmppBoshExtensionPrivate * const d;
+};
+
+#endif
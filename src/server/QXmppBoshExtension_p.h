@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPBOSHEXTENSION_P_H
+#define QXMPPBOSHEXTENSION_P_H
+
+#include <QDomElement>
+#include <QList>
+#include <QMap>
+
+#include "QXmppIncomingClient.h"
+#include "QXmppStream_p.h"
+
+class QTcpSocket;
+class QXmppBoshExtensionPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppBoshExtension class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+/// An HTTP request waiting for its response.
+
+class QXmppBoshRequest
+{
+public:
+    QTcpSocket *socket;
+    qint64 rid;
+    qint64 deadline;
+
+    // the body of a request received ahead of its predecessors
+    QDomElement body;
+};
+
+/// \brief The QXmppBoshSession class is the stream of a BOSH session.
+///
+/// The client's stanzas are unwrapped from the request bodies and handed
+/// to QXmppIncomingClient, while the data the server sends to the stream
+/// is buffered until a held request can carry it.
+///
+
+class QXmppBoshSession : public QXmppIncomingClient
+{
+    Q_OBJECT
+
+public:
+    QXmppBoshSession(const QString &sid, const QString &domain, QXmppBoshExtensionPrivate *extension, QObject *parent);
+
+    bool isConnected() const;
+    int heldRequests() const;
+
+    void start(QTcpSocket *socket, const QDomElement &body, qint64 rid);
+    void handleRequest(QTcpSocket *socket, const QDomElement &body);
+    void releaseSocket(QTcpSocket *socket);
+    void checkTimeouts(qint64 now);
+    void terminate(const QString &condition);
+
+public slots:
+    void disconnectFromHost();
+    bool sendData(const QByteArray &data);
+
+private slots:
+    void _q_flush();
+    void _q_slowConsumerTimeout();
+
+private:
+    void checkPending();
+    void hold(QTcpSocket *socket, qint64 rid);
+    void process(QTcpSocket *socket, qint64 rid, const QDomElement &body);
+    void respond(const QXmppBoshRequest &request);
+    void scheduleFlush();
+    QByteArray takePending();
+    void trim();
+
+    QXmppBoshExtensionPrivate *m_extension;
+    QString m_sid;
+    QString m_domain;
+    QByteArray m_authId;
+    int m_wait;
+    int m_hold;
+    int m_requests;
+    qint64 m_nextRid;
+    qint64 m_idleSince;
+
+    // held requests, oldest first
+    QList<QXmppBoshRequest> m_held;
+
+    // requests received ahead of their predecessors, by rid
+    QMap<qint64, QXmppBoshRequest> m_early;
+
+    // latest responses, by rid, for retransmissions
+    QMap<qint64, QByteArray> m_responses;
+
+    // data waiting for a held request, and the session creation
+    // attributes for the first response
+    QXmppOutputQueue m_pending;
+    QByteArray m_attributes;
+
+    // time since which the pending data exceeds the high watermark
+    qint64 m_congestedSince;
+    qint64 m_coalescedSize;
+
+    bool m_flushScheduled;
+    bool m_terminated;
+};
+
+#endif
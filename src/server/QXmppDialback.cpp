@@ -23,6 +23,7 @@
 
 #include <QDomElement>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppDialback.h"
 #include "QXmppUtils.h"
@@ -84,9 +85,10 @@ void QXmppDialback::setType(const QString &type)
 
 bool QXmppDialback::isDialback(const QDomElement &element)
 {
-    return element.namespaceURI() == ns_server_dialback &&
-           (element.tagName() == QLatin1String("result") ||
-           element.tagName() == QLatin1String("verify"));
+    const QXmppAtom tagName = QXmppAtom::tagName(element);
+    return QXmppAtom::namespaceUri(element) == QXmppAtom::NsServerDialback &&
+           (tagName == QXmppAtom::Result ||
+            tagName == QXmppAtom::Verify);
 }
 
 void QXmppDialback::parse(const QDomElement &element)
@@ -22,15 +22,20 @@
  */
 
 #include <QDomElement>
+#include <QElapsedTimer>
 #include <QSslKey>
 #include <QSslSocket>
 #include <QTimer>
 
+#include "QXmppAtom.h"
 #include "QXmppBindIq.h"
 #include "QXmppConstants.h"
+#include "QXmppJid.h"
 #include "QXmppMessage.h"
+#include "QXmppMetrics.h"
 #include "QXmppPasswordChecker.h"
 #include "QXmppSaslAuth.h"
+#include "QXmppServer.h"
 #include "QXmppSessionIq.h"
 #include "QXmppStreamFeatures.h"
 #include "QXmppUtils.h"
@@ -45,13 +50,53 @@ public:
     QString domain;
     QString username;
     QString resource;
-    QString jid;
+    QXmppJid jid;
     QXmppPasswordChecker *passwordChecker;
+    QXmppSslServer *sslServer;
+    bool plainAllowed;
     QXmppSaslDigestMd5 saslDigest;
     int saslDigestStep;
     QString saslDigestUsername;
+
+    // SCRAM
+    QCryptographicHash::Algorithm saslScramAlgorithm;
+    int saslScramStep;
+    QString saslScramUsername;
+    QByteArray saslScramGs2Header;
+    QByteArray saslScramClientFirstBare;
+    QByteArray saslScramServerFirst;
+    QByteArray saslScramNonce;
+    QByteArray saslScramStoredKey;
+    QByteArray saslScramServerKey;
+
+    // metrics
+    void recordAuthLatency();
+
+    QElapsedTimer authTimer;
+    QElapsedTimer tlsTimer;
+    QXmppHistogram *authLatency;
+    QXmppHistogram *tlsHandshakeTime;
+    QXmppCounter *iqReceived;
+    QXmppCounter *messagesReceived;
+    QXmppCounter *presencesReceived;
+    QXmppCounter *idleTimeouts;
 };
 
+void QXmppIncomingClientPrivate::recordAuthLatency()
+{
+    if (authLatency && authTimer.isValid())
+        authLatency->record(authTimer.nsecsElapsed() / 1000);
+    authTimer.invalidate();
+}
+
+static QByteArray xorBytes(const QByteArray &a, const QByteArray &b)
+{
+    QByteArray result(a);
+    for (int i = 0; i < result.size() && i < b.size(); ++i)
+        result[i] = result[i] ^ b[i];
+    return result;
+}
+
 /// Constructs a new incoming client stream.
 ///
 /// \param socket The socket for the XMPP stream.
@@ -64,14 +109,34 @@ QXmppIncomingClient::QXmppIncomingClient(QSslSocket *socket, const QString &doma
     d(new QXmppIncomingClientPrivate)
 {
     d->passwordChecker = 0;
+    d->sslServer = 0;
+    d->plainAllowed = true;
     d->domain = domain;
     d->saslDigestStep = 0;
+    d->saslScramAlgorithm = QCryptographicHash::Sha1;
+    d->saslScramStep = 0;
+    d->authLatency = 0;
+    d->tlsHandshakeTime = 0;
+    d->iqReceived = 0;
+    d->messagesReceived = 0;
+    d->presencesReceived = 0;
+    d->idleTimeouts = 0;
+    d->authTimer.invalidate();
+    d->tlsTimer.invalidate();
 
     if (socket) {
         info(QString("Incoming client connection from %1 %2").arg(
             socket->peerAddress().toString(),
             QString::number(socket->peerPort())));
         setSocket(socket);
+
+        // the handshake of direct TLS connections may still be running
+        if (socket->mode() == QSslSocket::SslServerMode && !socket->isEncrypted())
+            d->tlsTimer.start();
+        bool check = connect(socket, SIGNAL(encrypted()),
+                             this, SLOT(onEncrypted()));
+        Q_ASSERT(check);
+        Q_UNUSED(check);
     }
 
     // create inactivity timer
@@ -107,7 +172,7 @@ bool QXmppIncomingClient::isConnected() const
 
 QString QXmppIncomingClient::jid() const
 {
-    return d->jid;
+    return d->jid.toString();
 }
 
 /// Sets the number of seconds after which a client will be disconnected
@@ -131,12 +196,50 @@ void QXmppIncomingClient::setPasswordChecker(QXmppPasswordChecker *checker)
     d->passwordChecker = checker;
 }
 
+/// Sets whether the client may authenticate with SASL PLAIN, which
+/// discloses its password to anyone who can read the transport.
+///
+/// \param allowed
+
+void QXmppIncomingClient::setPlainAllowed(bool allowed)
+{
+    d->plainAllowed = allowed;
+}
+
+/// Sets the server whose worker threads perform the TLS handshake
+/// when the client negotiates STARTTLS.
+///
+/// \param server
+
+void QXmppIncomingClient::setSslServer(QXmppSslServer *server)
+{
+    d->sslServer = server;
+}
+
+/// Sets the metrics registry in which the stream records the stanzas it
+/// receives, its TLS handshake time, authentication latency and idle
+/// timeouts.
+///
+/// \param metrics
+
+void QXmppIncomingClient::setMetrics(QXmppMetrics *metrics)
+{
+    d->authLatency = metrics ? metrics->histogram("auth-latency") : 0;
+    d->tlsHandshakeTime = metrics ? metrics->histogram("tls-handshake-time") : 0;
+    d->iqReceived = metrics ? metrics->counter("stanzas-received-iq") : 0;
+    d->messagesReceived = metrics ? metrics->counter("stanzas-received-message") : 0;
+    d->presencesReceived = metrics ? metrics->counter("stanzas-received-presence") : 0;
+    d->idleTimeouts = metrics ? metrics->counter("idle-timeouts") : 0;
+}
+
 void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
 {
     if (d->idleTimer->interval())
         d->idleTimer->start();
     d->saslDigestStep = 0;
     d->saslDigestUsername.clear();
+    d->saslScramStep = 0;
+    d->saslScramUsername.clear();
 
     // start stream
     const QByteArray sessionId = QXmppUtils::generateStanzaHash().toAscii();
@@ -175,7 +278,14 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
     else if (d->passwordChecker)
     {
         QList<QString> mechanisms;
-        mechanisms << QLatin1String("PLAIN");
+        if (d->passwordChecker->hasGetSaltedKeys()) {
+#if QT_VERSION >= 0x050000
+            mechanisms << QLatin1String("SCRAM-SHA-256");
+#endif
+            mechanisms << QLatin1String("SCRAM-SHA-1");
+        }
+        if (d->plainAllowed)
+            mechanisms << QLatin1String("PLAIN");
         if (d->passwordChecker->hasGetPassword())
             mechanisms << QLatin1String("DIGEST-MD5");
         features.setAuthMechanismsStrings(mechanisms);
@@ -185,24 +295,38 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
 
 void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
 {
-    const QString ns = nodeRecv.namespaceURI();
+    const QXmppAtom ns = QXmppAtom::namespaceUri(nodeRecv);
+    const QXmppAtom tagName = QXmppAtom::tagName(nodeRecv);
 
     if (d->idleTimer->interval())
         d->idleTimer->start();
 
-    if (ns == ns_tls && nodeRecv.tagName() == QLatin1String("starttls"))
+    if (ns == QXmppAtom::NsTls && tagName == QXmppAtom::StartTls)
     {
+        // <proceed/> must reach the socket before it is detached or
+        // switched to TLS
         sendData("<proceed xmlns='urn:ietf:params:xml:ns:xmpp-tls'/>");
-        socket()->flush();
+        flushOutputQueue();
+
+        // detach the socket while a worker thread performs the handshake
+        if (d->sslServer && d->sslServer->handshakeThreadCount() > 0) {
+            QSslSocket *sslSocket = socket();
+            setSocket(0);
+            sslSocket->setParent(0);
+            d->sslServer->startServerEncryption(sslSocket, this);
+            return;
+        }
+
+        d->tlsTimer.start();
         socket()->startServerEncryption();
         return;
     }
-    else if (ns == ns_sasl)
+    else if (ns == QXmppAtom::NsSasl)
     {
-        if (nodeRecv.tagName() == QLatin1String("auth"))
+        if (tagName == QXmppAtom::Auth)
         {
             const QString mechanism = nodeRecv.attribute("mechanism");
-            if (mechanism == QLatin1String("PLAIN"))
+            if (mechanism == QLatin1String("PLAIN") && d->plainAllowed)
             {
                 QList<QByteArray> auth = QByteArray::fromBase64(nodeRecv.text().toAscii()).split('\0');
                 if (auth.size() != 3)
@@ -224,6 +348,7 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                     return;
                 }
 
+                d->authTimer.start();
                 QXmppPasswordReply *reply = d->passwordChecker->checkPassword(request);
                 reply->setParent(this);
                 reply->setProperty("__sasl_username", request.username());
@@ -246,6 +371,59 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                 const QByteArray data = QXmppSaslDigestMd5::serializeMessage(challenge).toBase64();
                 sendData("<challenge xmlns='urn:ietf:params:xml:ns:xmpp-sasl'>" + data +"</challenge>");
             }
+            else if (mechanism == QLatin1String("SCRAM-SHA-1")
+#if QT_VERSION >= 0x050000
+                     || mechanism == QLatin1String("SCRAM-SHA-256")
+#endif
+                     )
+            {
+#if QT_VERSION >= 0x050000
+                d->saslScramAlgorithm = (mechanism == QLatin1String("SCRAM-SHA-256")) ?
+                    QCryptographicHash::Sha256 : QCryptographicHash::Sha1;
+#else
+                d->saslScramAlgorithm = QCryptographicHash::Sha1;
+#endif
+
+                // we do not support channel binding
+                const QByteArray raw = QByteArray::fromBase64(nodeRecv.text().toAscii());
+                const int pos = raw.indexOf(',', 2);
+                if ((!raw.startsWith("n,") && !raw.startsWith("y,")) || pos < 0)
+                {
+                    sendData("<failure xmlns='urn:ietf:params:xml:ns:xmpp-sasl'><incorrect-encoding/></failure>");
+                    disconnectFromHost();
+                    return;
+                }
+                d->saslScramGs2Header = raw.left(pos + 1);
+                d->saslScramClientFirstBare = raw.mid(pos + 1);
+
+                const QMap<char, QByteArray> clientFirst = QXmppSaslScram::parseMessage(d->saslScramClientFirstBare);
+                const QString username = QXmppSaslScram::unescapeName(clientFirst.value('n'));
+                if (username.isEmpty() || clientFirst.value('r').isEmpty())
+                {
+                    sendData("<failure xmlns='urn:ietf:params:xml:ns:xmpp-sasl'><incorrect-encoding/></failure>");
+                    disconnectFromHost();
+                    return;
+                }
+                d->saslScramNonce = clientFirst.value('r') + QXmppSaslScram::generateNonce();
+
+                if (!d->passwordChecker) {
+                    // FIXME: what type of failure?
+                    warning(QString("Cannot authenticate '%1', no password checker").arg(username));
+                    sendData("<failure xmlns='urn:ietf:params:xml:ns:xmpp-sasl'/>");
+                    disconnectFromHost();
+                    return;
+                }
+
+                QXmppPasswordRequest request;
+                request.setUsername(username);
+                request.setDomain(d->domain);
+
+                d->authTimer.start();
+                QXmppPasswordReply *reply = d->passwordChecker->getSaltedKeys(request, d->saslScramAlgorithm);
+                reply->setParent(this);
+                reply->setProperty("__sasl_username", username);
+                connect(reply, SIGNAL(finished()), this, SLOT(onScramReply()));
+            }
             else
             {
                 // unsupported method
@@ -254,9 +432,47 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                 return;
             }
         }
-        else if (nodeRecv.tagName() == QLatin1String("response"))
+        else if (tagName == QXmppAtom::Response)
         {
-            if (d->saslDigestStep == 1)
+            if (d->saslScramStep == 1)
+            {
+                const QByteArray raw = QByteArray::fromBase64(nodeRecv.text().toAscii());
+                const int proofPos = raw.lastIndexOf(",p=");
+                const QMap<char, QByteArray> clientFinal = QXmppSaslScram::parseMessage(raw);
+                if (proofPos < 0 ||
+                    clientFinal.value('c') != d->saslScramGs2Header.toBase64() ||
+                    clientFinal.value('r') != d->saslScramNonce)
+                {
+                    sendData("<failure xmlns='urn:ietf:params:xml:ns:xmpp-sasl'><incorrect-encoding/></failure>");
+                    disconnectFromHost();
+                    return;
+                }
+
+                // verify the client's proof against the stored key
+                const QCryptographicHash::Algorithm algorithm = d->saslScramAlgorithm;
+                const QByteArray authMessage = d->saslScramClientFirstBare + "," +
+                    d->saslScramServerFirst + "," + raw.left(proofPos);
+                const QByteArray clientSignature = QXmppSaslScram::hmac(algorithm, d->saslScramStoredKey, authMessage);
+                const QByteArray clientKey = xorBytes(QByteArray::fromBase64(clientFinal.value('p')), clientSignature);
+                if (clientKey.size() != clientSignature.size() ||
+                    !QXmppSaslScram::signatureEquals(QXmppSaslScram::hash(algorithm, clientKey), d->saslScramStoredKey))
+                {
+                    warning(QString("Authentication failed for '%1'").arg(d->saslScramUsername));
+                    sendData("<failure xmlns='urn:ietf:params:xml:ns:xmpp-sasl'><not-authorized/></failure>");
+                    disconnectFromHost();
+                    return;
+                }
+
+                // authentication succeeded
+                d->saslScramStep = 2;
+                d->username = d->saslScramUsername;
+                d->jid = QXmppJid(d->username, d->domain);
+                info(QString("Authentication succeeded for '%1'").arg(d->username));
+                const QByteArray serverFinal = "v=" + QXmppSaslScram::hmac(algorithm, d->saslScramServerKey, authMessage).toBase64();
+                sendData("<success xmlns='urn:ietf:params:xml:ns:xmpp-sasl'>" + serverFinal.toBase64() + "</success>");
+                handleStart();
+            }
+            else if (d->saslDigestStep == 1)
             {
                 const QByteArray raw = QByteArray::fromBase64(nodeRecv.text().toAscii());
                 QMap<QByteArray, QByteArray> saslResponse = QXmppSaslDigestMd5::parseMessage(raw);
@@ -275,6 +491,7 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                 request.setUsername(username);
                 request.setDomain(d->domain);
 
+                d->authTimer.start();
                 QXmppPasswordReply *reply = d->passwordChecker->getDigest(request);
                 reply->setParent(this);
                 reply->setProperty("__sasl_raw", raw);
@@ -285,38 +502,38 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                 // authentication succeeded
                 d->saslDigestStep = 3;
                 d->username = d->saslDigestUsername;
-                d->jid = QString("%1@%2").arg(d->username, d->domain);
+                d->jid = QXmppJid(d->username, d->domain);
                 info(QString("Authentication succeeded for '%1'").arg(d->username));
                 sendData("<success xmlns='urn:ietf:params:xml:ns:xmpp-sasl'/>");
                 handleStart();
             }
         }
     }
-    else if (ns == ns_client)
+    else if (ns == QXmppAtom::NsClient)
     {
-        if (nodeRecv.tagName() == QLatin1String("iq"))
+        if (tagName == QXmppAtom::Iq)
         {
-            const QString type = nodeRecv.attribute("type");
-            if (QXmppBindIq::isBindIq(nodeRecv) && type == QLatin1String("set"))
+            const QXmppAtom type = QXmppAtom::attribute(nodeRecv, QXmppAtom::Type);
+            if (QXmppBindIq::isBindIq(nodeRecv) && type == QXmppAtom::Set)
             {
                 QXmppBindIq bindSet;
                 bindSet.parse(nodeRecv);
                 d->resource = bindSet.resource().trimmed();
                 if (d->resource.isEmpty())
                     d->resource = QXmppUtils::generateStanzaHash();
-                d->jid = QString("%1@%2/%3").arg(d->username, d->domain, d->resource);
+                d->jid = QXmppJid(d->username, d->domain, d->resource);
 
                 QXmppBindIq bindResult;
                 bindResult.setType(QXmppIq::Result);
                 bindResult.setId(bindSet.id());
-                bindResult.setJid(d->jid);
+                bindResult.setJid(d->jid.toString());
                 sendPacket(bindResult);
 
                 // bound
                 emit connected();
                 return;
             }
-            else if (QXmppSessionIq::isSessionIq(nodeRecv) && type == QLatin1String("set"))
+            else if (QXmppSessionIq::isSessionIq(nodeRecv) && type == QXmppAtom::Set)
             {
                 QXmppSessionIq sessionSet;
                 sessionSet.parse(nodeRecv);
@@ -324,7 +541,7 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                 QXmppIq sessionResult;
                 sessionResult.setType(QXmppIq::Result);
                 sessionResult.setId(sessionSet.id());
-                sessionResult.setTo(d->jid);
+                sessionResult.setTo(d->jid.toString());
                 sendPacket(sessionResult);
                 return;
             }
@@ -332,34 +549,43 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
 
         // check the sender is legitimate
         const QString from = nodeRecv.attribute("from");
-        if (!from.isEmpty() && from != d->jid && from != QXmppUtils::jidToBareJid(d->jid))
+        if (!from.isEmpty() && from != d->jid.toString() && from != d->jid.bareJidRef())
         {
             warning(QString("Received a stanza from unexpected JID %1").arg(from));
             return;
         }
 
         // process unhandled stanzas
-        if (nodeRecv.tagName() == QLatin1String("iq") ||
-            nodeRecv.tagName() == QLatin1String("message") ||
-            nodeRecv.tagName() == QLatin1String("presence"))
+        if (tagName == QXmppAtom::Iq ||
+            tagName == QXmppAtom::Message ||
+            tagName == QXmppAtom::Presence)
         {
             QDomElement nodeFull(nodeRecv);
 
             // if the sender is empty, set it to the appropriate JID
             if (nodeFull.attribute("from").isEmpty())
             {
-                if (nodeFull.tagName() == QLatin1String("presence") &&
+                if (tagName == QXmppAtom::Presence &&
                     (nodeFull.attribute("type") == QLatin1String("subscribe") ||
                     nodeFull.attribute("type") == QLatin1String("subscribed")))
-                    nodeFull.setAttribute("from", QXmppUtils::jidToBareJid(d->jid));
+                    nodeFull.setAttribute("from", d->jid.bareJidRef().toString());
                 else
-                    nodeFull.setAttribute("from", d->jid);
+                    nodeFull.setAttribute("from", d->jid.toString());
             }
 
             // if the recipient is empty, set it to the local domain
             if (nodeFull.attribute("to").isEmpty())
                 nodeFull.setAttribute("to", d->domain);
 
+            // count stanza
+            QXmppCounter *counter = d->presencesReceived;
+            if (tagName == QXmppAtom::Iq)
+                counter = d->iqReceived;
+            else if (tagName == QXmppAtom::Message)
+                counter = d->messagesReceived;
+            if (counter)
+                counter->add();
+
             // emit stanza for processing by server
             emit elementReceived(nodeFull);
         }
@@ -372,6 +598,7 @@ void QXmppIncomingClient::onDigestReply()
     if (!reply)
         return;
     reply->deleteLater();
+    d->recordAuthLatency();
 
     const QMap<QByteArray, QByteArray> saslResponse = QXmppSaslDigestMd5::parseMessage(reply->property("__sasl_raw").toByteArray());
     const QString username = QString::fromUtf8(saslResponse.value("username"));
@@ -410,12 +637,13 @@ void QXmppIncomingClient::onPasswordReply()
     if (!reply)
         return;
     reply->deleteLater();
+    d->recordAuthLatency();
 
     const QString username = reply->property("__sasl_username").toString();
     switch (reply->error()) {
     case QXmppPasswordReply::NoError:
         d->username = username;
-        d->jid = QString("%1@%2").arg(d->username, d->domain);
+        d->jid = QXmppJid(d->username, d->domain);
         info(QString("Authentication succeeded for '%1'").arg(username));
         sendData("<success xmlns='urn:ietf:params:xml:ns:xmpp-sasl'/>");
         handleStart();
@@ -433,9 +661,73 @@ void QXmppIncomingClient::onPasswordReply()
     }
 }
 
+void QXmppIncomingClient::onScramReply()
+{
+    QXmppPasswordReply *reply = qobject_cast<QXmppPasswordReply*>(sender());
+    if (!reply)
+        return;
+    reply->deleteLater();
+    d->recordAuthLatency();
+
+    const QString username = reply->property("__sasl_username").toString();
+    switch (reply->error()) {
+    case QXmppPasswordReply::NoError:
+        break;
+    case QXmppPasswordReply::AuthorizationError:
+        warning(QString("Authentication failed for '%1'").arg(username));
+        sendData("<failure xmlns='urn:ietf:params:xml:ns:xmpp-sasl'><not-authorized/></failure>");
+        disconnectFromHost();
+        return;
+    case QXmppPasswordReply::TemporaryError:
+        warning(QString("Temporary authentication failure for '%1'").arg(username));
+        sendData("<failure xmlns='urn:ietf:params:xml:ns:xmpp-sasl'><temporary-auth-failure/></failure>");
+        disconnectFromHost();
+        return;
+    }
+
+    // send server-first message
+    d->saslScramUsername = username;
+    d->saslScramStoredKey = reply->storedKey();
+    d->saslScramServerKey = reply->serverKey();
+    d->saslScramServerFirst = "r=" + d->saslScramNonce +
+        ",s=" + reply->salt().toBase64() +
+        ",i=" + QByteArray::number(reply->iterations());
+    d->saslScramStep = 1;
+    sendData("<challenge xmlns='urn:ietf:params:xml:ns:xmpp-sasl'>" + d->saslScramServerFirst.toBase64() + "</challenge>");
+}
+
+void QXmppIncomingClient::onEncrypted()
+{
+    if (d->tlsHandshakeTime && d->tlsTimer.isValid())
+        d->tlsHandshakeTime->record(d->tlsTimer.nsecsElapsed() / 1000);
+    d->tlsTimer.invalidate();
+}
+
+/// Re-attaches the socket once a worker thread completed the STARTTLS
+/// handshake, or drops the stream if the handshake failed.
+///
+/// \param socket
+
+void QXmppIncomingClient::_q_serverEncryptionFinished(QSslSocket *socket)
+{
+    if (!socket) {
+        warning("TLS handshake failed");
+        emit disconnected();
+        return;
+    }
+
+    socket->setParent(this);
+    setSocket(socket);
+
+    // the client restarts the stream over the encrypted socket
+    handleStart();
+}
+
 void QXmppIncomingClient::onTimeout()
 {
-    warning(QString("Idle timeout for '%1'").arg(d->jid));
+    warning(QString("Idle timeout for '%1'").arg(d->jid.toString()));
+    if (d->idleTimeouts)
+        d->idleTimeouts->add();
     disconnectFromHost();
 
     // make sure disconnected() gets emitted no matter what
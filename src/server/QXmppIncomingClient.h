@@ -27,7 +27,9 @@
 #include "QXmppStream.h"
 
 class QXmppIncomingClientPrivate;
+class QXmppMetrics;
 class QXmppPasswordChecker;
+class QXmppSslServer;
 
 /// \brief Interface for password checkers.
 ///
@@ -49,6 +51,12 @@ public:
 
     void setInactivityTimeout(int secs);
     void setPasswordChecker(QXmppPasswordChecker *checker);
+    void setMetrics(QXmppMetrics *metrics);
+
+    /// \cond
+    void setPlainAllowed(bool allowed);
+    void setSslServer(QXmppSslServer *server);
+    /// \endcond
 
 signals:
     /// This signal is emitted when an element is received.
@@ -62,8 +70,11 @@ protected:
 
 private slots:
     void onDigestReply();
+    void onEncrypted();
     void onPasswordReply();
+    void onScramReply();
     void onTimeout();
+    void _q_serverEncryptionFinished(QSslSocket *socket);
 
 private:
     Q_DISABLE_COPY(QXmppIncomingClient)
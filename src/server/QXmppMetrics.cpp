@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QMap>
+#include <QMutexLocker>
+#include <QVector>
+
+#include "QXmppMetrics.h"
+
+// values from 2^41 microseconds (about 25 days) are clamped
+static const qint64 histogramLimit = Q_INT64_C(1) << 41;
+
+#if QT_VERSION < 0x050300
+// additions below this limit are accumulated without locking
+static const qint64 counterAddLimit = 1 << 20;
+
+// the pending sum is folded once it exceeds this limit, which leaves room
+// for 1024 concurrent additions before the 32-bit integer overflows
+static const int counterFoldLimit = 1 << 30;
+#endif
+
+/// Constructs a new counter with a value of 0.
+
+QXmppCounter::QXmppCounter()
+#if QT_VERSION >= 0x050300
+    : m_value(0)
+#else
+    : m_pending(0)
+    , m_value(0)
+#endif
+{
+}
+
+/// Adds the given value to the counter.
+///
+/// \param value
+
+void QXmppCounter::add(qint64 value)
+{
+#if QT_VERSION >= 0x050300
+    m_value.fetchAndAddRelaxed(value);
+#else
+    if (value >= 0 && value < counterAddLimit) {
+        const int pending = m_pending.fetchAndAddRelaxed(int(value)) + int(value);
+        if (pending >= counterFoldLimit)
+            fold();
+    } else {
+        QMutexLocker locker(&m_mutex);
+        m_value += value;
+    }
+#endif
+}
+
+/// Returns the counter's current value.
+
+qint64 QXmppCounter::value() const
+{
+#if QT_VERSION >= 0x050300
+    return m_value.load();
+#else
+    QMutexLocker locker(&m_mutex);
+    m_value += m_pending.fetchAndStoreRelaxed(0);
+    return m_value;
+#endif
+}
+
+#if QT_VERSION < 0x050300
+void QXmppCounter::fold() const
+{
+    QMutexLocker locker(&m_mutex);
+    m_value += m_pending.fetchAndStoreRelaxed(0);
+}
+#endif
+
+/// Constructs an empty histogram.
+
+QXmppHistogram::QXmppHistogram()
+    : m_maximumIndex(-1)
+{
+}
+
+int QXmppHistogram::bucketIndex(qint64 value)
+{
+    if (value < SubBucketCount)
+        return value < 0 ? 0 : int(value);
+    if (value >= histogramLimit)
+        return BucketCount - 1;
+
+    // find the most significant bit
+    int msb = SubBucketBits;
+    for (int step = 32; step; step >>= 1) {
+        if (value >> (msb + step))
+            msb += step;
+    }
+
+    const int shift = msb - SubBucketBits;
+    return (shift + 1) * SubBucketCount + int((value >> shift) & (SubBucketCount - 1));
+}
+
+qint64 QXmppHistogram::bucketValue(int index)
+{
+    if (index < SubBucketCount)
+        return index;
+
+    const int shift = index / SubBucketCount - 1;
+    const qint64 lower = qint64(SubBucketCount + index % SubBucketCount) << shift;
+    return lower + (Q_INT64_C(1) << shift) - 1;
+}
+
+/// Records a value.
+///
+/// \param value
+
+void QXmppHistogram::record(qint64 value)
+{
+    const int index = bucketIndex(value);
+    m_buckets[index].ref();
+    m_count.add(1);
+    m_sum.add(value);
+
+    int maximum = m_maximumIndex;
+    while (index > maximum && !m_maximumIndex.testAndSetRelaxed(maximum, index))
+        maximum = m_maximumIndex;
+}
+
+/// Returns the number of recorded values.
+
+qint64 QXmppHistogram::count() const
+{
+    return m_count.value();
+}
+
+/// Returns the sum of the recorded values.
+
+qint64 QXmppHistogram::sum() const
+{
+    return m_sum.value();
+}
+
+/// Returns the largest recorded value, rounded up to its bucket's precision.
+
+qint64 QXmppHistogram::maximum() const
+{
+    const int index = m_maximumIndex;
+    return index < 0 ? 0 : bucketValue(index);
+}
+
+/// Returns the value below which the given percentage of the recorded
+/// values fall, rounded up to its bucket's precision.
+///
+/// \param percent A percentage between 0 and 100.
+
+qint64 QXmppHistogram::percentile(double percent) const
+{
+    // take a snapshot of the buckets
+    QVector<int> counts(BucketCount);
+    qint64 total = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        counts[i] = m_buckets[i];
+        total += counts[i];
+    }
+    if (!total)
+        return 0;
+
+    const qint64 wanted = qMax(Q_INT64_C(1), qint64(total * qBound(0.0, percent, 100.0) / 100.0 + 0.5));
+    qint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += counts[i];
+        if (seen >= wanted)
+            return bucketValue(i);
+    }
+    return maximum();
+}
+
+/// Returns a summary of the histogram, with its count, sum, mean,
+/// 50th, 90th and 99th percentiles and maximum.
+
+QVariantMap QXmppHistogram::toVariantMap() const
+{
+    const qint64 total = count();
+    QVariantMap map;
+    map["count"] = total;
+    map["sum"] = sum();
+    map["mean"] = total ? sum() / total : Q_INT64_C(0);
+    map["p50"] = percentile(50);
+    map["p90"] = percentile(90);
+    map["p99"] = percentile(99);
+    map["max"] = maximum();
+    return map;
+}
+
+class QXmppMetricsPrivate
+{
+public:
+    mutable QMutex mutex;
+    QMap<QString, QXmppCounter*> counters;
+    QMap<QString, QXmppHistogram*> histograms;
+};
+
+/// Constructs an empty metrics registry.
+
+QXmppMetrics::QXmppMetrics()
+    : d(new QXmppMetricsPrivate)
+{
+}
+
+/// Destroys the registry and all its metrics.
+
+QXmppMetrics::~QXmppMetrics()
+{
+    qDeleteAll(d->counters);
+    qDeleteAll(d->histograms);
+    delete d;
+}
+
+/// Returns the counter with the given name, creating it if needed.
+///
+/// \param name
+
+QXmppCounter *QXmppMetrics::counter(const QString &name)
+{
+    QMutexLocker locker(&d->mutex);
+    QXmppCounter *counter = d->counters.value(name);
+    if (!counter) {
+        counter = new QXmppCounter;
+        d->counters.insert(name, counter);
+    }
+    return counter;
+}
+
+/// Returns the names of all the counters.
+
+QStringList QXmppMetrics::counterNames() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->counters.keys();
+}
+
+/// Returns the histogram with the given name, creating it if needed.
+///
+/// \param name
+
+QXmppHistogram *QXmppMetrics::histogram(const QString &name)
+{
+    QMutexLocker locker(&d->mutex);
+    QXmppHistogram *histogram = d->histograms.value(name);
+    if (!histogram) {
+        histogram = new QXmppHistogram;
+        d->histograms.insert(name, histogram);
+    }
+    return histogram;
+}
+
+/// Returns the names of all the histograms.
+
+QStringList QXmppMetrics::histogramNames() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->histograms.keys();
+}
+
+/// Returns the current value of every counter, and a summary of every
+/// histogram as returned by QXmppHistogram::toVariantMap().
+
+QVariantMap QXmppMetrics::toVariantMap() const
+{
+    QMutexLocker locker(&d->mutex);
+    QVariantMap map;
+    foreach (const QString &name, d->counters.keys())
+        map[name] = d->counters.value(name)->value();
+    foreach (const QString &name, d->histograms.keys())
+        map[name] = d->histograms.value(name)->toVariantMap();
+    return map;
+}
+
+/// Returns all the metrics as a JSON object.
+
+QByteArray QXmppMetrics::toJson() const
+{
+    return toJson(toVariantMap());
+}
+
+static QByteArray jsonString(const QString &str)
+{
+    QByteArray out = "\"";
+    foreach (const QChar &c, str) {
+        switch (c.unicode()) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c.unicode() < 0x20 || c.unicode() > 0x7e)
+                out += "\\u" + QByteArray::number(c.unicode(), 16).rightJustified(4, '0');
+            else
+                out += char(c.unicode());
+        }
+    }
+    out += '"';
+    return out;
+}
+
+/// Serialises a QVariant holding maps, lists, strings, numbers and
+/// booleans to JSON.
+///
+/// \param value
+
+QByteArray QXmppMetrics::toJson(const QVariant &value)
+{
+    switch (value.type()) {
+    case QVariant::Invalid:
+        return "null";
+    case QVariant::Bool:
+        return value.toBool() ? "true" : "false";
+    case QVariant::Int:
+    case QVariant::LongLong:
+        return QByteArray::number(value.toLongLong());
+    case QVariant::UInt:
+    case QVariant::ULongLong:
+        return QByteArray::number(value.toULongLong());
+    case QVariant::Double:
+        return QByteArray::number(value.toDouble(), 'g', 15);
+    case QVariant::Map: {
+        const QVariantMap map = value.toMap();
+        QByteArray out = "{";
+        for (QVariantMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+            if (it != map.constBegin())
+                out += ',';
+            out += jsonString(it.key());
+            out += ':';
+            out += toJson(it.value());
+        }
+        out += '}';
+        return out;
+    }
+    case QVariant::List:
+    case QVariant::StringList: {
+        const QVariantList list = value.toList();
+        QByteArray out = "[";
+        for (int i = 0; i < list.size(); ++i) {
+            if (i)
+                out += ',';
+            out += toJson(list.at(i));
+        }
+        out += ']';
+        return out;
+    }
+    default:
+        return jsonString(value.toString());
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPMETRICS_H
+#define QXMPPMETRICS_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QStringList>
+#include <QVariant>
+
+#include "QXmppGlobal.h"
+
+class QXmppMetricsPrivate;
+
+/// \brief The QXmppCounter class represents a monotonic counter which can
+/// be incremented from any thread.
+///
+/// Adding a value only increments an atomic integer, reading the value
+/// may take a lock with Qt versions older than 5.3.
+///
+
+class QXMPP_EXPORT QXmppCounter
+{
+public:
+    QXmppCounter();
+
+    void add(qint64 value = 1);
+    qint64 value() const;
+
+private:
+#if QT_VERSION >= 0x050300
+    QAtomicInteger<qint64> m_value;
+#else
+    // small additions accumulate in m_pending, which is folded into
+    // m_value under the mutex when it grows large or is read
+    void fold() const;
+    mutable QAtomicInt m_pending;
+    mutable QMutex m_mutex;
+    mutable qint64 m_value;
+#endif
+    Q_DISABLE_COPY(QXmppCounter)
+};
+
+/// \brief The QXmppHistogram class records the distribution of values,
+/// typically latencies in microseconds.
+///
+/// Values are counted in logarithmic buckets, each power of two being
+/// split in 16 linear sub-buckets, so that percentiles are reported with
+/// a relative error below 7% whatever the magnitude. Recording a value
+/// only increments atomic integers, so it can be done from any thread
+/// while another thread reads the histogram.
+///
+
+class QXMPP_EXPORT QXmppHistogram
+{
+public:
+    QXmppHistogram();
+
+    void record(qint64 value);
+
+    qint64 count() const;
+    qint64 sum() const;
+    qint64 maximum() const;
+    qint64 percentile(double percent) const;
+
+    QVariantMap toVariantMap() const;
+
+    /// \cond
+    enum {
+        SubBucketBits = 4,
+        SubBucketCount = 1 << SubBucketBits,
+        BucketCount = (42 - SubBucketBits) * SubBucketCount,
+    };
+    /// \endcond
+
+private:
+    static int bucketIndex(qint64 value);
+    static qint64 bucketValue(int index);
+
+    QAtomicInt m_buckets[BucketCount];
+    QAtomicInt m_maximumIndex;
+    QXmppCounter m_count;
+    QXmppCounter m_sum;
+    Q_DISABLE_COPY(QXmppHistogram)
+};
+
+/// \brief The QXmppMetrics class is a registry of named counters and
+/// histograms.
+///
+/// Looking up a metric by name takes a lock, so code on a hot path should
+/// look up its metrics once and keep the returned pointers, which remain
+/// valid for the lifetime of the QXmppMetrics object.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppMetrics
+{
+public:
+    QXmppMetrics();
+    ~QXmppMetrics();
+
+    QXmppCounter *counter(const QString &name);
+    QStringList counterNames() const;
+
+    QXmppHistogram *histogram(const QString &name);
+    QStringList histogramNames() const;
+
+    QVariantMap toVariantMap() const;
+    QByteArray toJson() const;
+
+    static QByteArray toJson(const QVariant &value);
+
+private:
+    QXmppMetricsPrivate * const d;
+    Q_DISABLE_COPY(QXmppMetrics)
+};
+
+#endif
@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+
+#include "QXmppMetrics.h"
+#include "QXmppMetricsExtension.h"
+#include "QXmppMetricsExtension_p.h"
+#include "QXmppServer.h"
+
+// largest HTTP request header we accept
+static const int maxRequestSize = 8192;
+
+// time in milliseconds after which a scrape connection is closed, whatever
+// its state
+static const int connectionTimeout = 10000;
+
+// time in milliseconds a scrape waits for a fresh snapshot before being
+// answered with the previous one
+static const int snapshotTimeout = 1000;
+
+class QXmppMetricsExtensionPrivate
+{
+public:
+    QXmppMetricsExtensionPrivate(QXmppMetricsExtension *qq);
+    bool isFresh() const;
+    QByteArray render() const;
+    void requestRefresh();
+
+    QHostAddress address;
+    quint16 port;
+    QThread *thread;
+    QXmppMetricsHttpServer *httpServer;
+
+    // shared with the HTTP thread
+    QXmppMetrics *metrics;
+    mutable QMutex snapshotMutex;
+    QVariantMap snapshot;
+    QElapsedTimer snapshotTime;
+    int refreshInterval;
+    bool refreshRequested;
+
+private:
+    QXmppMetricsExtension *q;
+};
+
+QXmppMetricsExtensionPrivate::QXmppMetricsExtensionPrivate(QXmppMetricsExtension *qq)
+    : address(QHostAddress::LocalHost),
+    port(9105),
+    thread(0),
+    httpServer(0),
+    metrics(0),
+    refreshInterval(1000),
+    refreshRequested(false),
+    q(qq)
+{
+    snapshotTime.invalidate();
+}
+
+/// Returns true if the snapshot of the statistics is recent enough to be
+/// served, this is safe to call from any thread.
+
+bool QXmppMetricsExtensionPrivate::isFresh() const
+{
+    QMutexLocker locker(&snapshotMutex);
+    return snapshotTime.isValid() && snapshotTime.elapsed() < refreshInterval;
+}
+
+/// Asks the server's thread for a new snapshot of the statistics, unless
+/// one was already asked for, this is safe to call from any thread.
+
+void QXmppMetricsExtensionPrivate::requestRefresh()
+{
+    QMutexLocker locker(&snapshotMutex);
+    if (refreshRequested)
+        return;
+    refreshRequested = true;
+    QMetaObject::invokeMethod(q, "_q_refresh", Qt::QueuedConnection);
+}
+
+static QByteArray metricName(const QString &name)
+{
+    QByteArray out = "qxmpp_";
+    foreach (const QChar &c, name) {
+        const char ch = c.toLatin1();
+        if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9'))
+            out += ch;
+        else
+            out += '_';
+    }
+    return out;
+}
+
+static QByteArray labelValue(const QString &value)
+{
+    QByteArray out = value.toUtf8();
+    out.replace('\\', "\\\\");
+    out.replace('"', "\\\"");
+    out.replace('\n', "\\n");
+    return out;
+}
+
+static void renderGauges(QByteArray &out, const QString &prefix, const QVariantMap &map, const QVariantMap &skip)
+{
+    for (QVariantMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+        const QString name = prefix + it.key();
+        if (skip.contains(name))
+            continue;
+
+        if (it.value().type() == QVariant::Map) {
+            renderGauges(out, name + "_", it.value().toMap(), skip);
+            continue;
+        }
+
+        bool ok = false;
+        const double value = it.value().toDouble(&ok);
+        if (!ok || it.value().type() == QVariant::String)
+            continue;
+
+        const QByteArray metric = metricName(name);
+        out += "# TYPE " + metric + " gauge\n";
+        out += metric + ' ' + QByteArray::number(value, 'g', 15) + '\n';
+    }
+}
+
+QByteArray QXmppMetricsExtensionPrivate::render() const
+{
+    QVariantMap snapshot;
+    {
+        QMutexLocker locker(&snapshotMutex);
+        snapshot = this->snapshot;
+    }
+
+    QByteArray out;
+    QVariantMap skip;
+    skip.insert("version", QVariant());
+
+    if (metrics) {
+        // counters, preferring the server's totals which include open streams
+        foreach (const QString &name, metrics->counterNames()) {
+            qint64 value = metrics->counter(name)->value();
+            if (snapshot.contains(name))
+                value = qMax(value, snapshot.value(name).toLongLong());
+            const QByteArray metric = metricName(name) + "_total";
+            out += "# TYPE " + metric + " counter\n";
+            out += metric + ' ' + QByteArray::number(value) + '\n';
+            skip.insert(name, QVariant());
+        }
+
+        // histograms, as summaries
+        foreach (const QString &name, metrics->histogramNames()) {
+            const QXmppHistogram *histogram = metrics->histogram(name);
+            const QByteArray metric = metricName(name);
+            out += "# TYPE " + metric + " summary\n";
+            out += metric + "{quantile=\"0.5\"} " + QByteArray::number(histogram->percentile(50)) + '\n';
+            out += metric + "{quantile=\"0.9\"} " + QByteArray::number(histogram->percentile(90)) + '\n';
+            out += metric + "{quantile=\"0.99\"} " + QByteArray::number(histogram->percentile(99)) + '\n';
+            out += metric + "_sum " + QByteArray::number(histogram->sum()) + '\n';
+            out += metric + "_count " + QByteArray::number(histogram->count()) + '\n';
+            skip.insert(name, QVariant());
+        }
+    }
+
+    // everything else is reported as a gauge
+    renderGauges(out, QString(), snapshot, skip);
+
+    out += "# TYPE qxmpp_info gauge\n";
+    out += "qxmpp_info{version=\"" + labelValue(snapshot.value("version").toString()) + "\"} 1\n";
+    return out;
+}
+
+/// Constructs a new metrics extension.
+
+QXmppMetricsExtension::QXmppMetricsExtension()
+    : d(new QXmppMetricsExtensionPrivate(this))
+{
+}
+
+QXmppMetricsExtension::~QXmppMetricsExtension()
+{
+    stop();
+    delete d;
+}
+
+QString QXmppMetricsExtension::extensionName() const
+{
+    return QLatin1String("metrics");
+}
+
+/// Returns the address on which the HTTP listener is bound.
+///
+
+QHostAddress QXmppMetricsExtension::address() const
+{
+    return d->address;
+}
+
+/// Sets the address on which the HTTP listener is bound.
+///
+/// The default is QHostAddress::LocalHost. The change takes effect the
+/// next time the extension is started.
+///
+/// \param address
+
+void QXmppMetricsExtension::setAddress(const QHostAddress &address)
+{
+    d->address = address;
+}
+
+/// Returns the port on which the HTTP listener is bound.
+///
+
+quint16 QXmppMetricsExtension::port() const
+{
+    return d->port;
+}
+
+/// Sets the port on which the HTTP listener is bound, the default is 9105.
+///
+/// The change takes effect the next time the extension is started.
+///
+/// \param port
+
+void QXmppMetricsExtension::setPort(quint16 port)
+{
+    d->port = port;
+}
+
+/// Returns the interval in milliseconds during which a copy of the
+/// server's statistics is reused by scrapes.
+///
+
+int QXmppMetricsExtension::refreshInterval() const
+{
+    QMutexLocker locker(&d->snapshotMutex);
+    return d->refreshInterval;
+}
+
+/// Sets the interval in milliseconds during which a copy of the server's
+/// statistics is reused by scrapes, the default is 1000.
+///
+/// The statistics are only copied from the server's thread when a scrape
+/// finds the previous copy older than this interval, so frequent scrapes
+/// do not add work to stanza routing. Counters and histograms are always
+/// read live, this only affects the other statistics such as the number
+/// of connected streams.
+///
+/// \param msecs
+
+void QXmppMetricsExtension::setRefreshInterval(int msecs)
+{
+    QMutexLocker locker(&d->snapshotMutex);
+    d->refreshInterval = msecs;
+}
+
+/// Returns the current metrics in the Prometheus text exposition format.
+///
+/// This is safe to call from any thread.
+
+QByteArray QXmppMetricsExtension::render() const
+{
+    return d->render();
+}
+
+/// Starts the HTTP listener.
+
+bool QXmppMetricsExtension::start()
+{
+    if (d->thread)
+        return true;
+
+    QXmppServer *server = this->server();
+    if (!server)
+        return false;
+    d->metrics = server->metrics();
+    _q_refresh();
+
+    d->thread = new QThread;
+    d->httpServer = new QXmppMetricsHttpServer(d);
+    d->httpServer->moveToThread(d->thread);
+    d->thread->start();
+
+    bool listening = false;
+    QMetaObject::invokeMethod(d->httpServer, "start", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, listening),
+                              Q_ARG(QString, d->address.toString()),
+                              Q_ARG(int, d->port));
+    if (!listening) {
+        warning(QString("Could not start listening for metrics requests on %1 %2").arg(
+            d->address.toString(), QString::number(d->port)));
+        stop();
+        return false;
+    }
+
+    info(QString("Serving metrics on %1 %2").arg(
+        d->address.toString(), QString::number(d->port)));
+    return true;
+}
+
+/// Stops the HTTP listener.
+
+void QXmppMetricsExtension::stop()
+{
+    if (d->thread) {
+        QMetaObject::invokeMethod(d->httpServer, "stop", Qt::BlockingQueuedConnection);
+        d->thread->quit();
+        d->thread->wait();
+        delete d->httpServer;
+        d->httpServer = 0;
+        delete d->thread;
+        d->thread = 0;
+    }
+}
+
+void QXmppMetricsExtension::_q_refresh()
+{
+    QXmppServer *server = this->server();
+    if (!server)
+        return;
+
+    QVariantMap snapshot = server->statistics();
+    foreach (QXmppServerExtension *extension, server->extensions()) {
+        if (extension == this)
+            continue;
+        const QVariantMap stats = extension->statistics();
+        if (!stats.isEmpty())
+            snapshot.insert(extension->extensionName(), stats);
+    }
+
+    {
+        QMutexLocker locker(&d->snapshotMutex);
+        d->snapshot = snapshot;
+        d->snapshotTime.start();
+        d->refreshRequested = false;
+    }
+
+    // answer the scrapes which were waiting for the snapshot
+    if (d->httpServer)
+        QMetaObject::invokeMethod(d->httpServer, "_q_respond", Qt::QueuedConnection);
+}
+
+QXmppMetricsHttpServer::QXmppMetricsHttpServer(QXmppMetricsExtensionPrivate *extension)
+    : m_extension(extension)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    check = connect(this, SIGNAL(newConnection()),
+                    this, SLOT(_q_newConnection()));
+    Q_ASSERT(check);
+
+    m_waitTimer = new QTimer(this);
+    m_waitTimer->setInterval(snapshotTimeout);
+    m_waitTimer->setSingleShot(true);
+    check = connect(m_waitTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_respond()));
+    Q_ASSERT(check);
+}
+
+/// Starts listening for HTTP requests, this is invoked in the HTTP thread.
+///
+/// \param address
+/// \param port
+
+bool QXmppMetricsHttpServer::start(const QString &address, int port)
+{
+    return listen(QHostAddress(address), port);
+}
+
+/// Stops listening and drops pending connections, this is invoked in the
+/// HTTP thread.
+
+void QXmppMetricsHttpServer::stop()
+{
+    close();
+    m_waitTimer->stop();
+    m_waiting.clear();
+    foreach (QTcpSocket *socket, findChildren<QTcpSocket*>())
+        socket->abort();
+    qDeleteAll(findChildren<QTcpSocket*>());
+}
+
+void QXmppMetricsHttpServer::_q_newConnection()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    while (QTcpSocket *socket = nextPendingConnection()) {
+        check = connect(socket, SIGNAL(readyRead()),
+                        this, SLOT(_q_readyRead()));
+        Q_ASSERT(check);
+
+        check = connect(socket, SIGNAL(disconnected()),
+                        socket, SLOT(deleteLater()));
+        Q_ASSERT(check);
+
+        // do not let idle or half-open connections accumulate
+        QTimer::singleShot(connectionTimeout, socket, SLOT(deleteLater()));
+    }
+}
+
+void QXmppMetricsHttpServer::_q_readyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket)
+        return;
+
+    // wait for the complete request header
+    const QByteArray request = socket->peek(maxRequestSize);
+    const int headerEnd = request.indexOf("\r\n\r\n");
+    if (headerEnd < 0) {
+        if (request.size() >= maxRequestSize)
+            socket->abort();
+        return;
+    }
+    socket->disconnect(this);
+
+    const QList<QByteArray> requestLine = request.left(request.indexOf("\r\n")).split(' ');
+    if (requestLine.size() != 3 || requestLine[0] != "GET") {
+        respond(socket, "405 Method Not Allowed");
+    } else if (requestLine[1] != "/metrics" && requestLine[1] != "/") {
+        respond(socket, "404 Not Found");
+    } else if (m_extension->isFresh()) {
+        respond(socket, "200 OK");
+    } else {
+        // wait for a fresh snapshot, but not for too long
+        m_waiting << socket;
+        if (!m_waitTimer->isActive())
+            m_waitTimer->start();
+        m_extension->requestRefresh();
+    }
+}
+
+/// Answers the scrapes which were waiting for a snapshot.
+
+void QXmppMetricsHttpServer::_q_respond()
+{
+    m_waitTimer->stop();
+    const QList<QPointer<QTcpSocket> > sockets = m_waiting;
+    m_waiting.clear();
+    foreach (QTcpSocket *socket, sockets)
+        if (socket)
+            respond(socket, "200 OK");
+}
+
+/// Writes the response to a request and closes the connection.
+///
+/// \param socket
+/// \param status
+
+void QXmppMetricsHttpServer::respond(QTcpSocket *socket, const QByteArray &status)
+{
+    QByteArray body;
+    QByteArray contentType = "text/plain";
+    if (status.startsWith("200")) {
+        contentType = "text/plain; version=0.0.4";
+        body = m_extension->render();
+    }
+
+    QByteArray response = "HTTP/1.0 " + status + "\r\n";
+    response += "Content-Type: " + contentType + "\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += body;
+    socket->write(response);
+    socket->disconnectFromHost();
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPMETRICSEXTENSION_H
+#define QXMPPMETRICSEXTENSION_H
+
+#include <QHostAddress>
+
+#include "QXmppServerExtension.h"
+
+class QXmppMetricsExtensionPrivate;
+
+/// \brief The QXmppMetricsExtension class exposes the server's statistics
+/// over HTTP, in the Prometheus text exposition format.
+///
+/// Scrapes are answered by a dedicated thread: counters and histograms are
+/// read directly from QXmppServer::metrics(), while the other statistics
+/// of the server and its extensions are copied from the server's thread
+/// when a scrape finds the previous copy older than refreshInterval().
+/// Scraping therefore never stalls stanza routing, and an unscraped server
+/// does not collect statistics at all.
+///
+/// Scrape connections are closed after ten seconds, whatever their state.
+///
+/// The listener only binds to the loopback interface by default.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppMetricsExtension : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_PROPERTY(QHostAddress address READ address WRITE setAddress)
+    Q_PROPERTY(quint16 port READ port WRITE setPort)
+    Q_PROPERTY(int refreshInterval READ refreshInterval WRITE setRefreshInterval)
+
+public:
+    QXmppMetricsExtension();
+    ~QXmppMetricsExtension();
+
+    QString extensionName() const;
+
+    QHostAddress address() const;
+    void setAddress(const QHostAddress &address);
+
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    int refreshInterval() const;
+    void setRefreshInterval(int msecs);
+
+    QByteArray render() const;
+
+    bool start();
+    void stop();
+
+private slots:
+    void _q_refresh();
+
+private:
+    QXmppMetricsExtensionPrivate * const d;
+};
+
+#endif
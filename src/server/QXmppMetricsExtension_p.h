@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPMETRICSEXTENSION_P_H
+#define QXMPPMETRICSEXTENSION_P_H
+
+#include <QList>
+#include <QPointer>
+#include <QTcpServer>
+
+class QTcpSocket;
+class QTimer;
+class QXmppMetricsExtensionPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppMetricsExtension class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+/// \brief The QXmppMetricsHttpServer class answers HTTP requests for
+/// metrics, it lives in its own thread.
+///
+
+class QXmppMetricsHttpServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    QXmppMetricsHttpServer(QXmppMetricsExtensionPrivate *extension);
+
+public slots:
+    bool start(const QString &address, int port);
+    void stop();
+
+private slots:
+    void _q_newConnection();
+    void _q_readyRead();
+    void _q_respond();
+
+private:
+    void respond(QTcpSocket *socket, const QByteArray &status);
+
+    QXmppMetricsExtensionPrivate *m_extension;
+
+    // scrapes waiting for a fresh snapshot
+    QList<QPointer<QTcpSocket> > m_waiting;
+    QTimer *m_waitTimer;
+};
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDateTime>
+#include <QDomElement>
+#include <QHash>
+#include <QStringList>
+#include <QXmlStreamWriter>
+
+#include "QXmppAtom.h"
+#include "QXmppConstants.h"
+#include "QXmppJid.h"
+#include "QXmppMetrics.h"
+#include "QXmppOfflineExtension.h"
+#include "QXmppPasswordChecker.h"
+#include "QXmppPresence.h"
+#include "QXmppRecordLog_p.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+
+/// Reads a user's log in the writer thread, to deliver its messages.
+
+class QXmppOfflineReader : public QXmppRecordLogScanner
+{
+public:
+    QXmppOfflineReader(const QString &jid, QObject *parent);
+    void scanRecord(const QByteArray &payload, qint64 offset);
+
+    QString jid;
+    QList<QByteArray> payloads;
+};
+
+QXmppOfflineReader::QXmppOfflineReader(const QString &jid, QObject *parent)
+    : QXmppRecordLogScanner(parent),
+    jid(jid)
+{
+}
+
+void QXmppOfflineReader::scanRecord(const QByteArray &payload, qint64 offset)
+{
+    Q_UNUSED(offset);
+    payloads << payload;
+}
+
+class QXmppOfflineExtensionPrivate
+{
+public:
+    QXmppOfflineExtensionPrivate();
+
+    int maximumLogCount;
+    qint64 maximumLogSize;
+    QXmppRecordLog *log;
+
+    // size of the log of each user who has offline messages
+    QHash<QString, qint64> sizes;
+
+    QXmppCounter *delivered;
+    QXmppCounter *dropped;
+    QXmppCounter *stored;
+};
+
+QXmppOfflineExtensionPrivate::QXmppOfflineExtensionPrivate()
+    : maximumLogCount(10000),
+    maximumLogSize(1024 * 1024),
+    log(0),
+    delivered(0),
+    dropped(0),
+    stored(0)
+{
+}
+
+/// Constructs a new offline message extension.
+
+QXmppOfflineExtension::QXmppOfflineExtension()
+    : d(new QXmppOfflineExtensionPrivate)
+{
+    d->log = new QXmppRecordLog(".log", this);
+}
+
+QXmppOfflineExtension::~QXmppOfflineExtension()
+{
+    stop();
+    delete d;
+}
+
+QString QXmppOfflineExtension::extensionName() const
+{
+    return QLatin1String("offline");
+}
+
+/// Returns the directory in which the users' logs are stored.
+///
+
+QString QXmppOfflineExtension::directory() const
+{
+    return d->log->directory();
+}
+
+/// Sets the directory in which the users' logs are stored.
+///
+/// The change takes effect the next time the extension is started.
+///
+/// \param directory
+
+void QXmppOfflineExtension::setDirectory(const QString &directory)
+{
+    d->log->setDirectory(directory);
+}
+
+/// Returns the interval in milliseconds after which stored messages are
+/// written to disk.
+///
+
+int QXmppOfflineExtension::flushInterval() const
+{
+    return d->log->flushInterval();
+}
+
+/// Sets the interval in milliseconds after which stored messages are
+/// written to disk, the default is 100.
+///
+/// All the messages stored during that interval are written with a
+/// single sync per user.
+///
+/// \param msecs
+
+void QXmppOfflineExtension::setFlushInterval(int msecs)
+{
+    d->log->setFlushInterval(msecs);
+}
+
+/// Returns the maximum number of users who may have offline messages.
+///
+
+int QXmppOfflineExtension::maximumLogCount() const
+{
+    return d->maximumLogCount;
+}
+
+/// Sets the maximum number of users who may have offline messages, the
+/// default is 10000.
+///
+/// Once this many users have a log, messages for other users are not
+/// stored.
+///
+/// \param count
+
+void QXmppOfflineExtension::setMaximumLogCount(int count)
+{
+    d->maximumLogCount = count;
+}
+
+/// Returns the maximum size in bytes of a user's log.
+///
+
+qint64 QXmppOfflineExtension::maximumLogSize() const
+{
+    return d->maximumLogSize;
+}
+
+/// Sets the maximum size in bytes of a user's log, the default is 1MB.
+///
+/// Messages which do not fit are not stored.
+///
+/// \param size
+
+void QXmppOfflineExtension::setMaximumLogSize(qint64 size)
+{
+    d->maximumLogSize = size;
+}
+
+/// Stores chat and normal messages which have a body and are addressed to
+/// an existing local user without any available resource with a
+/// non-negative priority.
+///
+/// Messages for unknown users, or which exceed the quotas, are not
+/// handled, so the server answers them with a service-unavailable error.
+///
+/// The message is stored as received, with an XEP-0203 delay element
+/// added, so that payloads the server does not understand are kept.
+///
+/// \param element
+
+bool QXmppOfflineExtension::handleStanza(const QDomElement &element)
+{
+    QXmppServer *server = this->server();
+    if (!d->log->isOpen() || QXmppAtom::tagName(element) != QXmppAtom::Message)
+        return false;
+
+    const QXmppJid to(element.attribute("to"));
+    if (to.domainRef() != server->domain() || to.nodeRef().isEmpty())
+        return false;
+
+    // resources with a negative priority do not receive messages
+    const QString bareJid = to.bareJidRef().toString();
+    foreach (const QXmppPresence &presence, server->availablePresences(bareJid))
+        if (presence.status().priority() >= 0)
+            return false;
+
+    const QString type = element.attribute("type");
+    if ((!type.isEmpty() && type != QLatin1String("normal") && type != QLatin1String("chat")) ||
+        element.firstChildElement("body").isNull())
+        return false;
+
+    // only store messages for existing accounts
+    QXmppPasswordChecker *checker = server->passwordChecker();
+    QXmppPasswordRequest request;
+    request.setDomain(to.domain());
+    request.setUsername(to.node());
+    if (!checker || !checker->userExists(request))
+        return false;
+
+    // enforce the number of logs
+    if (!d->sizes.contains(bareJid) && d->sizes.size() >= d->maximumLogCount) {
+        d->dropped->add();
+        return false;
+    }
+
+    // mark the message as delayed, keeping any other payload as is
+    QDomElement stanza = element.cloneNode(true).toElement();
+    bool delayed = false;
+    for (QDomElement child = stanza.firstChildElement("delay"); !child.isNull(); child = child.nextSiblingElement("delay"))
+        if (child.namespaceURI() == ns_delayed_delivery)
+            delayed = true;
+    if (!delayed) {
+        QDomElement delay = stanza.ownerDocument().createElementNS(ns_delayed_delivery, "delay");
+        delay.setAttribute("from", server->domain());
+        delay.setAttribute("stamp", QXmppUtils::datetimeToString(QDateTime::currentDateTime().toUTC()));
+        stanza.appendChild(delay);
+    }
+
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    helperToXmlAddDomElement(&xmlStream, stanza, QStringList() << ns_client << ns_server);
+
+    // enforce the quota
+    qint64 size = d->sizes.value(bareJid);
+    if (size + QXmppRecordLog::HeaderSize + data.size() > d->maximumLogSize) {
+        d->dropped->add();
+        return false;
+    }
+    d->sizes.insert(bareJid, size + d->log->append(bareJid, data));
+    d->stored->add();
+    return true;
+}
+
+/// Starts the writer thread.
+
+bool QXmppOfflineExtension::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->log->isOpen())
+        return true;
+
+    QXmppServer *server = this->server();
+    if (!server)
+        return false;
+
+    QXmppMetrics *metrics = server->metrics();
+    d->delivered = metrics->counter("offline-messages-delivered");
+    d->dropped = metrics->counter("offline-messages-dropped");
+    d->stored = metrics->counter("offline-messages-stored");
+    d->log->setMetrics(metrics->counter("offline-write-failures"),
+                       metrics->histogram("offline-flush-time"));
+
+    if (!d->log->open()) {
+        warning(QString("Could not use offline message directory %1").arg(d->log->directory()));
+        return false;
+    }
+
+    // index the existing logs
+    d->sizes = d->log->sizes();
+
+    check = connect(server, SIGNAL(resourceAvailable(QString)),
+                    this, SLOT(_q_resourceAvailable(QString)),
+                    Qt::UniqueConnection);
+    Q_ASSERT(check);
+
+    info(QString("Storing offline messages in %1").arg(d->log->directory()));
+    return true;
+}
+
+/// Writes the pending messages to disk and stops the writer thread.
+
+void QXmppOfflineExtension::stop()
+{
+    d->log->close();
+}
+
+/// Delivers a user's offline messages when one of their resources becomes
+/// available with a non-negative priority.
+///
+/// The log is removed at once, and its messages are sent in a single write
+/// once the writer thread has read them.
+///
+/// \param jid
+
+void QXmppOfflineExtension::_q_resourceAvailable(const QString &jid)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    const QString bareJid = QXmppJid(jid).bareJidRef().toString();
+    if (!d->log->isOpen() || !d->sizes.contains(bareJid))
+        return;
+    d->sizes.remove(bareJid);
+
+    QXmppOfflineReader *reader = new QXmppOfflineReader(jid, this);
+    check = connect(reader, SIGNAL(finished()),
+                    this, SLOT(_q_logRead()));
+    Q_ASSERT(check);
+
+    d->log->take(bareJid, reader);
+}
+
+/// Sends the messages read by the writer thread. If they cannot be routed,
+/// they are stored again for the next session.
+
+void QXmppOfflineExtension::_q_logRead()
+{
+    QXmppOfflineReader *reader = static_cast<QXmppOfflineReader*>(sender());
+    if (!reader)
+        return;
+    reader->deleteLater();
+
+    QByteArray stanzas;
+    foreach (const QByteArray &payload, reader->payloads)
+        stanzas += payload;
+
+    const int count = reader->payloads.size();
+    if (!count || server()->sendData(reader->jid, stanzas)) {
+        d->delivered->add(count);
+        return;
+    }
+
+    // keep the messages for the next session
+    const QString bareJid = QXmppJid(reader->jid).bareJidRef().toString();
+    qint64 size = d->sizes.value(bareJid);
+    foreach (const QByteArray &payload, reader->payloads)
+        size += d->log->append(bareJid, payload);
+    d->sizes.insert(bareJid, size);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPOFFLINEEXTENSION_H
+#define QXMPPOFFLINEEXTENSION_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppOfflineExtensionPrivate;
+
+/// \brief The QXmppOfflineExtension class stores the messages sent to local
+/// users who have no available resource, and delivers them when the user
+/// connects again.
+///
+/// Messages are only stored for users which the server's password checker
+/// knows, see QXmppPasswordChecker::userExists().
+///
+/// Each user has an append-only log in directory(). Storing a message only
+/// appends it to an in-memory buffer, the buffers are written and synced
+/// to disk by a dedicated thread every flushInterval() milliseconds, so
+/// bursts of offline messages do not stall stanza routing.
+///
+/// When one of the user's resources sends an available presence with a
+/// non-negative priority, the user's log is removed, read by the writer
+/// thread and sent to the resource in a single write.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppOfflineExtension : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_PROPERTY(QString directory READ directory WRITE setDirectory)
+    Q_PROPERTY(int flushInterval READ flushInterval WRITE setFlushInterval)
+    Q_PROPERTY(int maximumLogCount READ maximumLogCount WRITE setMaximumLogCount)
+    Q_PROPERTY(qint64 maximumLogSize READ maximumLogSize WRITE setMaximumLogSize)
+
+public:
+    QXmppOfflineExtension();
+    ~QXmppOfflineExtension();
+
+    QString extensionName() const;
+
+    QString directory() const;
+    void setDirectory(const QString &directory);
+
+    int flushInterval() const;
+    void setFlushInterval(int msecs);
+
+    int maximumLogCount() const;
+    void setMaximumLogCount(int count);
+
+    qint64 maximumLogSize() const;
+    void setMaximumLogSize(qint64 size);
+
+    bool handleStanza(const QDomElement &element);
+
+    bool start();
+    void stop();
+
+private slots:
+    void _q_logRead();
+    void _q_resourceAvailable(const QString &jid);
+
+private:
+    QXmppOfflineExtensionPrivate * const d;
+};
+
+#endif
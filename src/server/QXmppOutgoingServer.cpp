@@ -29,15 +29,20 @@
 
 #include "QXmppConstants.h"
 #include "QXmppDialback.h"
+#include "QXmppMetrics.h"
 #include "QXmppOutgoingServer.h"
+#include "QXmppStream_p.h"
+#include "QXmppSocketConnector.h"
 #include "QXmppStreamFeatures.h"
 #include "QXmppUtils.h"
 
 class QXmppOutgoingServerPrivate
 {
 public:
-    QList<QByteArray> dataQueue;
+    QXmppOutputQueue dataQueue;
     QDnsLookup dns;
+    bool dnsPending;
+    QXmppSocketConnector *connector;
     QString localDomain;
     QString localStreamKey;
     QString remoteDomain;
@@ -45,6 +50,9 @@ public:
     QString verifyKey;
     QTimer *dialbackTimer;
     bool ready;
+
+    // metrics
+    QXmppHistogram *queueLength;
 };
 
 /// Constructs a new outgoing server-to-server stream.
@@ -61,11 +69,16 @@ QXmppOutgoingServer::QXmppOutgoingServer(const QString &domain, QObject *parent)
     Q_UNUSED(check);
 
     // socket initialisation
-    QSslSocket *socket = new QSslSocket(this);
-    setSocket(socket);
+    attachSocket(new QSslSocket(this));
 
-    check = connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
-                    this, SLOT(socketError(QAbstractSocket::SocketError)));
+    // connection attempts
+    d->connector = new QXmppSocketConnector(this);
+    check = connect(d->connector, SIGNAL(connected(QSslSocket*)),
+                    this, SLOT(_q_connectorConnected(QSslSocket*)));
+    Q_ASSERT(check);
+
+    check = connect(d->connector, SIGNAL(error(QAbstractSocket::SocketError)),
+                    this, SLOT(_q_connectorError(QAbstractSocket::SocketError)));
     Q_ASSERT(check);
 
     // DNS lookups
@@ -80,12 +93,10 @@ QXmppOutgoingServer::QXmppOutgoingServer(const QString &domain, QObject *parent)
                     this, SLOT(sendDialback()));
     Q_ASSERT(check);
 
+    d->dnsPending = false;
     d->localDomain = domain;
     d->ready = false;
-
-    check = connect(socket, SIGNAL(sslErrors(QList<QSslError>)),
-                    this, SLOT(slotSslErrors(QList<QSslError>)));
-    Q_ASSERT(check);
+    d->queueLength = 0;
 }
 
 /// Destroys the stream.
@@ -108,30 +119,85 @@ void QXmppOutgoingServer::connectToHost(const QString &domain)
     debug(QString("Looking up server for domain %1").arg(domain));
     d->dns.setName("_xmpp-server._tcp." + domain);
     d->dns.setType(QDnsLookup::SRV);
+    d->dnsPending = true;
     d->dns.lookup();
 }
 
+/// Disconnects from the remote server, aborting any pending DNS lookup or
+/// connection attempts.
+
+void QXmppOutgoingServer::disconnectFromHost()
+{
+    const bool wasConnecting = d->dnsPending || d->connector->isConnecting();
+
+    d->dnsPending = false;
+    d->dns.abort();
+    d->connector->abort();
+
+    QXmppStream::disconnectFromHost();
+    if (wasConnecting)
+        emit disconnected();
+}
+
 void QXmppOutgoingServer::_q_dnsLookupFinished()
 {
-    QString host;
-    quint16 port;
+    QList<QPair<QString, quint16> > hosts;
+
+    // the lookup was aborted by disconnectFromHost()
+    if (!d->dnsPending)
+        return;
+    d->dnsPending = false;
 
     if (d->dns.error() == QDnsLookup::NoError &&
         !d->dns.serviceRecords().isEmpty()) {
-        // take the first returned record
-        host = d->dns.serviceRecords().first().target();
-        port = d->dns.serviceRecords().first().port();
+        // the records are sorted by priority and weight
+        d->connector->connectToServices(d->dns.serviceRecords());
+        return;
     } else {
         // as a fallback, use domain as the host name
         warning(QString("Lookup for domain %1 failed: %2")
                 .arg(d->dns.name(), d->dns.errorString()));
-        host = d->remoteDomain;
-        port = 5269;
+        hosts << qMakePair(d->remoteDomain, quint16(5269));
     }
 
     // connect to server
-    info(QString("Connecting to %1:%2").arg(host, QString::number(port)));
-    socket()->connectToHost(host, port);
+    d->connector->connectToHosts(hosts);
+}
+
+void QXmppOutgoingServer::_q_connectorConnected(QSslSocket *newSocket)
+{
+    QSslSocket *oldSocket = socket();
+    attachSocket(newSocket);
+    oldSocket->disconnect(this);
+    oldSocket->deleteLater();
+
+    info(QString("Socket connected to %1 %2").arg(
+        newSocket->peerAddress().toString(),
+        QString::number(newSocket->peerPort())));
+    handleStart();
+}
+
+void QXmppOutgoingServer::_q_connectorError(QAbstractSocket::SocketError error)
+{
+    Q_UNUSED(error);
+    emit disconnected();
+}
+
+void QXmppOutgoingServer::attachSocket(QSslSocket *socket)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    socket->setParent(this);
+    setSocket(socket);
+
+    check = connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+                    this, SLOT(socketError(QAbstractSocket::SocketError)));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(sslErrors(QList<QSslError>)),
+                    this, SLOT(slotSslErrors(QList<QSslError>)));
+    Q_ASSERT(check);
 }
 
 void QXmppOutgoingServer::handleStart()
@@ -192,8 +258,7 @@ void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
     {
         if (stanza.tagName() == QLatin1String("proceed"))
         {
-            debug("Starting encryption");
-            socket()->startClientEncryption();
+            startClientEncryption(d->remoteDomain);
             return;
         }
     }
@@ -217,10 +282,9 @@ void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
                 info(QString("Outgoing server stream to %1 is ready").arg(response.from()));
                 d->ready = true;
 
-                // send queued data
-                foreach (const QByteArray &data, d->dataQueue)
-                    sendData(data);
-                d->dataQueue.clear();
+                // send queued data, most urgent first
+                while (!d->dataQueue.isEmpty())
+                    sendData(d->dataQueue.dequeue());
 
                 // emit signal
                 emit connected();
@@ -271,14 +335,47 @@ void QXmppOutgoingServer::setVerify(const QString &id, const QString &key)
 
 /// Sends or queues data until connected.
 ///
+/// While the stream is being established, at most highWaterMark() bytes
+/// are held, superseded presences being dropped first.
+///
 /// \param data
 
 void QXmppOutgoingServer::queueData(const QByteArray &data)
 {
-    if (isConnected())
+    if (isConnected()) {
         sendData(data);
-    else
-        d->dataQueue.append(data);
+        return;
+    }
+
+    // bound the amount of data held while the stream is being established
+    if (highWaterMark() > 0 && d->dataQueue.size() + data.size() > highWaterMark()) {
+        d->dataQueue.coalesce();
+        if (d->dataQueue.size() + data.size() > highWaterMark()) {
+            warning(QString("Dropping data for %1, the queue is full").arg(d->remoteDomain));
+            return;
+        }
+    }
+
+    d->dataQueue.enqueue(data);
+    if (d->queueLength)
+        d->queueLength->record(d->dataQueue.count());
+}
+
+/// Returns the number of stanzas waiting for the stream to be ready.
+
+int QXmppOutgoingServer::queueLength() const
+{
+    return d->dataQueue.count();
+}
+
+/// Sets the metrics registry in which the stream records the length of
+/// its queue whenever data is queued.
+///
+/// \param metrics
+
+void QXmppOutgoingServer::setMetrics(QXmppMetrics *metrics)
+{
+    d->queueLength = metrics ? metrics->histogram("s2s-queue-length") : 0;
 }
 
 /// Returns the remote server's domain.
@@ -30,6 +30,7 @@
 
 class QSslError;
 class QXmppDialback;
+class QXmppMetrics;
 class QXmppOutgoingServer;
 class QXmppOutgoingServerPrivate;
 
@@ -53,6 +54,9 @@ public:
 
     QString remoteDomain() const;
 
+    int queueLength() const;
+    void setMetrics(QXmppMetrics *metrics);
+
 signals:
     /// This signal is emitted when a dialback verify response is received.
     void dialbackResponseReceived(const QXmppDialback &response);
@@ -66,15 +70,20 @@ protected:
 
 public slots:
     void connectToHost(const QString &domain);
+    void disconnectFromHost();
     void queueData(const QByteArray &data);
 
 private slots:
+    void _q_connectorConnected(QSslSocket *socket);
+    void _q_connectorError(QAbstractSocket::SocketError error);
     void _q_dnsLookupFinished();
     void sendDialback();
     void slotSslErrors(const QList<QSslError> &errors);
     void socketError(QAbstractSocket::SocketError error);
 
 private:
+    void attachSocket(QSslSocket *socket);
+
     Q_DISABLE_COPY(QXmppOutgoingServer)
     QXmppOutgoingServerPrivate* const d;
 };
@@ -21,11 +21,42 @@
  *
  */
 
+#include <QCache>
 #include <QCryptographicHash>
+#include <QDateTime>
+#include <QHash>
+#include <QPointer>
+#include <QRunnable>
 #include <QString>
+#include <QThreadPool>
 #include <QTimer>
 
 #include "QXmppPasswordChecker.h"
+#include "QXmppSaslAuth.h"
+
+#include "QXmppUtils.h"
+
+static const int defaultScramIterations = 4096;
+
+static void deriveDigest(QXmppPasswordReply *reply, const QXmppPasswordRequest &request, const QString &secret)
+{
+    reply->setDigest(QCryptographicHash::hash(
+        (request.username() + ":" + request.domain() + ":" + secret).toUtf8(),
+        QCryptographicHash::Md5));
+}
+
+static void deriveSaltedKeys(QXmppPasswordReply *reply, const QXmppPasswordRequest &request, const QString &secret, QCryptographicHash::Algorithm algorithm)
+{
+    const QByteArray salt = QXmppSaslScram::hash(algorithm,
+        (request.username() + ":" + request.domain()).toUtf8()).left(16);
+    const QByteArray salted = QXmppSaslScram::saltedPassword(algorithm,
+        secret.toUtf8(), salt, defaultScramIterations);
+    reply->setSalt(salt);
+    reply->setIterations(defaultScramIterations);
+    reply->setStoredKey(QXmppSaslScram::hash(algorithm,
+        QXmppSaslScram::clientKey(algorithm, salted)));
+    reply->setServerKey(QXmppSaslScram::serverKey(algorithm, salted));
+}
 
 /// Returns the requested domain.
 
@@ -75,6 +106,7 @@ void QXmppPasswordRequest::setUsername(const QString &username)
 
 QXmppPasswordReply::QXmppPasswordReply(QObject *parent)
     : QObject(parent),
+    m_iterations(0),
     m_error(QXmppPasswordReply::NoError),
     m_isFinished(false)
 {
@@ -150,6 +182,70 @@ void QXmppPasswordReply::setPassword(const QString &password)
     m_password = password;
 }
 
+/// Returns the SCRAM iteration count.
+
+int QXmppPasswordReply::iterations() const
+{
+    return m_iterations;
+}
+
+/// Sets the SCRAM iteration count.
+///
+/// \param iterations
+
+void QXmppPasswordReply::setIterations(int iterations)
+{
+    m_iterations = iterations;
+}
+
+/// Returns the SCRAM salt.
+
+QByteArray QXmppPasswordReply::salt() const
+{
+    return m_salt;
+}
+
+/// Sets the SCRAM salt.
+///
+/// \param salt
+
+void QXmppPasswordReply::setSalt(const QByteArray &salt)
+{
+    m_salt = salt;
+}
+
+/// Returns the SCRAM ServerKey.
+
+QByteArray QXmppPasswordReply::serverKey() const
+{
+    return m_serverKey;
+}
+
+/// Sets the SCRAM ServerKey.
+///
+/// \param serverKey
+
+void QXmppPasswordReply::setServerKey(const QByteArray &serverKey)
+{
+    m_serverKey = serverKey;
+}
+
+/// Returns the SCRAM StoredKey, which is the hash of the ClientKey.
+
+QByteArray QXmppPasswordReply::storedKey() const
+{
+    return m_storedKey;
+}
+
+/// Sets the SCRAM StoredKey, which is the hash of the ClientKey.
+///
+/// \param storedKey
+
+void QXmppPasswordReply::setStoredKey(const QByteArray &storedKey)
+{
+    m_storedKey = storedKey;
+}
+
 /// Checks that the given credentials are valid.
 ///
 /// The base implementation requires that you reimplement getPassword().
@@ -188,9 +284,36 @@ QXmppPasswordReply *QXmppPasswordChecker::getDigest(const QXmppPasswordRequest &
     QString secret;
     QXmppPasswordReply::Error error = getPassword(request, secret);
     if (error == QXmppPasswordReply::NoError) {
-        reply->setDigest(QCryptographicHash::hash(
-            (request.username() + ":" + request.domain() + ":" + secret).toUtf8(),
-            QCryptographicHash::Md5));
+        deriveDigest(reply, request, secret);
+    } else {
+        reply->setError(error);
+    }
+
+    // reply is finished
+    reply->finishLater();
+    return reply;
+}
+
+/// Retrieves the SCRAM salt, iteration count, StoredKey and ServerKey
+/// for the given username.
+///
+/// Reimplement this method if your backend stores salted keys, so that
+/// authenticating a user does not require any key derivation.
+///
+/// The base implementation derives the keys from getPassword(), using
+/// a salt computed from the username and domain.
+///
+/// \param request
+/// \param algorithm
+
+QXmppPasswordReply *QXmppPasswordChecker::getSaltedKeys(const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm)
+{
+    QXmppPasswordReply *reply = new QXmppPasswordReply;
+
+    QString secret;
+    QXmppPasswordReply::Error error = getPassword(request, secret);
+    if (error == QXmppPasswordReply::NoError) {
+        deriveSaltedKeys(reply, request, secret, algorithm);
     } else {
         reply->setError(error);
     }
@@ -222,3 +345,430 @@ bool QXmppPasswordChecker::hasGetPassword() const
     return false;
 }
 
+/// Returns true if the getSaltedKeys() method is implemented.
+///
+/// The base implementation returns false: deriving the keys from
+/// getPassword() costs thousands of hash iterations per login, so SCRAM
+/// is only offered if you reimplement getSaltedKeys() and this method, or
+/// wrap the checker in a QXmppThreadedPasswordChecker.
+///
+
+bool QXmppPasswordChecker::hasGetSaltedKeys() const
+{
+    return false;
+}
+
+/// Returns true if the user of the given request has an account.
+///
+/// This is used when routing stanzas, for instance to decide whether
+/// offline messages may be stored, so it should answer quickly. The base
+/// implementation calls getPassword() if hasGetPassword() returns true,
+/// and returns false otherwise.
+///
+/// \param request
+
+bool QXmppPasswordChecker::userExists(const QXmppPasswordRequest &request)
+{
+    QString password;
+    return hasGetPassword() &&
+           getPassword(request, password) == QXmppPasswordReply::NoError;
+}
+
+enum QXmppPasswordLookupType
+{
+    CheckPasswordLookup = 0,
+    DigestLookup,
+    SaltedKeysLookup
+};
+
+/// A lookup which calls the backend's getPassword() in a worker thread.
+
+class QXmppPasswordLookup : public QRunnable
+{
+public:
+    QXmppPasswordLookup(QXmppPasswordChecker *backend, QObject *receiver,
+                        QXmppPasswordReply *result, QXmppPasswordLookupType type,
+                        const QXmppPasswordRequest &request,
+                        QCryptographicHash::Algorithm algorithm,
+                        const QByteArray &hashSalt)
+        : m_backend(backend), m_receiver(receiver), m_result(result), m_type(type),
+        m_request(request), m_algorithm(algorithm), m_hashSalt(hashSalt)
+    {
+    }
+
+    void run()
+    {
+        QString secret;
+        QXmppPasswordReply::Error error = m_backend->getPassword(m_request, secret);
+        if (error == QXmppPasswordReply::NoError) {
+            if (m_type == CheckPasswordLookup)
+                m_result->setDigest(QCryptographicHash::hash(m_hashSalt + secret.toUtf8(), QCryptographicHash::Sha1));
+            else if (m_type == DigestLookup)
+                deriveDigest(m_result, m_request, secret);
+            else
+                deriveSaltedKeys(m_result, m_request, secret, m_algorithm);
+        } else {
+            m_result->setError(error);
+        }
+
+        // the result is only accessed again from the receiver's thread
+        QMetaObject::invokeMethod(m_receiver, "_q_lookupFinished", Qt::QueuedConnection,
+                                  Q_ARG(QObject*, m_result));
+    }
+
+private:
+    QXmppPasswordChecker *m_backend;
+    QObject *m_receiver;
+    QXmppPasswordReply *m_result;
+    QXmppPasswordLookupType m_type;
+    QXmppPasswordRequest m_request;
+    QCryptographicHash::Algorithm m_algorithm;
+    QByteArray m_hashSalt;
+};
+
+struct QXmppPasswordCacheEntry
+{
+    uint expires;
+    QByteArray digest;
+    QByteArray salt;
+    int iterations;
+    QByteArray storedKey;
+    QByteArray serverKey;
+};
+
+struct QXmppPasswordWaiter
+{
+    QPointer<QXmppPasswordReply> reply;
+    QByteArray passwordHash;
+};
+
+class QXmppThreadedPasswordCheckerPrivate
+{
+public:
+    QXmppThreadedPasswordCheckerPrivate(QXmppThreadedPasswordChecker *qq);
+    QXmppPasswordCacheEntry *cachedEntry(const QString &key);
+    QByteArray passwordHash(const QString &password) const;
+    QXmppPasswordReply *lookup(QXmppPasswordLookupType type, const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm);
+    void finishLookup(QXmppPasswordReply *result);
+
+    QXmppPasswordChecker *backend;
+    QCache<QString, QXmppPasswordCacheEntry> cache;
+    QCache<QString, uint> accounts;
+    int cacheExpiry;
+    QHash<QString, QList<QXmppPasswordWaiter> > pending;
+    QThreadPool pool;
+
+    // salt for the hashes of verified passwords
+    QByteArray hashSalt;
+
+private:
+    QXmppThreadedPasswordChecker *q;
+};
+
+QXmppThreadedPasswordCheckerPrivate::QXmppThreadedPasswordCheckerPrivate(QXmppThreadedPasswordChecker *qq)
+    : backend(0),
+    cache(1000),
+    accounts(1000),
+    cacheExpiry(300),
+    hashSalt(QXmppUtils::generateRandomBytes(16)),
+    q(qq)
+{
+}
+
+/// Returns the cache entry for the given key, unless it has expired.
+
+QXmppPasswordCacheEntry *QXmppThreadedPasswordCheckerPrivate::cachedEntry(const QString &key)
+{
+    QXmppPasswordCacheEntry *entry = cache.object(key);
+    if (entry && entry->expires < QDateTime::currentDateTime().toTime_t()) {
+        cache.remove(key);
+        return 0;
+    }
+    return entry;
+}
+
+QByteArray QXmppThreadedPasswordCheckerPrivate::passwordHash(const QString &password) const
+{
+    return QCryptographicHash::hash(hashSalt + password.toUtf8(), QCryptographicHash::Sha1);
+}
+
+/// Looks up credentials, either from the cache, by joining a pending
+/// lookup or by starting a new one.
+
+QXmppPasswordReply *QXmppThreadedPasswordCheckerPrivate::lookup(QXmppPasswordLookupType type, const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm)
+{
+    QXmppPasswordReply *reply = new QXmppPasswordReply;
+    const bool threaded = backend->hasGetPassword();
+
+    QXmppPasswordWaiter waiter;
+    waiter.reply = reply;
+    if (type == CheckPasswordLookup)
+        waiter.passwordHash = passwordHash(request.password());
+
+    // when the backend checks passwords itself, lookups are only
+    // valid for one password
+    QString key = QString("%1:%2:%3@%4").arg(QString::number(type),
+        QString::number(algorithm), request.username(), request.domain());
+    if (type == CheckPasswordLookup && !threaded)
+        key += ":" + QString::fromAscii(waiter.passwordHash.toHex());
+
+    // check the cache
+    QXmppPasswordCacheEntry *entry = cachedEntry(key);
+    if (entry && (type != CheckPasswordLookup || entry->digest == waiter.passwordHash)) {
+        if (type == DigestLookup) {
+            reply->setDigest(entry->digest);
+        } else if (type == SaltedKeysLookup) {
+            reply->setSalt(entry->salt);
+            reply->setIterations(entry->iterations);
+            reply->setStoredKey(entry->storedKey);
+            reply->setServerKey(entry->serverKey);
+        }
+        reply->finishLater();
+        return reply;
+    }
+
+    // coalesce with a pending lookup
+    const bool isPending = pending.contains(key);
+    pending[key] << waiter;
+    if (isPending)
+        return reply;
+
+    // start a new lookup
+    QXmppPasswordReply *result = 0;
+    if (threaded) {
+        result = new QXmppPasswordReply;
+        result->setProperty("__cache_key", key);
+        result->setProperty("__account", request.username() + "@" + request.domain());
+        result->setProperty("__account", request.username() + "@" + request.domain());
+        pool.start(new QXmppPasswordLookup(backend, q, result, type, request, algorithm, hashSalt));
+    } else {
+        if (type == CheckPasswordLookup)
+            result = backend->checkPassword(request);
+        else if (type == DigestLookup)
+            result = backend->getDigest(request);
+        else
+            result = backend->getSaltedKeys(request, algorithm);
+        result->setProperty("__cache_key", key);
+        if (type == CheckPasswordLookup)
+            result->setProperty("__password_hash", waiter.passwordHash);
+        bool check = QObject::connect(result, SIGNAL(finished()),
+                                      q, SLOT(_q_backendFinished()));
+        Q_ASSERT(check);
+        Q_UNUSED(check);
+
+        // the backend may have finished synchronously
+        if (result->isFinished())
+            QMetaObject::invokeMethod(result, "finished", Qt::QueuedConnection);
+    }
+    return reply;
+}
+
+/// Caches the result of a lookup and finishes the replies waiting for it.
+
+void QXmppThreadedPasswordCheckerPrivate::finishLookup(QXmppPasswordReply *result)
+{
+    const QString key = result->property("__cache_key").toString();
+    const QXmppPasswordLookupType type = static_cast<QXmppPasswordLookupType>(key.section(':', 0, 0).toInt());
+
+    // the backend verified this password
+    if (result->error() == QXmppPasswordReply::NoError && result->property("__password_hash").isValid())
+        result->setDigest(result->property("__password_hash").toByteArray());
+
+    if (result->error() == QXmppPasswordReply::NoError) {
+        QXmppPasswordCacheEntry *entry = new QXmppPasswordCacheEntry;
+        entry->expires = QDateTime::currentDateTime().toTime_t() + cacheExpiry;
+        entry->digest = result->digest();
+        entry->salt = result->salt();
+        entry->iterations = result->iterations();
+        entry->storedKey = result->storedKey();
+        entry->serverKey = result->serverKey();
+        cache.insert(key, entry);
+
+        // a successful lookup proves the account exists
+        accounts.insert(result->property("__account").toString(), new uint(entry->expires));
+    }
+
+    foreach (const QXmppPasswordWaiter &waiter, pending.take(key)) {
+        QXmppPasswordReply *reply = waiter.reply;
+        if (!reply)
+            continue;
+
+        if (result->error() != QXmppPasswordReply::NoError) {
+            reply->setError(result->error());
+        } else if (type == CheckPasswordLookup) {
+            if (waiter.passwordHash != result->digest())
+                reply->setError(QXmppPasswordReply::AuthorizationError);
+        } else {
+            reply->setDigest(result->digest());
+            reply->setSalt(result->salt());
+            reply->setIterations(result->iterations());
+            reply->setStoredKey(result->storedKey());
+            reply->setServerKey(result->serverKey());
+        }
+        reply->finish();
+    }
+    result->deleteLater();
+}
+
+/// Constructs a new threaded password checker.
+///
+/// \param backend The password checker which performs the lookups.
+/// \param parent
+
+QXmppThreadedPasswordChecker::QXmppThreadedPasswordChecker(QXmppPasswordChecker *backend, QObject *parent)
+    : QObject(parent),
+    d(new QXmppThreadedPasswordCheckerPrivate(this))
+{
+    d->backend = backend;
+    d->pool.setMaxThreadCount(4);
+}
+
+/// Destroys the threaded password checker, waiting for running lookups
+/// to complete.
+
+QXmppThreadedPasswordChecker::~QXmppThreadedPasswordChecker()
+{
+    d->pool.waitForDone();
+    delete d;
+}
+
+/// Returns the number of seconds after which cached credentials expire.
+
+int QXmppThreadedPasswordChecker::cacheExpiry() const
+{
+    return d->cacheExpiry;
+}
+
+/// Sets the number of seconds after which cached credentials expire.
+///
+/// The default value is 300 seconds.
+///
+/// \param secs
+
+void QXmppThreadedPasswordChecker::setCacheExpiry(int secs)
+{
+    d->cacheExpiry = secs;
+}
+
+/// Returns the maximum number of cached entries.
+
+int QXmppThreadedPasswordChecker::cacheSize() const
+{
+    return d->cache.maxCost();
+}
+
+/// Sets the maximum number of cached entries, after which the least
+/// recently used entries are discarded.
+///
+/// The default value is 1000 entries.
+///
+/// \param size
+
+void QXmppThreadedPasswordChecker::setCacheSize(int size)
+{
+    d->cache.setMaxCost(size);
+    d->accounts.setMaxCost(size);
+}
+
+/// Returns the maximum number of threads used to call the backend.
+
+int QXmppThreadedPasswordChecker::maxThreadCount() const
+{
+    return d->pool.maxThreadCount();
+}
+
+/// Sets the maximum number of threads used to call the backend.
+///
+/// The default value is 4 threads.
+///
+/// \param count
+
+void QXmppThreadedPasswordChecker::setMaxThreadCount(int count)
+{
+    d->pool.setMaxThreadCount(count);
+}
+
+/// Discards all cached credentials, for instance after a password change.
+
+void QXmppThreadedPasswordChecker::clearCache()
+{
+    d->cache.clear();
+    d->accounts.clear();
+}
+
+/// Checks that the given credentials are valid.
+///
+/// \param request
+
+QXmppPasswordReply *QXmppThreadedPasswordChecker::checkPassword(const QXmppPasswordRequest &request)
+{
+    return d->lookup(CheckPasswordLookup, request, QCryptographicHash::Sha1);
+}
+
+/// Retrieves the MD5 digest for the given username.
+///
+/// \param request
+
+QXmppPasswordReply *QXmppThreadedPasswordChecker::getDigest(const QXmppPasswordRequest &request)
+{
+    return d->lookup(DigestLookup, request, QCryptographicHash::Md5);
+}
+
+/// Retrieves the SCRAM salted keys for the given username.
+///
+/// \param request
+/// \param algorithm
+
+QXmppPasswordReply *QXmppThreadedPasswordChecker::getSaltedKeys(const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm)
+{
+    return d->lookup(SaltedKeysLookup, request, algorithm);
+}
+
+/// Returns true if the backend implements getPassword().
+
+bool QXmppThreadedPasswordChecker::hasGetPassword() const
+{
+    return d->backend->hasGetPassword();
+}
+
+/// Returns true if the backend can provide SCRAM salted keys.
+///
+/// Keys derived from the backend's getPassword() are computed in the
+/// worker threads and cached, so they are available too.
+
+bool QXmppThreadedPasswordChecker::hasGetSaltedKeys() const
+{
+    return d->backend->hasGetSaltedKeys() || d->backend->hasGetPassword();
+}
+
+/// Returns true if the user has an account.
+///
+/// Users whose credentials were looked up recently are answered from the
+/// cache, otherwise the backend is asked.
+///
+/// \param request
+
+bool QXmppThreadedPasswordChecker::userExists(const QXmppPasswordRequest &request)
+{
+    const QString account = request.username() + "@" + request.domain();
+    const uint *expires = d->accounts.object(account);
+    if (expires && *expires >= QDateTime::currentDateTime().toTime_t())
+        return true;
+
+    if (!d->backend->userExists(request))
+        return false;
+    d->accounts.insert(account, new uint(QDateTime::currentDateTime().toTime_t() + d->cacheExpiry));
+    return true;
+}
+
+void QXmppThreadedPasswordChecker::_q_backendFinished()
+{
+    QXmppPasswordReply *result = qobject_cast<QXmppPasswordReply*>(sender());
+    if (result)
+        d->finishLookup(result);
+}
+
+void QXmppThreadedPasswordChecker::_q_lookupFinished(QObject *result)
+{
+    d->finishLookup(static_cast<QXmppPasswordReply*>(result));
+}
@@ -24,10 +24,13 @@
 #ifndef QXMPPPASSWORDCHECKER_H
 #define QXMPPPASSWORDCHECKER_H
 
+#include <QCryptographicHash>
 #include <QObject>
 
 #include "QXmppGlobal.h"
 
+class QXmppThreadedPasswordCheckerPrivate;
+
 /// \brief The QXmppPasswordRequest class represents a password request.
 ///
 class QXMPP_EXPORT QXmppPasswordRequest
@@ -75,6 +78,18 @@ public:
     QString password() const;
     void setPassword(const QString &password);
 
+    int iterations() const;
+    void setIterations(int iterations);
+
+    QByteArray salt() const;
+    void setSalt(const QByteArray &salt);
+
+    QByteArray serverKey() const;
+    void setServerKey(const QByteArray &serverKey);
+
+    QByteArray storedKey() const;
+    void setStoredKey(const QByteArray &storedKey);
+
     QXmppPasswordReply::Error error() const;
     void setError(QXmppPasswordReply::Error error);
 
@@ -90,6 +105,10 @@ signals:
 private:
     QByteArray m_digest;
     QString m_password;
+    int m_iterations;
+    QByteArray m_salt;
+    QByteArray m_serverKey;
+    QByteArray m_storedKey;
     QXmppPasswordReply::Error m_error;
     bool m_isFinished;
 };
@@ -102,10 +121,63 @@ class QXMPP_EXPORT QXmppPasswordChecker
 public:
     virtual QXmppPasswordReply *checkPassword(const QXmppPasswordRequest &request);
     virtual QXmppPasswordReply *getDigest(const QXmppPasswordRequest &request);
+    virtual QXmppPasswordReply *getSaltedKeys(const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm);
     virtual bool hasGetPassword() const;
+    virtual bool hasGetSaltedKeys() const;
+    virtual bool userExists(const QXmppPasswordRequest &request);
 
 protected:
     virtual QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password);
+
+private:
+    friend class QXmppPasswordLookup;
+};
+
+/// \brief The QXmppThreadedPasswordChecker class wraps a password checker
+/// so that credentials are retrieved asynchronously and cached.
+///
+/// If the backend implements getPassword(), it is called on a bounded pool
+/// of worker threads so that a slow backend does not block the server.
+/// The backend must therefore be thread-safe. Otherwise, the backend's
+/// own asynchronous methods are used.
+///
+/// Successful lookups are kept in a least-recently-used cache until they
+/// expire, and concurrent lookups for the same user are coalesced into a
+/// single backend request.
+
+class QXMPP_EXPORT QXmppThreadedPasswordChecker : public QObject, public QXmppPasswordChecker
+{
+    Q_OBJECT
+
+public:
+    QXmppThreadedPasswordChecker(QXmppPasswordChecker *backend, QObject *parent = 0);
+    ~QXmppThreadedPasswordChecker();
+
+    int cacheExpiry() const;
+    void setCacheExpiry(int secs);
+
+    int cacheSize() const;
+    void setCacheSize(int size);
+
+    int maxThreadCount() const;
+    void setMaxThreadCount(int count);
+
+    void clearCache();
+
+    QXmppPasswordReply *checkPassword(const QXmppPasswordRequest &request);
+    QXmppPasswordReply *getDigest(const QXmppPasswordRequest &request);
+    QXmppPasswordReply *getSaltedKeys(const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm);
+    bool hasGetPassword() const;
+    bool hasGetSaltedKeys() const;
+    bool userExists(const QXmppPasswordRequest &request);
+
+private slots:
+    void _q_backendFinished();
+    void _q_lookupFinished(QObject *result);
+
+private:
+    QXmppThreadedPasswordCheckerPrivate * const d;
+    friend class QXmppThreadedPasswordCheckerPrivate;
 };
 
 #endif
@@ -0,0 +1,685 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSet>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <QUrl>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <io.h>
+#elif defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+#include "QXmppMetrics.h"
+#include "QXmppRecordLog_p.h"
+
+// pending data above which a flush is requested without waiting
+static const qint64 maxPendingSize = 256 * 1024;
+
+/// Writes the data to the file and waits for it to reach the disk.
+///
+/// \param file
+/// \param data
+
+static bool writeAndSync(QFile &file, const QByteArray &data)
+{
+    if (file.write(data) != data.size() || !file.flush())
+        return false;
+#if defined(Q_OS_WIN)
+    return FlushFileBuffers((HANDLE)_get_osfhandle(file.handle()));
+#elif defined(Q_OS_UNIX)
+    return ::fsync(file.handle()) == 0;
+#else
+    return true;
+#endif
+}
+
+/// Decodes the 32-bit big endian length of a record.
+///
+/// \param header
+
+static quint32 recordLength(const char *header)
+{
+    const uchar *ptr = reinterpret_cast<const uchar*>(header);
+    return (quint32(ptr[0]) << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+}
+
+/// Returns the length of the complete records of a log file, truncating
+/// the record torn by an interrupted write, if any.
+///
+/// \param path
+
+static qint64 recoverFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadWrite))
+        return 0;
+
+    const qint64 fileSize = file.size();
+    char header[QXmppRecordLog::HeaderSize];
+    qint64 pos = 0;
+    while (pos + QXmppRecordLog::HeaderSize <= fileSize &&
+           file.seek(pos) &&
+           file.read(header, QXmppRecordLog::HeaderSize) == QXmppRecordLog::HeaderSize) {
+        const qint64 size = QXmppRecordLog::HeaderSize + recordLength(header);
+        if (pos + size > fileSize)
+            break;
+        pos += size;
+    }
+
+    if (pos < fileSize)
+        file.resize(pos);
+    return pos;
+}
+
+QXmppRecordLogBatch::QXmppRecordLogBatch()
+    : replace(false)
+{
+}
+
+/// Constructs a new log scanner.
+///
+/// \param parent
+
+QXmppRecordLogScanner::QXmppRecordLogScanner(QObject *parent)
+    : QObject(parent),
+    m_size(0),
+    m_fileSize(0)
+{
+}
+
+/// Returns the size of the log when the read was requested, records
+/// appended later are not read.
+///
+
+qint64 QXmppRecordLogScanner::size() const
+{
+    return m_size;
+}
+
+/// Constructs a new set of logs, whose files are named after their key
+/// followed by the given suffix.
+///
+/// \param suffix
+/// \param parent
+
+QXmppRecordLog::QXmppRecordLog(const QString &suffix, QObject *parent)
+    : QObject(parent),
+    m_suffix(suffix),
+    m_thread(0),
+    m_writer(0),
+    m_pendingSize(0),
+    m_writeFailures(0),
+    m_flushTime(0)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setInterval(100);
+    m_flushTimer->setSingleShot(true);
+    check = connect(m_flushTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_flush()));
+    Q_ASSERT(check);
+}
+
+QXmppRecordLog::~QXmppRecordLog()
+{
+    close();
+}
+
+/// Returns the directory holding the logs.
+///
+
+QString QXmppRecordLog::directory() const
+{
+    return m_directory;
+}
+
+/// Sets the directory holding the logs.
+///
+/// The change takes effect the next time the logs are opened.
+///
+/// \param directory
+
+void QXmppRecordLog::setDirectory(const QString &directory)
+{
+    m_directory = directory;
+}
+
+/// Returns the interval in milliseconds after which appended records are
+/// written to disk.
+///
+
+int QXmppRecordLog::flushInterval() const
+{
+    return m_flushTimer->interval();
+}
+
+/// Sets the interval in milliseconds after which appended records are
+/// written to disk, the default is 100.
+///
+/// \param msecs
+
+void QXmppRecordLog::setFlushInterval(int msecs)
+{
+    m_flushTimer->setInterval(msecs);
+}
+
+/// Sets the metrics updated by the writer thread.
+///
+/// \param writeFailures
+/// \param flushTime
+
+void QXmppRecordLog::setMetrics(QXmppCounter *writeFailures, QXmppHistogram *flushTime)
+{
+    m_writeFailures = writeFailures;
+    m_flushTime = flushTime;
+}
+
+/// Creates the directory if needed and starts the writer thread.
+///
+/// The record headers of the existing logs are checked, so that a record
+/// torn by a crash is dropped before any record is appended after it.
+
+bool QXmppRecordLog::open()
+{
+    if (m_thread)
+        return true;
+    if (m_directory.isEmpty() || !QDir(m_directory).mkpath("."))
+        return false;
+
+    m_synced.clear();
+    QDir dir(m_directory);
+    foreach (const QFileInfo &info, dir.entryInfoList(QStringList() << ("*" + m_suffix), QDir::Files)) {
+        const QByteArray name = info.fileName().left(info.fileName().size() - m_suffix.size()).toLatin1();
+        m_synced.insert(QUrl::fromPercentEncoding(name), recoverFile(info.filePath()));
+    }
+
+    m_thread = new QThread;
+    m_writer = new QXmppRecordLogWriter(this);
+    m_writer->moveToThread(m_thread);
+    m_thread->start();
+    return true;
+}
+
+/// Writes the pending records and stops the writer thread.
+
+void QXmppRecordLog::close()
+{
+    m_flushTimer->stop();
+    if (m_thread) {
+        QMetaObject::invokeMethod(m_writer, "flush", Qt::BlockingQueuedConnection);
+        m_thread->quit();
+        m_thread->wait();
+        delete m_writer;
+        m_writer = 0;
+        delete m_thread;
+        m_thread = 0;
+    }
+}
+
+/// Returns true if the logs are open.
+
+bool QXmppRecordLog::isOpen() const
+{
+    return m_thread != 0;
+}
+
+/// Returns the size of the given log, including pending records.
+///
+/// \param key
+
+qint64 QXmppRecordLog::size(const QString &key) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    qint64 size = m_synced.value(key);
+    QHash<QString, QXmppRecordLogBatch>::const_iterator it = m_writing.constFind(key);
+    if (it != m_writing.constEnd())
+        size = (it->replace ? 0 : size) + it->records.size();
+    it = m_pending.constFind(key);
+    if (it != m_pending.constEnd())
+        size = (it->replace ? 0 : size) + it->records.size();
+    return size;
+}
+
+/// Returns the size of each non-empty log, by key.
+
+QHash<QString, qint64> QXmppRecordLog::sizes() const
+{
+    QSet<QString> keys;
+    {
+        QMutexLocker locker(&m_mutex);
+        keys = QSet<QString>::fromList(m_synced.keys());
+        keys += QSet<QString>::fromList(m_writing.keys());
+        keys += QSet<QString>::fromList(m_pending.keys());
+    }
+
+    QHash<QString, qint64> sizes;
+    foreach (const QString &key, keys) {
+        const qint64 logSize = size(key);
+        if (logSize > 0)
+            sizes.insert(key, logSize);
+    }
+    return sizes;
+}
+
+/// Appends a record to the given log.
+///
+/// Returns the size of the record, including its header.
+///
+/// \param key
+/// \param payload
+
+qint64 QXmppRecordLog::append(const QString &key, const QByteArray &payload)
+{
+    const QByteArray data = record(payload);
+
+    qint64 pendingSize;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_pending[key].records.append(data);
+        m_pendingSize += data.size();
+        pendingSize = m_pendingSize;
+    }
+
+    if (pendingSize >= maxPendingSize)
+        _q_flush();
+    else
+        _q_scheduleFlush();
+    return data.size();
+}
+
+/// Reads the records at the given offsets of a log in the writer thread,
+/// handing them to the scanner's scanRecord() method in the order of the
+/// offsets, then emits the scanner's finished() signal.
+///
+/// Offsets which do not hold a complete record are skipped.
+///
+/// \param key
+/// \param offsets
+/// \param scanner
+
+void QXmppRecordLog::read(const QString &key, const QList<qint64> &offsets, QXmppRecordLogScanner *scanner)
+{
+    scanner->m_offsets = offsets;
+    request("read", key, scanner);
+}
+
+/// Reads the records of the given log in the writer thread, handing them
+/// to the scanner's scanRecord() method, then emits the scanner's
+/// finished() signal.
+///
+/// Only the records appended before this call are scanned.
+///
+/// \param key
+/// \param scanner
+
+void QXmppRecordLog::scan(const QString &key, QXmppRecordLogScanner *scanner)
+{
+    request("scan", key, scanner);
+}
+
+/// Scans the given log like scan(), and removes it.
+///
+/// The log is empty as soon as this method returns, the records appended
+/// afterwards start a new log.
+///
+/// \param key
+/// \param scanner
+
+void QXmppRecordLog::take(const QString &key, QXmppRecordLogScanner *scanner)
+{
+    request("scan", key, scanner);
+
+    // the writer thread removes the file once it has been scanned
+    {
+        QMutexLocker locker(&m_mutex);
+        QXmppRecordLogBatch &pending = m_pending[key];
+        m_pendingSize -= pending.records.size();
+        pending.replace = true;
+        pending.records.clear();
+    }
+    _q_scheduleFlush();
+}
+
+/// Replaces the content of the given log.
+///
+/// The new content is written and synced by the writer thread.
+///
+/// \param key
+/// \param records
+
+void QXmppRecordLog::rewrite(const QString &key, const QByteArray &records)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        QXmppRecordLogBatch &pending = m_pending[key];
+        m_pendingSize += records.size() - pending.records.size();
+        pending.replace = true;
+        pending.records = records;
+    }
+    _q_flush();
+}
+
+/// Returns the record holding the given payload, with its header.
+///
+/// \param payload
+
+QByteArray QXmppRecordLog::record(const QByteArray &payload)
+{
+    const quint32 length = payload.size();
+    const char header[HeaderSize] = {
+        char(length >> 24), char(length >> 16), char(length >> 8), char(length) };
+
+    QByteArray data;
+    data.reserve(HeaderSize + payload.size());
+    data.append(header, HeaderSize);
+    data.append(payload);
+    return data;
+}
+
+/// Returns the size of the complete record at the given position, including
+/// its header, or 0 if the records end with a torn record.
+///
+/// \param records
+/// \param pos
+
+int QXmppRecordLog::recordSize(const QByteArray &records, int pos)
+{
+    if (pos < 0 || pos + HeaderSize > records.size())
+        return 0;
+    const quint32 length = recordLength(records.constData() + pos);
+    if (length > quint32(records.size() - pos - HeaderSize))
+        return 0;
+    return HeaderSize + length;
+}
+
+/// Returns the path of the given log.
+///
+/// \param key
+
+QString QXmppRecordLog::path(const QString &key) const
+{
+    return QDir(m_directory).filePath(QString::fromLatin1(QUrl::toPercentEncoding(key)) + m_suffix);
+}
+
+/// Takes a snapshot of the given log for the scanner, then invokes the
+/// writer thread's method which reads it.
+///
+/// The synced part of the file is not modified until the writer thread
+/// handles a later flush, so the snapshot stays valid until it is read.
+///
+/// \param method
+/// \param key
+/// \param scanner
+
+void QXmppRecordLog::request(const char *method, const QString &key, QXmppRecordLogScanner *scanner)
+{
+    scanner->m_fileSize = snapshot(key, &scanner->m_tail);
+    scanner->m_size = scanner->m_fileSize + scanner->m_tail.size();
+    if (m_writer)
+        QMetaObject::invokeMethod(m_writer, method, Qt::QueuedConnection,
+                                  Q_ARG(QString, key),
+                                  Q_ARG(QObject*, scanner));
+    else
+        QMetaObject::invokeMethod(scanner, "finished", Qt::QueuedConnection);
+}
+
+/// Returns the length of the synced records at the start of the given log
+/// file, and sets \a tail to the records which follow them in memory.
+///
+/// The file is not modified below that length until the caller's thread
+/// replaces or removes the log, so it can be read without holding the lock.
+///
+/// \param key
+/// \param tail
+
+qint64 QXmppRecordLog::snapshot(const QString &key, QByteArray *tail) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    qint64 fileSize = m_synced.value(key);
+    tail->clear();
+
+    QHash<QString, QXmppRecordLogBatch>::const_iterator it = m_writing.constFind(key);
+    if (it != m_writing.constEnd()) {
+        if (it->replace)
+            fileSize = 0;
+        *tail = it->records;
+    }
+    it = m_pending.constFind(key);
+    if (it != m_pending.constEnd()) {
+        if (it->replace) {
+            fileSize = 0;
+            tail->clear();
+        }
+        *tail += it->records;
+    }
+    return fileSize;
+}
+
+/// Hands the pending records to the writer thread.
+
+void QXmppRecordLog::_q_flush()
+{
+    m_flushTimer->stop();
+    if (m_writer)
+        QMetaObject::invokeMethod(m_writer, "flush", Qt::QueuedConnection);
+}
+
+/// Schedules a flush after flushInterval() milliseconds, unless one is
+/// already scheduled.
+
+void QXmppRecordLog::_q_scheduleFlush()
+{
+    if (!m_flushTimer->isActive())
+        m_flushTimer->start();
+}
+
+QXmppRecordLogWriter::QXmppRecordLogWriter(QXmppRecordLog *log)
+    : m_log(log)
+{
+}
+
+/// Writes the pending records to the logs, syncing each log once.
+///
+/// The batch is swapped out of the pending records, so that appends and
+/// reads do not wait for the disk. If a log cannot be written, it is
+/// truncated back to its synced length and its records are kept for the
+/// next flush.
+
+void QXmppRecordLogWriter::flush()
+{
+    QHash<QString, QXmppRecordLogBatch> batch;
+    {
+        QMutexLocker locker(&m_log->m_mutex);
+        batch = m_log->m_pending;
+        m_log->m_writing = batch;
+        m_log->m_pending.clear();
+        m_log->m_pendingSize = 0;
+    }
+    if (batch.isEmpty())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QHash<QString, qint64> synced;
+    QHash<QString, QXmppRecordLogBatch>::const_iterator it;
+    for (it = batch.constBegin(); it != batch.constEnd(); ++it)
+        synced.insert(it.key(), write(it.key(), it.value()));
+
+    bool failed = false;
+    {
+        QMutexLocker locker(&m_log->m_mutex);
+        m_log->m_writing.clear();
+        for (it = batch.constBegin(); it != batch.constEnd(); ++it) {
+            const qint64 size = synced.value(it.key());
+            if (size > 0) {
+                m_log->m_synced.insert(it.key(), size);
+            } else if (size == 0) {
+                m_log->m_synced.remove(it.key());
+            } else {
+                // keep the records, unless the log was replaced meanwhile
+                QXmppRecordLogBatch &pending = m_log->m_pending[it.key()];
+                if (!pending.replace) {
+                    pending.replace = it->replace;
+                    pending.records.prepend(it->records);
+                    m_log->m_pendingSize += it->records.size();
+                }
+                failed = true;
+            }
+        }
+    }
+
+    if (failed)
+        QMetaObject::invokeMethod(m_log, "_q_scheduleFlush", Qt::QueuedConnection);
+
+    if (m_log->m_flushTime)
+        m_log->m_flushTime->record(timer.nsecsElapsed() / 1000);
+}
+
+/// Reads the records at the requested offsets of a log for a
+/// QXmppRecordLogScanner.
+///
+/// \param key
+/// \param object
+
+void QXmppRecordLogWriter::read(const QString &key, QObject *object)
+{
+    QXmppRecordLogScanner *scanner = static_cast<QXmppRecordLogScanner*>(object);
+    const qint64 fileSize = scanner->m_fileSize;
+    const QByteArray &tail = scanner->m_tail;
+
+    QFile file(m_log->path(key));
+    if (fileSize > 0)
+        file.open(QIODevice::ReadOnly);
+
+    foreach (qint64 offset, scanner->m_offsets) {
+        if (offset < fileSize) {
+            char header[QXmppRecordLog::HeaderSize];
+            if (file.isOpen() && file.seek(offset) &&
+                file.read(header, QXmppRecordLog::HeaderSize) == QXmppRecordLog::HeaderSize) {
+                const qint64 length = recordLength(header);
+                if (offset + QXmppRecordLog::HeaderSize + length <= fileSize) {
+                    const QByteArray payload = file.read(length);
+                    if (payload.size() == length)
+                        scanner->scanRecord(payload, offset);
+                }
+            }
+        } else {
+            const int pos = offset - fileSize;
+            const int size = QXmppRecordLog::recordSize(tail, pos);
+            if (size)
+                scanner->scanRecord(tail.mid(pos + QXmppRecordLog::HeaderSize, size - QXmppRecordLog::HeaderSize),
+                                    offset);
+        }
+    }
+
+    QMetaObject::invokeMethod(scanner, "finished", Qt::QueuedConnection);
+}
+
+/// Reads all the records of a log for a QXmppRecordLogScanner.
+///
+/// \param key
+/// \param object
+
+void QXmppRecordLogWriter::scan(const QString &key, QObject *object)
+{
+    QXmppRecordLogScanner *scanner = static_cast<QXmppRecordLogScanner*>(object);
+    const qint64 fileSize = scanner->m_fileSize;
+    const QByteArray &tail = scanner->m_tail;
+
+    // the synced part of the file only holds complete records
+    qint64 offset = 0;
+    QFile file(m_log->path(key));
+    if (fileSize > 0 && file.open(QIODevice::ReadOnly)) {
+        char header[QXmppRecordLog::HeaderSize];
+        while (offset < fileSize &&
+               file.read(header, QXmppRecordLog::HeaderSize) == QXmppRecordLog::HeaderSize) {
+            const qint64 length = recordLength(header);
+            const QByteArray payload = file.read(length);
+            if (payload.size() != length)
+                break;
+            scanner->scanRecord(payload, offset);
+            offset += QXmppRecordLog::HeaderSize + length;
+        }
+    }
+
+    int pos = 0;
+    while (const int size = QXmppRecordLog::recordSize(tail, pos)) {
+        scanner->scanRecord(tail.mid(pos + QXmppRecordLog::HeaderSize, size - QXmppRecordLog::HeaderSize),
+                            fileSize + pos);
+        pos += size;
+    }
+
+    QMetaObject::invokeMethod(scanner, "finished", Qt::QueuedConnection);
+}
+
+/// Writes a batch of records to its log and syncs it.
+///
+/// Returns the new length of the log file, 0 if the log was removed, or -1
+/// if writing failed, in which case the file is truncated back to its last
+/// synced length.
+///
+/// \param key
+/// \param batch
+
+qint64 QXmppRecordLogWriter::write(const QString &key, const QXmppRecordLogBatch &batch)
+{
+    const QString path = m_log->path(key);
+    bool ok = false;
+
+    if (batch.replace && batch.records.isEmpty()) {
+        ok = !QFile::exists(path) || QFile::remove(path);
+        if (ok)
+            return 0;
+    } else {
+        const qint64 base = batch.replace ? 0 : m_log->m_synced.value(key);
+        QFile file(path);
+        if (file.open(QIODevice::ReadWrite)) {
+            // drop anything written after the synced records
+            ok = (file.size() == base || file.resize(base)) &&
+                 file.seek(base) &&
+                 writeAndSync(file, batch.records);
+            if (ok)
+                return base + batch.records.size();
+            file.resize(base);
+        }
+    }
+
+    if (m_log->m_writeFailures)
+        m_log->m_writeFailures->add();
+    return -1;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPRECORDLOG_P_H
+#define QXMPPRECORDLOG_P_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+
+class QThread;
+class QTimer;
+class QXmppCounter;
+class QXmppHistogram;
+class QXmppRecordLogWriter;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmpp server extensions.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+/// \brief The QXmppRecordLogBatch class holds the records of a log which
+/// have not been written to disk yet.
+///
+
+class QXmppRecordLogBatch
+{
+public:
+    QXmppRecordLogBatch();
+
+    // whether the records replace the content of the log
+    bool replace;
+    QByteArray records;
+};
+
+/// \brief The QXmppRecordLogScanner class receives the records of a log
+/// read by QXmppRecordLog::read(), scan() or take().
+///
+
+class QXmppRecordLogScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppRecordLogScanner(QObject *parent = 0);
+
+    qint64 size() const;
+
+    /// Handles the record stored at the given offset of the log.
+    ///
+    /// This method is called from the writer thread.
+    ///
+    /// \param payload
+    /// \param offset
+    virtual void scanRecord(const QByteArray &payload, qint64 offset) = 0;
+
+signals:
+    /// This signal is emitted in the scanner's thread once all the records
+    /// have been read.
+    void finished();
+
+private:
+    friend class QXmppRecordLog;
+    friend class QXmppRecordLogWriter;
+    qint64 m_size;
+
+    // the snapshot of the log taken when the read was requested
+    qint64 m_fileSize;
+    QByteArray m_tail;
+    QList<qint64> m_offsets;
+};
+
+/// \brief The QXmppRecordLog class manages a directory of append-only
+/// logs, one per key, made of length-prefixed records.
+///
+/// Appending a record only copies it to an in-memory buffer. The buffers
+/// are written by a dedicated thread after flushInterval() milliseconds,
+/// with a single sync per log and batch. Reads are performed by the same
+/// thread, on a snapshot of the log taken when they are requested which
+/// includes the pending records, and their results are handed to a
+/// QXmppRecordLogScanner, so the calling thread never waits for the disk.
+///
+/// The methods must be called from the thread the log lives in.
+///
+
+class QXmppRecordLog : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum {
+        HeaderSize = 4  ///< size of the 32-bit big endian record length
+    };
+
+    QXmppRecordLog(const QString &suffix, QObject *parent = 0);
+    ~QXmppRecordLog();
+
+    QString directory() const;
+    void setDirectory(const QString &directory);
+
+    int flushInterval() const;
+    void setFlushInterval(int msecs);
+
+    void setMetrics(QXmppCounter *writeFailures, QXmppHistogram *flushTime);
+
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    qint64 size(const QString &key) const;
+    QHash<QString, qint64> sizes() const;
+    qint64 append(const QString &key, const QByteArray &payload);
+    void read(const QString &key, const QList<qint64> &offsets, QXmppRecordLogScanner *scanner);
+    void scan(const QString &key, QXmppRecordLogScanner *scanner);
+    void take(const QString &key, QXmppRecordLogScanner *scanner);
+    void rewrite(const QString &key, const QByteArray &records);
+
+    static QByteArray record(const QByteArray &payload);
+    static int recordSize(const QByteArray &records, int pos);
+
+private slots:
+    void _q_flush();
+    void _q_scheduleFlush();
+
+private:
+    friend class QXmppRecordLogWriter;
+    QString path(const QString &key) const;
+    void request(const char *method, const QString &key, QXmppRecordLogScanner *scanner);
+    qint64 snapshot(const QString &key, QByteArray *tail) const;
+
+    QString m_directory;
+    QString m_suffix;
+    QTimer *m_flushTimer;
+    QThread *m_thread;
+    QXmppRecordLogWriter *m_writer;
+
+    // shared with the writer thread, the lock is never held during I/O
+    mutable QMutex m_mutex;
+    QHash<QString, QXmppRecordLogBatch> m_pending;
+    QHash<QString, QXmppRecordLogBatch> m_writing;
+    qint64 m_pendingSize;
+
+    // length of the synced records of each log file, only modified by
+    // the writer thread while the logs are open
+    QHash<QString, qint64> m_synced;
+
+    QXmppCounter *m_writeFailures;
+    QXmppHistogram *m_flushTime;
+};
+
+/// \brief The QXmppRecordLogWriter class appends the pending records of a
+/// QXmppRecordLog to disk, it lives in its own thread.
+///
+
+class QXmppRecordLogWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppRecordLogWriter(QXmppRecordLog *log);
+
+public slots:
+    void flush();
+    void read(const QString &key, QObject *scanner);
+    void scan(const QString &key, QObject *scanner);
+
+private:
+    qint64 write(const QString &key, const QXmppRecordLogBatch &batch);
+
+    QXmppRecordLog *m_log;
+};
+
+#endif
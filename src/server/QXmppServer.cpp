@@ -23,52 +23,112 @@
 
 #include <QCoreApplication>
 #include <QDomElement>
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QPluginLoader>
 #include <QSslCertificate>
+#include <QSslConfiguration>
 #include <QSslKey>
 #include <QSslSocket>
+#include <QThread>
+#include <QTimer>
 
+#include "QXmppAtom.h"
 #include "QXmppConstants.h"
 #include "QXmppDialback.h"
 #include "QXmppIq.h"
 #include "QXmppIncomingClient.h"
 #include "QXmppIncomingServer.h"
+#include "QXmppJid.h"
+#include "QXmppMessage.h"
+#include "QXmppMetrics.h"
 #include "QXmppOutgoingServer.h"
 #include "QXmppPresence.h"
 #include "QXmppServer.h"
+#include "QXmppServer_p.h"
 #include "QXmppServerExtension.h"
 #include "QXmppServerPlugin.h"
+#include "QXmppServerPresence_p.h"
 #include "QXmppUtils.h"
 
-static void helperToXmlAddDomElement(QXmlStreamWriter* stream, const QDomElement& element, const QStringList &omitNamespaces)
+// limits on the data queued for a single stream
+static const qint64 streamLowWaterMark = 256 * 1024;
+static const qint64 streamHighWaterMark = 1024 * 1024;
+
+// time after which a TLS handshake performed by a worker thread is aborted
+static const qint64 handshakeTimeout = 30000;
+
+/// Escapes a value so that it can be written inside a double-quoted
+/// XML attribute.
+///
+/// \param value
+
+static QByteArray escapedAttribute(const QString &value)
 {
-    stream->writeStartElement(element.tagName());
+    QByteArray data = value.toUtf8();
+    if (data.contains('&'))
+        data.replace('&', "&amp;");
+    if (data.contains('<'))
+        data.replace('<', "&lt;");
+    if (data.contains('>'))
+        data.replace('>', "&gt;");
+    if (data.contains('"'))
+        data.replace('"', "&quot;");
+    return data;
+}
 
-    /* attributes */
-    QString xmlns = element.namespaceURI();
-    if (!xmlns.isEmpty() && !omitNamespaces.contains(xmlns))
-        stream->writeAttribute("xmlns", xmlns);
-    QDomNamedNodeMap attrs = element.attributes();
-    for (int i = 0; i < attrs.size(); i++)
-    {
-        QDomAttr attr = attrs.item(i).toAttr();
-        stream->writeAttribute(attr.name(), attr.value());
-    }
+/// Splits serialized XMPP data around the value of the root element's
+/// 'to' attribute, inserting an empty attribute if there is none.
+///
+/// QXmlStreamWriter escapes '"' and '>' inside attribute values, so the
+/// first '>' ends the start tag and ' to="' can only be the attribute.
+///
+/// \param data
+/// \param head
+/// \param tail
 
-    /* children */
-    QDomNode childNode = element.firstChild();
-    while (!childNode.isNull())
-    {
-        if (childNode.isElement())
-        {
-            helperToXmlAddDomElement(stream, childNode.toElement(), QStringList() << xmlns);
-        } else if (childNode.isText()) {
-            stream->writeCharacters(childNode.toText().data());
-        }
-        childNode = childNode.nextSibling();
+static bool splitRecipient(const QByteArray &data, QByteArray &head, QByteArray &tail)
+{
+    const int tagEnd = data.indexOf('>');
+    if (!data.startsWith('<') || tagEnd < 0)
+        return false;
+
+    const QByteArray marker(" to=\"");
+    const int pos = data.indexOf(marker);
+    if (pos >= 0 && pos < tagEnd) {
+        const int valueStart = pos + marker.size();
+        const int valueEnd = data.indexOf('"', valueStart);
+        if (valueEnd < 0)
+            return false;
+        head = data.left(valueStart);
+        tail = data.mid(valueEnd);
+    } else {
+        int nameEnd = 1;
+        while (nameEnd < tagEnd && data.at(nameEnd) != ' ' && data.at(nameEnd) != '/')
+            nameEnd++;
+        head = data.left(nameEnd) + marker;
+        tail = '"' + data.mid(nameEnd);
     }
-    stream->writeEndElement();
+    return true;
+}
+
+// value of an attribute of the first start tag, empty if it is missing
+static QByteArray startTagAttribute(const QByteArray &data, const char *name)
+{
+    const int tagEnd = data.indexOf('>');
+    if (tagEnd < 0)
+        return QByteArray();
+
+    const QByteArray marker = ' ' + QByteArray(name) + '=';
+    const int pos = QByteArray::fromRawData(data.constData(), tagEnd).indexOf(marker);
+    const int valueStart = pos + marker.size() + 1;
+    if (pos < 0 || valueStart >= tagEnd)
+        return QByteArray();
+
+    const int valueEnd = data.indexOf(data.at(valueStart - 1), valueStart);
+    if (valueEnd < 0 || valueEnd > tagEnd)
+        return QByteArray();
+    return data.mid(valueStart, valueEnd - valueStart);
 }
 
 class QXmppServerPrivate
@@ -76,7 +136,9 @@ class QXmppServerPrivate
 public:
     QXmppServerPrivate(QXmppServer *qq);
     void loadExtensions(QXmppServer *server);
-    bool routeData(const QString &to, const QByteArray &data);
+    bool routeData(const QXmppJid &to, const QByteArray &data, QXmppServer::DeliveryMode mode);
+    bool deliverData(const QXmppJid &to, const QByteArray &data, QXmppServer::DeliveryMode mode);
+    QList<QXmppIncomingClient*> messageRecipients(const QXmppJid &to, const QByteArray &data);
     void startExtensions();
     void stopExtensions();
 
@@ -87,18 +149,30 @@ public:
     QList<QXmppServerExtension*> extensions;
     QXmppLogger *logger;
     QXmppPasswordChecker *passwordChecker;
+    QXmppServerPresence *presence;
 
     // client-to-server
     QXmppSslServer *serverForClients;
+    QXmppSslServer *serverForDirectTlsClients;
     QSet<QXmppIncomingClient*> incomingClients;
-    QHash<QString, QXmppIncomingClient*> incomingClientsByJid;
-    QHash<QString, QSet<QXmppIncomingClient*> > incomingClientsByBareJid;
+    QHash<QXmppJid, QXmppIncomingClient*> incomingClientsByJid;
+    QHash<QXmppJid, QSet<QXmppIncomingClient*> > incomingClientsByBareJid;
 
     // server-to-server
     QSet<QXmppIncomingServer*> incomingServers;
     QSet<QXmppOutgoingServer*> outgoingServers;
     QXmppSslServer *serverForServers;
 
+    // metrics
+    QXmppMetrics metrics;
+    QXmppHistogram *routeLatency;
+    QXmppCounter *routeFailures;
+    QXmppCounter *iqSent;
+    QXmppCounter *messagesSent;
+    QXmppCounter *presencesSent;
+    QXmppCounter *clientBytesReceived;
+    QXmppCounter *clientBytesSent;
+
 private:
     bool loaded;
     bool started;
@@ -108,30 +182,77 @@ private:
 QXmppServerPrivate::QXmppServerPrivate(QXmppServer *qq)
     : logger(0),
     passwordChecker(0),
+    presence(0),
     loaded(false),
     started(false),
     q(qq)
 {
+    routeLatency = metrics.histogram("route-latency");
+    routeFailures = metrics.counter("route-failures");
+    iqSent = metrics.counter("stanzas-sent-iq");
+    messagesSent = metrics.counter("stanzas-sent-message");
+    presencesSent = metrics.counter("stanzas-sent-presence");
+    clientBytesReceived = metrics.counter("client-bytes-received");
+    clientBytesSent = metrics.counter("client-bytes-sent");
+}
+
+/// Routes XMPP data to the given recipient, recording the time it takes
+/// and the type of stanza.
+///
+/// \param to
+/// \param data
+/// \param mode
+///
+
+bool QXmppServerPrivate::routeData(const QXmppJid &to, const QByteArray &data, QXmppServer::DeliveryMode mode)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool routed = deliverData(to, data, mode);
+    if (routed) {
+        if (data.startsWith("<message"))
+            messagesSent->add();
+        else if (data.startsWith("<presence"))
+            presencesSent->add();
+        else if (data.startsWith("<iq"))
+            iqSent->add();
+    } else {
+        routeFailures->add();
+    }
+
+    routeLatency->record(timer.nsecsElapsed() / 1000);
+    return routed;
+}
+
+static bool isSubdomain(const QStringRef &name, const QString &domain)
+{
+    const int pos = name.size() - domain.size() - 1;
+    return pos >= 0 && name.at(pos) == QLatin1Char('.') && name.endsWith(domain);
 }
 
-/// Routes XMPP data to the given recipient.
+/// Delivers XMPP data to a local client or queues it on an outgoing
+/// server-to-server stream.
 ///
 /// \param to
 /// \param data
+/// \param mode
 ///
 
-bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
+bool QXmppServerPrivate::deliverData(const QXmppJid &to, const QByteArray &data, QXmppServer::DeliveryMode mode)
 {
     // refuse to route packets to empty destination, own domain or sub-domains
-    const QString toDomain = QXmppUtils::jidToDomain(to);
-    if (to.isEmpty() || to == domain || toDomain.endsWith("." + domain))
+    const QStringRef toDomain = to.domainRef();
+    if (to.isNull() || to.toString() == domain || isSubdomain(toDomain, domain))
         return false;
 
     if (toDomain == domain) {
 
         // look for a client connection
         QList<QXmppIncomingClient*> found;
-        if (QXmppUtils::jidToResource(to).isEmpty()) {
+        if (to.isBare() && mode == QXmppServer::PriorityDelivery && data.startsWith("<message")) {
+            found = messageRecipients(to, data);
+        } else if (to.isBare()) {
             foreach (QXmppIncomingClient *conn, incomingClientsByBareJid.value(to))
                 found << conn;
         } else {
@@ -152,7 +273,7 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
 
         // look for an outgoing S2S connection
         foreach (QXmppOutgoingServer *conn, outgoingServers) {
-            if (conn->remoteDomain() == toDomain) {
+            if (toDomain == conn->remoteDomain()) {
                 // send or queue data
                 QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
                 return true;
@@ -163,6 +284,8 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
         // we need to establish the S2S connection
         QXmppOutgoingServer *conn = new QXmppOutgoingServer(domain, 0);
         conn->setLocalStreamKey(QXmppUtils::generateStanzaHash().toAscii());
+        conn->setMetrics(&metrics);
+        conn->setWaterMarks(streamLowWaterMark, streamHighWaterMark);
         conn->moveToThread(q->thread());
         conn->setParent(q);
 
@@ -175,7 +298,7 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
 
         // queue data and connect to remote server
         QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
-        QMetaObject::invokeMethod(conn, "connectToHost", Q_ARG(QString, toDomain));
+        QMetaObject::invokeMethod(conn, "connectToHost", Q_ARG(QString, toDomain.toString()));
         return true;
 
     } else {
@@ -186,24 +309,59 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
     }
 }
 
+/// Returns the connections of the resources a message addressed to a
+/// local bare JID should be delivered to, following RFC 6121.
+///
+/// \param to
+/// \param data
+
+QList<QXmppIncomingClient*> QXmppServerPrivate::messageRecipients(const QXmppJid &to, const QByteArray &data)
+{
+    QList<QXmppIncomingClient*> found;
+    const QByteArray type = startTagAttribute(data, "type");
+    if (type.isEmpty() || type == "normal" || type == "chat") {
+        // the most available resource
+        const QString resource = presence->preferredResource(to);
+        if (!resource.isEmpty()) {
+            QXmppIncomingClient *conn = incomingClientsByJid.value(QXmppJid(to.node(), to.domain(), resource));
+            if (conn)
+                found << conn;
+        }
+    } else if (type == "headline") {
+        // every resource with a non-negative priority
+        foreach (const QString &resource, presence->deliveryResources(to)) {
+            QXmppIncomingClient *conn = incomingClientsByJid.value(QXmppJid(to.node(), to.domain(), resource));
+            if (conn)
+                found << conn;
+        }
+    }
+
+    // groupchat and error messages to a bare JID are not delivered
+    return found;
+}
+
 /// Handles an incoming XML element.
 ///
 /// \param server
-/// \param stream
+/// \param presence
 /// \param element
 
-static void handleStanza(QXmppServer *server, const QDomElement &element)
+static void handleStanza(QXmppServer *server, QXmppServerPresence *presence, const QDomElement &element)
 {
     // try extensions
     foreach (QXmppServerExtension *extension, server->extensions())
         if (extension->handleStanza(element))
             return;
 
+    // handle presence broadcasts and probes
+    if (QXmppAtom::tagName(element) == QXmppAtom::Presence && presence->handlePresence(element))
+        return;
+
     // default handlers
     const QString domain = server->domain();
     const QString to = element.attribute("to");
     if (to == domain) {
-        if (element.tagName() == QLatin1String("iq")) {
+        if (QXmppAtom::tagName(element) == QXmppAtom::Iq) {
             // we do not support the given IQ
             QXmppIq request;
             request.parse(element);
@@ -223,7 +381,10 @@ static void handleStanza(QXmppServer *server, const QDomElement &element)
     } else {
 
         // route element or reply on behalf of missing peer
-        if (!server->sendElement(element) && element.tagName() == QLatin1String("iq")) {
+        if (server->sendElement(element))
+            return;
+
+        if (QXmppAtom::tagName(element) == QXmppAtom::Iq) {
             QXmppIq request;
             request.parse(element);
 
@@ -235,6 +396,24 @@ static void handleStanza(QXmppServer *server, const QDomElement &element)
                 QXmppStanza::Error::ServiceUnavailable);
             response.setError(error);
             server->sendPacket(response);
+        } else if (QXmppAtom::tagName(element) == QXmppAtom::Message) {
+            // no extension stored the message and no resource can
+            // receive it, headlines and errors are silently dropped
+            // (RFC 6121, section 8.5.2)
+            QXmppMessage request;
+            request.parse(element);
+            if (request.type() == QXmppMessage::Error || request.type() == QXmppMessage::Headline)
+                return;
+
+            QXmppMessage response;
+            response.setType(QXmppMessage::Error);
+            response.setId(request.id());
+            response.setFrom(request.to());
+            response.setTo(request.from());
+            QXmppStanza::Error error(QXmppStanza::Error::Cancel,
+                QXmppStanza::Error::ServiceUnavailable);
+            response.setError(error);
+            server->sendPacket(response);
         }
     }
 }
@@ -313,10 +492,23 @@ QXmppServer::QXmppServer(QObject *parent)
                     this, SLOT(_q_clientConnection(QSslSocket*)));
     Q_ASSERT(check);
 
+    d->serverForDirectTlsClients = new QXmppSslServer(this);
+    d->serverForDirectTlsClients->setDirectTls(true);
+    check = connect(d->serverForDirectTlsClients, SIGNAL(newConnection(QSslSocket*)),
+                    this, SLOT(_q_clientConnection(QSslSocket*)));
+    Q_ASSERT(check);
+
     d->serverForServers = new QXmppSslServer(this);
     check = connect(d->serverForServers, SIGNAL(newConnection(QSslSocket*)),
                     this, SLOT(_q_serverConnection(QSslSocket*)));
     Q_ASSERT(check);
+
+    d->serverForDirectTlsClients->setMetrics(&d->metrics);
+
+    d->presence = new QXmppServerPresence(this);
+    check = connect(d->presence, SIGNAL(resourceAvailable(QString)),
+                    this, SIGNAL(resourceAvailable(QString)));
+    Q_ASSERT(check);
 }
 
 /// Destroys an XMPP server instance.
@@ -391,14 +583,8 @@ QXmppLogger *QXmppServer::logger()
 
 void QXmppServer::setLogger(QXmppLogger *logger)
 {
-    if (d->logger)
-        QObject::disconnect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
-                   d->logger, SLOT(log(QXmppLogger::MessageType,QString)));
     d->logger = logger;
-    d->logger = logger;
-    if (d->logger)
-        connect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
-                d->logger, SLOT(log(QXmppLogger::MessageType,QString)));
+    setLogSink(d->logger);
 }
 
 /// Returns the password checker used to verify client credentials.
@@ -419,15 +605,46 @@ void QXmppServer::setPasswordChecker(QXmppPasswordChecker *checker)
     d->passwordChecker = checker;
 }
 
+/// Returns the metrics registry of the server.
+///
+/// Extensions can use it to publish their own counters and histograms,
+/// which are then reported by statistics().
+
+QXmppMetrics *QXmppServer::metrics()
+{
+    return &d->metrics;
+}
+
 /// Returns the statistics for the server.
+///
+/// Besides the number of streams, this includes the value of every
+/// counter and a summary of every histogram of metrics(). Durations
+/// are expressed in microseconds.
+///
+/// \sa QXmppMetrics::toJson()
 
 QVariantMap QXmppServer::statistics() const
 {
-    QVariantMap stats;
+    QVariantMap stats = d->metrics.toVariantMap();
     stats["version"] = qApp->applicationVersion();
     stats["incoming-clients"] = d->incomingClients.size();
     stats["incoming-servers"] = d->incomingServers.size();
     stats["outgoing-servers"] = d->outgoingServers.size();
+
+    // include the traffic of open client streams
+    qint64 bytesReceived = d->clientBytesReceived->value();
+    qint64 bytesSent = d->clientBytesSent->value();
+    foreach (QXmppIncomingClient *stream, d->incomingClients) {
+        bytesReceived += stream->bytesReceived();
+        bytesSent += stream->bytesSent();
+    }
+    stats["client-bytes-received"] = bytesReceived;
+    stats["client-bytes-sent"] = bytesSent;
+
+    int queued = 0;
+    foreach (QXmppOutgoingServer *stream, d->outgoingServers)
+        queued += stream->queueLength();
+    stats["outgoing-servers-queued"] = queued;
     return stats;
 }
 
@@ -441,6 +658,7 @@ void QXmppServer::addCaCertificates(const QString &path)
         d->warning(QString("SSL CA certificates are not readable %1").arg(path));
     QList<QSslCertificate> certificates = QSslCertificate::fromPath(path);
     d->serverForClients->addCaCertificates(certificates);
+    d->serverForDirectTlsClients->addCaCertificates(certificates);
     d->serverForServers->addCaCertificates(certificates);
 }
 
@@ -457,6 +675,7 @@ void QXmppServer::setLocalCertificate(const QString &path)
     else
         d->warning(QString("SSL certificate is not readable %1").arg(path));
     d->serverForClients->setLocalCertificate(certificate);
+    d->serverForDirectTlsClients->setLocalCertificate(certificate);
     d->serverForServers->setLocalCertificate(certificate);
 }
 
@@ -473,9 +692,37 @@ void QXmppServer::setPrivateKey(const QString &path)
     else
         d->warning(QString("SSL key is not readable %1").arg(path));
     d->serverForClients->setPrivateKey(key);
+    d->serverForDirectTlsClients->setPrivateKey(key);
     d->serverForServers->setPrivateKey(key);
 }
 
+/// Returns the maximum number of worker threads used to perform the TLS
+/// handshake for clients connecting with direct TLS or negotiating
+/// STARTTLS, which share a single pool.
+///
+/// \sa listenForSecureClients()
+
+int QXmppServer::handshakeThreadCount() const
+{
+    return d->serverForDirectTlsClients->handshakeThreadCount();
+}
+
+/// Sets the maximum number of worker threads used to perform the TLS
+/// handshake for clients connecting with direct TLS or negotiating
+/// STARTTLS.
+///
+/// Connections are handed back to the server's thread once they are
+/// encrypted. The default value of 0 performs handshakes in the server's
+/// thread.
+///
+/// \param count
+/// \sa listenForSecureClients()
+
+void QXmppServer::setHandshakeThreadCount(int count)
+{
+    d->serverForDirectTlsClients->setHandshakeThreadCount(count);
+}
+
 /// Listen for incoming XMPP client connections.
 ///
 /// \param address
@@ -499,6 +746,38 @@ bool QXmppServer::listenForClients(const QHostAddress &address, quint16 port)
     return true;
 }
 
+/// Listen for incoming XMPP client connections which use direct TLS
+/// as defined by XEP-0368: SRV records for XMPP over TLS.
+///
+/// You must set a local certificate and private key before calling
+/// this method.
+///
+/// \param address
+/// \param port
+
+bool QXmppServer::listenForSecureClients(const QHostAddress &address, quint16 port)
+{
+    if (d->domain.isEmpty()) {
+        d->warning("No domain was specified!");
+        return false;
+    }
+
+    if (!d->serverForDirectTlsClients->isDirectTlsReady()) {
+        d->warning("No SSL certificate or key was specified for direct TLS!");
+        return false;
+    }
+
+    if (!d->serverForDirectTlsClients->listen(address, port)) {
+        d->warning(QString("Could not start listening for direct TLS C2S on port %1").arg(QString::number(port)));
+        return false;
+    }
+
+    // start extensions
+    d->loadExtensions(this);
+    d->startExtensions();
+    return true;
+}
+
 /// Closes the server.
 ///
 
@@ -506,6 +785,7 @@ void QXmppServer::close()
 {
     // prevent new connections
     d->serverForClients->close();
+    d->serverForDirectTlsClients->close();
     d->serverForServers->close();
 
     // stop extensions
@@ -545,9 +825,13 @@ bool QXmppServer::listenForServers(const QHostAddress &address, quint16 port)
 
 /// Route an XMPP stanza.
 ///
+/// A message addressed to the bare JID of a local user is delivered
+/// according to \a mode.
+///
 /// \param element
+/// \param mode
 
-bool QXmppServer::sendElement(const QDomElement &element)
+bool QXmppServer::sendElement(const QDomElement &element, DeliveryMode mode)
 {
     // serialize data
     QByteArray data;
@@ -556,14 +840,33 @@ bool QXmppServer::sendElement(const QDomElement &element)
     helperToXmlAddDomElement(&xmlStream, element, omitNamespaces);
 
     // route data
-    return d->routeData(element.attribute("to"), data);
+    return d->routeData(element.attribute("to"), data, mode);
+}
+
+/// Route raw XMPP data, which must consist of complete stanzas.
+///
+/// This allows an extension to hand several stanzas to a stream in a
+/// single write.
+///
+/// \param to
+/// \param data
+/// \param mode
+
+bool QXmppServer::sendData(const QString &to, const QByteArray &data, DeliveryMode mode)
+{
+    return d->routeData(to, data, mode);
 }
 
 /// Route an XMPP packet.
 ///
+/// A message addressed to the bare JID of a local user is delivered
+/// according to \a mode, pass AllResourcesDelivery to send a copy to each
+/// of the user's connected resources.
+///
 /// \param packet
+/// \param mode
 
-bool QXmppServer::sendPacket(const QXmppStanza &packet)
+bool QXmppServer::sendPacket(const QXmppStanza &packet, DeliveryMode mode)
 {
     // serialize data
     QByteArray data;
@@ -571,7 +874,58 @@ bool QXmppServer::sendPacket(const QXmppStanza &packet)
     packet.toXml(&xmlStream);
 
     // route data
-    return d->routeData(packet.to(), data);
+    return d->routeData(packet.to(), data, mode);
+}
+
+/// Routes an XMPP packet to a set of recipients.
+///
+/// The packet is serialized only once, then each recipient's copy is
+/// obtained by patching the 'to' attribute of the serialized data. The
+/// copy destined to a bare JID is delivered according to \a mode.
+///
+/// Returns the number of recipients the packet was routed to.
+///
+/// \param packet
+/// \param recipients
+/// \param mode
+
+int QXmppServer::broadcastPacket(const QXmppStanza &packet, const QStringList &recipients, DeliveryMode mode)
+{
+    if (recipients.isEmpty())
+        return 0;
+
+    // serialize data
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    packet.toXml(&xmlStream);
+
+    // split data around the value of the 'to' attribute
+    QByteArray head, tail;
+    if (!splitRecipient(data, head, tail))
+        return 0;
+
+    // route data
+    int routed = 0;
+    foreach (const QString &recipient, recipients) {
+        const QByteArray to = escapedAttribute(recipient);
+        QByteArray patched;
+        patched.reserve(head.size() + to.size() + tail.size());
+        patched += head;
+        patched += to;
+        patched += tail;
+        if (d->routeData(recipient, patched, mode))
+            routed++;
+    }
+    return routed;
+}
+
+/// Returns the last presence of each available resource of a local user.
+///
+/// \param bareJid
+
+QList<QXmppPresence> QXmppServer::availablePresences(const QString &bareJid) const
+{
+    return d->presence->availablePresences(QXmppJid(bareJid).bareJid());
 }
 
 /// Add a new incoming client stream.
@@ -584,6 +938,8 @@ void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
     Q_UNUSED(check);
 
     stream->setPasswordChecker(d->passwordChecker);
+    stream->setMetrics(&d->metrics);
+    stream->setWaterMarks(streamLowWaterMark, streamHighWaterMark);
 
     check = connect(stream, SIGNAL(connected()),
                     this, SLOT(_q_clientConnected()));
@@ -615,6 +971,8 @@ void QXmppServer::_q_clientConnection(QSslSocket *socket)
 
     QXmppIncomingClient *stream = new QXmppIncomingClient(socket, d->domain, this);
     stream->setInactivityTimeout(120);
+    // STARTTLS handshakes share the direct TLS listener's worker threads
+    stream->setSslServer(d->serverForDirectTlsClients);
     socket->setParent(stream);
     addIncomingClient(stream);
 }
@@ -629,7 +987,7 @@ void QXmppServer::_q_clientConnected()
         return;
 
     // FIXME: at this point the JID must contain a resource, assert it?
-    const QString jid = client->jid();
+    const QXmppJid jid = client->jid();
 
     // check whether the connection conflicts with another one
     QXmppIncomingClient *old = d->incomingClientsByJid.value(jid);
@@ -638,10 +996,10 @@ void QXmppServer::_q_clientConnected()
         old->disconnectFromHost();
     }
     d->incomingClientsByJid.insert(jid, client);
-    d->incomingClientsByBareJid[QXmppUtils::jidToBareJid(jid)].insert(client);
+    d->incomingClientsByBareJid[jid.bareJid()].insert(client);
 
     // emit signal
-    emit clientConnected(jid);
+    emit clientConnected(jid.toString());
 }
 
 /// Handle a stream disconnection for a client.
@@ -653,12 +1011,15 @@ void QXmppServer::_q_clientDisconnected()
         return;
 
     if (d->incomingClients.remove(client)) {
+        d->clientBytesReceived->add(client->bytesReceived());
+        d->clientBytesSent->add(client->bytesSent());
+
         // remove stream from routing tables
-        const QString jid = client->jid();
-        if (!jid.isEmpty()) {
+        const QXmppJid jid = client->jid();
+        if (!jid.isNull()) {
             if (d->incomingClientsByJid.value(jid) == client)
                 d->incomingClientsByJid.remove(jid);
-            const QString bareJid = QXmppUtils::jidToBareJid(jid);
+            const QXmppJid bareJid = jid.bareJid();
             if (d->incomingClientsByBareJid.contains(bareJid)) {
                 d->incomingClientsByBareJid[bareJid].remove(client);
                 if (d->incomingClientsByBareJid[bareJid].isEmpty())
@@ -666,12 +1027,16 @@ void QXmppServer::_q_clientDisconnected()
             }
         }
 
+        // broadcast unavailable presence on the client's behalf
+        if (!jid.isNull())
+            d->presence->clientDisconnected(jid);
+
         // destroy client
         client->deleteLater();
 
         // emit signal
-        if (!jid.isEmpty())
-            emit clientDisconnected(jid);
+        if (!jid.isNull())
+            emit clientDisconnected(jid.toString());
     }
 }
 
@@ -705,7 +1070,7 @@ void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
 
 void QXmppServer::handleElement(const QDomElement &element)
 {
-    handleStanza(this, element);
+    handleStanza(this, d->presence, element);
 }
 
 /// Handle a stream disconnection for an outgoing server.
@@ -769,11 +1134,51 @@ void QXmppServer::_q_serverDisconnected()
 class QXmppSslServerPrivate
 {
 public:
+    QXmppSslServerPrivate();
+    void updateConfiguration();
+
+    bool directTls;
     QList<QSslCertificate> caCertificates;
     QSslCertificate localCertificate;
     QSslKey privateKey;
+
+    // configuration shared by all incoming sockets
+    QSslConfiguration configuration;
+    bool configurationValid;
+
+    // worker threads for direct TLS handshakes
+    QXmppSslHandshakePool *handshakePool;
+    QXmppHistogram *handshakeTime;
 };
 
+QXmppSslServerPrivate::QXmppSslServerPrivate()
+    : directTls(false),
+    configurationValid(false),
+    handshakePool(0),
+    handshakeTime(0)
+{
+}
+
+/// Builds the TLS configuration which is shared by all incoming sockets,
+/// so that accepting a connection does not need to copy the certificates
+/// and key one by one.
+
+void QXmppSslServerPrivate::updateConfiguration()
+{
+    configurationValid = !localCertificate.isNull() && !privateKey.isNull();
+    if (!configurationValid) {
+        configuration = QSslConfiguration();
+        return;
+    }
+
+    QSslConfiguration config = QSslConfiguration::defaultConfiguration();
+    config.setProtocol(QSsl::AnyProtocol);
+    config.setCaCertificates(config.caCertificates() + caCertificates);
+    config.setLocalCertificate(localCertificate);
+    config.setPrivateKey(privateKey);
+    configuration = config;
+}
+
 /// Constructs a new SSL server instance.
 ///
 /// \param parent
@@ -794,21 +1199,142 @@ QXmppSslServer::~QXmppSslServer()
 
 void QXmppSslServer::incomingConnection(int socketDescriptor)
 {
-    QSslSocket *socket = new QSslSocket;
+    // sockets handed to the handshake pool must not have a parent
+    const bool offload = d->directTls && d->handshakePool;
+    QSslSocket *socket = new QSslSocket(offload ? 0 : this);
     if (!socket->setSocketDescriptor(socketDescriptor)) {
         delete socket;
         return;
     }
 
-    if (!d->localCertificate.isNull() && !d->privateKey.isNull()) {
-        socket->setProtocol(QSsl::AnyProtocol);
-        socket->addCaCertificates(d->caCertificates);
-        socket->setLocalCertificate(d->localCertificate);
-        socket->setPrivateKey(d->privateKey);
+    if (d->configurationValid) {
+        socket->setSslConfiguration(d->configuration);
+    } else if (d->directTls) {
+        // we cannot honour direct TLS without a certificate
+        socket->abort();
+        delete socket;
+        return;
+    }
+
+    // with direct TLS, the handshake starts immediately
+    if (offload) {
+        d->handshakePool->start(socket);
+        return;
+    } else if (d->directTls) {
+        socket->startServerEncryption();
     }
     emit newConnection(socket);
 }
 
+/// Returns the maximum number of worker threads used to perform the
+/// TLS handshake of incoming direct TLS connections.
+///
+/// A value of 0 means the handshakes are performed in the server's thread.
+
+int QXmppSslServer::handshakeThreadCount() const
+{
+    return d->handshakePool ? d->handshakePool->maximumThreadCount() : 0;
+}
+
+/// Sets the maximum number of worker threads used to perform the
+/// TLS handshake of incoming direct TLS connections, and of the
+/// connections passed to startServerEncryption().
+///
+/// When this is greater than 0, newConnection() is only emitted once
+/// a direct TLS socket is encrypted, and the socket is handed back to the
+/// server's thread. This keeps connection storms from stalling the streams
+/// which are already established.
+///
+/// \param count
+
+void QXmppSslServer::setHandshakeThreadCount(int count)
+{
+    if (count <= 0) {
+        delete d->handshakePool;
+        d->handshakePool = 0;
+        return;
+    }
+
+    if (!d->handshakePool) {
+        bool check;
+        Q_UNUSED(check);
+
+        d->handshakePool = new QXmppSslHandshakePool(this);
+        d->handshakePool->setHandshakeTime(d->handshakeTime);
+        check = connect(d->handshakePool, SIGNAL(encrypted(QSslSocket*)),
+                        this, SIGNAL(newConnection(QSslSocket*)));
+        Q_ASSERT(check);
+    }
+    d->handshakePool->setMaximumThreadCount(count);
+}
+
+/// Starts the server-side TLS handshake of an accepted connection in a
+/// worker thread, for instance after STARTTLS. This must only be called
+/// if handshakeThreadCount() is greater than 0.
+///
+/// The socket must not have a parent. Once the handshake completes, the
+/// socket is moved back to the server's thread and the receiver's
+/// _q_serverEncryptionFinished(QSslSocket*) slot is invoked with it, or
+/// with 0 if the handshake failed.
+///
+/// \param socket
+/// \param receiver
+
+void QXmppSslServer::startServerEncryption(QSslSocket *socket, QObject *receiver)
+{
+    Q_ASSERT(d->handshakePool);
+    d->handshakePool->start(socket, receiver);
+}
+
+/// Sets the metrics registry in which the duration of the TLS handshakes
+/// performed by worker threads is recorded.
+///
+/// \param metrics
+
+void QXmppSslServer::setMetrics(QXmppMetrics *metrics)
+{
+    d->handshakeTime = metrics ? metrics->histogram("tls-handshake-time") : 0;
+    if (d->handshakePool)
+        d->handshakePool->setHandshakeTime(d->handshakeTime);
+}
+
+/// Returns true if incoming connections are encrypted as soon as they
+/// are accepted (XEP-0368), rather than waiting for STARTTLS.
+
+bool QXmppSslServer::isDirectTls() const
+{
+    return d->directTls;
+}
+
+/// Sets whether incoming connections are encrypted as soon as they
+/// are accepted (XEP-0368), rather than waiting for STARTTLS.
+///
+/// \param directTls
+
+void QXmppSslServer::setDirectTls(bool directTls)
+{
+    d->directTls = directTls;
+}
+
+/// Returns true if a local certificate and private key are set, which
+/// is required for direct TLS.
+
+bool QXmppSslServer::isDirectTlsReady() const
+{
+    return d->configurationValid;
+}
+
+/// Returns the TLS configuration which is applied to incoming connections.
+///
+/// The configuration is built once when the certificates or key change,
+/// and is then shared by all the accepted sockets. It is null if no local
+/// certificate and private key have been set.
+
+QSslConfiguration QXmppSslServer::sslConfiguration() const
+{
+    return d->configuration;
+}
+
 /// Adds the given certificates to the CA certificate database to be used
 /// for incoming connnections.
 ///
@@ -817,6 +1343,7 @@ void QXmppSslServer::incomingConnection(int socketDescriptor)
 void QXmppSslServer::addCaCertificates(const QList<QSslCertificate> &certificates)
 {
     d->caCertificates += certificates;
+    d->updateConfiguration();
 }
 
 /// Sets the local certificate to be used for incoming connections.
@@ -826,6 +1353,7 @@ void QXmppSslServer::addCaCertificates(const QList<QSslCertificate> &certificate
 void QXmppSslServer::setLocalCertificate(const QSslCertificate &certificate)
 {
     d->localCertificate = certificate;
+    d->updateConfiguration();
 }
 
 /// Sets the local private key to be used for incoming connections.
@@ -835,5 +1363,266 @@ void QXmppSslServer::setLocalCertificate(const QSslCertificate &certificate)
 void QXmppSslServer::setPrivateKey(const QSslKey &key)
 {
     d->privateKey = key;
+    d->updateConfiguration();
+}
+
+
+QXmppSslHandshakeWorker::QXmppSslHandshakeWorker(QThread *returnThread, QXmppHistogram *handshakeTime)
+    : m_returnThread(returnThread),
+    m_handshakeTime(handshakeTime)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    // the timer follows the worker to its thread
+    m_deadlineTimer = new QTimer(this);
+    m_deadlineTimer->setInterval(1000);
+    check = connect(m_deadlineTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_checkDeadlines()));
+    Q_ASSERT(check);
+}
+
+/// Starts the server-side TLS handshake, this is invoked in the worker's
+/// thread.
+///
+/// \param id
+/// \param socket
+
+void QXmppSslHandshakeWorker::startHandshake(int id, QSslSocket *socket)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    // the worker owns the socket until it is encrypted
+    socket->setParent(this);
+
+    check = connect(socket, SIGNAL(encrypted()),
+                    this, SLOT(_q_socketEncrypted()));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+                    this, SLOT(_q_socketError()));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(disconnected()),
+                    this, SLOT(_q_socketError()));
+    Q_ASSERT(check);
+
+    Handshake &handshake = m_handshakes[socket];
+    handshake.id = id;
+    handshake.timer.start();
+    if (!m_deadlineTimer->isActive())
+        m_deadlineTimer->start();
+    socket->startServerEncryption();
+}
+
+/// Aborts the handshakes which exceeded their deadline.
+
+void QXmppSslHandshakeWorker::_q_checkDeadlines()
+{
+    foreach (QSslSocket *socket, m_handshakes.keys()) {
+        if (m_handshakes.value(socket).timer.hasExpired(handshakeTimeout))
+            abortHandshake(socket);
+    }
+    if (m_handshakes.isEmpty())
+        m_deadlineTimer->stop();
+}
+
+/// Hands an encrypted socket back to the return thread.
+///
+/// This is not done while the socket is emitting encrypted(), as the
+/// socket must not change threads while it is still processing events.
+///
+/// \param id
+/// \param socket
+
+void QXmppSslHandshakeWorker::_q_returnSocket(int id, QSslSocket *socket)
+{
+    socket->setParent(0);
+    socket->moveToThread(m_returnThread);
+    emit handshakeFinished(id, socket);
+}
+
+void QXmppSslHandshakeWorker::_q_socketEncrypted()
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    if (!socket || !m_handshakes.contains(socket))
+        return;
+
+    const Handshake handshake = m_handshakes.take(socket);
+    if (m_handshakeTime)
+        m_handshakeTime->record(handshake.timer.nsecsElapsed() / 1000);
+
+    socket->disconnect(this);
+    QMetaObject::invokeMethod(this, "_q_returnSocket", Qt::QueuedConnection,
+                              Q_ARG(int, handshake.id),
+                              Q_ARG(QSslSocket*, socket));
 }
 
+void QXmppSslHandshakeWorker::_q_socketError()
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    if (!socket || !m_handshakes.contains(socket))
+        return;
+
+    abortHandshake(socket);
+}
+
+/// Drops a socket whose handshake failed or timed out.
+///
+/// \param socket
+
+void QXmppSslHandshakeWorker::abortHandshake(QSslSocket *socket)
+{
+    const int id = m_handshakes.take(socket).id;
+    socket->disconnect(this);
+    socket->abort();
+    socket->deleteLater();
+    emit handshakeFailed(id);
+}
+
+QXmppSslHandshakePool::QXmppSslHandshakePool(QObject *parent)
+    : QObject(parent),
+    m_lastId(0),
+    m_maximumThreadCount(1),
+    m_handshakeTime(0)
+{
+    qRegisterMetaType<QSslSocket*>("QSslSocket*");
+}
+
+/// Stops the worker threads, any handshake in progress is aborted.
+
+QXmppSslHandshakePool::~QXmppSslHandshakePool()
+{
+    foreach (QThread *thread, m_threads)
+        thread->quit();
+    foreach (QThread *thread, m_threads)
+        thread->wait();
+    qDeleteAll(m_workers);
+    qDeleteAll(m_threads);
+}
+
+/// Returns the maximum number of worker threads.
+
+int QXmppSslHandshakePool::maximumThreadCount() const
+{
+    return m_maximumThreadCount;
+}
+
+/// Sets the maximum number of worker threads.
+///
+/// Threads which are already running are kept, but no new handshakes
+/// are assigned to threads beyond the maximum.
+///
+/// \param count
+
+void QXmppSslHandshakePool::setMaximumThreadCount(int count)
+{
+    m_maximumThreadCount = qMax(1, count);
+}
+
+/// Sets the histogram in which the duration of handshakes is recorded,
+/// in microseconds. This only applies to worker threads started afterwards.
+///
+/// \param histogram
+
+void QXmppSslHandshakePool::setHandshakeTime(QXmppHistogram *histogram)
+{
+    m_handshakeTime = histogram;
+}
+
+/// Moves the given socket to a worker thread and starts the server-side
+/// TLS handshake. The socket must not have a parent.
+///
+/// If a \a receiver is given, its _q_serverEncryptionFinished(QSslSocket*)
+/// slot is invoked once the handshake completes, with the socket or with 0
+/// if the handshake failed. Otherwise the encrypted() signal is emitted.
+///
+/// \param socket
+/// \param receiver
+
+void QXmppSslHandshakePool::start(QSslSocket *socket, QObject *receiver)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    // pick the least loaded worker
+    int index = -1;
+    const int usable = qMin(m_workers.size(), m_maximumThreadCount);
+    for (int i = 0; i < usable; ++i) {
+        if (index < 0 || m_pending[i] < m_pending[index])
+            index = i;
+    }
+
+    // start another worker if all of them are busy
+    if ((index < 0 || m_pending[index] > 0) && usable < m_maximumThreadCount) {
+        QThread *workerThread = new QThread;
+        QXmppSslHandshakeWorker *worker = new QXmppSslHandshakeWorker(thread(), m_handshakeTime);
+        worker->moveToThread(workerThread);
+
+        check = connect(worker, SIGNAL(handshakeFailed(int)),
+                        this, SLOT(_q_handshakeFailed(int)));
+        Q_ASSERT(check);
+
+        check = connect(worker, SIGNAL(handshakeFinished(int,QSslSocket*)),
+                        this, SLOT(_q_handshakeFinished(int,QSslSocket*)));
+        Q_ASSERT(check);
+
+        workerThread->start();
+        index = m_workers.size();
+        m_threads << workerThread;
+        m_workers << worker;
+        m_pending << 0;
+    }
+
+    // ids only need to be unique among the handshakes in progress
+    m_lastId = (m_lastId % 0x7fffffff) + 1;
+    const int id = m_lastId;
+    m_pending[index]++;
+    if (receiver)
+        m_receivers.insert(id, receiver);
+    socket->moveToThread(m_threads[index]);
+    QMetaObject::invokeMethod(m_workers[index], "startHandshake",
+                              Q_ARG(int, id),
+                              Q_ARG(QSslSocket*, socket));
+}
+
+void QXmppSslHandshakePool::handshakeDone()
+{
+    const int index = m_workers.indexOf(static_cast<QXmppSslHandshakeWorker*>(sender()));
+    if (index >= 0 && m_pending[index] > 0)
+        m_pending[index]--;
+}
+
+void QXmppSslHandshakePool::_q_handshakeFailed(int id)
+{
+    handshakeDone();
+
+    // the worker already released the socket
+    if (m_receivers.contains(id)) {
+        QPointer<QObject> receiver = m_receivers.take(id);
+        if (receiver)
+            QMetaObject::invokeMethod(receiver, "_q_serverEncryptionFinished",
+                                      Q_ARG(QSslSocket*, 0));
+    }
+}
+
+void QXmppSslHandshakePool::_q_handshakeFinished(int id, QSslSocket *socket)
+{
+    handshakeDone();
+
+    // hand the socket back to the receiver which requested the handshake
+    if (m_receivers.contains(id)) {
+        QPointer<QObject> receiver = m_receivers.take(id);
+        if (receiver)
+            QMetaObject::invokeMethod(receiver, "_q_serverEncryptionFinished",
+                                      Q_ARG(QSslSocket*, socket));
+        else
+            delete socket;
+        return;
+    }
+
+    // the socket is owned by our parent until a stream takes it
+    socket->setParent(parent());
+    emit encrypted(socket);
+}
@@ -24,6 +24,7 @@
 #ifndef QXMPPSERVER_H
 #define QXMPPSERVER_H
 
+#include <QStringList>
 #include <QTcpServer>
 #include <QVariantMap>
 
@@ -31,11 +32,13 @@
 
 class QDomElement;
 class QSslCertificate;
+class QSslConfiguration;
 class QSslKey;
 class QSslSocket;
 
 class QXmppDialback;
 class QXmppIncomingClient;
+class QXmppMetrics;
 class QXmppOutgoingServer;
 class QXmppPasswordChecker;
 class QXmppPresence;
@@ -61,6 +64,14 @@ class QXMPP_EXPORT QXmppServer : public QXmppLoggable
     Q_OBJECT
 
 public:
+    /// This enum describes how a message addressed to the bare JID of a
+    /// local user is delivered to the user's resources.
+    enum DeliveryMode
+    {
+        PriorityDelivery = 0,   ///< Follow RFC 6121: chat and normal messages go to the most available resource with a non-negative priority, headlines to every such resource.
+        AllResourcesDelivery    ///< Send a copy to every connected resource.
+    };
+
     QXmppServer(QObject *parent = 0);
     ~QXmppServer();
 
@@ -76,18 +87,27 @@ public:
     QXmppPasswordChecker *passwordChecker();
     void setPasswordChecker(QXmppPasswordChecker *checker);
 
+    QXmppMetrics *metrics();
     QVariantMap statistics() const;
 
     void addCaCertificates(const QString &caCertificates);
     void setLocalCertificate(const QString &path);
     void setPrivateKey(const QString &path);
 
+    int handshakeThreadCount() const;
+    void setHandshakeThreadCount(int count);
+
     void close();
     bool listenForClients(const QHostAddress &address = QHostAddress::Any, quint16 port = 5222);
+    bool listenForSecureClients(const QHostAddress &address = QHostAddress::Any, quint16 port = 5223);
     bool listenForServers(const QHostAddress &address = QHostAddress::Any, quint16 port = 5269);
 
-    bool sendElement(const QDomElement &element);
-    bool sendPacket(const QXmppStanza &stanza);
+    bool sendData(const QString &to, const QByteArray &data, DeliveryMode mode = PriorityDelivery);
+    bool sendElement(const QDomElement &element, DeliveryMode mode = PriorityDelivery);
+    bool sendPacket(const QXmppStanza &stanza, DeliveryMode mode = PriorityDelivery);
+    int broadcastPacket(const QXmppStanza &stanza, const QStringList &recipients, DeliveryMode mode = PriorityDelivery);
+
+    QList<QXmppPresence> availablePresences(const QString &bareJid) const;
 
     /// \cond
     // FIXME: this method should not be public, but it is needed to
@@ -102,6 +122,11 @@ signals:
     /// This signal is emitted when a client has disconnected.
     void clientDisconnected(const QString &jid);
 
+    /// This signal is emitted when a local resource becomes available
+    /// with a non-negative priority, either by sending its initial
+    /// presence or by raising its priority.
+    void resourceAvailable(const QString &jid);
+
 public slots:
     void handleElement(const QDomElement &element);
 
@@ -136,8 +161,23 @@ public:
     void setLocalCertificate(const QSslCertificate &certificate);
     void setPrivateKey(const QSslKey &key);
 
+    bool isDirectTls() const;
+    void setDirectTls(bool directTls);
+    bool isDirectTlsReady() const;
+
+    QSslConfiguration sslConfiguration() const;
+
+    int handshakeThreadCount() const;
+    void setHandshakeThreadCount(int count);
+    void startServerEncryption(QSslSocket *socket, QObject *receiver);
+
+    void setMetrics(QXmppMetrics *metrics);
+
 signals:
     /// This signal is emitted when a new connection is established.
+    ///
+    /// The socket is a child of the server, the receiver should
+    /// reparent it if it wants to take ownership.
     void newConnection(QSslSocket *socket);
 
 private:
@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+
+#include "QXmppMetrics.h"
+#include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "QXmppServerPresence_p.h"
+
+// maximum number of broadcasts processed in one pass of the event loop
+static const int presenceBatchSize = 256;
+
+/// Returns the rank of an availability status, the most available first.
+///
+/// \param type
+
+static int availabilityRank(QXmppPresence::Status::Type type)
+{
+    switch (type) {
+    case QXmppPresence::Status::Chat:
+        return 5;
+    case QXmppPresence::Status::Online:
+        return 4;
+    case QXmppPresence::Status::Away:
+        return 3;
+    case QXmppPresence::Status::XA:
+        return 2;
+    case QXmppPresence::Status::DND:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/// Compares the availability of two resources, by priority then by status.
+///
+/// \param a
+/// \param b
+
+static int compareAvailability(const QXmppPresence::Status &a, const QXmppPresence::Status &b)
+{
+    if (a.priority() != b.priority())
+        return a.priority() - b.priority();
+    return availabilityRank(a.type()) - availabilityRank(b.type());
+}
+
+/// Constructs a new presence handler for the given server.
+///
+/// \param server
+
+QXmppServerPresence::QXmppServerPresence(QXmppServer *server)
+    : QObject(server),
+    m_server(server),
+    m_scheduled(false)
+{
+    m_broadcasts = server->metrics()->counter("presence-broadcasts");
+    m_probesAnswered = server->metrics()->counter("presence-probes-answered");
+    m_probesSent = server->metrics()->counter("presence-probes-sent");
+}
+
+/// Returns the last presence of each available resource of a local user.
+///
+/// \param bareJid
+
+QList<QXmppPresence> QXmppServerPresence::availablePresences(const QXmppJid &bareJid) const
+{
+    return m_presences.value(bareJid).values();
+}
+
+/// Returns the available resources of a local user which have a
+/// non-negative priority.
+///
+/// \param bareJid
+
+QStringList QXmppServerPresence::deliveryResources(const QXmppJid &bareJid) const
+{
+    QStringList resources;
+    QHash<QXmppJid, QHash<QString, QXmppPresence> >::const_iterator it = m_presences.constFind(bareJid);
+    if (it == m_presences.constEnd())
+        return resources;
+    for (QHash<QString, QXmppPresence>::const_iterator r = it->constBegin(); r != it->constEnd(); ++r)
+        if (r->status().priority() >= 0)
+            resources << r.key();
+    return resources;
+}
+
+/// Returns the most available resource of a local user, or an empty string
+/// if the user has no available resource with a non-negative priority.
+///
+/// \param bareJid
+
+QString QXmppServerPresence::preferredResource(const QXmppJid &bareJid) const
+{
+    return m_preferred.value(bareJid);
+}
+
+/// Handles a presence stanza which no server extension handled.
+///
+/// Returns true if the stanza was consumed, false if it should be routed.
+///
+/// \param element
+
+bool QXmppServerPresence::handlePresence(const QDomElement &element)
+{
+    QXmppPresence presence;
+    presence.parse(element);
+
+    const QString domain = m_server->domain();
+    const QXmppJid from(presence.from());
+    const QXmppJid to(presence.to());
+
+    switch (presence.type()) {
+    case QXmppPresence::Available:
+    case QXmppPresence::Unavailable:
+    {
+        // only handle broadcasts from local resources, route the others
+        if (to.toString() != domain || from.domainRef() != domain ||
+            from.nodeRef().isEmpty() || from.isBare())
+            return false;
+
+        const QXmppJid bareJid = from.bareJid();
+        const QString resource = from.resource();
+        if (presence.type() == QXmppPresence::Available) {
+            QHash<QString, QXmppPresence> &resources = m_presences[bareJid];
+            const bool initial = !resources.contains(resource);
+            const bool wasInterested = !initial && resources.value(resource).status().priority() >= 0;
+            resources.insert(resource, presence);
+            updatePreferred(bareJid, resource);
+            queue(presence, initial);
+
+            // RFC 6121: the resource now receives the user's messages
+            if (!wasInterested && presence.status().priority() >= 0)
+                emit resourceAvailable(from.toString());
+        } else {
+            QHash<QXmppJid, QHash<QString, QXmppPresence> >::iterator it = m_presences.find(bareJid);
+            if (it != m_presences.end() && it->remove(resource)) {
+                if (it->isEmpty())
+                    m_presences.erase(it);
+                updatePreferred(bareJid, QString());
+                queue(presence, false);
+            }
+        }
+        return true;
+    }
+    case QXmppPresence::Probe:
+        if (to.domainRef() != domain || to.nodeRef().isEmpty())
+            return false;
+        answerProbe(from, to.bareJid());
+        return true;
+    case QXmppPresence::Subscribe:
+    case QXmppPresence::Subscribed:
+    case QXmppPresence::Unsubscribe:
+    case QXmppPresence::Unsubscribed:
+        // the extensions are about to update the subscriptions
+        invalidate(from.bareJid());
+        invalidate(to.bareJid());
+        return false;
+    default:
+        return false;
+    }
+}
+
+/// Generates an unavailable presence on behalf of a client which
+/// disconnected without sending one.
+///
+/// \param jid
+
+void QXmppServerPresence::clientDisconnected(const QXmppJid &jid)
+{
+    const QXmppJid bareJid = jid.bareJid();
+    QHash<QXmppJid, QHash<QString, QXmppPresence> >::iterator it = m_presences.find(bareJid);
+    if (it == m_presences.end() || !it->remove(jid.resource()))
+        return;
+    if (it->isEmpty())
+        m_presences.erase(it);
+    updatePreferred(bareJid, QString());
+
+    QXmppPresence presence(QXmppPresence::Unavailable);
+    presence.setFrom(jid.toString());
+    queue(presence, false);
+}
+
+/// Answers a presence probe for a local user from the presence cache.
+///
+/// \param from
+/// \param to
+
+void QXmppServerPresence::answerProbe(const QXmppJid &from, const QXmppJid &to)
+{
+    // only subscribers are allowed to probe
+    if (!subscribers(to).contains(from.bareJid().toString()))
+        return;
+
+    const QHash<QString, QXmppPresence> resources = m_presences.value(to);
+    if (resources.isEmpty()) {
+        QXmppPresence presence(QXmppPresence::Unavailable);
+        presence.setFrom(to.toString());
+        presence.setTo(from.toString());
+        m_server->sendPacket(presence);
+    } else {
+        foreach (QXmppPresence presence, resources) {
+            presence.setTo(from.toString());
+            m_server->sendPacket(presence);
+        }
+    }
+    m_probesAnswered->add();
+}
+
+/// Drops the cached subscriptions of a user, they will be requested from
+/// the extensions again when they are needed.
+///
+/// \param bareJid
+
+void QXmppServerPresence::invalidate(const QXmppJid &bareJid)
+{
+    m_subscribers.remove(bareJid);
+    m_subscriptions.remove(bareJid);
+}
+
+/// Queues a presence broadcast for the next batch.
+///
+/// A resource's pending broadcast is superseded by its newer presence, so
+/// that only the latest one is sent.
+///
+/// \param presence
+/// \param initial Whether this is the initial presence of the resource.
+
+void QXmppServerPresence::queue(const QXmppPresence &presence, bool initial)
+{
+    const QXmppJid jid(presence.from());
+    QHash<QXmppJid, QPair<QXmppPresence, bool> >::iterator it = m_pending.find(jid);
+    if (it == m_pending.end()) {
+        m_pendingOrder << jid;
+        m_pending.insert(jid, qMakePair(presence, initial));
+    } else {
+        it->first = presence;
+        if (presence.type() == QXmppPresence::Unavailable)
+            it->second = false;
+    }
+
+    if (!m_scheduled) {
+        m_scheduled = true;
+        QMetaObject::invokeMethod(this, "_q_processPending", Qt::QueuedConnection);
+    }
+}
+
+/// Returns the JIDs which are subscribed to a user's presence.
+///
+/// \param bareJid
+
+QSet<QString> QXmppServerPresence::subscribers(const QXmppJid &bareJid)
+{
+    QHash<QXmppJid, QSet<QString> >::const_iterator it = m_subscribers.constFind(bareJid);
+    if (it != m_subscribers.constEnd())
+        return it.value();
+
+    QSet<QString> jids;
+    foreach (QXmppServerExtension *extension, m_server->extensions())
+        jids += extension->presenceSubscribers(bareJid.toString());
+
+    // only keep the graph of available users
+    if (m_presences.contains(bareJid))
+        m_subscribers.insert(bareJid, jids);
+    return jids;
+}
+
+/// Returns the JIDs to whose presence a user is subscribed.
+///
+/// \param bareJid
+
+QSet<QString> QXmppServerPresence::subscriptions(const QXmppJid &bareJid)
+{
+    QHash<QXmppJid, QSet<QString> >::const_iterator it = m_subscriptions.constFind(bareJid);
+    if (it != m_subscriptions.constEnd())
+        return it.value();
+
+    QSet<QString> jids;
+    foreach (QXmppServerExtension *extension, m_server->extensions())
+        jids += extension->presenceSubscriptions(bareJid.toString());
+
+    // only keep the graph of available users
+    if (m_presences.contains(bareJid))
+        m_subscriptions.insert(bareJid, jids);
+    return jids;
+}
+
+/// Recomputes the most available resource of a local user after one of
+/// its presences changed.
+///
+/// Among equally available resources, the one which sent the change is
+/// preferred, then the previously preferred one, so that messages follow
+/// the resource the user is active on.
+///
+/// \param bareJid
+/// \param resource The resource whose presence changed, if it is still available.
+
+void QXmppServerPresence::updatePreferred(const QXmppJid &bareJid, const QString &resource)
+{
+    QHash<QXmppJid, QHash<QString, QXmppPresence> >::const_iterator it = m_presences.constFind(bareJid);
+    if (it == m_presences.constEnd()) {
+        m_preferred.remove(bareJid);
+        return;
+    }
+
+    const QString previous = m_preferred.value(bareJid);
+    QString best;
+    QXmppPresence::Status bestStatus;
+    for (QHash<QString, QXmppPresence>::const_iterator r = it->constBegin(); r != it->constEnd(); ++r) {
+        const QXmppPresence::Status &status = r->status();
+        if (status.priority() < 0)
+            continue;
+        const int cmp = best.isNull() ? 1 : compareAvailability(status, bestStatus);
+        if (cmp > 0 || (cmp == 0 && best != resource &&
+                        (r.key() == resource || r.key() == previous))) {
+            best = r.key();
+            bestStatus = status;
+        }
+    }
+
+    if (best.isNull())
+        m_preferred.remove(bareJid);
+    else
+        m_preferred.insert(bareJid, best);
+}
+
+/// Processes a batch of pending broadcasts.
+///
+/// Each presence is serialized once for all its recipients. An initial
+/// presence also receives the presences of the user's other resources and
+/// of local contacts from the cache, while remote contacts are probed once
+/// per user and batch.
+
+void QXmppServerPresence::_q_processPending()
+{
+    m_scheduled = false;
+
+    const QString domain = m_server->domain();
+    QHash<QXmppJid, QSet<QString> > probes;
+    QSet<QXmppJid> users;
+
+    for (int i = 0; i < presenceBatchSize && !m_pendingOrder.isEmpty(); ++i) {
+        const QXmppJid jid = m_pendingOrder.takeFirst();
+        const QPair<QXmppPresence, bool> pending = m_pending.take(jid);
+        const QXmppJid bareJid = jid.bareJid();
+        users.insert(bareJid);
+
+        // broadcast to subscribers and to the user's own resources
+        QStringList recipients = subscribers(bareJid).toList();
+        recipients << bareJid.toString();
+        m_server->broadcastPacket(pending.first, recipients);
+        m_broadcasts->add();
+
+        if (!pending.second)
+            continue;
+
+        // send the user's other resources to the new resource
+        QHash<QString, QXmppPresence>::const_iterator it;
+        const QHash<QString, QXmppPresence> own = m_presences.value(bareJid);
+        for (it = own.constBegin(); it != own.constEnd(); ++it) {
+            if (it.key() == jid.resourceRef())
+                continue;
+            QXmppPresence presence = it.value();
+            presence.setTo(jid.toString());
+            m_server->sendPacket(presence);
+        }
+
+        // answer for local contacts from memory, probe remote ones
+        foreach (const QString &contact, subscriptions(bareJid)) {
+            const QXmppJid contactJid(contact);
+            if (contactJid.domainRef() == domain) {
+                foreach (QXmppPresence presence, m_presences.value(contactJid.bareJid())) {
+                    presence.setTo(jid.toString());
+                    m_server->sendPacket(presence);
+                }
+                m_probesAnswered->add();
+            } else {
+                probes[bareJid].insert(contact);
+            }
+        }
+    }
+
+    // send probes
+    QHash<QXmppJid, QSet<QString> >::const_iterator it;
+    for (it = probes.constBegin(); it != probes.constEnd(); ++it) {
+        QXmppPresence probe(QXmppPresence::Probe);
+        probe.setFrom(it.key().toString());
+        m_server->broadcastPacket(probe, it.value().toList());
+        m_probesSent->add(it.value().size());
+    }
+
+    // forget the subscriptions of users which are no longer available
+    foreach (const QXmppJid &bareJid, users) {
+        if (!m_presences.contains(bareJid))
+            invalidate(bareJid);
+    }
+
+    if (!m_pendingOrder.isEmpty()) {
+        m_scheduled = true;
+        QMetaObject::invokeMethod(this, "_q_processPending", Qt::QueuedConnection);
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERPRESENCE_P_H
+#define QXMPPSERVERPRESENCE_P_H
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+
+#include "QXmppJid.h"
+#include "QXmppPresence.h"
+
+class QDomElement;
+class QXmppCounter;
+class QXmppServer;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServer class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+/// \brief The QXmppServerPresence class handles the presence broadcasts
+/// of local users on behalf of QXmppServer.
+///
+/// It keeps the last presence of each available resource and the
+/// subscription graph of available users, as reported by the server
+/// extensions' presenceSubscribers() and presenceSubscriptions(). Initial
+/// presences are broadcast and probed for in batches, and probes for local
+/// users are answered from memory.
+///
+/// It also tracks the most available resource of each user, to which
+/// messages addressed to the user's bare JID are delivered.
+///
+
+class QXmppServerPresence : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppServerPresence(QXmppServer *server);
+
+    QList<QXmppPresence> availablePresences(const QXmppJid &bareJid) const;
+    QStringList deliveryResources(const QXmppJid &bareJid) const;
+    QString preferredResource(const QXmppJid &bareJid) const;
+    bool handlePresence(const QDomElement &element);
+    void clientDisconnected(const QXmppJid &jid);
+
+signals:
+    /// This signal is emitted when a resource becomes available with a
+    /// non-negative priority, i.e. when it starts receiving messages
+    /// addressed to the user's bare JID.
+    void resourceAvailable(const QString &jid);
+
+private slots:
+    void _q_processPending();
+
+private:
+    void answerProbe(const QXmppJid &from, const QXmppJid &to);
+    void invalidate(const QXmppJid &bareJid);
+    void queue(const QXmppPresence &presence, bool initial);
+    void updatePreferred(const QXmppJid &bareJid, const QString &resource);
+    QSet<QString> subscribers(const QXmppJid &bareJid);
+    QSet<QString> subscriptions(const QXmppJid &bareJid);
+
+    QXmppServer *m_server;
+
+    // last presence of each available resource, by bare JID then resource
+    QHash<QXmppJid, QHash<QString, QXmppPresence> > m_presences;
+
+    // most available resource with a non-negative priority, by bare JID
+    QHash<QXmppJid, QString> m_preferred;
+
+    // subscription graph of available users
+    QHash<QXmppJid, QSet<QString> > m_subscribers;
+    QHash<QXmppJid, QSet<QString> > m_subscriptions;
+
+    // broadcasts waiting for the next batch, by full JID
+    QList<QXmppJid> m_pendingOrder;
+    QHash<QXmppJid, QPair<QXmppPresence, bool> > m_pending;
+    bool m_scheduled;
+
+    QXmppCounter *m_broadcasts;
+    QXmppCounter *m_probesAnswered;
+    QXmppCounter *m_probesSent;
+};
+
+#endif
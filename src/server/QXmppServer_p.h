@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVER_P_H
+#define QXMPPSERVER_P_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+
+class QSslSocket;
+class QThread;
+class QTimer;
+class QXmppHistogram;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServer class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+/// \brief The QXmppSslHandshakeWorker class performs TLS handshakes
+/// in a worker thread.
+///
+
+class QXmppSslHandshakeWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppSslHandshakeWorker(QThread *returnThread, QXmppHistogram *handshakeTime);
+
+signals:
+    void handshakeFailed(int id);
+    void handshakeFinished(int id, QSslSocket *socket);
+
+public slots:
+    void startHandshake(int id, QSslSocket *socket);
+
+private slots:
+    void _q_checkDeadlines();
+    void _q_returnSocket(int id, QSslSocket *socket);
+    void _q_socketEncrypted();
+    void _q_socketError();
+
+private:
+    struct Handshake
+    {
+        int id;
+        QElapsedTimer timer;
+    };
+
+    void abortHandshake(QSslSocket *socket);
+
+    QThread *m_returnThread;
+    QXmppHistogram *m_handshakeTime;
+    QHash<QSslSocket*, Handshake> m_handshakes;
+    QTimer *m_deadlineTimer;
+};
+
+/// \brief The QXmppSslHandshakePool class dispatches the TLS handshakes
+/// of accepted sockets to a bounded number of worker threads.
+///
+/// Once a socket is encrypted, it is moved back to the pool's thread and
+/// either handed to the receiver which requested the handshake, or
+/// announced by the encrypted() signal. Handshakes which take longer than
+/// 30 seconds are aborted.
+///
+
+class QXmppSslHandshakePool : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppSslHandshakePool(QObject *parent);
+    ~QXmppSslHandshakePool();
+
+    int maximumThreadCount() const;
+    void setMaximumThreadCount(int count);
+
+    void setHandshakeTime(QXmppHistogram *histogram);
+    void start(QSslSocket *socket, QObject *receiver = 0);
+
+signals:
+    void encrypted(QSslSocket *socket);
+
+private slots:
+    void _q_handshakeFailed(int id);
+    void _q_handshakeFinished(int id, QSslSocket *socket);
+
+private:
+    void handshakeDone();
+
+    int m_lastId;
+    int m_maximumThreadCount;
+    QXmppHistogram *m_handshakeTime;
+    QList<QThread*> m_threads;
+    QList<QXmppSslHandshakeWorker*> m_workers;
+    QList<int> m_pending;
+
+    // receivers of the handshakes requested with start(socket, receiver),
+    // by handshake id
+    QHash<int, QPointer<QObject> > m_receivers;
+};
+
+#endif
@@ -1,20 +1,37 @@
 # Headers
 INSTALL_HEADERS += \
+    server/QXmppArchiveExtension.h \
+    server/QXmppBoshExtension.h \
+    server/QXmppBoshExtension_p.h \
     server/QXmppDialback.h \
     server/QXmppIncomingClient.h \
     server/QXmppIncomingServer.h \
+    server/QXmppMetrics.h \
+    server/QXmppMetricsExtension.h \
+    server/QXmppMetricsExtension_p.h \
+    server/QXmppOfflineExtension.h \
     server/QXmppOutgoingServer.h \
     server/QXmppPasswordChecker.h \
+    server/QXmppRecordLog_p.h \
     server/QXmppServer.h \
+    server/QXmppServer_p.h \
     server/QXmppServerExtension.h \
-    server/QXmppServerPlugin.h
+    server/QXmppServerPlugin.h \
+    server/QXmppServerPresence_p.h
 
 # Source files
 SOURCES += \
+    server/QXmppArchiveExtension.cpp \
+    server/QXmppBoshExtension.cpp \
     server/QXmppDialback.cpp \
     server/QXmppIncomingClient.cpp \
     server/QXmppIncomingServer.cpp \
+    server/QXmppMetrics.cpp \
+    server/QXmppMetricsExtension.cpp \
+    server/QXmppOfflineExtension.cpp \
     server/QXmppOutgoingServer.cpp \
     server/QXmppPasswordChecker.cpp \
+    server/QXmppRecordLog.cpp \
     server/QXmppServer.cpp \
-    server/QXmppServerExtension.cpp
+    server/QXmppServerExtension.cpp \
+    server/QXmppServerPresence.cpp
@@ -25,27 +25,47 @@
 #include <cstdlib>
 
 #include <QCoreApplication>
+#include <QDir>
 #include <QDomDocument>
 #include <QEventLoop>
+#include <QSslCertificate>
+#include <QSslConfiguration>
+#include <QSslKey>
+#include <QSslSocket>
+#include <QTcpServer>
 #include <QVariant>
 #include <QtTest/QtTest>
 
+#include "QXmppArchiveExtension.h"
 #include "QXmppArchiveIq.h"
+#include "QXmppArchiveManager.h"
+#include "QXmppAtom.h"
 #include "QXmppBindIq.h"
+#include "QXmppBoshExtension.h"
 #include "QXmppClient.h"
 #include "QXmppCodec.h"
+#include "QXmppJid.h"
 #include "QXmppJingleIq.h"
+#include "QXmppLogger.h"
 #include "QXmppMessage.h"
+#include "QXmppMetrics.h"
+#include "QXmppMetricsExtension.h"
 #include "QXmppNonSASLAuth.h"
+#include "QXmppOfflineExtension.h"
 #include "QXmppPasswordChecker.h"
+#include "QXmppPingIq.h"
 #include "QXmppPresence.h"
 #include "QXmppPubSubIq.h"
+#include "QXmppRosterIq.h"
 #include "QXmppRpcIq.h"
 #include "QXmppRtpChannel.h"
 #include "QXmppSaslAuth.h"
 #include "QXmppSessionIq.h"
+#include "QXmppSocketConnector.h"
 #include "QXmppServer.h"
+#include "QXmppServerExtension.h"
 #include "QXmppStreamFeatures.h"
+#include "QXmppStream_p.h"
 #include "QXmppStun.h"
 #include "QXmppUtils.h"
 #include "QXmppVCardIq.h"
@@ -54,6 +74,45 @@
 #include "QXmppEntityTimeIq.h"
 #include "tests.h"
 
+Q_DECLARE_METATYPE(QList<QXmppArchiveChat>)
+Q_DECLARE_METATYPE(QXmppArchiveChat)
+Q_DECLARE_METATYPE(QXmppMessage)
+Q_DECLARE_METATYPE(QXmppPresence)
+#if QT_VERSION < 0x050000
+Q_DECLARE_METATYPE(QSslSocket*)
+#endif
+
+void TestUtils::testAtom()
+{
+    // predefined atoms
+    QCOMPARE(QXmppAtom::find(QString("jabber:iq:roster")), QXmppAtom(QXmppAtom::NsRoster));
+    QCOMPARE(QXmppAtom(QXmppAtom::NsRoster).toString(), QLatin1String("jabber:iq:roster"));
+    QCOMPARE(QXmppAtom(QXmppAtom::Xmlns).toString(), QLatin1String("xmlns"));
+    QCOMPARE(QXmppAtom::find(QString("iq")).id(), int(QXmppAtom::Iq));
+
+    const QString text("<message><body/></message>");
+    QCOMPARE(QXmppAtom::find(text.midRef(1, 7)), QXmppAtom(QXmppAtom::Message));
+
+    // unknown names
+    QCOMPARE(QXmppAtom::find(QString()).isNull(), true);
+    QCOMPARE(QXmppAtom::find(QString("urn:example:atom")).isNull(), true);
+    const QXmppAtom atom = QXmppAtom::intern("urn:example:atom");
+    QVERIFY(atom.id() >= QXmppAtom::PredefinedCount);
+    QCOMPARE(QXmppAtom::find(QString("urn:example:atom")), atom);
+    QCOMPARE(QXmppAtom::intern("urn:example:atom"), atom);
+    QCOMPARE(atom.toString(), QLatin1String("urn:example:atom"));
+
+    // DOM helpers
+    QDomDocument doc;
+    QCOMPARE(doc.setContent(QByteArray("<iq xmlns=\"jabber:client\" type=\"get\"><query xmlns=\"jabber:iq:roster\"/></iq>"), true), true);
+    const QDomElement element = doc.documentElement();
+    QCOMPARE(QXmppAtom::tagName(element), QXmppAtom(QXmppAtom::Iq));
+    QCOMPARE(QXmppAtom::namespaceUri(element), QXmppAtom(QXmppAtom::NsClient));
+    QCOMPARE(QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsRoster), true);
+    QCOMPARE(QXmppAtom::hasChildElement(element, QXmppAtom::Query, QXmppAtom::NsVersion), false);
+    QCOMPARE(QXmppAtom::hasChildElement(element, QXmppAtom::Bind, QXmppAtom::NsRoster), false);
+}
+
 void TestUtils::testCrc32()
 {
     quint32 crc = QXmppUtils::generateCrc32(QByteArray());
@@ -82,6 +141,195 @@ void TestUtils::testDigestMd5()
     QCOMPARE(QXmppSaslDigestMd5::serializeMessage(map), bytes);
 }
 
+void TestUtils::testLogger()
+{
+    const QString path = QDir::temp().filePath("qxmpp-test.log");
+    const QStringList paths = QStringList() << path << path + ".1" << path + ".2" << path + ".3";
+    foreach (const QString &name, paths)
+        QFile::remove(name);
+
+    QXmppLogger logger;
+    logger.setLogFilePath(path);
+    logger.setMaxLogFileSize(1024);
+    logger.setMaxLogFiles(2);
+    logger.setAsynchronous(true);
+    logger.setLoggingType(QXmppLogger::FileLogging);
+    for (int i = 0; i < 100; ++i)
+        logger.log(QXmppLogger::DebugMessage, QString("message %1").arg(i));
+
+    // re-opening writes out all pending messages
+    logger.reopen();
+    QVERIFY(QFile::exists(paths[0]));
+    QVERIFY(QFile::exists(paths[1]));
+    QVERIFY(QFile::exists(paths[2]));
+    QVERIFY(!QFile::exists(paths[3]));
+    for (int i = 0; i < 3; ++i)
+        QVERIFY(QFileInfo(paths[i]).size() <= 1024);
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(file.readAll().trimmed().endsWith("DEBUG message 99"));
+    file.close();
+
+    logger.setLoggingType(QXmppLogger::NoLogging);
+    foreach (const QString &name, paths)
+        QFile::remove(name);
+
+    // enabled message types
+    QCOMPARE(logger.enabledTypes(), QXmppLogger::MessageTypes(QXmppLogger::NoMessage));
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+    logger.setMessageTypes(QXmppLogger::DebugMessage | QXmppLogger::WarningMessage);
+    QCOMPARE(logger.enabledTypes(), QXmppLogger::DebugMessage | QXmppLogger::WarningMessage);
+
+    // log sinks are inherited by loggable children
+    QXmppClient client;
+    client.setLogger(&logger);
+    QXmppLoggable *child = new QXmppLoggable(&client);
+    QCOMPARE(child->logSink(), &logger);
+    QXmppLoggable *orphan = new QXmppLoggable;
+    QCOMPARE(orphan->logSink(), (QXmppLogger*)0);
+    orphan->setParent(child);
+    QCOMPARE(orphan->logSink(), &logger);
+    client.setLogger(0);
+    QCOMPARE(orphan->logSink(), (QXmppLogger*)0);
+}
+
+void TestUtils::testRandom()
+{
+    // random bytes
+    QCOMPARE(QXmppUtils::generateRandomBytes(0).size(), 0);
+    QCOMPARE(QXmppUtils::generateRandomBytes(12).size(), 12);
+    QCOMPARE(QXmppUtils::generateRandomBytes(10000).size(), 10000);
+    QVERIFY(QXmppUtils::generateRandomBytes(16) != QXmppUtils::generateRandomBytes(16));
+
+    // random integers
+    for (int i = 0; i < 100; ++i) {
+        const int val = QXmppUtils::generateRandomInteger(10);
+        QVERIFY(val >= 0 && val < 10);
+    }
+
+    // stanza hashes
+    const QRegExp hashRegex("[0-9a-zA-Z]*");
+    for (int length = 0; length < 64; ++length) {
+        const QString hash = QXmppUtils::generateStanzaHash(length);
+        QCOMPARE(hash.size(), length);
+        QVERIFY(hashRegex.exactMatch(hash));
+    }
+}
+
+void TestUtils::testScram()
+{
+    // test vectors from RFC 5802
+    const QCryptographicHash::Algorithm algorithm = QCryptographicHash::Sha1;
+    const QByteArray salted = QXmppSaslScram::saltedPassword(algorithm,
+        "pencil", QByteArray::fromBase64("QSXCR+Q6sek8bf92"), 4096);
+    QCOMPARE(salted, QByteArray::fromHex("1d96ee3a529b5a5f9e47c01f229a2cb8a6e15f7d"));
+
+    const QByteArray clientKey = QXmppSaslScram::clientKey(algorithm, salted);
+    QCOMPARE(clientKey, QByteArray::fromHex("e234c47bf6c36696dd6d852b99aaa2ba26555728"));
+
+    const QByteArray serverKey = QXmppSaslScram::serverKey(algorithm, salted);
+    QCOMPARE(serverKey, QByteArray::fromHex("0fe09258b3ac852ba502cc62ba903eaacdbf7d31"));
+
+    const QByteArray authMessage("n=user,r=fyko+d2lbbFgONRv9qkxdawL,"
+        "r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,s=QSXCR+Q6sek8bf92,i=4096,"
+        "c=biws,r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j");
+    QCOMPARE(QXmppSaslScram::hmac(algorithm, serverKey, authMessage).toBase64(),
+             QByteArray("rmF9pqV8S7suAoZWja4dJRkFsKQ="));
+
+    // message parsing
+    QMap<char, QByteArray> map = QXmppSaslScram::parseMessage("r=abc,s=QSXCR+Q6sek8bf92,i=4096");
+    QCOMPARE(map.size(), 3);
+    QCOMPARE(map.value('r'), QByteArray("abc"));
+    QCOMPARE(map.value('s'), QByteArray("QSXCR+Q6sek8bf92"));
+    QCOMPARE(map.value('i'), QByteArray("4096"));
+
+    // name escaping
+    QCOMPARE(QXmppSaslScram::escapeName("a=b,c"), QByteArray("a=3Db=2Cc"));
+    QCOMPARE(QXmppSaslScram::unescapeName("a=3Db=2Cc"), QString("a=b,c"));
+
+    // signature comparison
+    QVERIFY(QXmppSaslScram::signatureEquals("abc", "abc"));
+    QVERIFY(!QXmppSaslScram::signatureEquals("abc", "abd"));
+    QVERIFY(!QXmppSaslScram::signatureEquals("abc", "ab"));
+
+    // the client only completes once the server signature is verified
+    QXmppConfiguration config;
+    config.setUser("user");
+    config.setPassword("pencil");
+    QXmppSaslScram scram(algorithm);
+    scram.setConfiguration(&config);
+    const QByteArray clientFirstBare = scram.authText().mid(3);
+    const QByteArray serverFirst = "r=" + clientFirstBare.mid(clientFirstBare.indexOf(",r=") + 3) +
+        "3rfcNHYJY1ZVvWVs7j,s=QSXCR+Q6sek8bf92,i=4096";
+    QByteArray response;
+    QVERIFY(scram.challengeResponse(serverFirst, response, 1));
+    QVERIFY(!scram.isComplete());
+
+    const QByteArray clientFinal = response.left(response.indexOf(",p="));
+    const QByteArray serverSignature = QXmppSaslScram::hmac(algorithm, serverKey,
+        clientFirstBare + "," + serverFirst + "," + clientFinal);
+    QVERIFY(!scram.challengeResponse("v=" + QByteArray("bogus").toBase64(), response, 2));
+    QVERIFY(!scram.isComplete());
+    QVERIFY(!scram.challengeResponse("", response, 2));
+    QVERIFY(!scram.isComplete());
+    QVERIFY(scram.challengeResponse("v=" + serverSignature.toBase64(), response, 2));
+    QVERIFY(scram.isComplete());
+}
+
+void TestUtils::testElement()
+{
+    const QByteArray xml("<x xmlns=\"jabber:x:data\" type=\"form\">"
+        "<field var=\"a\"><value>1</value></field>"
+        "<field var=\"b\"/>"
+        "<field var=\"c\" label=\"C\"><value>3</value></field>"
+        "</x>");
+    QDomDocument doc;
+    QCOMPARE(doc.setContent(xml, true), true);
+
+    // sibling traversal
+    QXmppElement x(doc.documentElement());
+    QStringList vars;
+    QXmppElement field = x.firstChildElement("field");
+    while (!field.isNull()) {
+        vars << field.attribute("var");
+        field = field.nextSiblingElement("field");
+    }
+    QCOMPARE(vars, QStringList() << "a" << "b" << "c");
+    QCOMPARE(x.firstChildElement().nextSiblingElement().nextSiblingElement().attributeNames(),
+             QStringList() << "label" << "var");
+
+    // children outlive their parent
+    QXmppElement value = x.firstChildElement("field").firstChildElement("value");
+    x = QXmppElement();
+    QCOMPARE(value.value(), QLatin1String("1"));
+    QCOMPARE(value.nextSiblingElement().isNull(), true);
+
+    // removing and re-appending a child
+    QXmppElement parent(doc.documentElement());
+    QXmppElement middle = parent.firstChildElement().nextSiblingElement();
+    parent.removeChild(middle);
+    QCOMPARE(middle.nextSiblingElement().isNull(), true);
+    QCOMPARE(parent.firstChildElement().nextSiblingElement().attribute("var"), QLatin1String("c"));
+    parent.appendChild(middle);
+    QCOMPARE(parent.firstChildElement().nextSiblingElement().nextSiblingElement().attribute("var"), QLatin1String("b"));
+
+    // children keep being shared with the tree once appended
+    QXmppElement item;
+    item.setTagName("item");
+    QXmppElement query;
+    query.setTagName("query");
+    query.setAttribute("xmlns", "jabber:iq:test");
+    query.appendChild(item);
+    item.setAttribute("jid", "foo@example.com");
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QXmlStreamWriter writer(&buffer);
+    query.toXml(&writer);
+    QCOMPARE(buffer.data(), QByteArray("<query xmlns=\"jabber:iq:test\"><item jid=\"foo@example.com\"/></query>"));
+}
+
 void TestUtils::testHmac()
 {
     QByteArray hmac = QXmppUtils::generateHmacMd5(QByteArray(16, 0x0b), QByteArray("Hi There"));
@@ -115,6 +363,35 @@ void TestUtils::testJid()
     QCOMPARE(QXmppUtils::jidToUser("foo@example.com"), QLatin1String("foo"));
     QCOMPARE(QXmppUtils::jidToUser("example.com"), QString());
     QCOMPARE(QXmppUtils::jidToUser(QString()), QString());
+
+    // pre-parsed JIDs
+    const QXmppJid full(QString("foo@example.com/resource/with@at"));
+    QCOMPARE(full.node(), QLatin1String("foo"));
+    QCOMPARE(full.domain(), QLatin1String("example.com"));
+    QCOMPARE(full.resource(), QLatin1String("resource/with@at"));
+    QCOMPARE(full.domainRef().toString(), QLatin1String("example.com"));
+    QCOMPARE(full.bareJidRef().toString(), QLatin1String("foo@example.com"));
+    QCOMPARE(full.isBare(), false);
+    QCOMPARE(full.bareJid(), QXmppJid(QString("foo@example.com")));
+    QCOMPARE(full.bareJid().isBare(), true);
+    QCOMPARE(qHash(full.bareJid()), qHash(QXmppJid(QString("foo@example.com"))));
+
+    const QXmppJid domain(QString("example.com"));
+    QCOMPARE(domain.node(), QString());
+    QCOMPARE(domain.domain(), QLatin1String("example.com"));
+    QCOMPARE(domain.resource(), QString());
+    QCOMPARE(domain.isBare(), true);
+
+    QCOMPARE(QXmppJid("foo", "example.com", "resource"), QXmppJid(QString("foo@example.com/resource")));
+    QCOMPARE(QXmppJid("foo", "example.com").toString(), QLatin1String("foo@example.com"));
+    QVERIFY(QXmppJid(QString("foo@example.com")) != QXmppJid(QString("bar@example.com")));
+    QCOMPARE(QXmppJid().isNull(), true);
+    QCOMPARE(QXmppJid().domain(), QString());
+
+    QHash<QXmppJid, int> table;
+    table.insert(QString("foo@example.com/resource"), 1);
+    QCOMPARE(table.value(QString("foo@example.com/resource")), 1);
+    QCOMPARE(table.value(QString("foo@example.com")), 0);
 }
 
 // FIXME: how should we test MIME detection without expose getImageType?
@@ -474,6 +751,29 @@ void TestPackets::testMessageLegacyDelay()
     serializePacket(message, xml);
 }
 
+void TestPackets::testMessageSharing()
+{
+    QXmppMessage message("foo@example.com/QXmpp", "bar@example.com", "hello");
+    message.setId("message1");
+    message.setReceiptRequested(true);
+
+    // copies share data until they are modified
+    QXmppMessage copy(message);
+    QXmppMessage assigned;
+    assigned = message;
+    QCOMPARE(copy.body(), QLatin1String("hello"));
+    QCOMPARE(assigned.id(), QLatin1String("message1"));
+
+    copy.setBody("goodbye");
+    copy.setTo("baz@example.com");
+    QCOMPARE(message.body(), QLatin1String("hello"));
+    QCOMPARE(message.to(), QLatin1String("bar@example.com"));
+    QCOMPARE(copy.body(), QLatin1String("goodbye"));
+    QCOMPARE(copy.to(), QLatin1String("baz@example.com"));
+    QCOMPARE(copy.isReceiptRequested(), true);
+    QCOMPARE(assigned.body(), QLatin1String("hello"));
+}
+
 void TestPackets::testNonSaslAuth()
 {
     // Client Requests Authentication Fields from Server
@@ -639,6 +939,22 @@ void TestPackets::testPresenceWithMuc()
     serializePacket(presence, xml);
 }
 
+void TestPackets::testPresenceSharing()
+{
+    QXmppPresence presence;
+    presence.setFrom("foo@example.com/QXmpp");
+    presence.status().setStatusText("Working");
+
+    QXmppPresence copy(presence);
+    copy.status().setType(QXmppPresence::Status::Away);
+    copy.setFrom("foo@example.com/other");
+
+    QCOMPARE(presence.status().type(), QXmppPresence::Status::Online);
+    QCOMPARE(presence.from(), QLatin1String("foo@example.com/QXmpp"));
+    QCOMPARE(copy.status().type(), QXmppPresence::Status::Away);
+    QCOMPARE(copy.status().statusText(), QLatin1String("Working"));
+}
+
 void TestPackets::testSession()
 {
     const QByteArray xml(
@@ -802,6 +1118,138 @@ void TestPackets::testEntityTimeResult()
     serializePacket(entityTime, xml);
 }
 
+template <class T>
+static QByteArray domRoundTrip(const QByteArray &xml)
+{
+    T packet;
+    parsePacket(packet, xml);
+
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    packet.toXml(&writer);
+    return data;
+}
+
+template <class T>
+static QByteArray readerRoundTrip(const QByteArray &xml)
+{
+    QXmlStreamReader reader(xml);
+    T packet;
+    if (!reader.readNextStartElement())
+        return QByteArray();
+    packet.parse(&reader);
+    if (!reader.isEndElement())
+        return QByteArray();
+
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    packet.toXml(&writer);
+    return data;
+}
+
+void TestPackets::testStreamReader_data()
+{
+    QTest::addColumn<QString>("type");
+    QTest::addColumn<QByteArray>("xml");
+
+    QTest::newRow("message") << "message" << QByteArray(
+        "<message xmlns=\"jabber:client\" id=\"m1\" to=\"foo@example.com/QXmpp\" from=\"bar@example.com/QXmpp\" type=\"chat\">"
+        "<subject>test subject</subject>"
+        "<body>test body &amp; stuff</body>"
+        "<thread>test thread</thread>"
+        "<composing xmlns=\"http://jabber.org/protocol/chatstates\"/>"
+        "<request xmlns=\"urn:xmpp:receipts\"/>"
+        "<attention xmlns=\"urn:xmpp:attention:0\"/>"
+        "<delay xmlns=\"urn:xmpp:delay\" stamp=\"2010-06-29T08:23:06Z\"/>"
+        "<x xmlns=\"jabber:x:conference\" jid=\"room@conference.example.com\"><reason>join us</reason></x>"
+        "</message>");
+    QTest::newRow("message-error") << "message" << QByteArray(
+        "<message to=\"foo@example.com/QXmpp\" type=\"error\">"
+        "<body>hi</body>"
+        "<error type=\"cancel\"><service-unavailable xmlns=\"urn:ietf:params:xml:ns:xmpp-stanzas\"/></error>"
+        "</message>");
+    QTest::newRow("presence") << "presence" << QByteArray(
+        "<presence xmlns=\"jabber:client\" to=\"foo@example.com/QXmpp\" from=\"bar@example.com/QXmpp\">"
+        "<show>away</show>"
+        "<status>In a meeting</status>"
+        "<priority>5</priority>"
+        "<x xmlns=\"vcard-temp:x:update\"><photo>73b908bc</photo></x>"
+        "<c xmlns=\"http://jabber.org/protocol/caps\" hash=\"sha-1\" node=\"http://code.google.com/p/qxmpp\" ver=\"QgayPKawpkPSDYmwT/WM94uAlu0=\"/>"
+        "<x xmlns=\"http://jabber.org/protocol/muc#user\">"
+        "<item affiliation=\"none\" role=\"none\"><actor jid=\"fluellen@shakespeare.lit\"/><reason>Avaunt, you cullion!</reason></item>"
+        "<status code=\"307\"/>"
+        "</x>"
+        "<nick xmlns=\"http://jabber.org/protocol/nick\">Bar</nick>"
+        "</presence>");
+    QTest::newRow("bind") << "bind" << QByteArray(
+        "<iq id=\"bind_2\" type=\"result\">"
+        "<bind xmlns=\"urn:ietf:params:xml:ns:xmpp-bind\">"
+        "<jid>somenode@example.com/someresource</jid>"
+        "</bind>"
+        "</iq>");
+    QTest::newRow("ping") << "ping" << QByteArray(
+        "<iq id=\"ping_1\" to=\"capulet.lit\" from=\"juliet@capulet.lit/balcony\" type=\"get\">"
+        "<ping xmlns=\"urn:xmpp:ping\"/>"
+        "</iq>");
+    QTest::newRow("roster") << "roster" << QByteArray(
+        "<iq id=\"roster_1\" type=\"result\">"
+        "<query xmlns=\"jabber:iq:roster\">"
+        "<item jid=\"romeo@example.net\" name=\"Romeo\" subscription=\"both\"><group>Friends</group></item>"
+        "<item jid=\"mercutio@example.org\" subscription=\"from\"/>"
+        "</query>"
+        "</iq>");
+    QTest::newRow("roster-error") << "roster" << QByteArray(
+        "<iq id=\"roster_2\" type=\"error\">"
+        "<error type=\"cancel\" code=\"503\"><service-unavailable xmlns=\"urn:ietf:params:xml:ns:xmpp-stanzas\"/></error>"
+        "</iq>");
+    QTest::newRow("version") << "version" << QByteArray(
+        "<iq id=\"version_1\" type=\"result\">"
+        "<query xmlns=\"jabber:iq:version\">"
+        "<name>qxmpp</name><os>Windows-XP</os><version>0.2.0</version>"
+        "</query>"
+        "</iq>");
+    QTest::newRow("vcard") << "vcard" << QByteArray(
+        "<iq id=\"vcard1\" type=\"result\">"
+        "<vCard xmlns=\"vcard-temp\">"
+        "<FN>Foo Bar!</FN>"
+        "<NICKNAME>FooBar</NICKNAME>"
+        "</vCard>"
+        "</iq>");
+}
+
+void TestPackets::testStreamReader()
+{
+    QFETCH(QString, type);
+    QFETCH(QByteArray, xml);
+
+    QByteArray expected;
+    QByteArray actual;
+    if (type == "message") {
+        expected = domRoundTrip<QXmppMessage>(xml);
+        actual = readerRoundTrip<QXmppMessage>(xml);
+    } else if (type == "presence") {
+        expected = domRoundTrip<QXmppPresence>(xml);
+        actual = readerRoundTrip<QXmppPresence>(xml);
+    } else if (type == "bind") {
+        expected = domRoundTrip<QXmppBindIq>(xml);
+        actual = readerRoundTrip<QXmppBindIq>(xml);
+    } else if (type == "ping") {
+        expected = domRoundTrip<QXmppPingIq>(xml);
+        actual = readerRoundTrip<QXmppPingIq>(xml);
+    } else if (type == "roster") {
+        expected = domRoundTrip<QXmppRosterIq>(xml);
+        actual = readerRoundTrip<QXmppRosterIq>(xml);
+    } else if (type == "version") {
+        expected = domRoundTrip<QXmppVersionIq>(xml);
+        actual = readerRoundTrip<QXmppVersionIq>(xml);
+    } else if (type == "vcard") {
+        expected = domRoundTrip<QXmppVCardIq>(xml);
+        actual = readerRoundTrip<QXmppVCardIq>(xml);
+    }
+    QVERIFY(!expected.isEmpty());
+    QCOMPARE(actual, expected);
+}
+
 void TestCodec::testTheoraDecoder()
 {
 #ifdef QXMPP_USE_THEORA
@@ -1152,12 +1600,45 @@ public:
         return m_getPassword;
     };
 
+    /// Derive SCRAM keys from getPassword(), the cost is acceptable here.
+    bool hasGetSaltedKeys() const
+    {
+        return m_getPassword;
+    };
+
 private:
     bool m_getPassword;
     QString m_username;
     QString m_password;
 };
 
+class TestPresenceExtension : public QXmppServerExtension
+{
+public:
+    TestPresenceExtension()
+        : subscriberLookups(0), subscriptionLookups(0)
+    {
+    };
+
+    /// Every user is subscribed to a remote contact.
+    QSet<QString> presenceSubscribers(const QString &jid)
+    {
+        Q_UNUSED(jid);
+        subscriberLookups++;
+        return QSet<QString>() << "contact@remote.example";
+    };
+
+    QSet<QString> presenceSubscriptions(const QString &jid)
+    {
+        Q_UNUSED(jid);
+        subscriptionLookups++;
+        return QSet<QString>() << "contact@remote.example";
+    };
+
+    int subscriberLookups;
+    int subscriptionLookups;
+};
+
 void TestRtp::testBad()
 {
     QXmppRtpPacket packet;
@@ -1205,8 +1686,378 @@ void TestRtp::testWithCsrc()
 }
 
 
+void TestServer::testConnect_data()
+{
+    QTest::addColumn<QString>("mechanism");
+
+    QTest::newRow("PLAIN") << "PLAIN";
+    QTest::newRow("DIGEST-MD5") << "DIGEST-MD5";
+    QTest::newRow("SCRAM-SHA-1") << "SCRAM-SHA-1";
+}
+
+void TestServer::testArchive()
+{
+    const QString testDomain("localhost");
+    const QString testPassword("testpwd");
+    const QString testUser("testuser");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12352;
+
+    QDir dir(QDir::temp().filePath("qxmpp-test-archive"));
+    foreach (const QString &name, dir.entryList(QDir::Files))
+        dir.remove(name);
+
+    // prepare server
+    TestPasswordChecker passwordChecker(testUser, testPassword);
+    QXmppArchiveExtension *extension = new QXmppArchiveExtension;
+    extension->setDirectory(dir.path());
+    extension->setFlushInterval(10);
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(extension);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // archive messages, messages without a body are skipped
+    QStringList stanzas;
+    stanzas << "<message xmlns=\"jabber:client\" from=\"testuser@localhost/r\" to=\"other@localhost\" type=\"chat\"><body>first</body></message>";
+    stanzas << "<message xmlns=\"jabber:client\" from=\"testuser@localhost/r\" to=\"other@localhost/s\" type=\"chat\"><body>second</body></message>";
+    stanzas << "<message xmlns=\"jabber:client\" from=\"friend@localhost/x\" to=\"testuser@localhost\" type=\"chat\"><body>third</body></message>";
+    stanzas << "<message xmlns=\"jabber:client\" from=\"friend@localhost/x\" to=\"testuser@localhost\" type=\"chat\"/>";
+    foreach (const QString &stanza, stanzas) {
+        QDomDocument doc;
+        doc.setContent(stanza, true);
+        server.handleElement(doc.documentElement());
+    }
+    QCOMPARE(server.metrics()->counter("archive-messages")->value(), Q_INT64_C(6));
+
+    // connect client
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setUser(testUser);
+    config.setPassword(testPassword);
+    config.setPort(testPort);
+
+    QXmppClient client;
+    QXmppArchiveManager *manager = new QXmppArchiveManager;
+    client.addExtension(manager);
+    client.connectToServer(config);
+    for (int i = 0; i < 300 && !client.isConnected(); ++i)
+        QTest::qWait(10);
+    QVERIFY(client.isConnected());
+
+    qRegisterMetaType<QList<QXmppArchiveChat> >("QList<QXmppArchiveChat>");
+    qRegisterMetaType<QXmppArchiveChat>("QXmppArchiveChat");
+    QSignalSpy listSpy(manager, SIGNAL(archiveListReceived(QList<QXmppArchiveChat>)));
+    QSignalSpy chatSpy(manager, SIGNAL(archiveChatReceived(QXmppArchiveChat)));
+
+    // list all collections
+    manager->listCollections(QString());
+    for (int i = 0; i < 300 && listSpy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(listSpy.size(), 1);
+    QList<QXmppArchiveChat> chats = listSpy.takeFirst().at(0).value<QList<QXmppArchiveChat> >();
+    QCOMPARE(chats.size(), 2);
+    QStringList withs;
+    foreach (const QXmppArchiveChat &chat, chats)
+        withs << chat.with();
+    withs.sort();
+    QCOMPARE(withs, QStringList() << "friend@localhost" << "other@localhost");
+
+    // list the collections with a peer
+    manager->listCollections("other@localhost");
+    for (int i = 0; i < 300 && listSpy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(listSpy.size(), 1);
+    chats = listSpy.takeFirst().at(0).value<QList<QXmppArchiveChat> >();
+    QCOMPARE(chats.size(), 1);
+    QCOMPARE(chats.at(0).with(), QString("other@localhost"));
+
+    // retrieve the collection
+    manager->retrieveCollection("other@localhost", chats.at(0).start());
+    for (int i = 0; i < 300 && chatSpy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(chatSpy.size(), 1);
+    const QXmppArchiveChat chat = chatSpy.takeFirst().at(0).value<QXmppArchiveChat>();
+    QCOMPARE(chat.messages().size(), 2);
+    QCOMPARE(chat.messages().at(0).body(), QString("first"));
+    QCOMPARE(chat.messages().at(0).isReceived(), false);
+    QCOMPARE(chat.messages().at(1).body(), QString("second"));
+
+    // remove the collections with a peer
+    manager->removeCollections("other@localhost");
+    manager->listCollections(QString());
+    for (int i = 0; i < 300 && listSpy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(listSpy.size(), 1);
+    chats = listSpy.takeFirst().at(0).value<QList<QXmppArchiveChat> >();
+    QCOMPARE(chats.size(), 1);
+    QCOMPARE(chats.at(0).with(), QString("friend@localhost"));
+
+    // the removal survives reading the archive back from disk
+    extension->stop();
+    QVERIFY(extension->start());
+    manager->listCollections(QString());
+    for (int i = 0; i < 300 && listSpy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(listSpy.size(), 1);
+    chats = listSpy.takeFirst().at(0).value<QList<QXmppArchiveChat> >();
+    QCOMPARE(chats.size(), 1);
+    QCOMPARE(chats.at(0).with(), QString("friend@localhost"));
+
+    // a log made mostly of removed messages is compacted
+    const QString logPath = dir.filePath("testuser%40localhost.archive");
+    for (int i = 0; i < 300; ++i) {
+        QDomDocument doc;
+        doc.setContent(QString("<message xmlns=\"jabber:client\" from=\"testuser@localhost/r\" to=\"bulk@localhost\" type=\"chat\"><body>bulk</body></message>"), true);
+        server.handleElement(doc.documentElement());
+    }
+    for (int i = 0; i < 300 && QFileInfo(logPath).size() < 300 * 50; ++i)
+        QTest::qWait(10);
+    QVERIFY(QFileInfo(logPath).size() >= 300 * 50);
+    manager->removeCollections("bulk@localhost");
+    for (int i = 0; i < 300 && QFileInfo(logPath).size() >= 1024; ++i)
+        QTest::qWait(10);
+    QVERIFY(QFileInfo(logPath).size() < 1024);
+
+    // the remaining messages are still retrieved
+    manager->retrieveCollection("friend@localhost", chats.at(0).start());
+    for (int i = 0; i < 300 && chatSpy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(chatSpy.size(), 1);
+    const QXmppArchiveChat compacted = chatSpy.takeFirst().at(0).value<QXmppArchiveChat>();
+    QCOMPARE(compacted.messages().size(), 1);
+    QCOMPARE(compacted.messages().at(0).body(), QString("third"));
+
+    server.close();
+}
+
+static void boshWrite(QTcpSocket *socket, const QByteArray &body)
+{
+    socket->write("POST /http-bind HTTP/1.1\r\n"
+                  "Host: localhost\r\n"
+                  "Content-Type: text/xml; charset=utf-8\r\n"
+                  "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                  "\r\n" + body);
+}
+
+static QDomElement boshRead(QTcpSocket *socket, QDomDocument &doc)
+{
+    QByteArray response;
+    for (int i = 0; i < 500; ++i) {
+        response += socket->readAll();
+        const int headerEnd = response.indexOf("\r\n\r\n");
+        const int pos = response.indexOf("Content-Length: ");
+        if (headerEnd >= 0 && pos >= 0 && pos < headerEnd) {
+            const int length = response.mid(pos + 16, response.indexOf("\r\n", pos) - pos - 16).toInt();
+            if (response.size() >= headerEnd + 4 + length) {
+                doc.setContent(response.mid(headerEnd + 4, length), true);
+                return doc.documentElement();
+            }
+        }
+        QTest::qWait(10);
+    }
+    return QDomElement();
+}
+
+static QByteArray boshBody(const QString &sid, int rid, const QString &payload = QString(), const QString &attributes = QString())
+{
+    return QString("<body xmlns='http://jabber.org/protocol/httpbind' xmlns:xmpp='urn:xmpp:xbosh' sid='%1' rid='%2'%3>%4</body>").arg(
+        sid, QString::number(rid), attributes, payload).toUtf8();
+}
+
+void TestServer::testBosh()
+{
+    const QString testDomain("localhost");
+    const QString testPassword("testpwd");
+    const QString testUser("testuser");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12354;
+    const quint16 testBoshPort = 12355;
+
+    // prepare server
+    TestPasswordChecker passwordChecker(testUser, testPassword);
+    QXmppBoshExtension *extension = new QXmppBoshExtension;
+    extension->setAddress(testHost);
+    extension->setPort(testBoshPort);
+    extension->setSecure(true);
+    extension->setMaximumConnections(1);
+    extension->setMaximumWait(1);
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(extension);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QTcpSocket socket;
+    socket.connectToHost(testHost, testBoshPort);
+    QVERIFY(socket.waitForConnected());
+
+    // create a session, the wait is capped
+    QDomDocument doc;
+    boshWrite(&socket, "<body xmlns='http://jabber.org/protocol/httpbind' xmlns:xmpp='urn:xmpp:xbosh'"
+                       " rid='1000' to='localhost' wait='60' hold='1' xmpp:version='1.0'/>");
+    QDomElement body = boshRead(&socket, doc);
+    QCOMPARE(body.tagName(), QString("body"));
+    const QString sid = body.attribute("sid");
+    QVERIFY(!sid.isEmpty());
+    QCOMPARE(body.attribute("wait"), QString("1"));
+    QCOMPARE(body.attribute("hold"), QString("1"));
+    QCOMPARE(body.attribute("requests"), QString("2"));
+    QCOMPARE(body.firstChildElement().localName(), QString("features"));
+    QStringList mechanisms;
+    QDomElement mechanism = body.firstChildElement().firstChildElement("mechanisms").firstChildElement("mechanism");
+    for ( ; !mechanism.isNull(); mechanism = mechanism.nextSiblingElement("mechanism"))
+        mechanisms << mechanism.text();
+    QVERIFY(mechanisms.contains("PLAIN"));
+    QCOMPARE(server.metrics()->counter("bosh-sessions-created")->value(), Q_INT64_C(1));
+
+    // connections beyond the maximum are refused
+    QTcpSocket extra;
+    extra.connectToHost(testHost, testBoshPort);
+    for (int i = 0; i < 300 && extra.state() != QAbstractSocket::UnconnectedState; ++i)
+        QTest::qWait(10);
+    QCOMPARE(extra.state(), QAbstractSocket::UnconnectedState);
+
+    // authenticate
+    const QByteArray auth = QByteArray("\0testuser\0testpwd", 17).toBase64();
+    boshWrite(&socket, boshBody(sid, 1001, "<auth xmlns='urn:ietf:params:xml:ns:xmpp-sasl' mechanism='PLAIN'>" + auth + "</auth>"));
+    body = boshRead(&socket, doc);
+    QCOMPARE(body.firstChildElement().tagName(), QString("success"));
+
+    // restart the stream and bind a resource
+    boshWrite(&socket, boshBody(sid, 1002, QString(), " xmpp:restart='true' to='localhost'"));
+    body = boshRead(&socket, doc);
+    QCOMPARE(body.firstChildElement().localName(), QString("features"));
+
+    boshWrite(&socket, boshBody(sid, 1003, "<iq xmlns='jabber:client' type='set' id='bind_1'>"
+        "<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'><resource>web</resource></bind></iq>"));
+    body = boshRead(&socket, doc);
+    QCOMPARE(body.firstChildElement().tagName(), QString("iq"));
+    QCOMPARE(body.firstChildElement().namespaceURI(), QString("jabber:client"));
+    QCOMPARE(body.firstChildElement().attribute("id"), QString("bind_1"));
+
+    // stanzas sent while a request is held are batched in its response
+    boshWrite(&socket, boshBody(sid, 1004));
+    for (int i = 0; i < 300 && extension->statistics().value("held-requests").toInt() < 1; ++i)
+        QTest::qWait(10);
+    QXmppMessage message(testDomain, "testuser@localhost/web", "first");
+    QVERIFY(server.sendPacket(message));
+    message.setBody("second");
+    QVERIFY(server.sendPacket(message));
+    body = boshRead(&socket, doc);
+    QDomElement child = body.firstChildElement();
+    QCOMPARE(child.tagName(), QString("message"));
+    QCOMPARE(child.firstChildElement("body").text(), QString("first"));
+    child = child.nextSiblingElement();
+    QCOMPARE(child.tagName(), QString("message"));
+    QCOMPARE(child.firstChildElement("body").text(), QString("second"));
+
+    // a held request is answered when its wait expires
+    boshWrite(&socket, boshBody(sid, 1005));
+    body = boshRead(&socket, doc);
+    QCOMPARE(body.tagName(), QString("body"));
+    QVERIFY(body.firstChildElement().isNull());
+    QVERIFY(server.metrics()->counter("bosh-empty-responses")->value() >= 1);
+
+    // a retransmitted request gets the same response
+    boshWrite(&socket, boshBody(sid, 1004));
+    body = boshRead(&socket, doc);
+    QCOMPARE(body.firstChildElement().firstChildElement("body").text(), QString("first"));
+
+    // terminate the session
+    boshWrite(&socket, boshBody(sid, 1006, QString(), " type='terminate'"));
+    body = boshRead(&socket, doc);
+    QCOMPARE(body.attribute("type"), QString("terminate"));
+    QCOMPARE(extension->statistics().value("sessions").toInt(), 0);
+
+    // the session is gone
+    boshWrite(&socket, boshBody(sid, 1007));
+    body = boshRead(&socket, doc);
+    QCOMPARE(body.attribute("type"), QString("terminate"));
+    QCOMPARE(body.attribute("condition"), QString("item-not-found"));
+
+    server.close();
+}
+
+void TestServer::testBroadcast()
+{
+    const QString testDomain("localhost");
+    const QString testPassword("testpwd");
+    const QString testUser("testuser");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12349;
+
+    // prepare server
+    TestPasswordChecker passwordChecker(testUser, testPassword);
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // connect two resources
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setUser(testUser);
+    config.setPassword(testPassword);
+    config.setPort(testPort);
+
+    QEventLoop loop;
+    QList<QXmppClient*> clients;
+    foreach (const QString &resource, QStringList() << "a" << "b") {
+        QXmppClient *client = new QXmppClient(this);
+        connect(client, SIGNAL(connected()),
+                &loop, SLOT(quit()));
+        config.setResource(resource);
+        client->connectToServer(config);
+        loop.exec();
+        QCOMPARE(client->isConnected(), true);
+        clients << client;
+    }
+
+    // broadcast a message, with per-recipient 'to'
+    QXmppMessage message;
+    message.setFrom(testDomain);
+    message.setTo("ignored@localhost");
+    message.setBody("a \"quoted\" <body>");
+
+    qRegisterMetaType<QXmppMessage>("QXmppMessage");
+    QSignalSpy spyA(clients[0], SIGNAL(messageReceived(QXmppMessage)));
+    QSignalSpy spyB(clients[1], SIGNAL(messageReceived(QXmppMessage)));
+    const QStringList recipients = QStringList()
+        << "testuser@localhost/a"
+        << "testuser@localhost/b"
+        << "nosuchuser@localhost";
+    QCOMPARE(server.broadcastPacket(message, recipients), 2);
+
+    for (int i = 0; i < 300 && (spyA.isEmpty() || spyB.isEmpty()); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spyA.size(), 1);
+    QCOMPARE(spyB.size(), 1);
+
+    const QXmppMessage receivedA = spyA.first().at(0).value<QXmppMessage>();
+    QCOMPARE(receivedA.to(), QString("testuser@localhost/a"));
+    QCOMPARE(receivedA.body(), message.body());
+    const QXmppMessage receivedB = spyB.first().at(0).value<QXmppMessage>();
+    QCOMPARE(receivedB.to(), QString("testuser@localhost/b"));
+    QCOMPARE(receivedB.body(), message.body());
+
+    // nothing to route
+    QCOMPARE(server.broadcastPacket(message, QStringList()), 0);
+
+    qDeleteAll(clients);
+    server.close();
+}
+
 void TestServer::testConnect()
 {
+    QFETCH(QString, mechanism);
+
     const QString testDomain("localhost");
     const QString testPassword("testpwd");
     const QString testUser("testuser");
@@ -1240,6 +2091,7 @@ void TestServer::testConnect()
     config.setHost(testHost.toString());
     config.setUser(testUser);
     config.setPort(testPort);
+    config.setSASLAuthMechanismString(mechanism);
 
     // check bad password fails
     config.setPassword("badpassword");
@@ -1254,6 +2106,600 @@ void TestServer::testConnect()
     QCOMPARE(client.isConnected(), true);
 }
 
+void TestServer::testConnectDirectTls_data()
+{
+    QTest::addColumn<int>("handshakeThreads");
+
+    QTest::newRow("no threads") << 0;
+    QTest::newRow("two threads") << 2;
+}
+
+void TestServer::testConnectDirectTls()
+{
+    QFETCH(int, handshakeThreads);
+
+    const QString testDomain("localhost");
+    const QString testPassword("testpwd");
+    const QString testUser("testuser");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12346;
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::StdoutLogging);
+
+    // prepare server
+    TestPasswordChecker passwordChecker(testUser, testPassword);
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setLogger(&logger);
+    server.setPasswordChecker(&passwordChecker);
+    server.setLocalCertificate(":/server.crt");
+    server.setPrivateKey(":/server.key");
+    server.setHandshakeThreadCount(handshakeThreads);
+    QVERIFY(server.listenForSecureClients(testHost, testPort));
+
+    // prepare client
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    connect(&client, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setUser(testUser);
+    config.setPassword(testPassword);
+    config.setPort(testPort);
+    config.setStreamSecurityMode(QXmppConfiguration::TLSDirect);
+
+    client.connectToServer(config);
+    loop.exec();
+    QCOMPARE(client.isConnected(), true);
+}
+
+void TestServer::testConnectAbort()
+{
+    const QString testDomain("localhost");
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::StdoutLogging);
+
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    QSignalSpy connectedSpy(&client, SIGNAL(connected()));
+
+    // use a non-routable address so the connection stays pending
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost("10.255.255.1");
+    config.setPort(5222);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+    QCOMPARE(client.state(), QXmppClient::ConnectingState);
+
+    // disconnecting must abort the pending attempts
+    client.disconnectFromServer();
+    QCOMPARE(client.state(), QXmppClient::DisconnectedState);
+
+    QEventLoop loop;
+    QTimer::singleShot(500, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(client.state(), QXmppClient::DisconnectedState);
+    QCOMPARE(connectedSpy.count(), 0);
+}
+
+void TestServer::testConnectRace()
+{
+    const quint16 closedPort = 12348;
+
+    qRegisterMetaType<QSslSocket*>("QSslSocket*");
+    qRegisterMetaType<QAbstractSocket::SocketError>("QAbstractSocket::SocketError");
+
+    QTcpServer listener;
+    QVERIFY(listener.listen(QHostAddress::LocalHost));
+
+    QXmppSocketConnector connector;
+    QSignalSpy connectedSpy(&connector, SIGNAL(connected(QSslSocket*)));
+    QSignalSpy errorSpy(&connector, SIGNAL(error(QAbstractSocket::SocketError)));
+
+    QEventLoop loop;
+    connect(&connector, SIGNAL(connected(QSslSocket*)),
+            &loop, SLOT(quit()));
+    connect(&connector, SIGNAL(error(QAbstractSocket::SocketError)),
+            &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+
+    // the first host refuses the connection, the second one accepts it
+    QList<QPair<QString, quint16> > hosts;
+    hosts << qMakePair(QString("127.0.0.1"), closedPort);
+    hosts << qMakePair(QString("127.0.0.1"), listener.serverPort());
+    connector.connectToHosts(hosts);
+    QVERIFY(connector.isConnecting());
+    loop.exec();
+
+    QCOMPARE(connectedSpy.count(), 1);
+    QCOMPARE(errorSpy.count(), 0);
+    QVERIFY(!connector.isConnecting());
+
+    QSslSocket *socket = qvariant_cast<QSslSocket*>(connectedSpy.at(0).at(0));
+    QVERIFY(socket);
+    QCOMPARE(socket->peerPort(), listener.serverPort());
+    delete socket;
+
+    // when every host fails, the error is reported
+    hosts.clear();
+    hosts << qMakePair(QString("127.0.0.1"), closedPort);
+    connector.connectToHosts(hosts);
+    loop.exec();
+
+    QCOMPARE(connectedSpy.count(), 1);
+    QCOMPARE(errorSpy.count(), 1);
+    QCOMPARE(qvariant_cast<QAbstractSocket::SocketError>(errorSpy.at(0).at(0)),
+             QAbstractSocket::ConnectionRefusedError);
+}
+
+void TestServer::testTlsHandshake()
+{
+    const QHostAddress testHost(QHostAddress::LocalHost);
+
+    // prepare server
+    QFile certificateFile(":/server.crt");
+    QVERIFY(certificateFile.open(QIODevice::ReadOnly));
+    QFile keyFile(":/server.key");
+    QVERIFY(keyFile.open(QIODevice::ReadOnly));
+
+    QXmppSslServer server;
+    server.setDirectTls(true);
+    server.setLocalCertificate(QSslCertificate(certificateFile.readAll()));
+    server.setPrivateKey(QSslKey(keyFile.readAll(), QSsl::Rsa));
+    QVERIFY(server.isDirectTlsReady());
+    QVERIFY(server.listen(testHost));
+
+    // QXmppSslServer does not resume sessions, so every handshake is full
+    QBENCHMARK {
+        QSslSocket socket;
+        socket.setPeerVerifyMode(QSslSocket::VerifyNone);
+
+        QEventLoop loop;
+        connect(&socket, SIGNAL(encrypted()),
+                &loop, SLOT(quit()));
+        connect(&socket, SIGNAL(error(QAbstractSocket::SocketError)),
+                &loop, SLOT(quit()));
+        socket.connectToHostEncrypted(testHost.toString(), server.serverPort());
+        loop.exec();
+        QVERIFY(socket.isEncrypted());
+        socket.abort();
+    }
+}
+
+void TestServer::testMetrics()
+{
+    QXmppMetrics metrics;
+
+    // counters
+    QXmppCounter *counter = metrics.counter("foo");
+    QCOMPARE(metrics.counter("foo"), counter);
+    counter->add();
+    counter->add(Q_INT64_C(5000000000));
+    QCOMPARE(counter->value(), Q_INT64_C(5000000001));
+
+    // histograms
+    QXmppHistogram *histogram = metrics.histogram("bar");
+    QCOMPARE(histogram->percentile(50), Q_INT64_C(0));
+    for (int i = 1; i <= 1000; ++i)
+        histogram->record(i);
+    QCOMPARE(histogram->count(), Q_INT64_C(1000));
+    QCOMPARE(histogram->sum(), Q_INT64_C(500500));
+    QVERIFY(histogram->percentile(50) >= 500 && histogram->percentile(50) < 535);
+    QVERIFY(histogram->percentile(99) >= 990 && histogram->percentile(99) < 1024);
+    QVERIFY(histogram->maximum() >= 1000 && histogram->maximum() < 1024);
+    histogram->record(Q_INT64_C(1) << 50);
+    QVERIFY(histogram->maximum() > 0);
+
+    // dump
+    QCOMPARE(metrics.counterNames(), QStringList() << "foo");
+    QCOMPARE(metrics.histogramNames(), QStringList() << "bar");
+    const QByteArray json = metrics.toJson();
+    QVERIFY(json.startsWith("{\"bar\":{\"count\":1001,"));
+    QVERIFY(json.endsWith(",\"foo\":5000000001}"));
+    QCOMPARE(QXmppMetrics::toJson(QVariantList() << "a\"b" << true << QVariant()),
+             QByteArray("[\"a\\\"b\",true,null]"));
+
+    // server statistics
+    QXmppServer server;
+    server.metrics()->counter("custom")->add(3);
+    const QVariantMap stats = server.statistics();
+    QCOMPARE(stats.value("custom").toLongLong(), Q_INT64_C(3));
+    QCOMPARE(stats.value("incoming-clients").toInt(), 0);
+    QVERIFY(stats.value("route-latency").toMap().contains("p99"));
+}
+
+void TestServer::testMetricsExtension()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12347;
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.metrics()->counter("foo-bar")->add(2);
+
+    QXmppMetricsExtension *extension = new QXmppMetricsExtension;
+    extension->setPort(testPort);
+    server.addExtension(extension);
+    QVERIFY(server.listenForClients(testHost, 12348));
+
+    // render directly
+    const QByteArray text = extension->render();
+    QVERIFY(text.contains("# TYPE qxmpp_foo_bar_total counter\nqxmpp_foo_bar_total 2\n"));
+    QVERIFY(text.contains("qxmpp_route_latency_count 0\n"));
+    QVERIFY(text.contains("qxmpp_incoming_clients 0\n"));
+
+    // scrape over HTTP
+    QTcpSocket socket;
+    socket.connectToHost(testHost, testPort);
+    QVERIFY(socket.waitForConnected(3000));
+    socket.write("GET /metrics HTTP/1.0\r\n\r\n");
+    while (socket.state() == QAbstractSocket::ConnectedState && socket.waitForReadyRead(3000))
+        ;
+    const QByteArray response = socket.readAll();
+    QVERIFY(response.startsWith("HTTP/1.0 200 OK\r\n"));
+    QVERIFY(response.contains("qxmpp_foo_bar_total 2\n"));
+
+    server.close();
+}
+
+void TestServer::testOfflineMessages()
+{
+    const QString testDomain("localhost");
+    const QString testPassword("testpwd");
+    const QString testUser("testuser");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12351;
+
+    QDir dir(QDir::temp().filePath("qxmpp-test-offline"));
+    foreach (const QString &name, dir.entryList(QDir::Files))
+        dir.remove(name);
+
+    // prepare server
+    TestPasswordChecker passwordChecker(testUser, testPassword);
+    QXmppOfflineExtension *extension = new QXmppOfflineExtension;
+    extension->setDirectory(dir.path());
+    extension->setFlushInterval(10);
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(extension);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // store messages for the offline user
+    QStringList bodies;
+    bodies << "first" << "second" << "third";
+    foreach (const QString &body, bodies) {
+        QDomDocument doc;
+        doc.setContent(QString("<message xmlns=\"jabber:client\" from=\"other@localhost/r\" to=\"testuser@localhost\" type=\"chat\"><body>%1</body><payload xmlns=\"urn:example:payload\"/></message>").arg(body), true);
+        server.handleElement(doc.documentElement());
+    }
+
+    // messages without a body are not stored
+    QDomDocument doc;
+    doc.setContent(QByteArray("<message xmlns=\"jabber:client\" from=\"other@localhost/r\" to=\"testuser@localhost\" type=\"chat\"/>"), true);
+    server.handleElement(doc.documentElement());
+
+    // nor are messages for unknown users
+    doc.setContent(QByteArray("<message xmlns=\"jabber:client\" from=\"other@localhost/r\" to=\"nobody@localhost\" type=\"chat\"><body>lost</body></message>"), true);
+    server.handleElement(doc.documentElement());
+    QCOMPARE(server.metrics()->counter("offline-messages-stored")->value(), Q_INT64_C(3));
+    QVERIFY(!QFile::exists(dir.filePath("nobody%40localhost.log")));
+
+    // wait for the log to be written, then tear its end
+    const QString logPath = dir.filePath("testuser%40localhost.log");
+    for (int i = 0; i < 300 && QFileInfo(logPath).size() == 0; ++i)
+        QTest::qWait(10);
+    QVERIFY(QFileInfo(logPath).size() > 0);
+
+    // unknown payloads are stored as received
+    QFile log(logPath);
+    QVERIFY(log.open(QIODevice::ReadOnly));
+    const QByteArray stored = log.readAll();
+    QCOMPARE(stored.count("<payload xmlns=\"urn:example:payload\"/>"), bodies.size());
+    QCOMPARE(stored.count("<delay xmlns=\"urn:xmpp:delay\""), bodies.size());
+    log.close();
+
+    QVERIFY(log.open(QIODevice::WriteOnly | QIODevice::Append));
+    log.write(QByteArray("\0\0\1", 3));
+    log.close();
+
+    // the messages are delivered when the user sends available presence
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setUser(testUser);
+    config.setPassword(testPassword);
+    config.setPort(testPort);
+
+    QXmppClient client;
+    qRegisterMetaType<QXmppMessage>("QXmppMessage");
+    QSignalSpy spy(&client, SIGNAL(messageReceived(QXmppMessage)));
+    client.connectToServer(config);
+    for (int i = 0; i < 300 && spy.size() < bodies.size(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spy.size(), bodies.size());
+    for (int i = 0; i < bodies.size(); ++i) {
+        const QXmppMessage message = spy.at(i).at(0).value<QXmppMessage>();
+        QCOMPARE(message.body(), bodies.at(i));
+        QCOMPARE(message.from(), QString("other@localhost/r"));
+        QVERIFY(message.stamp().isValid());
+    }
+    for (int i = 0; i < 300 && QFile::exists(logPath); ++i)
+        QTest::qWait(10);
+    QVERIFY(!QFile::exists(logPath));
+    QCOMPARE(server.metrics()->counter("offline-messages-delivered")->value(), Q_INT64_C(3));
+
+    server.close();
+}
+
+void TestServer::testOutputQueue()
+{
+    const QByteArray iqGet("<iq type=\"get\" id=\"1\"><ping xmlns=\"urn:xmpp:ping\"/></iq>");
+    const QByteArray iqResult("<iq id='2' type='result'/>");
+    const QByteArray message("<message to=\"b@localhost\"><body>hi</body></message>");
+    const QByteArray presence1("<presence from=\"a@localhost/r\" to=\"b@localhost\"><show>away</show></presence>");
+    const QByteArray presence2("<presence from=\"a@localhost/r\" to=\"b@localhost\"/>");
+    const QByteArray presence3("<presence from=\"c@localhost/r\" to=\"b@localhost\" type=\"unavailable\"/>");
+    const QByteArray subscribe("<presence from=\"a@localhost\" to=\"b@localhost\" type=\"subscribe\"/>");
+
+    // priorities
+    QByteArray key;
+    QCOMPARE(QXmppOutputQueue::priority(iqResult), QXmppOutputQueue::HighPriority);
+    QCOMPARE(QXmppOutputQueue::priority(iqGet), QXmppOutputQueue::NormalPriority);
+    QCOMPARE(QXmppOutputQueue::priority(message), QXmppOutputQueue::NormalPriority);
+    QCOMPARE(QXmppOutputQueue::priority(subscribe, &key), QXmppOutputQueue::NormalPriority);
+    QVERIFY(key.isEmpty());
+    QCOMPARE(QXmppOutputQueue::priority(presence1, &key), QXmppOutputQueue::LowPriority);
+    QCOMPARE(key, QByteArray("a@localhost/r b@localhost"));
+    QCOMPARE(QXmppOutputQueue::priority("</stream:stream>"), QXmppOutputQueue::HighPriority);
+
+    // ordering
+    QXmppOutputQueue queue;
+    QVERIFY(queue.isEmpty());
+    queue.enqueue(presence1);
+    queue.enqueue(message);
+    queue.enqueue(presence2);
+    queue.enqueue(presence3);
+    queue.enqueue(subscribe);
+    queue.enqueue(iqResult);
+    QCOMPARE(queue.count(), 6);
+    QCOMPARE(queue.size(), qint64(presence1.size() + message.size() + presence2.size() +
+                                  presence3.size() + subscribe.size() + iqResult.size()));
+
+    // coalescing keeps the latest presence of each sender
+    QCOMPARE(queue.coalesce(), 1);
+    QCOMPARE(queue.count(), 5);
+    QCOMPARE(queue.dequeue(), iqResult);
+    QCOMPARE(queue.dequeue(), message);
+    QCOMPARE(queue.dequeue(), subscribe);
+    QCOMPARE(queue.dequeue(), presence2);
+    QCOMPARE(queue.dequeue(), presence3);
+    QVERIFY(queue.isEmpty());
+    QCOMPARE(queue.size(), qint64(0));
+}
+
+void TestServer::testPresence()
+{
+    const QString testDomain("localhost");
+    const QString testPassword("testpwd");
+    const QString testUser("testuser");
+    const QString testBareJid("testuser@localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12350;
+
+    // prepare server
+    TestPasswordChecker passwordChecker(testUser, testPassword);
+    TestPresenceExtension *extension = new TestPresenceExtension;
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(extension);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setUser(testUser);
+    config.setPassword(testPassword);
+    config.setPort(testPort);
+
+    qRegisterMetaType<QXmppPresence>("QXmppPresence");
+
+    // the first resource's initial presence is cached
+    QXmppClient clientA;
+    config.setResource("a");
+    clientA.connectToServer(config);
+    for (int i = 0; i < 300 && server.availablePresences(testBareJid).size() < 1; ++i)
+        QTest::qWait(10);
+    QCOMPARE(server.availablePresences(testBareJid).size(), 1);
+    QCOMPARE(server.availablePresences(testBareJid).first().from(), QString("testuser@localhost/a"));
+
+    // the second resource is sent the first one's presence from memory
+    QXmppClient clientB;
+    QSignalSpy spyB(&clientB, SIGNAL(presenceReceived(QXmppPresence)));
+    config.setResource("b");
+    clientB.connectToServer(config);
+    bool receivedA = false;
+    for (int i = 0; i < 300 && !receivedA; ++i) {
+        QTest::qWait(10);
+        for (int j = 0; j < spyB.size(); ++j)
+            if (spyB.at(j).at(0).value<QXmppPresence>().from() == "testuser@localhost/a")
+                receivedA = true;
+    }
+    QVERIFY(receivedA);
+    QCOMPARE(server.availablePresences(testBareJid).size(), 2);
+
+    // the subscription graph was only looked up once
+    QCOMPARE(extension->subscriberLookups, 1);
+    QCOMPARE(extension->subscriptionLookups, 1);
+    QCOMPARE(server.metrics()->counter("presence-probes-sent")->value(), Q_INT64_C(2));
+
+    // disconnecting a client drops its presence
+    clientA.disconnectFromServer();
+    for (int i = 0; i < 300 && server.availablePresences(testBareJid).size() > 1; ++i)
+        QTest::qWait(10);
+    QCOMPARE(server.availablePresences(testBareJid).size(), 1);
+    QCOMPARE(server.availablePresences(testBareJid).first().from(), QString("testuser@localhost/b"));
+
+    server.close();
+}
+
+void TestServer::testPriorityDelivery()
+{
+    const QString testDomain("localhost");
+    const QString testPassword("testpwd");
+    const QString testUser("testuser");
+    const QString testBareJid("testuser@localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12353;
+
+    // prepare server
+    TestPasswordChecker passwordChecker(testUser, testPassword);
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // connect two resources with different priorities
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setUser(testUser);
+    config.setPassword(testPassword);
+    config.setPort(testPort);
+
+    QXmppClient clientA;
+    config.setResource("a");
+    clientA.connectToServer(config, QXmppPresence(QXmppPresence::Available,
+        QXmppPresence::Status(QXmppPresence::Status::Online, QString(), 1)));
+
+    QXmppClient clientB;
+    config.setResource("b");
+    clientB.connectToServer(config, QXmppPresence(QXmppPresence::Available,
+        QXmppPresence::Status(QXmppPresence::Status::Online, QString(), 5)));
+
+    for (int i = 0; i < 300 && server.availablePresences(testBareJid).size() < 2; ++i)
+        QTest::qWait(10);
+    QCOMPARE(server.availablePresences(testBareJid).size(), 2);
+
+    qRegisterMetaType<QXmppMessage>("QXmppMessage");
+    QSignalSpy spyA(&clientA, SIGNAL(messageReceived(QXmppMessage)));
+    QSignalSpy spyB(&clientB, SIGNAL(messageReceived(QXmppMessage)));
+
+    // a chat message only goes to the highest priority resource,
+    // a headline goes to every resource
+    QXmppMessage chat(testDomain, testBareJid, "chat");
+    QXmppMessage headline(testDomain, testBareJid, "headline");
+    headline.setType(QXmppMessage::Headline);
+    QVERIFY(server.sendPacket(chat));
+    QVERIFY(server.sendPacket(headline));
+    for (int i = 0; i < 300 && (spyA.size() < 1 || spyB.size() < 2); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spyA.size(), 1);
+    QCOMPARE(spyA.takeFirst().at(0).value<QXmppMessage>().body(), QString("headline"));
+    QCOMPARE(spyB.size(), 2);
+    QCOMPARE(spyB.takeFirst().at(0).value<QXmppMessage>().body(), QString("chat"));
+    spyB.clear();
+
+    // copies to every resource are explicitly requested
+    QXmppMessage copied(testDomain, testBareJid, "copied");
+    QVERIFY(server.sendPacket(copied, QXmppServer::AllResourcesDelivery));
+    for (int i = 0; i < 300 && (spyA.isEmpty() || spyB.isEmpty()); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spyA.size(), 1);
+    QCOMPARE(spyB.size(), 1);
+    spyA.clear();
+    spyB.clear();
+
+    // a resource with a negative priority does not receive messages
+    clientB.setClientPresence(QXmppPresence(QXmppPresence::Available,
+        QXmppPresence::Status(QXmppPresence::Status::Online, QString(), -1)));
+    bool lowered = false;
+    for (int i = 0; i < 300 && !lowered; ++i) {
+        QTest::qWait(10);
+        foreach (const QXmppPresence &presence, server.availablePresences(testBareJid))
+            if (presence.from() == "testuser@localhost/b" && presence.status().priority() < 0)
+                lowered = true;
+    }
+    QVERIFY(lowered);
+    QVERIFY(server.sendPacket(chat));
+    for (int i = 0; i < 300 && spyA.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spyA.size(), 1);
+    QCOMPARE(spyB.size(), 0);
+
+    // a message which no resource can receive is bounced to the sender
+    QXmppMessage lost(QString(), "nobody@localhost", "lost");
+    QVERIFY(clientB.sendPacket(lost));
+    for (int i = 0; i < 300 && spyB.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spyB.size(), 1);
+    const QXmppMessage bounce = spyB.takeFirst().at(0).value<QXmppMessage>();
+    QCOMPARE(bounce.type(), QXmppMessage::Error);
+    QCOMPARE(bounce.from(), QString("nobody@localhost"));
+    QCOMPARE(bounce.error().condition(), QXmppStanza::Error::ServiceUnavailable);
+
+    server.close();
+}
+
+void TestServer::testThreadedPasswordChecker()
+{
+    TestPasswordChecker backend("testuser", "testpwd");
+    QXmppThreadedPasswordChecker checker(&backend);
+
+    QXmppPasswordRequest good;
+    good.setDomain("localhost");
+    good.setUsername("testuser");
+    good.setPassword("testpwd");
+
+    QXmppPasswordRequest bad(good);
+    bad.setPassword("badpwd");
+
+    QXmppPasswordRequest unknown(good);
+    unknown.setUsername("nosuchuser");
+
+    // concurrent lookups for the same user are coalesced
+    for (int pass = 0; pass < 2; ++pass) {
+        QXmppPasswordReply *goodReply = checker.checkPassword(good);
+        QXmppPasswordReply *badReply = checker.checkPassword(bad);
+        QXmppPasswordReply *unknownReply = checker.checkPassword(unknown);
+        QXmppPasswordReply *digestReply = checker.getDigest(good);
+
+        QEventLoop loop;
+        QList<QXmppPasswordReply*> replies;
+        replies << goodReply << badReply << unknownReply << digestReply;
+        foreach (QXmppPasswordReply *reply, replies)
+            connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+        while (!goodReply->isFinished() || !badReply->isFinished() ||
+               !unknownReply->isFinished() || !digestReply->isFinished())
+            loop.exec();
+
+        QCOMPARE(goodReply->error(), QXmppPasswordReply::NoError);
+        QCOMPARE(badReply->error(), QXmppPasswordReply::AuthorizationError);
+        QCOMPARE(unknownReply->error(), QXmppPasswordReply::AuthorizationError);
+        QCOMPARE(digestReply->error(), QXmppPasswordReply::NoError);
+        QCOMPARE(digestReply->digest(), QCryptographicHash::hash("testuser:localhost:testpwd", QCryptographicHash::Md5));
+        qDeleteAll(replies);
+    }
+}
+
 void TestStun::testFingerprint()
 {
     // without fingerprint
@@ -29,11 +29,16 @@ class TestUtils : public QObject
     Q_OBJECT
 
 private slots:
+    void testAtom();
     void testCrc32();
     void testDigestMd5();
+    void testElement();
     void testHmac();
+    void testScram();
     void testJid();
+    void testLogger();
     void testMime();
+    void testRandom();
     void testLibVersion();
     void testTimezoneOffset();
 };
@@ -56,12 +61,14 @@ private slots:
     void testMessageReceipt();
     void testMessageDelay();
     void testMessageLegacyDelay();
+    void testMessageSharing();
     void testNonSaslAuth();
     void testPresence();
     void testPresenceFull();
     void testPresenceWithVCardUpdate();
     void testPresenceWithCapability();
     void testPresenceWithMuc();
+    void testPresenceSharing();
     void testSession();
     void testStreamFeatures();
     void testVCard();
@@ -69,6 +76,8 @@ private slots:
     void testVersionResult();
     void testEntityTimeGet();
     void testEntityTimeResult();
+    void testStreamReader_data();
+    void testStreamReader();
 };
 
 class TestCodec : public QObject
@@ -120,7 +129,23 @@ class TestServer : public QObject
     Q_OBJECT
 
 private slots:
+    void testArchive();
+    void testBosh();
+    void testBroadcast();
+    void testConnect_data();
     void testConnect();
+    void testConnectDirectTls_data();
+    void testConnectDirectTls();
+    void testConnectAbort();
+    void testConnectRace();
+    void testTlsHandshake();
+    void testMetrics();
+    void testMetricsExtension();
+    void testOfflineMessages();
+    void testOutputQueue();
+    void testPresence();
+    void testPriorityDelivery();
+    void testThreadedPasswordChecker();
 };
 
 class TestStun : public QObject